@@ -5,6 +5,11 @@
 
 #include <emos/compiler.h>
 
+#define INTERRUPT_TIMER_VECTOR      0x7C    /* local APIC timer */
+#define INTERRUPT_TLB_VECTOR        0x7D    /* IPI asking to drop stale translations */
+#define INTERRUPT_RESCHEDULE_VECTOR 0x7E    /* IPI asking to look at the run queue again */
+#define INTERRUPT_YIELD_VECTOR      0x7F    /* software interrupt that gives up the CPU */
+
 struct interrupt_frame {
     uint32_t error;
     uint32_t eip;
@@ -0,0 +1,77 @@
+#ifndef __EMOS_ASM_INTRINSICS_FPU_H__
+#define __EMOS_ASM_INTRINSICS_FPU_H__
+
+#include <stdint.h>
+
+#include <emos/compiler.h>
+
+#define XCR0_X87        0x00000001
+#define XCR0_SSE        0x00000002
+#define XCR0_AVX        0x00000004
+
+__always_inline void _i686_clts(void)
+{
+    asm volatile ("clts");
+}
+
+__always_inline void _i686_fninit(void)
+{
+    asm volatile ("fninit");
+}
+
+__always_inline uint16_t _i686_fnstsw(void)
+{
+    uint16_t value = 0xFFFF;
+
+    asm volatile ("fnstsw %0" : "+m"(value));
+
+    return value;
+}
+
+__always_inline void _i686_fnsave(void *area)
+{
+    asm volatile ("fnsave (%0)" : : "r"(area) : "memory");
+}
+
+__always_inline void _i686_frstor(const void *area)
+{
+    asm volatile ("frstor (%0)" : : "r"(area) : "memory");
+}
+
+__always_inline void _i686_fxsave(void *area)
+{
+    asm volatile ("fxsave (%0)" : : "r"(area) : "memory");
+}
+
+__always_inline void _i686_fxrstor(const void *area)
+{
+    asm volatile ("fxrstor (%0)" : : "r"(area) : "memory");
+}
+
+__always_inline void _i686_ldmxcsr(uint32_t value)
+{
+    asm volatile ("ldmxcsr %0" : : "m"(value));
+}
+
+/* the requested-feature bitmap goes in edx:eax, only the low half is ever used here */
+__always_inline void _i686_xsave(void *area, uint32_t mask)
+{
+    asm volatile ("xsave (%0)" : : "r"(area), "a"(mask), "d"(0) : "memory");
+}
+
+__always_inline void _i686_xsaveopt(void *area, uint32_t mask)
+{
+    asm volatile ("xsaveopt (%0)" : : "r"(area), "a"(mask), "d"(0) : "memory");
+}
+
+__always_inline void _i686_xrstor(const void *area, uint32_t mask)
+{
+    asm volatile ("xrstor (%0)" : : "r"(area), "a"(mask), "d"(0) : "memory");
+}
+
+__always_inline void _i686_xsetbv(uint32_t index, uint32_t value)
+{
+    asm volatile ("xsetbv" : : "c"(index), "a"(value), "d"(0));
+}
+
+#endif // __EMOS_ASM_INTRINSICS_FPU_H__
@@ -10,4 +10,13 @@ __always_inline void _i686_ltr(uint16_t sel)
     asm volatile ("ltr %%ax" : : "a"(sel));
 }
 
+__always_inline uint16_t _i686_str(void)
+{
+    uint16_t sel;
+
+    asm volatile ("str %0" : "=r"(sel));
+
+    return sel;
+}
+
 #endif // __EMOS_ASM_INTRINSICS_LTR_H__
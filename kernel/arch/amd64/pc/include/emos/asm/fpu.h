@@ -0,0 +1,39 @@
+#ifndef __EMOS_ASM_FPU_H__
+#define __EMOS_ASM_FPU_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/thread.h>
+
+#define FPU_NONE        0
+#define FPU_FNSAVE      1   /* x87 only */
+#define FPU_FXSAVE      2   /* x87 and SSE */
+#define FPU_XSAVE       3   /* every component enabled in XCR0 */
+#define FPU_XSAVEOPT    4   /* XSAVE that skips what is unchanged since the last restore */
+
+struct fpu_stat {
+    int mode;
+    size_t state_size;
+
+    uint64_t trap_count;        /* device-not-available faults taken */
+    uint64_t restore_count;     /* state loaded from a thread */
+    uint64_t reuse_count;       /* faults the registers still held the state of the thread for */
+    uint64_t save_count;        /* switches out of a thread that used the FPU */
+};
+
+/* finds out how the state is saved and builds the state new threads start from */
+status_t _pc_fpu_init(void);
+
+/* called on every processor, leaves the FPU to fault on the first use */
+void _pc_fpu_init_cpu(void);
+
+status_t _pc_fpu_allocate_state(struct thread *th);
+void _pc_fpu_free_state(struct thread *th);
+
+/* called on a switch with interrupts disabled, saves prev if it used the FPU since it was switched in */
+void _pc_fpu_switch(struct thread *prev);
+
+status_t _pc_fpu_get_stat(struct fpu_stat *stat);
+
+#endif // __EMOS_ASM_FPU_H__
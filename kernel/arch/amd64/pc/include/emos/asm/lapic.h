@@ -0,0 +1,34 @@
+#ifndef __EMOS_ASM_LAPIC_H__
+#define __EMOS_ASM_LAPIC_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+status_t _pc_lapic_init(uint64_t addr);
+int _pc_lapic_is_present(void);
+
+/* called on every processor, the one the 8259 is wired to keeps receiving it through LINT0 while routed */
+void _pc_lapic_enable(int route_pic);
+
+uint8_t _pc_lapic_get_id(void);
+void _pc_lapic_eoi(void);
+
+void _pc_lapic_send_ipi(uint8_t apic_id, int vector);
+void _pc_lapic_send_ipi_all_but_self(int vector);
+void _pc_lapic_send_init(uint8_t apic_id);
+void _pc_lapic_send_startup(uint8_t apic_id, uintptr_t entry_addr);
+
+/* measured against the PIT once, every processor is taken to run on the same bus clock */
+status_t _pc_lapic_calibrate_timer(void);
+int _pc_lapic_has_timer(void);
+
+/* makes the timer the scheduler tick of the boot processor */
+void _pc_lapic_timer_init(void);
+
+/* a plain periodic tick for the other processors */
+void _pc_lapic_timer_start(void);
+
+#endif // __EMOS_ASM_LAPIC_H__
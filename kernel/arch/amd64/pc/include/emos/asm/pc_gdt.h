@@ -3,14 +3,28 @@
 
 #include <emos/asm/gdt.h>
 
-#define GDT_ENTRY_COUNT 6
+#include <stddef.h>
+
+#include <emos/smp.h>
+
+#define GDT_ENTRY_COUNT (5 + SMP_MAX_CPU_COUNT * 3)
 
 #define SEG_SEL_KERNEL_CODE 0x08
 #define SEG_SEL_KERNEL_DATA 0x10
 #define SEG_SEL_USER_CODE   0x18
 #define SEG_SEL_USER_DATA   0x20
-#define SEG_SEL_TSS         0x28
+#define SEG_SEL_TSS         0x28    /* the boot processor, the others follow */
+#define SEG_SEL_PERCPU      (SEG_SEL_TSS + SMP_MAX_CPU_COUNT * 8)       /* loaded into GS */
+#define SEG_SEL_TLS         (SEG_SEL_PERCPU + SMP_MAX_CPU_COUNT * 8)    /* loaded into FS */
+
+#define SEG_SEL_CPU_TSS(cpu)    (SEG_SEL_TSS + (cpu) * 8)
+#define SEG_SEL_CPU_PERCPU(cpu) (SEG_SEL_PERCPU + (cpu) * 8)
+#define SEG_SEL_CPU_TLS(cpu)    (SEG_SEL_TLS + (cpu) * 8)
 
 void _pc_gdt_init(void);
+void _pc_gdt_init_cpu(int cpu);
+
+/* points FS of this processor somewhere else, takes effect once FS is loaded again */
+void _pc_gdt_set_tls(void *base, size_t size);
 
 #endif // __EMOS_ASM_PC_GDT_H__
@@ -0,0 +1,24 @@
+#ifndef __EMOS_ASM_PC_TICK_H__
+#define __EMOS_ASM_PC_TICK_H__
+
+#include <stdint.h>
+
+/* a timer the scheduler tick can run on, counts are in whatever unit the timer counts */
+struct tick_source {
+    const char *name;
+
+    uint32_t count_per_tick;
+    uint32_t max_count;         /* the longest one-shot the counter can hold */
+
+    void (*start_periodic)(void);
+    void (*start_oneshot)(uint32_t ticks);
+
+    /* counts the armed one-shot has covered, at most what was programmed */
+    uint32_t (*get_oneshot_elapsed)(void);
+};
+
+/* the boot processor keeps the global tick on this source from now on */
+void _pc_tick_init(struct tick_source *source);
+void _pc_tick_handle_interrupt(void);
+
+#endif // __EMOS_ASM_PC_TICK_H__
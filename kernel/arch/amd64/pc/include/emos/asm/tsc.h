@@ -0,0 +1,14 @@
+#ifndef __EMOS_ASM_TSC_H__
+#define __EMOS_ASM_TSC_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+/* measures the time stamp counter against the HPET or the PIT, a clock source only if it is invariant */
+status_t _pc_tsc_init(void);
+
+uint64_t _pc_tsc_get_frequency(void);
+int _pc_tsc_is_invariant(void);
+
+#endif // __EMOS_ASM_TSC_H__
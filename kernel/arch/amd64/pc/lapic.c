@@ -0,0 +1,221 @@
+#include <emos/asm/lapic.h>
+
+#include <emos/asm/page.h>
+#include <emos/asm/interrupt.h>
+#include <emos/asm/pause.h>
+#include <emos/asm/pit.h>
+#include <emos/asm/pc_tick.h>
+
+#include <emos/mm.h>
+#include <emos/scheduler.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "lapic"
+
+#define LAPIC_REG_ID            0x020
+#define LAPIC_REG_TPR           0x080
+#define LAPIC_REG_EOI           0x0B0
+#define LAPIC_REG_SVR           0x0F0
+#define LAPIC_REG_ESR           0x280
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_LINT0     0x350
+#define LAPIC_REG_LVT_LINT1     0x360
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_LVT_ERROR     0x370
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE        0x00000100
+
+#define LAPIC_LVT_MASKED        0x00010000
+#define LAPIC_LVT_NMI           0x00000400
+#define LAPIC_LVT_EXTINT        0x00000700
+#define LAPIC_LVT_PERIODIC      0x00020000
+
+#define LAPIC_TIMER_DIVIDE_16   0x00000003
+
+#define LAPIC_ICR_FIXED         0x00000000
+#define LAPIC_ICR_INIT          0x00000500
+#define LAPIC_ICR_STARTUP       0x00000600
+#define LAPIC_ICR_PENDING       0x00001000
+#define LAPIC_ICR_ASSERT        0x00004000
+#define LAPIC_ICR_ALL_BUT_SELF  0x000C0000
+
+static volatile uint32_t *lapic_regs = NULL;
+
+static struct tick_source timer_tick_source;
+
+static uint32_t read_reg(uint32_t reg)
+{
+    return lapic_regs[reg / sizeof(uint32_t)];
+}
+
+static void write_reg(uint32_t reg, uint32_t value)
+{
+    lapic_regs[reg / sizeof(uint32_t)] = value;
+}
+
+status_t _pc_lapic_init(uint64_t addr)
+{
+    status_t status;
+    vpn_t vpn;
+
+    if (lapic_regs) return STATUS_SUCCESS;
+    if (addr >= 0x100000000ULL) return STATUS_INVALID_VALUE;
+
+    status = mm_vma_allocate_page(1, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_map(addr / PAGE_SIZE, vpn, 1, PMF_NOCACHE);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(vpn, 1);
+        return status;
+    }
+
+    lapic_regs = (void *)(vpn * PAGE_SIZE + (uintptr_t)(addr & (PAGE_SIZE - 1)));
+
+    LOG_DEBUG("mapped local APIC 0x%08llX at %p\n", addr, (void *)lapic_regs);
+
+    return STATUS_SUCCESS;
+}
+
+int _pc_lapic_is_present(void)
+{
+    return !!lapic_regs;
+}
+
+void _pc_lapic_enable(int route_pic)
+{
+    /* virtual wire mode: the 8259 keeps interrupting through LINT0 */
+    write_reg(LAPIC_REG_LVT_LINT0, route_pic ? LAPIC_LVT_EXTINT : LAPIC_LVT_MASKED);
+    write_reg(LAPIC_REG_LVT_LINT1, LAPIC_LVT_NMI);
+    write_reg(LAPIC_REG_LVT_ERROR, LAPIC_LVT_MASKED);
+    write_reg(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    /* the error status register is cleared by writing it twice */
+    write_reg(LAPIC_REG_ESR, 0);
+    write_reg(LAPIC_REG_ESR, 0);
+
+    write_reg(LAPIC_REG_TPR, 0);
+    write_reg(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+uint8_t _pc_lapic_get_id(void)
+{
+    return read_reg(LAPIC_REG_ID) >> 24;
+}
+
+void _pc_lapic_eoi(void)
+{
+    write_reg(LAPIC_REG_EOI, 0);
+}
+
+/* the command is split over two registers, an interrupt in between would send a mix of two */
+static void send_command(uint8_t apic_id, uint32_t command)
+{
+    uint32_t irqstate;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    while (read_reg(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        _i686_pause();
+    }
+
+    write_reg(LAPIC_REG_ICR_HIGH, (uint32_t)apic_id << 24);
+    write_reg(LAPIC_REG_ICR_LOW, command);
+
+    interrupt_restore(irqstate);
+}
+
+void _pc_lapic_send_ipi(uint8_t apic_id, int vector)
+{
+    send_command(apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | (vector & 0xFF));
+}
+
+void _pc_lapic_send_ipi_all_but_self(int vector)
+{
+    send_command(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | (vector & 0xFF));
+}
+
+void _pc_lapic_send_init(uint8_t apic_id)
+{
+    send_command(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+/* the processor starts in real mode at the page the vector names */
+void _pc_lapic_send_startup(uint8_t apic_id, uintptr_t entry_addr)
+{
+    send_command(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | ((entry_addr / PAGE_SIZE) & 0xFF));
+}
+
+static void start_periodic(void)
+{
+    write_reg(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    write_reg(LAPIC_REG_LVT_TIMER, LAPIC_LVT_PERIODIC | INTERRUPT_TIMER_VECTOR);
+    write_reg(LAPIC_REG_TIMER_INITIAL, timer_tick_source.count_per_tick);
+}
+
+static void start_oneshot(uint32_t ticks)
+{
+    write_reg(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    write_reg(LAPIC_REG_LVT_TIMER, INTERRUPT_TIMER_VECTOR);
+    write_reg(LAPIC_REG_TIMER_INITIAL, ticks * timer_tick_source.count_per_tick);
+}
+
+static uint32_t get_oneshot_elapsed(void)
+{
+    /* a one-shot stays at zero once it has run out */
+    return read_reg(LAPIC_REG_TIMER_INITIAL) - read_reg(LAPIC_REG_TIMER_CURRENT);
+}
+
+static struct tick_source timer_tick_source = {
+    .name = "local APIC timer",
+    .count_per_tick = 0,
+    .max_count = 0xFFFFFFFF,
+    .start_periodic = start_periodic,
+    .start_oneshot = start_oneshot,
+    .get_oneshot_elapsed = get_oneshot_elapsed,
+};
+
+/* the timer runs off the bus clock, which nothing tells us about */
+status_t _pc_lapic_calibrate_timer(void)
+{
+    uint32_t elapsed;
+
+    if (!lapic_regs) return STATUS_CONFLICTING_STATE;
+
+    write_reg(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    write_reg(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    write_reg(LAPIC_REG_TIMER_INITIAL, 0xFFFFFFFF);
+
+    _pc_pit_wait(PIT_FREQUENCY / SCHEDULER_TICK_RATE);
+
+    elapsed = 0xFFFFFFFF - read_reg(LAPIC_REG_TIMER_CURRENT);
+    write_reg(LAPIC_REG_TIMER_INITIAL, 0);
+
+    if (elapsed == 0) return STATUS_HARDWARE_FAILED;
+
+    timer_tick_source.count_per_tick = elapsed;
+
+    LOG_DEBUG("timer runs at %lu counts per tick\n", elapsed);
+
+    return STATUS_SUCCESS;
+}
+
+int _pc_lapic_has_timer(void)
+{
+    return timer_tick_source.count_per_tick != 0;
+}
+
+void _pc_lapic_timer_init(void)
+{
+    _pc_tick_init(&timer_tick_source);
+}
+
+void _pc_lapic_timer_start(void)
+{
+    start_periodic();
+}
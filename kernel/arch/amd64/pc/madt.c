@@ -0,0 +1,161 @@
+#include <emos/asm/madt.h>
+
+#include <string.h>
+
+#include <emos/asm/acpi.h>
+
+#include <emos/compiler.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "madt"
+
+#define MADT_FLAG_PCAT_COMPAT       0x00000001
+
+#define MADT_TYPE_LAPIC             0
+#define MADT_TYPE_IOAPIC            1
+#define MADT_TYPE_SOURCE_OVERRIDE   2
+#define MADT_TYPE_LAPIC_OVERRIDE    5
+
+#define MADT_LAPIC_ENABLED          0x00000001
+#define MADT_LAPIC_ONLINE_CAPABLE   0x00000002
+
+struct madt {
+    struct acpi_sdt_header header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __packed;
+
+struct madt_entry_header {
+    uint8_t type;
+    uint8_t length;
+} __packed;
+
+struct madt_entry_lapic {
+    struct madt_entry_header header;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __packed;
+
+struct madt_entry_ioapic {
+    struct madt_entry_header header;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t ioapic_addr;
+    uint32_t gsi_base;
+} __packed;
+
+struct madt_entry_source_override {
+    struct madt_entry_header header;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __packed;
+
+struct madt_entry_lapic_override {
+    struct madt_entry_header header;
+    uint16_t reserved;
+    uint64_t lapic_addr;
+} __packed;
+
+static struct madt_info info;
+static int initialized = 0;
+
+static void add_cpu(const struct madt_entry_lapic *entry)
+{
+    if (!(entry->flags & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE_CAPABLE))) return;
+
+    if (info.cpu_count >= SMP_MAX_CPU_COUNT) {
+        LOG_DEBUG("ignoring processor with APIC ID %u, too many processors\n", entry->apic_id);
+        return;
+    }
+
+    info.cpus[info.cpu_count].apic_id = entry->apic_id;
+    info.cpus[info.cpu_count].acpi_id = entry->acpi_id;
+    info.cpu_count++;
+}
+
+static void add_ioapic(const struct madt_entry_ioapic *entry)
+{
+    if (info.ioapic_count >= MADT_MAX_IOAPIC_COUNT) {
+        LOG_DEBUG("ignoring I/O APIC with ID %u, too many I/O APICs\n", entry->ioapic_id);
+        return;
+    }
+
+    info.ioapics[info.ioapic_count].id = entry->ioapic_id;
+    info.ioapics[info.ioapic_count].addr = entry->ioapic_addr;
+    info.ioapics[info.ioapic_count].gsi_base = entry->gsi_base;
+    info.ioapic_count++;
+}
+
+static void add_override(const struct madt_entry_source_override *entry)
+{
+    /* only the ISA bus is ever overridden */
+    if (entry->bus != 0 || entry->source >= MADT_ISA_IRQ_COUNT) return;
+
+    info.overrides[entry->source].gsi = entry->gsi;
+    info.overrides[entry->source].flags = entry->flags;
+}
+
+status_t _pc_madt_init(void)
+{
+    status_t status;
+    struct acpi_sdt_header *header;
+    struct madt *madt;
+    struct madt_entry_header *entry;
+    uintptr_t end;
+
+    if (initialized) return STATUS_SUCCESS;
+
+    status = _pc_acpi_init();
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = _pc_acpi_find_table("APIC", 0, &header);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    madt = (void *)header;
+
+    memset(&info, 0, sizeof(info));
+    info.lapic_addr = madt->lapic_addr;
+    info.pic_present = !!(madt->flags & MADT_FLAG_PCAT_COMPAT);
+
+    /* ISA interrupts are identity mapped unless an override says otherwise */
+    for (int i = 0; i < MADT_ISA_IRQ_COUNT; i++) {
+        info.overrides[i].gsi = i;
+        info.overrides[i].flags = MADT_POLARITY_CONFORMS | MADT_TRIGGER_CONFORMS;
+    }
+
+    end = (uintptr_t)madt + madt->header.length;
+    for (entry = (void *)(madt + 1); (uintptr_t)entry + sizeof(*entry) <= end; entry = (void *)((uintptr_t)entry + entry->length)) {
+        if (entry->length < sizeof(*entry) || (uintptr_t)entry + entry->length > end) break;
+
+        switch (entry->type) {
+            case MADT_TYPE_LAPIC:
+                add_cpu((void *)entry);
+                break;
+            case MADT_TYPE_IOAPIC:
+                add_ioapic((void *)entry);
+                break;
+            case MADT_TYPE_SOURCE_OVERRIDE:
+                add_override((void *)entry);
+                break;
+            case MADT_TYPE_LAPIC_OVERRIDE:
+                info.lapic_addr = ((struct madt_entry_lapic_override *)entry)->lapic_addr;
+                break;
+            default:
+                break;
+        }
+    }
+
+    LOG_DEBUG("%d processors, local APIC at 0x%08llX, %d I/O APICs\n", info.cpu_count, info.lapic_addr, info.ioapic_count);
+
+    initialized = 1;
+
+    return STATUS_SUCCESS;
+}
+
+const struct madt_info *_pc_madt_get_info(void)
+{
+    return initialized ? &info : NULL;
+}
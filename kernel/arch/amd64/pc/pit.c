@@ -0,0 +1,143 @@
+#include <emos/asm/pit.h>
+
+#include <emos/asm/io.h>
+#include <emos/asm/isr.h>
+#include <emos/asm/pc_tick.h>
+
+#include <emos/scheduler.h>
+#include <emos/clock.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "pit"
+
+#define PIT_TICK_COUNT      (PIT_FREQUENCY / SCHEDULER_TICK_RATE)
+
+#define PIT_MODE_ONESHOT    0x30    /* channel 0, lobyte/hibyte, interrupt on terminal count */
+#define PIT_MODE_PERIODIC   0x34    /* channel 0, lobyte/hibyte, rate generator */
+#define PIT_MODE_WAIT       0xB0    /* channel 2, lobyte/hibyte, interrupt on terminal count */
+#define PIT_MODE_COUNTER    0xB4    /* channel 2, lobyte/hibyte, rate generator */
+
+#define PIT_GATE_PORT       0x0061
+#define PIT_GATE_ENABLE     0x01    /* channel 2 counts while set */
+#define PIT_GATE_SPEAKER    0x02
+#define PIT_GATE_OUTPUT     0x20    /* channel 2 has reached its terminal count */
+
+static uint32_t oneshot_count;
+
+static void pit_program(uint8_t mode, uint16_t count)
+{
+    io_out8(0x0043, mode);
+    io_out8(0x0040, count & 0xFF);
+    io_out8(0x0040, (count >> 8) & 0xFF);
+}
+
+static uint16_t pit_read_count(void)
+{
+    uint16_t count;
+
+    io_out8(0x0043, 0x00);  /* latch channel 0 */
+    count = io_in8(0x0040);
+    count |= io_in8(0x0040) << 8;
+
+    return count;
+}
+
+static void start_periodic(void)
+{
+    pit_program(PIT_MODE_PERIODIC, PIT_TICK_COUNT);
+}
+
+static void start_oneshot(uint32_t ticks)
+{
+    oneshot_count = ticks * PIT_TICK_COUNT;
+
+    pit_program(PIT_MODE_ONESHOT, oneshot_count);
+}
+
+static uint32_t get_oneshot_elapsed(void)
+{
+    uint32_t remaining = pit_read_count();
+
+    /* the counter wraps after the terminal count, the interrupt is then already pending */
+    if (remaining > oneshot_count) return oneshot_count;
+
+    return oneshot_count - remaining;
+}
+
+static struct tick_source pit_tick_source = {
+    .name = "PIT",
+    .count_per_tick = PIT_TICK_COUNT,
+    .max_count = 0xFFFF,
+    .start_periodic = start_periodic,
+    .start_oneshot = start_oneshot,
+    .get_oneshot_elapsed = get_oneshot_elapsed,
+};
+
+/* channel 2 keeps counting down from 0x10000 over and over */
+static void clock_enable(void)
+{
+    uint8_t gate;
+
+    gate = io_in8(PIT_GATE_PORT) & ~(PIT_GATE_ENABLE | PIT_GATE_SPEAKER);
+    io_out8(PIT_GATE_PORT, gate);
+
+    io_out8(0x0043, PIT_MODE_COUNTER);
+    io_out8(0x0042, 0x00);
+    io_out8(0x0042, 0x00);
+
+    io_out8(PIT_GATE_PORT, gate | PIT_GATE_ENABLE);
+}
+
+static uint64_t clock_read(void)
+{
+    uint16_t count;
+
+    io_out8(0x0043, 0x80);  /* latch channel 2 */
+    count = io_in8(0x0042);
+    count |= io_in8(0x0042) << 8;
+
+    /* counting down, so negated to go up */
+    return (uint16_t)-count;
+}
+
+/* wraps around every 55ms, good enough for nothing but a last resort */
+static struct clock_source pit_clock_source = {
+    .name = "PIT",
+    .rating = 100,
+    .frequency = PIT_FREQUENCY,
+    .mask = 0xFFFF,
+    .read = clock_read,
+    .enable = clock_enable,
+};
+
+void _pc_pit_init(void)
+{
+    _pc_tick_init(&pit_tick_source);
+
+    _pc_isr_unmask_interrupt(0x20);
+}
+
+/* busy waits on channel 2, which leaves the tick on channel 0 alone and needs no interrupts */
+void _pc_pit_wait(uint16_t count)
+{
+    uint8_t gate;
+
+    gate = io_in8(PIT_GATE_PORT) & ~(PIT_GATE_ENABLE | PIT_GATE_SPEAKER);
+    io_out8(PIT_GATE_PORT, gate);
+
+    io_out8(0x0043, PIT_MODE_WAIT);
+    io_out8(0x0042, count & 0xFF);
+    io_out8(0x0042, (count >> 8) & 0xFF);
+
+    /* counting starts on the rising edge of the gate */
+    io_out8(PIT_GATE_PORT, gate | PIT_GATE_ENABLE);
+
+    while (!(io_in8(PIT_GATE_PORT) & PIT_GATE_OUTPUT)) {}
+
+    io_out8(PIT_GATE_PORT, gate);
+}
+
+status_t _pc_pit_register_clock(void)
+{
+    return clock_register_source(&pit_clock_source);
+}
@@ -0,0 +1,329 @@
+#include <emos/smp.h>
+
+#include <string.h>
+
+#include <emos/asm/pc_gdt.h>
+#include <emos/asm/isr.h>
+#include <emos/asm/interrupt.h>
+#include <emos/asm/madt.h>
+#include <emos/asm/lapic.h>
+#include <emos/asm/page.h>
+#include <emos/asm/pause.h>
+#include <emos/asm/atomic.h>
+#include <emos/asm/fpu.h>
+#include <emos/asm/intrinsics/ltr.h>
+#include <emos/asm/intrinsics/register.h>
+
+#include <emos/mm.h>
+#include <emos/thread.h>
+#include <emos/scheduler.h>
+#include <emos/spinlock.h>
+#include <emos/tick.h>
+#include <emos/panic.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "smp"
+
+#define TRAMPOLINE_PFN          0x8     /* must match TRAMPOLINE_BASE of the trampoline */
+#define AP_STACK_SIZE           0x4000
+#define AP_START_TIMEOUT        (SCHEDULER_TICK_RATE)   /* ticks */
+
+struct trampoline_params {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uintptr_t stack;
+    uintptr_t entry;
+};
+
+extern const uint8_t _pc_smp_trampoline_start[];
+extern const uint8_t _pc_smp_trampoline_end[];
+extern const struct trampoline_params _pc_smp_trampoline_params;
+
+static volatile int cpu_online[SMP_MAX_CPU_COUNT] = { 1 };
+static volatile uint32_t online_count = 1;
+static uint8_t cpu_apic_ids[SMP_MAX_CPU_COUNT];
+
+static volatile int starting_cpu;
+static volatile int ap_started;
+
+/* a single shootdown at a time, the initiator keeps the lock until every processor has answered */
+static struct spinlock flush_lock;
+static volatile vpn_t flush_vpn;
+static volatile size_t flush_page_count;
+static volatile int flush_pending[SMP_MAX_CPU_COUNT];
+
+int smp_get_cpu_count(void)
+{
+    return online_count;
+}
+
+/* every processor runs on a TSS of its own, so the task register tells them apart */
+int smp_get_cpu_index(void)
+{
+    uint16_t sel = _i686_str();
+
+    if (sel < SEG_SEL_TSS) return 0;
+
+    return (sel - SEG_SEL_TSS) >> 3;
+}
+
+int smp_is_cpu_online(int cpu)
+{
+    if (cpu < 0 || cpu >= SMP_MAX_CPU_COUNT) return 0;
+
+    return cpu_online[cpu];
+}
+
+void smp_send_reschedule(int cpu)
+{
+    if (cpu == smp_get_cpu_index() || !smp_is_cpu_online(cpu)) return;
+
+    _pc_lapic_send_ipi(cpu_apic_ids[cpu], INTERRUPT_RESCHEDULE_VECTOR);
+}
+
+static void serve_flush(int cpu)
+{
+    mm_flush_tlb_local(flush_vpn, flush_page_count);
+
+    _i686_compiler_barrier();
+    flush_pending[cpu] = 0;
+}
+
+void smp_flush_tlb(vpn_t vpn, size_t page_count)
+{
+    int cpu;
+    uint32_t irqstate;
+
+    if (online_count <= 1) return;
+
+    spinlock_lock_irqsave(&flush_lock, &irqstate);
+
+    cpu = smp_get_cpu_index();
+
+    flush_vpn = vpn;
+    flush_page_count = page_count;
+
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        if (i == cpu || !cpu_online[i]) continue;
+
+        flush_pending[i] = 1;
+        _pc_lapic_send_ipi(cpu_apic_ids[i], INTERRUPT_TLB_VECTOR);
+    }
+
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        while (flush_pending[i]) {
+            smp_cpu_relax();
+        }
+    }
+
+    spinlock_unlock_irqrestore(&flush_lock, irqstate);
+}
+
+/* a processor spinning with interrupts off would otherwise never answer a shootdown */
+void smp_cpu_relax(void)
+{
+    int cpu = smp_get_cpu_index();
+
+    if (flush_pending[cpu]) {
+        serve_flush(cpu);
+    }
+
+    _i686_pause();
+}
+
+static void *tlb_isr(int num, struct interrupt_frame *frame, struct isr_regs *regs, void *data)
+{
+    int cpu = smp_get_cpu_index();
+
+    if (flush_pending[cpu]) {
+        serve_flush(cpu);
+    }
+
+    _pc_lapic_eoi();
+
+    return NULL;
+}
+
+__attribute__((noreturn))
+static void ap_main(void)
+{
+    status_t status;
+    int cpu = starting_cpu;
+
+    _pc_gdt_init_cpu(cpu);
+    _pc_isr_load();
+    _pc_lapic_enable(0);
+    _pc_lapic_timer_start();
+    _pc_fpu_init_cpu();
+
+    status = thread_init_cpu(NULL);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to initialize multitasking on processor #%d", cpu);
+    }
+
+    cpu_online[cpu] = 1;
+    _i686_atomic_fetch_add32(&online_count, 1);
+    ap_started = 1;
+
+    thread_enable_preemption();
+    interrupt_enable();
+
+    for (;;) {
+        if (scheduler_has_other_runnable_thread()) {
+            scheduler_yield();
+        } else {
+            asm volatile (
+                "pushfl\r\n"
+                "sti\r\n"
+                "hlt\r\n"
+                "popfl\r\n"
+            );
+        }
+    }
+}
+
+/* the PIT is the only clock there is this early, waiting a tick more makes sure a whole one has passed */
+static void wait_ticks(uint64_t ticks)
+{
+    uint64_t deadline = get_global_tick() + ticks + 1;
+
+    while (get_global_tick() < deadline) {
+        _i686_pause();
+    }
+}
+
+static int wait_ap_started(uint64_t ticks)
+{
+    uint64_t deadline = get_global_tick() + ticks + 1;
+
+    while (!ap_started) {
+        if (get_global_tick() >= deadline) return 0;
+        _i686_pause();
+    }
+
+    return 1;
+}
+
+/* committed and in the kernel half, a fault on the first push could not be delivered on that very stack */
+static status_t allocate_ap_stack(vpn_t *stack_vpn)
+{
+    status_t status;
+    pfn_t stack_pfn = 0;
+    vpn_t vpn = 0;
+
+    status = mm_pma_allocate_frame(AP_STACK_SIZE / PAGE_SIZE, &stack_pfn, PAF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) goto has_error;
+
+    status = mm_vma_allocate_page(AP_STACK_SIZE / PAGE_SIZE, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) goto has_error;
+
+    status = mm_map(stack_pfn, vpn, AP_STACK_SIZE / PAGE_SIZE, PMF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) goto has_error;
+
+    *stack_vpn = vpn;
+
+    return STATUS_SUCCESS;
+
+has_error:
+    if (vpn) {
+        mm_vma_free_page(vpn, AP_STACK_SIZE / PAGE_SIZE);
+    }
+
+    if (stack_pfn) {
+        mm_pma_free_frame(stack_pfn, AP_STACK_SIZE / PAGE_SIZE);
+    }
+
+    return status;
+}
+
+static status_t start_ap(int cpu, uint8_t apic_id, struct trampoline_params *params)
+{
+    status_t status;
+    vpn_t stack_vpn;
+
+    status = allocate_ap_stack(&stack_vpn);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    params->stack = stack_vpn * PAGE_SIZE + AP_STACK_SIZE;
+
+    starting_cpu = cpu;
+    ap_started = 0;
+    cpu_apic_ids[cpu] = apic_id;
+
+    /* INIT, then two startup IPIs as the MultiProcessor Specification has it */
+    _pc_lapic_send_init(apic_id);
+    wait_ticks(1);
+
+    _pc_lapic_send_startup(apic_id, TRAMPOLINE_PFN * PAGE_SIZE);
+    if (!wait_ap_started(1)) {
+        _pc_lapic_send_startup(apic_id, TRAMPOLINE_PFN * PAGE_SIZE);
+        wait_ap_started(AP_START_TIMEOUT);
+    }
+
+    if (!ap_started) {
+        /* the processor may still wake up later, so its stack is left behind */
+        LOG_DEBUG("processor with APIC ID %u did not start\n", apic_id);
+        return STATUS_TIMED_OUT;
+    }
+
+    LOG_DEBUG("processor #%d with APIC ID %u is online\n", cpu, apic_id);
+
+    return STATUS_SUCCESS;
+}
+
+status_t smp_init(void)
+{
+    status_t status;
+    const struct madt_info *info;
+    struct trampoline_params *params;
+    uint8_t boot_apic_id;
+    int cpu = 1;
+
+    /* every processor needs its own timer to preempt */
+    if (!_pc_lapic_has_timer()) return STATUS_UNSUPPORTED;
+
+    info = _pc_madt_get_info();
+
+    boot_apic_id = _pc_lapic_get_id();
+    cpu_apic_ids[0] = boot_apic_id;
+
+    status = _pc_isr_add_interrupt_handler(INTERRUPT_TLB_VECTOR, NULL, tlb_isr, NULL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    if (info->cpu_count <= 1) return STATUS_SUCCESS;
+
+    /* the frame below 1MiB a startup IPI can name must not be handed out in the meantime */
+    if (CHECK_SUCCESS(mm_pma_get_frame_refcount(TRAMPOLINE_PFN, NULL))) return STATUS_CONFLICTING_STATE;
+
+    status = mm_pma_mark_reserved(TRAMPOLINE_PFN, TRAMPOLINE_PFN);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    /* the trampoline turns paging on while running from there */
+    status = mm_map(TRAMPOLINE_PFN, TRAMPOLINE_PFN, 1, PMF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    memcpy((void *)(TRAMPOLINE_PFN * PAGE_SIZE), _pc_smp_trampoline_start, _pc_smp_trampoline_end - _pc_smp_trampoline_start);
+
+    params = (void *)(TRAMPOLINE_PFN * PAGE_SIZE + ((uintptr_t)&_pc_smp_trampoline_params - (uintptr_t)_pc_smp_trampoline_start));
+    params->cr0 = _i686_read_cr0();
+    params->cr3 = _i686_read_cr3();
+    params->cr4 = _i686_read_cr4();
+    params->entry = (uintptr_t)ap_main;
+
+    /* one at a time, they share the trampoline */
+    for (int i = 0; i < info->cpu_count && cpu < SMP_MAX_CPU_COUNT; i++) {
+        if (info->cpus[i].apic_id == boot_apic_id) continue;
+
+        status = start_ap(cpu, info->cpus[i].apic_id, params);
+        if (!CHECK_SUCCESS(status)) continue;
+
+        cpu++;
+    }
+
+    mm_unmap(TRAMPOLINE_PFN, 1);
+
+    LOG_DEBUG("%lu processors online\n", online_count);
+
+    return STATUS_SUCCESS;
+}
@@ -12,6 +12,7 @@
 #include <emos/panic.h>
 #include <emos/scheduler.h>
 #include <emos/thread.h>
+#include <emos/smp.h>
 #include <emos/mm.h>
 
 #define MODULE_NAME "asm_thread"
@@ -52,7 +53,7 @@ status_t _pc_thread_allocate_kthread_stack(struct thread *th)
     if (!CHECK_SUCCESS(status)) goto has_error;
     kmode_stack_mapped = 1;
 
-    th->kmode_stack_base_vpn = kmode_stack_base_vpn * PAGE_SIZE;
+    th->kmode_stack_base_vpn = kmode_stack_base_vpn;
     th->kmode_stack_ptr = (void *)((kmode_stack_base_vpn + th->kmode_stack_page_count) * PAGE_SIZE);
 
     return STATUS_SUCCESS;
@@ -97,8 +98,8 @@ status_t _pc_thread_setup_kthread_stack(struct thread *th)
     iregs->ecx = (uintptr_t)th->kmode_entry;
     iregs->ds = SEG_SEL_KERNEL_DATA;
     iregs->es = SEG_SEL_KERNEL_DATA;
-    iregs->fs = SEG_SEL_KERNEL_DATA;
-    iregs->gs = SEG_SEL_KERNEL_DATA;
+    iregs->fs = SEG_SEL_CPU_TLS(smp_get_cpu_index());
+    iregs->gs = SEG_SEL_CPU_PERCPU(smp_get_cpu_index());
 
     /* stack area for dummy ebp (only for debugging purpose, will be replaced by popal) */
     esp -= 4;
@@ -128,3 +129,11 @@ void _pc_thread_free_kthread_stack(struct thread *th)
     mm_vma_free_page(th->kmode_stack_base_vpn, th->kmode_stack_page_count);
     mm_pma_free_frame(kmode_stack_base_pfn, th->kmode_stack_page_count);
 }
+
+/* the descriptor is reloaded only when the selector is, so FS is loaded again even if it did not change */
+void _pc_thread_load_tls(struct thread *th)
+{
+    _pc_gdt_set_tls(th->tls, sizeof(th->tls));
+
+    asm volatile ("mov %0, %%fs" : : "r"(SEG_SEL_CPU_TLS(smp_get_cpu_index())) : "memory");
+}
@@ -4,16 +4,18 @@
 
 #include <emos/asm/pc_gdt.h>
 
-struct tss _pc_tss;
+#include <emos/smp.h>
 
-void _pc_tss_init(void)
+struct tss _pc_tss[SMP_MAX_CPU_COUNT];
+
+void _pc_tss_init(int cpu)
 {
-    memset(&_pc_tss, 0, sizeof(_pc_tss));
-    _pc_tss.ss0 = SEG_SEL_KERNEL_DATA;
-    _pc_tss.iomap_base = sizeof(_pc_tss);
+    memset(&_pc_tss[cpu], 0, sizeof(_pc_tss[cpu]));
+    _pc_tss[cpu].ss0 = SEG_SEL_KERNEL_DATA;
+    _pc_tss[cpu].iomap_base = sizeof(_pc_tss[cpu]);
 }
 
 void _pc_tss_set_stack(uintptr_t kstack)
 {
-    _pc_tss.esp0 = kstack;
+    _pc_tss[smp_get_cpu_index()].esp0 = kstack;
 }
@@ -0,0 +1,75 @@
+#ifndef __EMOS_ASM_ATOMIC_H__
+#define __EMOS_ASM_ATOMIC_H__
+
+#include <stdint.h>
+
+#include <emos/compiler.h>
+#include <emos/asm/interrupt.h>
+#include <emos/asm/instruction.h>
+
+/* xadd and cmpxchg came with the 486, a 386 has a single CPU and only needs interrupts off */
+
+__always_inline uint16_t _i686_atomic_fetch_add16(volatile uint16_t *ptr, uint16_t value)
+{
+    uint32_t irqstate;
+    uint16_t old;
+
+    if (!_pc_xadd_undefined) {
+        asm volatile ("lock xaddw %0, %1" : "+r"(value), "+m"(*ptr) : : "memory");
+        return value;
+    }
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+    old = *ptr;
+    *ptr = old + value;
+    interrupt_restore(irqstate);
+
+    return old;
+}
+
+__always_inline uint32_t _i686_atomic_fetch_add32(volatile uint32_t *ptr, uint32_t value)
+{
+    uint32_t irqstate, old;
+
+    if (!_pc_xadd_undefined) {
+        asm volatile ("lock xaddl %0, %1" : "+r"(value), "+m"(*ptr) : : "memory");
+        return value;
+    }
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+    old = *ptr;
+    *ptr = old + value;
+    interrupt_restore(irqstate);
+
+    return old;
+}
+
+/* returns the value found, the store happened if it equals expected */
+__always_inline uint32_t _i686_atomic_cmpxchg32(volatile uint32_t *ptr, uint32_t expected, uint32_t desired)
+{
+    uint32_t irqstate, old;
+
+    if (!_pc_xadd_undefined) {
+        asm volatile ("lock cmpxchgl %2, %1" : "=a"(old), "+m"(*ptr) : "r"(desired), "0"(expected) : "memory");
+        return old;
+    }
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+    old = *ptr;
+    if (old == expected) {
+        *ptr = desired;
+    }
+    interrupt_restore(irqstate);
+
+    return old;
+}
+
+__always_inline void _i686_compiler_barrier(void)
+{
+    asm volatile ("" : : : "memory");
+}
+
+#endif // __EMOS_ASM_ATOMIC_H__
@@ -5,6 +5,7 @@
 
 extern int _pc_invlpg_undefined;
 extern int _pc_rdtsc_undefined;
+extern int _pc_xadd_undefined;
 
 status_t _pc_instruction_test(void (*test_func)(void), size_t instr_size, int *is_undefined);
 
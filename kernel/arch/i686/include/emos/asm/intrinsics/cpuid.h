@@ -11,16 +11,41 @@
 #define CPUID_GET_FEATURES              0x00000001
 #define CPUID_GET_TLB                   0x00000002
 #define CPUID_GET_SERIAL                0x00000003
+#define CPUID_GET_XSAVE                 0x0000000D
 
 #define CPUID_INTEL_EXTENDED            0x80000000
 #define CPUID_INTEL_FEATURES            0x80000001
 #define CPUID_INTEL_BRAND_STRING        0x80000002
 #define CPUID_INTEL_BRAND_STRING_MORE   0x80000003
 #define CPUID_INTEL_BRAND_STRING_END    0x80000004
+#define CPUID_INTEL_POWER_MANAGEMENT    0x80000007
+
+/* CPUID_GET_FEATURES edx */
+#define CPUID_FEATURE_EDX_FPU           0x00000001
+#define CPUID_FEATURE_EDX_PSE           0x00000008
+#define CPUID_FEATURE_EDX_FXSR          0x01000000
+#define CPUID_FEATURE_EDX_SSE           0x02000000
+
+/* CPUID_GET_FEATURES ecx */
+#define CPUID_FEATURE_ECX_XSAVE         0x04000000
+
+/* CPUID_INTEL_POWER_MANAGEMENT edx */
+#define CPUID_POWER_EDX_INVARIANT_TSC   0x00000100
+
+/* CPUID_GET_XSAVE sub-leaf 1 eax */
+#define CPUID_XSAVE_EAX_XSAVEOPT        0x00000001
 
 __always_inline void _i686_cpuid(uint32_t request, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
 {
     __cpuid(request, *eax, *ebx, *ecx, *edx);
 }
 
+__always_inline void _i686_cpuid_count(uint32_t request, uint32_t subrequest, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __cpuid_count(request, subrequest, *eax, *ebx, *ecx, *edx);
+}
+
+/* evaluates to 0 if the cpuid instruction is not supported */
+#define _i686_cpuid_max_request() __get_cpuid_max(0, NULL)
+
 #endif // __EMOS_ASM_INTRINSICS_CPUID_H__
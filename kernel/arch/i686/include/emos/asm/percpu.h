@@ -0,0 +1,36 @@
+#ifndef __EMOS_ASM_PERCPU_H__
+#define __EMOS_ASM_PERCPU_H__
+
+#include <stddef.h>
+
+/*
+ * GS covers the area of the processor it is loaded on, FS the thread-local slots of
+ * the thread running there. Either read is a single instruction that cannot be
+ * interrupted halfway and moved to another processor, only 32-bit fields fit.
+ */
+
+#define this_cpu_read(field) __extension__ ({ \
+    __typeof__(((struct percpu *)0)->field) __value; \
+    asm volatile ("movl %%gs:%c1, %0" : "=r"(__value) : "i"(offsetof(struct percpu, field))); \
+    __value; \
+})
+
+#define this_cpu_write(field, value) do { \
+    __typeof__(((struct percpu *)0)->field) __value = (value); \
+    asm volatile ("movl %0, %%gs:%c1" : : "r"(__value), "i"(offsetof(struct percpu, field)) : "memory"); \
+} while (0)
+
+/* the address stays right only as long as the thread cannot move, with interrupts or preemption disabled */
+#define this_cpu_ptr(field) (&this_cpu_read(self)->field)
+
+#define this_thread_tls_read(slot) __extension__ ({ \
+    uintptr_t __value; \
+    asm volatile ("movl %%fs:(, %1, 4), %0" : "=r"(__value) : "r"(slot)); \
+    __value; \
+})
+
+#define this_thread_tls_write(slot, value) do { \
+    asm volatile ("movl %0, %%fs:(, %1, 4)" : : "r"((uintptr_t)(value)), "r"(slot) : "memory"); \
+} while (0)
+
+#endif // __EMOS_ASM_PERCPU_H__
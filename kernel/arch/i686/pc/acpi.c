@@ -0,0 +1,164 @@
+#include <emos/asm/acpi.h>
+
+#include <string.h>
+
+#include <emos/asm/page.h>
+
+#include <bootemos/bootinfo.h>
+#include <emos/mm.h>
+#include <emos/macros.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "acpi"
+
+extern struct bootinfo_table_header *_pc_bootinfo_table;
+
+static struct acpi_sdt_header *root_table = NULL;
+static int root_is_xsdt = 0;
+
+static status_t map_physical(uint64_t paddr, size_t size, void **ptr)
+{
+    status_t status;
+    uintptr_t offset = paddr & (PAGE_SIZE - 1);
+    size_t page_count = ALIGN_DIV(offset + size, PAGE_SIZE);
+    vpn_t vpn;
+
+    /* without PAE nothing above 4GiB can be reached */
+    if (paddr + size > 0x100000000ULL) return STATUS_INVALID_VALUE;
+
+    status = mm_vma_allocate_page(page_count, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_map(paddr / PAGE_SIZE, vpn, page_count, PMF_READONLY);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(vpn, page_count);
+        return status;
+    }
+
+    *ptr = (void *)(vpn * PAGE_SIZE + offset);
+
+    return STATUS_SUCCESS;
+}
+
+static void unmap_physical(void *ptr, size_t size)
+{
+    uintptr_t offset = (uintptr_t)ptr & (PAGE_SIZE - 1);
+    size_t page_count = ALIGN_DIV(offset + size, PAGE_SIZE);
+    vpn_t vpn = (uintptr_t)ptr / PAGE_SIZE;
+
+    mm_unmap(vpn, page_count);
+    mm_vma_free_page(vpn, page_count);
+}
+
+static int is_checksum_valid(const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    uint8_t sum = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        sum += bytes[i];
+    }
+
+    return sum == 0;
+}
+
+/* map the header first to learn how much of the table there is */
+static status_t map_table(uint64_t paddr, struct acpi_sdt_header **table)
+{
+    status_t status;
+    struct acpi_sdt_header *header;
+    uint32_t length;
+
+    status = map_physical(paddr, sizeof(*header), (void **)&header);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    length = header->length;
+    unmap_physical(header, sizeof(*header));
+
+    if (length < sizeof(*header)) return STATUS_SYSTEM_CORRUPTED;
+
+    status = map_physical(paddr, length, (void **)&header);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    if (!is_checksum_valid(header, length)) {
+        unmap_physical(header, length);
+        return STATUS_SYSTEM_CORRUPTED;
+    }
+
+    *table = header;
+
+    return STATUS_SUCCESS;
+}
+
+status_t _pc_acpi_init(void)
+{
+    status_t status;
+    struct bootinfo_entry_header *enthdr;
+    struct bootinfo_entry_acpi_rsdp *arent = NULL;
+
+    if (root_table) return STATUS_SUCCESS;
+
+    enthdr = (void *)((uintptr_t)_pc_bootinfo_table + _pc_bootinfo_table->header_size);
+    for (int i = 0; i < _pc_bootinfo_table->entry_count; i++) {
+        if (enthdr->type == BET_ACPI_RSDP) {
+            arent = (void *)((uintptr_t)enthdr + enthdr->header_size);
+            break;
+        }
+
+        enthdr = (void *)((uintptr_t)enthdr + enthdr->size);
+    }
+
+    if (!arent) return STATUS_ENTRY_NOT_FOUND;
+
+    /* the XSDT supersedes the RSDT from ACPI 2.0 on */
+    if (arent->revision >= 2 && arent->xsdt_addr) {
+        status = map_table(arent->xsdt_addr, &root_table);
+        if (CHECK_SUCCESS(status)) {
+            root_is_xsdt = 1;
+        }
+    }
+
+    if (!root_table) {
+        status = map_table(arent->rsdt_addr, &root_table);
+        if (!CHECK_SUCCESS(status)) return status;
+    }
+
+    LOG_DEBUG("using %.4s at revision %u from %.6s\n", root_table->signature, root_table->revision, root_table->oemid);
+
+    return STATUS_SUCCESS;
+}
+
+status_t _pc_acpi_find_table(const char *signature, int index, struct acpi_sdt_header **table)
+{
+    status_t status;
+    struct acpi_sdt_header *header;
+    size_t entry_size = root_is_xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+    size_t entry_count;
+    uint8_t *entries;
+    uint64_t paddr;
+
+    if (!root_table) return STATUS_CONFLICTING_STATE;
+
+    entry_count = (root_table->length - sizeof(*root_table)) / entry_size;
+    entries = (uint8_t *)(root_table + 1);
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (root_is_xsdt) {
+            memcpy(&paddr, entries + i * entry_size, sizeof(uint64_t));
+        } else {
+            paddr = ((uint32_t *)entries)[i];
+        }
+
+        status = map_table(paddr, &header);
+        if (!CHECK_SUCCESS(status)) continue;
+
+        if (memcmp(header->signature, signature, 4) == 0 && index-- == 0) {
+            *table = header;
+            return STATUS_SUCCESS;
+        }
+
+        unmap_physical(header, header->length);
+    }
+
+    return STATUS_ENTRY_NOT_FOUND;
+}
@@ -0,0 +1,339 @@
+#include <emos/asm/fpu.h>
+
+#include <string.h>
+
+#include <emos/asm/isr.h>
+#include <emos/asm/interrupt.h>
+#include <emos/asm/intrinsics/cpuid.h>
+#include <emos/asm/intrinsics/fpu.h>
+#include <emos/asm/intrinsics/register.h>
+
+#include <emos/slab.h>
+#include <emos/scheduler.h>
+#include <emos/smp.h>
+#include <emos/panic.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "fpu"
+
+#define FNSAVE_AREA_SIZE    108
+#define FXSAVE_AREA_SIZE    512
+#define MXCSR_DEFAULT       0x00001F80
+
+/* the components the kernel knows how to enable, AVX-512 would outgrow a slab page */
+#define XCR0_MASK           (XCR0_X87 | XCR0_SSE | XCR0_AVX)
+
+struct fpu_cpu_stat {
+    uint64_t trap_count;
+    uint64_t restore_count;
+    uint64_t reuse_count;
+    uint64_t save_count;
+};
+
+static int mode = FPU_NONE;
+static int has_cpuid = 0;
+static int has_sse = 0;
+static uint32_t xcr0 = 0;
+static size_t state_size = 0;
+
+static struct kmem_cache state_cache;
+static void *initial_state = NULL;
+
+/* the thread whose state each processor's registers last held */
+static struct thread *volatile owners[SMP_MAX_CPU_COUNT];
+
+static struct fpu_cpu_stat cpu_stats[SMP_MAX_CPU_COUNT];
+
+static void save(void *area)
+{
+    switch (mode) {
+        case FPU_XSAVEOPT:
+            _i686_xsaveopt(area, xcr0);
+            break;
+        case FPU_XSAVE:
+            _i686_xsave(area, xcr0);
+            break;
+        case FPU_FXSAVE:
+            _i686_fxsave(area);
+            break;
+        case FPU_FNSAVE:
+            _i686_fnsave(area);
+            break;
+        default:
+            break;
+    }
+}
+
+static void restore(const void *area)
+{
+    switch (mode) {
+        case FPU_XSAVEOPT:
+        case FPU_XSAVE:
+            _i686_xrstor(area, xcr0);
+            break;
+        case FPU_FXSAVE:
+            _i686_fxrstor(area);
+            break;
+        case FPU_FNSAVE:
+            _i686_frstor(area);
+            break;
+        default:
+            break;
+    }
+}
+
+/* a 386 or 486SX has no cpuid to ask, the status word only reads back zero with a coprocessor present */
+static int probe_x87(void)
+{
+    _i686_write_cr0(_i686_read_cr0() & ~(CR0_EM | CR0_TS));
+    _i686_fninit();
+
+    return (_i686_fnstsw() & 0xFF) == 0;
+}
+
+static void detect_mode(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (_i686_cpuid_max_request() < CPUID_GET_FEATURES) {
+        if (probe_x87()) {
+            mode = FPU_FNSAVE;
+            state_size = FNSAVE_AREA_SIZE;
+        }
+        return;
+    }
+
+    has_cpuid = 1;
+
+    _i686_cpuid(CPUID_GET_FEATURES, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_FEATURE_EDX_FPU)) return;
+
+    mode = FPU_FNSAVE;
+    state_size = FNSAVE_AREA_SIZE;
+
+    if (!(edx & CPUID_FEATURE_EDX_FXSR)) return;
+
+    mode = FPU_FXSAVE;
+    state_size = FXSAVE_AREA_SIZE;
+    has_sse = !!(edx & CPUID_FEATURE_EDX_SSE);
+
+    if (!(ecx & CPUID_FEATURE_ECX_XSAVE) || _i686_cpuid_max_request() < CPUID_GET_XSAVE) return;
+
+    _i686_cpuid_count(CPUID_GET_XSAVE, 0, &eax, &ebx, &ecx, &edx);
+    xcr0 = eax & XCR0_MASK;
+
+    mode = FPU_XSAVE;
+
+    _i686_cpuid_count(CPUID_GET_XSAVE, 1, &eax, &ebx, &ecx, &edx);
+    if (eax & CPUID_XSAVE_EAX_XSAVEOPT) {
+        mode = FPU_XSAVEOPT;
+    }
+}
+
+void _pc_fpu_init_cpu(void)
+{
+    uint32_t cr0 = _i686_read_cr0();
+
+    /* without a coprocessor every FPU instruction faults, the handler turns that into a panic */
+    if (mode == FPU_NONE) {
+        _i686_write_cr0(cr0 | CR0_EM);
+        return;
+    }
+
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_TS;
+    if (has_cpuid) {
+        cr0 |= CR0_NE;
+    }
+
+    if (mode >= FPU_FXSAVE) {
+        _i686_write_cr4(_i686_read_cr4() | CR4_OSFXSR | (has_sse ? CR4_OSXMMEXCPT : 0));
+    }
+
+    if (mode >= FPU_XSAVE) {
+        _i686_write_cr4(_i686_read_cr4() | CR4_OSXSAVE);
+        _i686_xsetbv(0, xcr0);
+    }
+
+    _i686_write_cr0(cr0);
+
+    owners[smp_get_cpu_index()] = NULL;
+}
+
+static void *device_not_available_handler(int num, struct interrupt_frame *frame, struct isr_regs *regs)
+{
+    status_t status;
+    struct thread *th;
+    struct fpu_cpu_stat *stat;
+    int cpu;
+
+    if (mode == FPU_NONE) {
+        panic(STATUS_UNSUPPORTED, "FPU instruction without a coprocessor at 0x%04X:0x%08lX", frame->cs, frame->eip);
+    }
+
+    _i686_clts();
+
+    /* nothing to switch yet before multitasking is up */
+    status = scheduler_get_current_thread(&th);
+    if (!CHECK_SUCCESS(status) || !th || !th->fpu_state) return NULL;
+
+    cpu = smp_get_cpu_index();
+    stat = &cpu_stats[cpu];
+
+    stat->trap_count++;
+
+    /* nobody has touched the registers since the thread last saved them here */
+    if (owners[cpu] == th && th->fpu_cpu == cpu) {
+        stat->reuse_count++;
+        return NULL;
+    }
+
+    restore(th->fpu_state);
+
+    owners[cpu] = th;
+    th->fpu_cpu = cpu;
+    stat->restore_count++;
+
+    return NULL;
+}
+
+status_t _pc_fpu_init(void)
+{
+    status_t status;
+    size_t align;
+
+    detect_mode();
+
+    _pc_fpu_init_cpu();
+
+    if (mode == FPU_NONE) {
+        LOG_DEBUG("no FPU present\n");
+        return _pc_isr_add_trap_handler(0x07, device_not_available_handler, NULL);
+    }
+
+    /* the size XSAVE needs depends on what was just enabled in XCR0 */
+    if (mode >= FPU_XSAVE) {
+        uint32_t eax, ebx, ecx, edx;
+
+        _i686_cpuid_count(CPUID_GET_XSAVE, 0, &eax, &ebx, &ecx, &edx);
+        state_size = ebx;
+        align = 64;
+    } else if (mode == FPU_FXSAVE) {
+        align = 16;
+    } else {
+        align = 4;
+    }
+
+    status = kmem_cache_init(&state_cache, "fpu", state_size, align, NULL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = kmem_cache_allocate(&state_cache, &initial_state);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    /* the XSAVE header has to be clear before the first save into it */
+    memset(initial_state, 0, state_size);
+
+    _i686_clts();
+    _i686_fninit();
+    if (has_sse) {
+        _i686_ldmxcsr(MXCSR_DEFAULT);
+    }
+    if (mode == FPU_XSAVEOPT) {
+        _i686_xsave(initial_state, xcr0);
+    } else {
+        save(initial_state);
+    }
+    _i686_write_cr0(_i686_read_cr0() | CR0_TS);
+
+    status = _pc_isr_add_trap_handler(0x07, device_not_available_handler, NULL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    LOG_DEBUG("saving %lu bytes of state in mode %d\n", state_size, mode);
+
+    return STATUS_SUCCESS;
+}
+
+status_t _pc_fpu_allocate_state(struct thread *th)
+{
+    status_t status;
+
+    th->fpu_state = NULL;
+    th->fpu_cpu = -1;
+
+    if (mode == FPU_NONE) return STATUS_SUCCESS;
+
+    status = kmem_cache_allocate(&state_cache, &th->fpu_state);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    memcpy(th->fpu_state, initial_state, state_size);
+
+    return STATUS_SUCCESS;
+}
+
+void _pc_fpu_free_state(struct thread *th)
+{
+    if (!th->fpu_state) return;
+
+    /* a thread allocated at the same address later starts off on no processor, so this is only tidying up */
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        if (owners[i] == th) {
+            owners[i] = NULL;
+        }
+    }
+
+    kmem_cache_free(&state_cache, th->fpu_state);
+    th->fpu_state = NULL;
+}
+
+void _pc_fpu_switch(struct thread *prev)
+{
+    int cpu;
+
+    if (mode == FPU_NONE) return;
+
+    /* TS stays set until prev touches the FPU, so there is nothing to save for a thread that did not */
+    if (_i686_read_cr0() & CR0_TS) return;
+
+    /* saved right away rather than on the next fault, another processor may pick prev up before then */
+    if (prev->fpu_state) {
+        cpu = smp_get_cpu_index();
+
+        save(prev->fpu_state);
+        cpu_stats[cpu].save_count++;
+
+        /* fnsave leaves the registers initialized */
+        if (mode == FPU_FNSAVE) {
+            owners[cpu] = NULL;
+        } else {
+            owners[cpu] = prev;
+            prev->fpu_cpu = cpu;
+        }
+    }
+
+    _i686_write_cr0(_i686_read_cr0() | CR0_TS);
+}
+
+status_t _pc_fpu_get_stat(struct fpu_stat *stat)
+{
+    uint32_t irqstate;
+
+    if (!stat) return STATUS_INVALID_VALUE;
+
+    memset(stat, 0, sizeof(*stat));
+    stat->mode = mode;
+    stat->state_size = state_size;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        stat->trap_count += cpu_stats[i].trap_count;
+        stat->restore_count += cpu_stats[i].restore_count;
+        stat->reuse_count += cpu_stats[i].reuse_count;
+        stat->save_count += cpu_stats[i].save_count;
+    }
+
+    interrupt_restore(irqstate);
+
+    return STATUS_SUCCESS;
+}
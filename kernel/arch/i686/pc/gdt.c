@@ -8,23 +8,30 @@
 #include <emos/asm/intrinsics/ltr.h>
 
 #include <emos/compiler.h>
+#include <emos/percpu.h>
+#include <emos/thread.h>
 
 struct gdt_entry _pc_gdt[GDT_ENTRY_COUNT];
 static struct gdtr _pc_gdtr;
 
-extern struct tss _pc_tss;
+extern struct tss _pc_tss[SMP_MAX_CPU_COUNT];
 
-static void gdt_load(void) {
+static struct percpu percpu_areas[SMP_MAX_CPU_COUNT];
+
+/* where FS points before the processor runs a thread */
+static uintptr_t boot_tls[SMP_MAX_CPU_COUNT][THREAD_TLS_SLOT_COUNT];
+
+static void gdt_load(int cpu) {
     asm volatile(
         "ljmp %1, $1f\n\t"
         "1:\n\t"
         "mov %0, %%ax\n\t"
         "mov %%ax, %%ds\n\t"
         "mov %%ax, %%es\n\t"
-        "mov %%ax, %%fs\n\t"
-        "mov %%ax, %%gs\n\t"
         "mov %%ax, %%ss\n\t"
-        : : "i"(SEG_SEL_KERNEL_DATA), "i"(SEG_SEL_KERNEL_CODE) : "memory", "ax"
+        "mov %w2, %%fs\n\t"
+        "mov %w3, %%gs\n\t"
+        : : "i"(SEG_SEL_KERNEL_DATA), "i"(SEG_SEL_KERNEL_CODE), "r"(SEG_SEL_CPU_TLS(cpu)), "r"(SEG_SEL_CPU_PERCPU(cpu)) : "memory", "ax"
     );
 }
 
@@ -42,24 +49,52 @@ static void set_gdt_entry(int idx, uint32_t base, uint32_t limit, uint8_t access
 
 void _pc_gdt_init(void)
 {
-    uintptr_t tss_base = (uintptr_t)&_pc_tss;
-
     memset(&_pc_gdt, 0, sizeof(_pc_gdt));
     
     set_gdt_entry(SEG_SEL_KERNEL_CODE >> 3, 0x00000000, 0xFFFFF, 0x9A, 0xC);
     set_gdt_entry(SEG_SEL_KERNEL_DATA >> 3, 0x00000000, 0xFFFFF, 0x92, 0xC);
     set_gdt_entry(SEG_SEL_USER_CODE >> 3, 0x00000000, 0xFFFFF, 0xFA, 0xC);
     set_gdt_entry(SEG_SEL_USER_DATA >> 3, 0x00000000, 0xFFFFF, 0xF2, 0xC);
-    set_gdt_entry(SEG_SEL_TSS >> 3, tss_base, sizeof(_pc_tss) - 1, 0x89, 0x0);
+
+    /* every processor needs a TSS of its own, a loaded one is marked busy */
+    for (int cpu = 0; cpu < SMP_MAX_CPU_COUNT; cpu++) {
+        set_gdt_entry(SEG_SEL_CPU_TSS(cpu) >> 3, (uintptr_t)&_pc_tss[cpu], sizeof(_pc_tss[cpu]) - 1, 0x89, 0x0);
+    }
+
+    /* byte granular, an access past the end faults instead of hitting what lies behind */
+    for (int cpu = 0; cpu < SMP_MAX_CPU_COUNT; cpu++) {
+        percpu_areas[cpu].self = &percpu_areas[cpu];
+        percpu_areas[cpu].cpu = cpu;
+
+        set_gdt_entry(SEG_SEL_CPU_PERCPU(cpu) >> 3, (uintptr_t)&percpu_areas[cpu], sizeof(percpu_areas[cpu]) - 1, 0x92, 0x4);
+        set_gdt_entry(SEG_SEL_CPU_TLS(cpu) >> 3, (uintptr_t)boot_tls[cpu], sizeof(boot_tls[cpu]) - 1, 0x92, 0x4);
+    }
 
     _pc_gdtr.size = sizeof(_pc_gdt) - 1;
     _pc_gdtr.gdt_ptr = (uint32_t)&_pc_gdt;
 
+    _pc_gdt_init_cpu(0);
+}
+
+void _pc_gdt_init_cpu(int cpu)
+{
     _i686_lgdt(&_pc_gdtr);
 
-    _pc_tss_init();
+    _pc_tss_init(cpu);
+
+    gdt_load(cpu);
+
+    _i686_ltr(SEG_SEL_CPU_TSS(cpu));
+}
+
+void _pc_gdt_set_tls(void *base, size_t size)
+{
+    set_gdt_entry(SEG_SEL_CPU_TLS(smp_get_cpu_index()) >> 3, (uintptr_t)base, size - 1, 0x92, 0x4);
+}
 
-    gdt_load();
+struct percpu *percpu_get(int cpu)
+{
+    if (cpu < 0 || cpu >= SMP_MAX_CPU_COUNT) return NULL;
 
-    _i686_ltr(SEG_SEL_TSS);
+    return &percpu_areas[cpu];
 }
@@ -0,0 +1,119 @@
+#include <emos/asm/hpet.h>
+
+#include <emos/asm/acpi.h>
+#include <emos/asm/page.h>
+
+#include <emos/mm.h>
+#include <emos/clock.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "hpet"
+
+#define HPET_REG_CAPABILITY     0x000
+#define HPET_REG_PERIOD         0x004   /* upper half of the capabilities, femtoseconds per count */
+#define HPET_REG_CONFIG         0x010
+#define HPET_REG_COUNTER        0x0F0   /* only the low half is read, the clock extends it */
+
+#define HPET_CONFIG_ENABLE      0x00000001
+
+#define HPET_MAX_PERIOD         100000000   /* femtoseconds, the specification asks for at least 10 MHz */
+#define FS_PER_SEC              1000000000000000ULL
+
+#define ACPI_ADDRESS_SPACE_MEMORY   0
+
+struct acpi_hpet {
+    struct acpi_sdt_header header;
+    uint32_t event_timer_block_id;
+    uint8_t address_space_id;
+    uint8_t register_bit_width;
+    uint8_t register_bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __packed;
+
+static volatile uint32_t *hpet_regs = NULL;
+static uint64_t frequency;
+
+static uint64_t clock_read(void)
+{
+    return _pc_hpet_read();
+}
+
+/* a 32-bit counter at the usual 14.3 MHz comes around every five minutes */
+static struct clock_source hpet_clock_source = {
+    .name = "HPET",
+    .rating = 250,
+    .mask = UINT32_MAX,
+    .read = clock_read,
+};
+
+static uint32_t read_reg(uint32_t reg)
+{
+    return hpet_regs[reg / sizeof(uint32_t)];
+}
+
+static void write_reg(uint32_t reg, uint32_t value)
+{
+    hpet_regs[reg / sizeof(uint32_t)] = value;
+}
+
+status_t _pc_hpet_init(void)
+{
+    status_t status;
+    struct acpi_hpet *table;
+    uint32_t period;
+    vpn_t vpn;
+
+    status = _pc_acpi_find_table("HPET", 0, (struct acpi_sdt_header **)&table);
+    if (!CHECK_SUCCESS(status)) return STATUS_HARDWARE_NOT_FOUND;
+
+    if (table->address_space_id != ACPI_ADDRESS_SPACE_MEMORY || table->address >= 0x100000000ULL) return STATUS_UNSUPPORTED;
+
+    status = mm_vma_allocate_page(1, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_map(table->address / PAGE_SIZE, vpn, 1, PMF_NOCACHE);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(vpn, 1);
+        return status;
+    }
+
+    hpet_regs = (volatile uint32_t *)(vpn * PAGE_SIZE + ((uintptr_t)table->address & (PAGE_SIZE - 1)));
+
+    period = read_reg(HPET_REG_PERIOD);
+    if (!period || period > HPET_MAX_PERIOD) {
+        mm_unmap(vpn, 1);
+        mm_vma_free_page(vpn, 1);
+        hpet_regs = NULL;
+        return STATUS_HARDWARE_FAILED;
+    }
+
+    frequency = FS_PER_SEC / period;
+
+    /* the comparators are left alone, only the main counter is of use */
+    write_reg(HPET_REG_CONFIG, read_reg(HPET_REG_CONFIG) | HPET_CONFIG_ENABLE);
+
+    LOG_DEBUG("HPET at 0x%08lX counts at %llu Hz\n", (uint32_t)table->address, frequency);
+
+    hpet_clock_source.frequency = frequency;
+
+    return clock_register_source(&hpet_clock_source);
+}
+
+int _pc_hpet_is_present(void)
+{
+    return !!hpet_regs;
+}
+
+uint32_t _pc_hpet_read(void)
+{
+    return read_reg(HPET_REG_COUNTER);
+}
+
+uint64_t _pc_hpet_get_frequency(void)
+{
+    return frequency;
+}
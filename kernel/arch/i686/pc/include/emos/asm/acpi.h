@@ -0,0 +1,26 @@
+#ifndef __EMOS_ASM_ACPI_H__
+#define __EMOS_ASM_ACPI_H__
+
+#include <stdint.h>
+
+#include <emos/compiler.h>
+#include <emos/status.h>
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oemid[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __packed;
+
+status_t _pc_acpi_init(void);
+
+/* the table stays mapped, index picks among tables sharing the signature */
+status_t _pc_acpi_find_table(const char *signature, int index, struct acpi_sdt_header **table);
+
+#endif // __EMOS_ASM_ACPI_H__
@@ -0,0 +1,15 @@
+#ifndef __EMOS_ASM_HPET_H__
+#define __EMOS_ASM_HPET_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+/* finds the timer block through ACPI and starts its main counter */
+status_t _pc_hpet_init(void);
+int _pc_hpet_is_present(void);
+
+uint32_t _pc_hpet_read(void);
+uint64_t _pc_hpet_get_frequency(void);
+
+#endif // __EMOS_ASM_HPET_H__
@@ -0,0 +1,17 @@
+#ifndef __EMOS_ASM_IOAPIC_H__
+#define __EMOS_ASM_IOAPIC_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+#define IOAPIC_ISA_VECTOR_BASE  0x20    /* legacy IRQs keep the vectors the 8259 gave them */
+
+/* every entry starts out masked and aimed at the processor calling this */
+status_t _pc_ioapic_init(void);
+int _pc_ioapic_is_present(void);
+
+status_t _pc_ioapic_mask_irq(int irq);
+status_t _pc_ioapic_unmask_irq(int irq);
+
+#endif // __EMOS_ASM_IOAPIC_H__
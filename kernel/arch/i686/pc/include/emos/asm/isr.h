@@ -43,6 +43,10 @@ struct isr_handler {
 };
 
 status_t _pc_isr_init(void);
+
+/* every processor loads the same table, only the boot one fills it */
+status_t _pc_isr_load(void);
+
 status_t _pc_isr_add_interrupt_handler(int num, void *data, interrupt_handler_t func, struct isr_handler **handler);
 status_t _pc_isr_add_trap_handler(int num, trap_handler_t func, struct isr_handler **handler);
 void _pc_isr_remove_handler(struct isr_handler *handler);
@@ -0,0 +1,54 @@
+#ifndef __EMOS_ASM_MADT_H__
+#define __EMOS_ASM_MADT_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/smp.h>
+
+#define MADT_MAX_IOAPIC_COUNT   4
+#define MADT_ISA_IRQ_COUNT      16
+
+#define MADT_POLARITY_MASK      0x0003
+#define MADT_POLARITY_CONFORMS  0x0000  /* what the bus has, active high for ISA */
+#define MADT_POLARITY_HIGH      0x0001
+#define MADT_POLARITY_LOW       0x0003
+#define MADT_TRIGGER_MASK       0x000C
+#define MADT_TRIGGER_CONFORMS   0x0000  /* what the bus has, edge for ISA */
+#define MADT_TRIGGER_EDGE       0x0004
+#define MADT_TRIGGER_LEVEL      0x000C
+
+struct madt_cpu {
+    uint8_t apic_id;
+    uint8_t acpi_id;
+};
+
+struct madt_ioapic {
+    uint8_t id;
+    uint32_t addr;
+    uint32_t gsi_base;      /* the first global system interrupt it takes */
+};
+
+struct madt_override {
+    uint32_t gsi;
+    uint16_t flags;
+};
+
+struct madt_info {
+    uint64_t lapic_addr;
+    int pic_present;        /* a legacy 8259 pair is wired up as well */
+
+    int cpu_count;
+    struct madt_cpu cpus[SMP_MAX_CPU_COUNT];
+
+    int ioapic_count;
+    struct madt_ioapic ioapics[MADT_MAX_IOAPIC_COUNT];
+
+    /* indexed by ISA IRQ, filled in for every one */
+    struct madt_override overrides[MADT_ISA_IRQ_COUNT];
+};
+
+status_t _pc_madt_init(void);
+const struct madt_info *_pc_madt_get_info(void);
+
+#endif // __EMOS_ASM_MADT_H__
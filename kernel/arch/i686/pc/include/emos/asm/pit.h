@@ -0,0 +1,18 @@
+#ifndef __EMOS_ASM_PIT_H__
+#define __EMOS_ASM_PIT_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+#define PIT_FREQUENCY       1193182
+
+/* makes the PIT the scheduler tick */
+void _pc_pit_init(void);
+
+void _pc_pit_wait(uint16_t count);
+
+/* once picked as the clock source channel 2 is no longer free for _pc_pit_wait() */
+status_t _pc_pit_register_clock(void);
+
+#endif // __EMOS_ASM_PIT_H__
@@ -3,12 +3,18 @@
 
 #include <emos/thread.h>
 
+#include <emos/asm/fpu.h>
+
 status_t _pc_thread_allocate_kthread_stack(struct thread *th);
 status_t _pc_thread_setup_kthread_stack(struct thread *th);
 void _pc_thread_free_kthread_stack(struct thread *th);
+void _pc_thread_load_tls(struct thread *th);
 
 #define thread_allocate_kthread_stack _pc_thread_allocate_kthread_stack
 #define thread_setup_kthread_stack _pc_thread_setup_kthread_stack
 #define thread_free_kthread_stack _pc_thread_free_kthread_stack
+#define thread_load_tls _pc_thread_load_tls
+#define thread_allocate_fpu_state _pc_fpu_allocate_state
+#define thread_free_fpu_state _pc_fpu_free_state
 
 #endif // __EMOS_ASM_THREAD_H__
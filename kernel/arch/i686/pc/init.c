@@ -8,8 +8,18 @@
 #include <emos/asm/io.h>
 #include <emos/asm/page.h>
 #include <emos/asm/isr.h>
+#include <emos/asm/interrupt.h>
 #include <emos/asm/pic.h>
+#include <emos/asm/pit.h>
+#include <emos/asm/hpet.h>
+#include <emos/asm/tsc.h>
+#include <emos/asm/lapic.h>
+#include <emos/asm/ioapic.h>
+#include <emos/asm/madt.h>
+#include <emos/asm/pc_tick.h>
 #include <emos/asm/instruction.h>
+#include <emos/asm/fpu.h>
+#include <emos/asm/intrinsics/register.h>
 
 #include <emos/compiler.h>
 #include <bootemos/bootinfo.h>
@@ -20,11 +30,16 @@
 #include <emos/log.h>
 #include <emos/thread.h>
 #include <emos/scheduler.h>
+#include <emos/tick.h>
+#include <emos/timer.h>
+#include <emos/smp.h>
+#include <emos/softirq.h>
 
 #define MODULE_NAME "init"
 
 int _pc_invlpg_undefined = 1;
 int _pc_rdtsc_undefined = 1;
+int _pc_xadd_undefined = 1;
 
 static void invlpg_test(void)
 {
@@ -37,6 +52,12 @@ static void rdtsc_test(void)
     asm volatile ("rdtsc" : "=a"(low), "=d"(high));
 }
 
+static void xadd_test(void)
+{
+    uint32_t value = 0;
+    asm volatile ("xadd %0, %0" : "+r"(value));
+}
+
 struct bootinfo_table_header *_pc_bootinfo_table;
 
 static int early_print_char(void *, char ch)
@@ -121,21 +142,20 @@ void _pc_init(struct bootinfo_table_header *btblhdr)
     LOG_DEBUG("%p %p %p %08lX\n", (void *)_pc_bootinfo_table, (void *)btblhdr, (void *)enthdr, btblhdr->size);
 }
 
-static volatile uint64_t global_tick = 0;
-
-uint64_t get_global_tick(void)
-{
-    return global_tick;
-}
-
 static void *switch_thread(struct interrupt_frame *frame, struct isr_regs *regs)
 {
     status_t status;
     struct thread *current_thread, *next_thread;
+    struct isr_regs *next_regs;
 
     status = scheduler_get_current_thread(&current_thread);
     if (!CHECK_SUCCESS(status)) return NULL;
 
+    /* the interrupt is as good as over, threads woken by deferred work get a say in what runs next */
+    if (frame->eflags & 0x0200) {
+        softirq_run();
+    }
+
     /* ask to scheduler */
     status = scheduler_get_next_thread(&next_thread);
     if (!CHECK_SUCCESS(status) || !next_thread) return NULL;
@@ -156,36 +176,134 @@ static void *switch_thread(struct interrupt_frame *frame, struct isr_regs *regs)
             panic(STATUS_SYSTEM_CORRUPTED, "system corrupted");
     }
     
-    /* save current stack pointer of the previous thread */
+    /* save current stack pointer of the previous thread, no other processor picks it up before the switch is over */
     current_thread->kmode_stack_ptr = (void *)(regs->esp - sizeof(struct isr_regs) - 4);
 
-    /* switch to next thread */
-    status = scheduler_set_current_thread(next_thread);
-    if (!CHECK_SUCCESS(status)) return NULL;
+    if (next_thread != current_thread) {
+        _pc_fpu_switch(current_thread);
+
+        /* a thread that last ran on another processor would pop the segments of that one */
+        next_regs = (void *)((uintptr_t)next_thread->kmode_stack_ptr + 4);
+        next_regs->fs = SEG_SEL_CPU_TLS(smp_get_cpu_index());
+        next_regs->gs = SEG_SEL_CPU_PERCPU(smp_get_cpu_index());
+
+        _pc_gdt_set_tls(next_thread->tls, sizeof(next_thread->tls));
+    }
 
     return next_thread->kmode_stack_ptr;
 }
 
-static void *pit_isr(int num, struct interrupt_frame *frame, struct isr_regs *regs, void *data)
+static void timer_softirq(void *data)
 {
-    global_tick++;
+    /* the callbacks expect interrupts disabled */
+    interrupt_disable();
+
+    timer_run(get_global_tick());
+
+    interrupt_enable();
+}
+
+static void *tick_isr(int num, struct interrupt_frame *frame, struct isr_regs *regs, void *data)
+{
+    void *new_stack = NULL;
+
+    if (num == INTERRUPT_TIMER_VECTOR) {
+        _pc_lapic_eoi();
+    }
+
+    /* every processor ticks to preempt, only the boot processor keeps the time */
+    if (smp_get_cpu_index() == 0) {
+        _pc_tick_handle_interrupt();
+
+        softirq_raise(SOFTIRQ_TIMER);
+    }
 
     if (thread_is_preemption_enabled()) {
-        return switch_thread(frame, regs);
+        new_stack = switch_thread(frame, regs);
     }
 
+    /* a one-shot countdown has to be rearmed on every interrupt */
+    tick_update();
+
+    return new_stack;
+}
+
+static void *yield_isr(int num, struct interrupt_frame *frame, struct isr_regs *regs, void *data)
+{
+    void *new_stack = NULL;
+
+    if (thread_is_preemption_enabled()) {
+        new_stack = switch_thread(frame, regs);
+    }
+
+    tick_update();
+
+    return new_stack;
+}
+
+static void *reschedule_isr(int num, struct interrupt_frame *frame, struct isr_regs *regs, void *data)
+{
+    void *new_stack = NULL;
+
+    _pc_lapic_eoi();
+
+    if (thread_is_preemption_enabled()) {
+        new_stack = switch_thread(frame, regs);
+    }
+
+    /* sent when a timer or a thread was added here from elsewhere, the countdown may be too long now */
+    tick_update();
+
+    return new_stack;
+}
+
+static void *spurious_isr(int num, struct interrupt_frame *frame, struct isr_regs *regs, void *data)
+{
+    /* a spurious interrupt must not be acknowledged */
     return NULL;
 }
 
-static void init_pit(void)
+/* the local APIC of the boot processor, and the I/O APIC to take over from the 8259 if there is one */
+static status_t apic_init(void)
 {
-    static const uint16_t pit_value = 1193182 / 100;
-    
-    io_out8(0x0043, 0x34);
-    io_out8(0x0040, pit_value & 0xFF);
-    io_out8(0x0040, (pit_value >> 8) & 0xFF);
+    status_t status;
+    const struct madt_info *info;
+
+    status = _pc_madt_init();
+    if (!CHECK_SUCCESS(status)) return status;
+
+    info = _pc_madt_get_info();
+
+    status = _pc_lapic_init(info->lapic_addr);
+    if (!CHECK_SUCCESS(status)) return status;
 
-    _pc_isr_unmask_interrupt(0x20);
+    status = _pc_isr_add_interrupt_handler(LAPIC_SPURIOUS_VECTOR, NULL, spurious_isr, NULL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = _pc_ioapic_init();
+    if (CHECK_SUCCESS(status)) {
+        _pc_pic_disable();
+    } else {
+        LOG_DEBUG("no I/O APIC, legacy interrupts stay on the 8259\n");
+    }
+
+    _pc_lapic_enable(!_pc_ioapic_is_present());
+
+    return _pc_lapic_calibrate_timer();
+}
+
+static void *page_fault_handler(int num, struct interrupt_frame *frame, struct isr_regs *regs)
+{
+    status_t status;
+    uint32_t fault_addr = _i686_read_cr2();
+
+    /* PFF_* flags share the bits of the error code */
+    status = mm_handle_page_fault(fault_addr, frame->error & (PFF_PRESENT | PFF_WRITE | PFF_USER));
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "page fault on 0x%08lX(0x%08lX) has occurred at 0x%04X:0x%08lX", fault_addr, frame->error, frame->cs, frame->eip);
+    }
+
+    return NULL;
 }
 
 void _pc_init_late(void)
@@ -217,8 +335,60 @@ void _pc_init_late(void)
         panic(status, "failed to test instruction rdtsc");
     }
 
-    _pc_isr_add_interrupt_handler(0x20, NULL, pit_isr, NULL);
+    LOG_DEBUG("testing whether xadd available...\n");
+    status = _pc_instruction_test(xadd_test, 3, &_pc_xadd_undefined);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to test instruction xadd");
+    }
+
+    LOG_DEBUG("initializing FPU...\n");
+    status = _pc_fpu_init();
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to initialize FPU");
+    }
+
+    LOG_DEBUG("enabling demand paging...\n");
+    status = _pc_isr_add_trap_handler(0x0E, page_fault_handler, NULL);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to add page fault handler");
+    }
+    mm_enable_demand_paging();
 
-    LOG_DEBUG("initializing PIT...\n");
-    init_pit();
+    LOG_DEBUG("initializing APIC...\n");
+    status = apic_init();
+    if (!CHECK_SUCCESS(status)) {
+        LOG_DEBUG("APIC unavailable, falling back to 8259 PIC and PIT\n");
+    }
+
+    /* the local APIC timer is calibrated by now, which leaves PIT channel 2 to the clock */
+    LOG_DEBUG("initializing clock sources...\n");
+    status = _pc_hpet_init();
+    if (!CHECK_SUCCESS(status)) {
+        LOG_DEBUG("no usable HPET\n");
+    }
+
+    status = _pc_tsc_init();
+    if (!CHECK_SUCCESS(status)) {
+        LOG_DEBUG("TSC is not usable as clock source\n");
+    }
+
+    status = _pc_pit_register_clock();
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to register PIT as clock source");
+    }
+
+    softirq_register(SOFTIRQ_TIMER, timer_softirq, NULL);
+
+    _pc_isr_add_interrupt_handler(INTERRUPT_YIELD_VECTOR, NULL, yield_isr, NULL);
+    _pc_isr_add_interrupt_handler(INTERRUPT_RESCHEDULE_VECTOR, NULL, reschedule_isr, NULL);
+
+    if (_pc_lapic_has_timer()) {
+        LOG_DEBUG("initializing local APIC timer...\n");
+        _pc_isr_add_interrupt_handler(INTERRUPT_TIMER_VECTOR, NULL, tick_isr, NULL);
+        _pc_lapic_timer_init();
+    } else {
+        LOG_DEBUG("initializing PIT...\n");
+        _pc_isr_add_interrupt_handler(0x20, NULL, tick_isr, NULL);
+        _pc_pit_init();
+    }
 }
@@ -0,0 +1,179 @@
+#include <emos/asm/ioapic.h>
+
+#include <emos/asm/page.h>
+#include <emos/asm/madt.h>
+#include <emos/asm/lapic.h>
+
+#include <emos/mm.h>
+#include <emos/spinlock.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "ioapic"
+
+#define IOAPIC_REG_SELECT       0x00
+#define IOAPIC_REG_WINDOW       0x10
+
+#define IOAPIC_INDEX_VERSION    0x01
+#define IOAPIC_INDEX_REDIRECT   0x10    /* two registers per entry */
+
+#define IOAPIC_ENTRY_MASKED     0x00010000
+#define IOAPIC_ENTRY_LEVEL      0x00008000
+#define IOAPIC_ENTRY_ACTIVE_LOW 0x00002000
+
+struct ioapic {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    int entry_count;
+};
+
+static struct ioapic ioapics[MADT_MAX_IOAPIC_COUNT];
+static int ioapic_count = 0;
+static uint8_t dest_apic_id;
+
+/* the index and the window are two accesses, nobody else may select in between */
+static struct spinlock ioapic_lock;
+
+static uint32_t read_reg(struct ioapic *ioapic, uint8_t index)
+{
+    ioapic->regs[IOAPIC_REG_SELECT / sizeof(uint32_t)] = index;
+    return ioapic->regs[IOAPIC_REG_WINDOW / sizeof(uint32_t)];
+}
+
+static void write_reg(struct ioapic *ioapic, uint8_t index, uint32_t value)
+{
+    ioapic->regs[IOAPIC_REG_SELECT / sizeof(uint32_t)] = index;
+    ioapic->regs[IOAPIC_REG_WINDOW / sizeof(uint32_t)] = value;
+}
+
+static void write_entry(struct ioapic *ioapic, int entry, uint32_t low, uint32_t high)
+{
+    /* keep it masked while the halves disagree */
+    write_reg(ioapic, IOAPIC_INDEX_REDIRECT + entry * 2, IOAPIC_ENTRY_MASKED);
+    write_reg(ioapic, IOAPIC_INDEX_REDIRECT + entry * 2 + 1, high);
+    write_reg(ioapic, IOAPIC_INDEX_REDIRECT + entry * 2, low);
+}
+
+static struct ioapic *find_ioapic(uint32_t gsi, int *entry)
+{
+    for (int i = 0; i < ioapic_count; i++) {
+        if (gsi < ioapics[i].gsi_base || gsi >= ioapics[i].gsi_base + ioapics[i].entry_count) continue;
+
+        *entry = gsi - ioapics[i].gsi_base;
+        return &ioapics[i];
+    }
+
+    return NULL;
+}
+
+static status_t map_ioapic(const struct madt_ioapic *desc, struct ioapic *ioapic)
+{
+    status_t status;
+    vpn_t vpn;
+
+    status = mm_vma_allocate_page(1, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_map(desc->addr / PAGE_SIZE, vpn, 1, PMF_NOCACHE);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(vpn, 1);
+        return status;
+    }
+
+    ioapic->regs = (void *)(vpn * PAGE_SIZE + (desc->addr & (PAGE_SIZE - 1)));
+    ioapic->gsi_base = desc->gsi_base;
+    ioapic->entry_count = ((read_reg(ioapic, IOAPIC_INDEX_VERSION) >> 16) & 0xFF) + 1;
+
+    return STATUS_SUCCESS;
+}
+
+status_t _pc_ioapic_init(void)
+{
+    status_t status;
+    const struct madt_info *info = _pc_madt_get_info();
+
+    if (ioapic_count) return STATUS_SUCCESS;
+    if (!info || !info->ioapic_count) return STATUS_HARDWARE_NOT_FOUND;
+    if (!_pc_lapic_is_present()) return STATUS_CONFLICTING_STATE;
+
+    spinlock_init(&ioapic_lock);
+
+    dest_apic_id = _pc_lapic_get_id();
+
+    for (int i = 0; i < info->ioapic_count; i++) {
+        status = map_ioapic(&info->ioapics[i], &ioapics[ioapic_count]);
+        if (!CHECK_SUCCESS(status)) continue;
+
+        for (int j = 0; j < ioapics[ioapic_count].entry_count; j++) {
+            write_entry(&ioapics[ioapic_count], j, IOAPIC_ENTRY_MASKED, 0);
+        }
+
+        LOG_DEBUG("I/O APIC %u at 0x%08lX takes GSI %lu-%lu\n", info->ioapics[i].id, info->ioapics[i].addr,
+                  ioapics[ioapic_count].gsi_base, ioapics[ioapic_count].gsi_base + ioapics[ioapic_count].entry_count - 1);
+
+        ioapic_count++;
+    }
+
+    if (!ioapic_count) return STATUS_HARDWARE_NOT_FOUND;
+
+    return STATUS_SUCCESS;
+}
+
+int _pc_ioapic_is_present(void)
+{
+    return ioapic_count > 0;
+}
+
+status_t _pc_ioapic_mask_irq(int irq)
+{
+    const struct madt_override *override;
+    struct ioapic *ioapic;
+    int entry;
+    uint32_t irqstate;
+
+    if (irq < 0 || irq >= MADT_ISA_IRQ_COUNT) return STATUS_INVALID_VALUE;
+
+    override = &_pc_madt_get_info()->overrides[irq];
+
+    ioapic = find_ioapic(override->gsi, &entry);
+    if (!ioapic) return STATUS_ENTRY_NOT_FOUND;
+
+    spinlock_lock_irqsave(&ioapic_lock, &irqstate);
+
+    write_reg(ioapic, IOAPIC_INDEX_REDIRECT + entry * 2, read_reg(ioapic, IOAPIC_INDEX_REDIRECT + entry * 2) | IOAPIC_ENTRY_MASKED);
+
+    spinlock_unlock_irqrestore(&ioapic_lock, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t _pc_ioapic_unmask_irq(int irq)
+{
+    const struct madt_override *override;
+    struct ioapic *ioapic;
+    int entry;
+    uint32_t low, irqstate;
+
+    if (irq < 0 || irq >= MADT_ISA_IRQ_COUNT) return STATUS_INVALID_VALUE;
+
+    override = &_pc_madt_get_info()->overrides[irq];
+
+    ioapic = find_ioapic(override->gsi, &entry);
+    if (!ioapic) return STATUS_ENTRY_NOT_FOUND;
+
+    /* fixed delivery in physical destination mode, ISA lines are edge triggered and active high by default */
+    low = IOAPIC_ISA_VECTOR_BASE + irq;
+    if ((override->flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW) {
+        low |= IOAPIC_ENTRY_ACTIVE_LOW;
+    }
+    if ((override->flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL) {
+        low |= IOAPIC_ENTRY_LEVEL;
+    }
+
+    spinlock_lock_irqsave(&ioapic_lock, &irqstate);
+
+    write_entry(ioapic, entry, low, (uint32_t)dest_apic_id << 24);
+
+    spinlock_unlock_irqrestore(&ioapic_lock, irqstate);
+
+    return STATUS_SUCCESS;
+}
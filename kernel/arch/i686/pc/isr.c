@@ -6,6 +6,8 @@
 #include <emos/asm/io.h>
 #include <emos/asm/idt.h>
 #include <emos/asm/pic.h>
+#include <emos/asm/ioapic.h>
+#include <emos/asm/lapic.h>
 #include <emos/asm/page.h>
 #include <emos/asm/pc_tss.h>
 #include <emos/asm/intrinsics/idt.h>
@@ -15,6 +17,7 @@
 #include <emos/panic.h>
 #include <emos/log.h>
 #include <emos/macros.h>
+#include <emos/softirq.h>
 
 #define MODULE_NAME "isr"
 
@@ -56,7 +59,7 @@ struct isr_handler *_pc_isr_table[256];
 
 int _pc_irq_depth = 0;
 
-status_t _pc_isr_init(void)
+status_t _pc_isr_load(void)
 {
     struct idtr idtr;
 
@@ -65,6 +68,13 @@ status_t _pc_isr_init(void)
     
     _i686_lidt(&idtr);
 
+    return STATUS_SUCCESS;
+}
+
+status_t _pc_isr_init(void)
+{
+    _pc_isr_load();
+
     for (int i = 0; i < ARRAY_SIZE(_pc_isr_table); i++) {
         _pc_isr_table[i] = NULL;
     }
@@ -249,8 +259,12 @@ status_t _pc_isr_mask_interrupt(int num)
     LOG_TRACE("masking interrupt #%02X...\n", num);
 
     if (0x20 <= num && num < 0x30) {
-        /* mask PIC first */
-        _pc_pic_mask_int(num - 0x20);
+        /* mask the interrupt controller first */
+        if (_pc_ioapic_is_present()) {
+            _pc_ioapic_mask_irq(num - 0x20);
+        } else {
+            _pc_pic_mask_int(num - 0x20);
+        }
     }
 
     _pc_idt[num].attributes &= ~0x80000000;
@@ -267,8 +281,12 @@ status_t _pc_isr_unmask_interrupt(int num)
     _pc_idt[num].attributes |= 0x80000000;
 
     if (0x20 <= num && num < 0x30) {
-        /* unmask PIC too */
-        _pc_pic_unmask_int(num - 0x20);
+        /* unmask the interrupt controller too */
+        if (_pc_ioapic_is_present()) {
+            _pc_ioapic_unmask_irq(num - 0x20);
+        } else {
+            _pc_pic_unmask_int(num - 0x20);
+        }
     }
 
     return STATUS_SUCCESS;
@@ -295,10 +313,14 @@ void *_pc_isr_common(struct interrupt_frame *frame, struct isr_regs *regs, int n
         has_error = (0x60207C00 >> num) & 1;
         is_fault = (0x603B7FE1 >> num) & 1;
     } else if (num < 0x30) {
-        if (num >= 0x28) {
-            io_out8(0x00A0, 0x20);
+        if (_pc_ioapic_is_present()) {
+            _pc_lapic_eoi();
+        } else {
+            if (num >= 0x28) {
+                io_out8(0x00A0, 0x20);
+            }
+            io_out8(0x0020, 0x20);
         }
-        io_out8(0x0020, 0x20);
     }
 
     if (!current_isr) {
@@ -325,5 +347,10 @@ void *_pc_isr_common(struct interrupt_frame *frame, struct isr_regs *regs, int n
 
     _pc_irq_depth--;
 
+    /* work the handlers deferred runs on the way out, unless the interrupted code had interrupts disabled */
+    if (num >= 0x20 && (frame->eflags & 0x0200)) {
+        softirq_run();
+    }
+
     return NULL;
 }
@@ -44,3 +44,10 @@ void _pc_pic_unmask_int(int num)
 
     io_out8(port, io_in8(port) & ~(1 << irqline));
 }
+
+/* everything goes through the I/O APIC instead, a spurious 8259 interrupt would hit 0x27 or 0x2F */
+void _pc_pic_disable(void)
+{
+    io_out8(0x0021, 0xFF);
+    io_out8(0x00A1, 0xFF);
+}
@@ -0,0 +1,269 @@
+#include <emos/asm/pc_tick.h>
+
+#include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
+
+#include <emos/tick.h>
+#include <emos/scheduler.h>
+#include <emos/timer.h>
+#include <emos/smp.h>
+#include <emos/clock.h>
+#include <emos/macros.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "tick"
+
+static struct tick_source *source = NULL;
+
+static volatile uint64_t global_tick = 0;
+
+static int oneshot_mode = 0;
+static volatile int oneshot_armed = 0;
+static volatile uint32_t oneshot_ticks;     /* ticks the armed countdown covers */
+static volatile uint64_t oneshot_start_ns;  /* when it was armed, the other processors cannot read the countdown */
+static uint32_t residual_count;             /* counts of a partial tick left when a countdown was cut short */
+
+/* odd while the boot processor is updating the tick and the countdown, the others retry their read */
+static volatile uint32_t tick_seq = 0;
+
+static struct tick_stat stat;
+
+/* counts an armed countdown has covered so far, including what earlier ones left over */
+static uint32_t oneshot_elapsed_count(void)
+{
+    return source->get_oneshot_elapsed() + residual_count;
+}
+
+/* count the ticks an armed countdown has already covered before it is replaced */
+static void account_cut_short(void)
+{
+    uint32_t elapsed = oneshot_elapsed_count();
+
+    global_tick += elapsed / source->count_per_tick;
+    stat.avoided_count += elapsed / source->count_per_tick;
+    residual_count = elapsed % source->count_per_tick;
+
+    oneshot_armed = 0;
+}
+
+static void write_begin(void)
+{
+    tick_seq++;
+    _i686_compiler_barrier();
+}
+
+static void write_end(void)
+{
+    _i686_compiler_barrier();
+    tick_seq++;
+}
+
+static void start_periodic(void)
+{
+    write_begin();
+
+    if (oneshot_armed) {
+        account_cut_short();
+    }
+
+    write_end();
+
+    source->start_periodic();
+
+    oneshot_mode = 0;
+}
+
+static void start_oneshot(uint32_t ticks)
+{
+    write_begin();
+
+    if (oneshot_armed) {
+        account_cut_short();
+    }
+
+    source->start_oneshot(ticks);
+
+    oneshot_mode = 1;
+    oneshot_armed = 1;
+    oneshot_ticks = ticks;
+    oneshot_start_ns = clock_get_monotonic_ns();
+
+    write_end();
+
+    stat.oneshot_count++;
+}
+
+void _pc_tick_init(struct tick_source *new_source)
+{
+    source = new_source;
+
+    LOG_DEBUG("ticking on %s, %lu counts per tick\n", source->name, source->count_per_tick);
+
+    source->start_periodic();
+}
+
+void _pc_tick_handle_interrupt(void)
+{
+    stat.interrupt_count++;
+
+    write_begin();
+
+    if (!oneshot_mode) {
+        global_tick++;
+    } else {
+        global_tick += oneshot_ticks;
+        stat.avoided_count += oneshot_ticks - 1;
+        oneshot_armed = 0;
+    }
+
+    write_end();
+}
+
+/* an interrupt may come in between reading both halves */
+static uint64_t read_global_tick(void)
+{
+    uint64_t tick;
+
+    do {
+        tick = global_tick;
+    } while (tick != global_tick);
+
+    return tick;
+}
+
+/*
+ * The countdown runs on the timer of the boot processor, so the others work out how far it got
+ * from the clock. That is registered before the tick starts, or the clock would read the tick.
+ */
+static uint64_t read_remote_tick(uint64_t *oneshot_end)
+{
+    uint64_t tick, start_ns, elapsed;
+    uint32_t seq, ticks;
+    int armed;
+
+    do {
+        seq = tick_seq;
+        _i686_compiler_barrier();
+
+        tick = global_tick;
+        armed = oneshot_armed;
+        ticks = oneshot_ticks;
+        start_ns = oneshot_start_ns;
+
+        _i686_compiler_barrier();
+    } while ((seq & 1) || seq != tick_seq);
+
+    if (oneshot_end) *oneshot_end = armed ? tick + ticks : 0;
+
+    if (!armed) return tick;
+
+    /* the interrupt at the end of the countdown is what accounts for the last tick */
+    elapsed = (clock_get_monotonic_ns() - start_ns) * SCHEDULER_TICK_RATE / NS_PER_SEC;
+
+    return tick + MIN(elapsed, ticks - 1);
+}
+
+uint64_t get_global_tick(void)
+{
+    uint64_t tick;
+    uint32_t irqstate;
+
+    if (smp_get_cpu_index() != 0) return read_remote_tick(NULL);
+    if (!oneshot_armed) return read_global_tick();
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    tick = global_tick;
+    if (oneshot_armed) {
+        tick += oneshot_elapsed_count() / source->count_per_tick;
+    }
+
+    interrupt_restore(irqstate);
+
+    return tick;
+}
+
+/* a timer added here may be due before the boot processor wakes up, which only it can fix */
+static void check_boot_deadline(void)
+{
+    status_t status;
+    uint64_t deadline, oneshot_end;
+
+    if (!oneshot_armed) return;
+
+    read_remote_tick(&oneshot_end);
+    if (!oneshot_end) return;
+
+    status = timer_get_next_expiry(&deadline);
+    if (!CHECK_SUCCESS(status) || status == STATUS_NO_EVENT) return;
+
+    if (deadline < oneshot_end) {
+        smp_send_reschedule(0);
+    }
+}
+
+int tick_is_stopped(int cpu)
+{
+    return cpu == 0 && oneshot_armed;
+}
+
+void tick_update(void)
+{
+    status_t status;
+    uint64_t deadline, now;
+    uint32_t max_ticks, ticks;
+
+    if (!source) return;
+
+    /* only the boot processor keeps the global tick, the others always tick */
+    if (smp_get_cpu_index() != 0) {
+        check_boot_deadline();
+        return;
+    }
+
+    now = get_global_tick();
+    max_ticks = source->max_count / source->count_per_tick;
+    ticks = max_ticks;
+
+    /* the tick is only needed to preempt, or to expire a deadline that comes sooner */
+    if (scheduler_has_other_runnable_thread()) {
+        if (oneshot_mode) {
+            start_periodic();
+        }
+        return;
+    }
+
+    status = timer_get_next_expiry(&deadline);
+    if (CHECK_SUCCESS(status) && status != STATUS_NO_EVENT) {
+        ticks = deadline > now ? MIN(deadline - now, max_ticks) : 1;
+    }
+
+    if (ticks <= 1) {
+        if (oneshot_mode) {
+            start_periodic();
+        }
+        return;
+    }
+
+    /* an armed countdown that ends soon enough can stay */
+    if (oneshot_armed && now + ticks >= global_tick + oneshot_ticks) return;
+
+    start_oneshot(ticks);
+}
+
+status_t tick_get_stat(struct tick_stat *statout)
+{
+    uint32_t irqstate;
+
+    if (!statout) return STATUS_INVALID_VALUE;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    *statout = stat;
+
+    interrupt_restore(irqstate);
+
+    return STATUS_SUCCESS;
+}
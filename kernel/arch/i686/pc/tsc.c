@@ -0,0 +1,116 @@
+#include <emos/asm/tsc.h>
+
+#include <emos/asm/instruction.h>
+#include <emos/asm/interrupt.h>
+#include <emos/asm/hpet.h>
+#include <emos/asm/pit.h>
+#include <emos/asm/intrinsics/cpuid.h>
+#include <emos/asm/intrinsics/rdtsc.h>
+
+#include <emos/clock.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "tsc"
+
+#define CALIBRATION_RUN_COUNT   3
+#define CALIBRATION_PIT_COUNT   (PIT_FREQUENCY / 20)    /* 50ms, the most channel 2 counts at once */
+#define CALIBRATION_HPET_MS     10
+
+static uint64_t frequency = 0;
+static int invariant = 0;
+
+static uint64_t clock_read(void)
+{
+    return _i686_rdtsc();
+}
+
+static struct clock_source tsc_clock_source = {
+    .name = "TSC",
+    .rating = 300,
+    .mask = UINT64_MAX,
+    .read = clock_read,
+};
+
+/* a counter that keeps its rate through frequency changes and sleep states is the only one worth a clock */
+static int detect_invariant(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (_i686_cpuid_max_request() < CPUID_GET_FEATURES) return 0;
+
+    _i686_cpuid(CPUID_INTEL_EXTENDED, &eax, &ebx, &ecx, &edx);
+    if (eax < CPUID_INTEL_POWER_MANAGEMENT) return 0;
+
+    _i686_cpuid(CPUID_INTEL_POWER_MANAGEMENT, &eax, &ebx, &ecx, &edx);
+
+    return !!(edx & CPUID_POWER_EDX_INVARIANT_TSC);
+}
+
+static uint64_t calibrate_hpet(void)
+{
+    uint32_t hpet_count = _pc_hpet_get_frequency() * CALIBRATION_HPET_MS / 1000;
+    uint32_t hpet_start;
+    uint64_t tsc_start, tsc_end;
+
+    hpet_start = _pc_hpet_read();
+    tsc_start = _i686_rdtsc();
+
+    while ((uint32_t)(_pc_hpet_read() - hpet_start) < hpet_count) {}
+
+    tsc_end = _i686_rdtsc();
+
+    return (tsc_end - tsc_start) * _pc_hpet_get_frequency() / hpet_count;
+}
+
+static uint64_t calibrate_pit(void)
+{
+    uint64_t tsc_start, tsc_end;
+
+    tsc_start = _i686_rdtsc();
+    _pc_pit_wait(CALIBRATION_PIT_COUNT);
+    tsc_end = _i686_rdtsc();
+
+    return (tsc_end - tsc_start) * PIT_FREQUENCY / CALIBRATION_PIT_COUNT;
+}
+
+status_t _pc_tsc_init(void)
+{
+    uint64_t result;
+    uint32_t irqstate;
+
+    if (_pc_rdtsc_undefined) return STATUS_UNSUPPORTED;
+
+    invariant = detect_invariant();
+
+    /* an interrupt in the window only ever makes a run longer, so the shortest one is closest */
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    for (int i = 0; i < CALIBRATION_RUN_COUNT; i++) {
+        result = _pc_hpet_is_present() ? calibrate_hpet() : calibrate_pit();
+        if (!frequency || result < frequency) {
+            frequency = result;
+        }
+    }
+
+    interrupt_restore(irqstate);
+
+    LOG_DEBUG("TSC runs at %llu Hz against the %s%s\n", frequency, _pc_hpet_is_present() ? "HPET" : "PIT", invariant ? "" : ", not invariant");
+
+    /* its rate may change under us, a slower counter is better than a wrong one */
+    if (!invariant) return STATUS_UNSUPPORTED;
+
+    tsc_clock_source.frequency = frequency;
+
+    return clock_register_source(&tsc_clock_source);
+}
+
+uint64_t _pc_tsc_get_frequency(void)
+{
+    return frequency;
+}
+
+int _pc_tsc_is_invariant(void)
+{
+    return invariant;
+}
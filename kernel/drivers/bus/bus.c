@@ -1 +1,13 @@
 #include <emos/bus.h>
+
+#include <emos/interface.h>
+
+status_t emos_bus_driver_add_interface(struct bus_driver *drv, const uuid_t if_uuid, const void *interface)
+{
+    return interface_register(drv, if_uuid, interface);
+}
+
+status_t emos_bus_driver_get_interface(struct bus_driver *drv, const uuid_t if_uuid, const void **ifout)
+{
+    return interface_find(drv, if_uuid, ifout);
+}
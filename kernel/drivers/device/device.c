@@ -1 +1,131 @@
 #include <emos/device.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <emos/asm/atomic.h>
+
+#include <emos/interface.h>
+#include <emos/spinlock.h>
+#include <emos/rcu.h>
+
+/* the operations come along in the same allocation */
+struct driver_allocation {
+    struct device_driver drv;
+    struct device_driver_ops ops;
+};
+
+/* writers only, readers follow the list under rcu_read_lock() */
+static struct spinlock list_lock;
+static struct device *first_device = NULL;
+
+static volatile uint32_t new_device_id = 1;
+
+status_t device_create(struct device **devout, struct bus *bus)
+{
+    status_t status;
+    struct device *dev;
+
+    if (!devout) return STATUS_INVALID_VALUE;
+
+    dev = malloc(sizeof(*dev));
+    if (!dev) return STATUS_INSUFFICIENT_MEMORY;
+
+    memset(dev, 0, sizeof(*dev));
+    dev->obj.type = OT_DEVICE;
+    dev->bus = bus;
+    dev->id = _i686_atomic_fetch_add32(&new_device_id, 1);
+
+    status = spinlock_lock(&list_lock);
+    if (!CHECK_SUCCESS(status)) {
+        free(dev);
+        return status;
+    }
+
+    dev->next = first_device;
+    rcu_assign_pointer(first_device, dev);
+
+    spinlock_unlock(&list_lock);
+
+    *devout = dev;
+
+    return STATUS_SUCCESS;
+}
+
+void device_remove(struct device *dev)
+{
+    status_t status;
+    struct device **link;
+
+    if (!dev) return;
+
+    status = spinlock_lock(&list_lock);
+    if (!CHECK_SUCCESS(status)) return;
+
+    for (link = &first_device; *link; link = &(*link)->next) {
+        if (*link == dev) {
+            /* a reader standing on the device still gets past it */
+            rcu_assign_pointer(*link, dev->next);
+            break;
+        }
+    }
+
+    spinlock_unlock(&list_lock);
+
+    synchronize_rcu();
+
+    free(dev);
+}
+
+struct device *device_get_next(struct device *dev)
+{
+    if (!dev) return rcu_dereference(first_device);
+
+    return rcu_dereference(dev->next);
+}
+
+struct device *device_find(uint32_t id)
+{
+    for (struct device *dev = device_get_next(NULL); dev; dev = device_get_next(dev)) {
+        if (dev->id == id) return dev;
+    }
+
+    return NULL;
+}
+
+status_t device_driver_create(struct device_driver **drv)
+{
+    struct driver_allocation *alloc;
+
+    if (!drv) return STATUS_INVALID_VALUE;
+
+    alloc = malloc(sizeof(*alloc));
+    if (!alloc) return STATUS_INSUFFICIENT_MEMORY;
+
+    memset(alloc, 0, sizeof(*alloc));
+    alloc->drv.ops = &alloc->ops;
+
+    *drv = &alloc->drv;
+
+    return STATUS_SUCCESS;
+}
+
+void device_driver_remove(struct device_driver *drv)
+{
+    if (!drv) return;
+
+    interface_unregister_all(drv);
+
+    /* drv is the first member */
+    free(drv);
+}
+
+status_t device_driver_add_interface(struct device_driver *drv, const uuid_t if_uuid, const void *interface)
+{
+    return interface_register(drv, if_uuid, interface);
+}
+
+status_t emos_device_driver_get_interface(struct device_driver *drv, const uuid_t if_uuid, const void **ifout)
+{
+    return interface_find(drv, if_uuid, ifout);
+}
@@ -0,0 +1,117 @@
+#include <emos/interface.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <emos/spinlock.h>
+#include <emos/rcu.h>
+
+struct interface_entry {
+    struct interface_entry *next;
+    struct interface_entry *free_next;
+
+    const void *owner;
+    uuid_t uuid;
+    const void *interface;
+};
+
+/* writers only, readers follow the list under rcu_read_lock() */
+static struct spinlock list_lock;
+static struct interface_entry *first_entry = NULL;
+
+status_t interface_register(const void *owner, const uuid_t if_uuid, const void *interface)
+{
+    status_t status;
+    struct interface_entry *entry;
+
+    if (!owner || !interface) return STATUS_INVALID_VALUE;
+
+    entry = malloc(sizeof(*entry));
+    if (!entry) return STATUS_INSUFFICIENT_MEMORY;
+
+    entry->owner = owner;
+    memcpy(entry->uuid, if_uuid, sizeof(uuid_t));
+    entry->interface = interface;
+
+    status = spinlock_lock(&list_lock);
+    if (!CHECK_SUCCESS(status)) {
+        free(entry);
+        return status;
+    }
+
+    for (struct interface_entry *e = first_entry; e; e = e->next) {
+        if (e->owner == owner && emos_uuid_isequal(e->uuid, if_uuid)) {
+            spinlock_unlock(&list_lock);
+            free(entry);
+            return STATUS_CONFLICTING_STATE;
+        }
+    }
+
+    /* the entry has to be complete before readers can reach it */
+    entry->next = first_entry;
+    rcu_assign_pointer(first_entry, entry);
+
+    spinlock_unlock(&list_lock);
+
+    return STATUS_SUCCESS;
+}
+
+void interface_unregister_all(const void *owner)
+{
+    status_t status;
+    struct interface_entry **link, *entry, *first_free = NULL;
+
+    status = spinlock_lock(&list_lock);
+    if (!CHECK_SUCCESS(status)) return;
+
+    link = &first_entry;
+    while ((entry = *link)) {
+        if (entry->owner != owner) {
+            link = &entry->next;
+            continue;
+        }
+
+        /* readers on the entry still find their way on through its next */
+        rcu_assign_pointer(*link, entry->next);
+
+        entry->free_next = first_free;
+        first_free = entry;
+    }
+
+    spinlock_unlock(&list_lock);
+
+    if (!first_free) return;
+
+    synchronize_rcu();
+
+    while ((entry = first_free)) {
+        first_free = entry->free_next;
+        free(entry);
+    }
+}
+
+status_t interface_find(const void *owner, const uuid_t if_uuid, const void **ifout)
+{
+    struct interface_entry *entry;
+    const void *interface = NULL;
+
+    if (!owner || !ifout) return STATUS_INVALID_VALUE;
+
+    rcu_read_lock();
+
+    for (entry = rcu_dereference(first_entry); entry; entry = rcu_dereference(entry->next)) {
+        if (entry->owner == owner && emos_uuid_isequal(entry->uuid, if_uuid)) {
+            interface = entry->interface;
+            break;
+        }
+    }
+
+    rcu_read_unlock();
+
+    if (!interface) return STATUS_ENTRY_NOT_FOUND;
+
+    *ifout = interface;
+
+    return STATUS_SUCCESS;
+}
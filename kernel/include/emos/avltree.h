@@ -0,0 +1,35 @@
+#ifndef __EMOS_AVLTREE_H__
+#define __EMOS_AVLTREE_H__
+
+#include <stddef.h>
+
+#include <emos/macros.h>
+
+struct avl_node {
+    struct avl_node *parent;
+    struct avl_node *left;
+    struct avl_node *right;
+    int height;
+};
+
+/* returns negative if a should be placed left to b */
+typedef int (*avl_compare_t)(const struct avl_node *a, const struct avl_node *b);
+
+struct avl_tree {
+    struct avl_node *root;
+    avl_compare_t compare;
+};
+
+#define AVL_ENTRY(ptr, type, member) CONTAINER_OF(ptr, type, member)
+
+void avl_init(struct avl_tree *tree, avl_compare_t compare);
+
+void avl_insert(struct avl_tree *tree, struct avl_node *node);
+void avl_remove(struct avl_tree *tree, struct avl_node *node);
+
+struct avl_node *avl_first(const struct avl_tree *tree);
+struct avl_node *avl_last(const struct avl_tree *tree);
+struct avl_node *avl_next(const struct avl_node *node);
+struct avl_node *avl_prev(const struct avl_node *node);
+
+#endif // __EMOS_AVLTREE_H__
@@ -25,7 +25,7 @@ struct bus_driver_ops {
 };
 
 struct bus_driver {
-    struct uuid id;
+    uuid_t id;
     struct bus_driver_ops *ops;
 };
 
@@ -33,7 +33,7 @@ status_t emos_bus_create(struct bus **busout);
 status_t emos_bus_remove(struct bus *bus);
 status_t emos_bus_driver_create(struct bus_driver **drv);
 status_t emos_bus_driver_remove(struct bus_driver *drv);
-status_t emos_bus_driver_add_interface(struct bus_driver *drv, struct uuid if_uuid, const void *interface);
-status_t emos_bus_driver_get_interface(struct bus_driver *drv, struct uuid if_uuid, const void **ifout);
+status_t emos_bus_driver_add_interface(struct bus_driver *drv, const uuid_t if_uuid, const void *interface);
+status_t emos_bus_driver_get_interface(struct bus_driver *drv, const uuid_t if_uuid, const void **ifout);
 
 #endif // __EMOS_BUS_H__
@@ -0,0 +1,36 @@
+#ifndef __EMOS_CLOCK_H__
+#define __EMOS_CLOCK_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+#define NS_PER_SEC  1000000000ULL
+
+/* a free-running counter the monotonic clock can be read from */
+struct clock_source {
+    const char *name;
+    int rating;             /* the highest rated source registered is used */
+
+    uint64_t frequency;     /* Hz */
+    uint64_t mask;          /* a narrower counter wraps around here, it has to be read more often than that */
+
+    uint64_t (*read)(void);
+    void (*enable)(void);   /* optional, called once the source has been picked */
+};
+
+struct clock_stat {
+    const char *name;
+    int rating;
+    uint64_t frequency;
+};
+
+/* called during boot, before the other processors start reading */
+status_t clock_register_source(struct clock_source *source);
+
+/* nanoseconds since the clock started, timer ticks stand in until a source is registered */
+uint64_t clock_get_monotonic_ns(void);
+
+status_t clock_get_stat(struct clock_stat *stat);
+
+#endif // __EMOS_CLOCK_H__
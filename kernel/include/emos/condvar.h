@@ -0,0 +1,26 @@
+#ifndef __EMOS_CONDVAR_H__
+#define __EMOS_CONDVAR_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/waitqueue.h>
+
+struct mutex;
+
+/* waits for a condition guarded by a mutex, the condition has to be checked again after every wakeup */
+struct condvar {
+    struct wait_queue waiters;  /* its lock guards the sequence */
+    uint32_t seq;               /* signals sent, a wait ends once it changes */
+};
+
+status_t condvar_init(struct condvar *cv);
+
+/* unlocks mtx while waiting, it is locked again on return, even on a timeout */
+status_t condvar_wait(struct condvar *cv, struct mutex *mtx);
+status_t condvar_wait_with_timeout(struct condvar *cv, struct mutex *mtx, int timeout_ms);
+
+status_t condvar_signal(struct condvar *cv);
+status_t condvar_broadcast(struct condvar *cv);
+
+#endif // __EMOS_CONDVAR_H__
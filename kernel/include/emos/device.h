@@ -15,6 +15,11 @@ struct device {
     struct object obj;
     struct device_driver *driver;
     void *data;
+
+    uint32_t id;
+    struct bus *bus;
+
+    struct device *next;    /* followed without a lock, see device_get_next() */
 };
 
 struct device_driver_ops {
@@ -30,12 +35,17 @@ struct device_driver {
 };
 
 status_t device_create(struct device **devout, struct bus *bus);
+/* sleeps until no reader can see the device any more */
 void device_remove(struct device *dev);
 
+/* only between rcu_read_lock() and rcu_read_unlock(), the device may be removed right after */
+struct device *device_get_next(struct device *dev);
+struct device *device_find(uint32_t id);
+
 status_t device_driver_create(struct device_driver **drv);
 void device_driver_remove(struct device_driver *drv);
 
-status_t device_driver_add_interface(struct device_driver *drv, struct uuid if_uuid, const void *interface);
-status_t emos_device_driver_get_interface(struct device_driver *drv, struct uuid if_uuid, const void **ifout);
+status_t device_driver_add_interface(struct device_driver *drv, const uuid_t if_uuid, const void *interface);
+status_t emos_device_driver_get_interface(struct device_driver *drv, const uuid_t if_uuid, const void **ifout);
 
 #endif // __EMOS_DEVICE_DRIVER_H__
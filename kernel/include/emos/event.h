@@ -0,0 +1,29 @@
+#ifndef __EMOS_EVENT_H__
+#define __EMOS_EVENT_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/waitqueue.h>
+
+#define EVENT_AUTO_RESET    0   /* a wait that ends takes the signal with it, one waiter at a time */
+#define EVENT_MANUAL_RESET  1   /* stays signaled and lets every waiter through until reset */
+
+struct event {
+    struct wait_queue waiters;  /* its lock guards the state */
+    int type;
+    int signaled;
+};
+
+status_t event_init(struct event *ev, int type, int signaled);
+
+/* callable from interrupt handlers */
+status_t event_set(struct event *ev);
+status_t event_reset(struct event *ev);
+
+status_t event_wait(struct event *ev);
+status_t event_wait_with_timeout(struct event *ev, int timeout_ms);
+
+int event_is_set(const struct event *ev);
+
+#endif // __EMOS_EVENT_H__
@@ -0,0 +1,17 @@
+#ifndef __EMOS_HEAP_H__
+#define __EMOS_HEAP_H__
+
+#include <stddef.h>
+
+#include <emos/status.h>
+
+struct heap_stat {
+    size_t magazine_hit_count;      /* small allocations served without the heap lock */
+    size_t magazine_miss_count;
+    size_t magazine_free_count;     /* small frees kept in a magazine */
+    size_t heap_free_count;         /* frees that went back to the heap */
+};
+
+status_t heap_get_stat(struct heap_stat *stat);
+
+#endif // __EMOS_HEAP_H__
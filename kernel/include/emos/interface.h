@@ -1,6 +1,17 @@
 #ifndef __EMOS_INTERFACE_H__
 #define __EMOS_INTERFACE_H__
 
+#include <emos/status.h>
+#include <emos/uuid.h>
 
+/*
+ * Interfaces a driver implements, found by the driver and the UUID of the interface.
+ * Lookups take no lock, entries go away a grace period after their owner unregisters.
+ */
+
+status_t interface_register(const void *owner, const uuid_t if_uuid, const void *interface);
+void interface_unregister_all(const void *owner);
+
+status_t interface_find(const void *owner, const uuid_t if_uuid, const void **ifout);
 
 #endif // __EMOS_INTERFACE_H__
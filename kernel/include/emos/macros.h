@@ -1,6 +1,7 @@
 #ifndef __EMOS_MACROS_H__
 #define __EMOS_MACROS_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -13,4 +14,6 @@
 #define ALIGN(v, a) (((v) + (a) - 1) & ~((a) - 1))
 #define ALIGN_DIV(v, a) (((v) + (a) - 1) / (a))
 
+#define CONTAINER_OF(ptr, type, member) ((type *)((uintptr_t)(ptr) - offsetof(type, member)))
+
 #endif  // __EMOS_MACROS_H__
\ No newline at end of file
@@ -8,29 +8,69 @@
 #include <bootemos/bootinfo.h>
 
 #define PAF_DEFAULT         0x00000000
-#define PAF_NO_24BIT        0x00000001
-#define PAF_NO_32BIT        0x00000002
+#define PAF_NO_24BIT        0x00000001  /* frames must be below 16MiB (ISA DMA) */
+#define PAF_NO_32BIT        0x00000002  /* frames must be below 4GiB */
+#define PAF_ZERO            0x00000004  /* frames must be zeroed, taken from the zero pool when possible */
+
+#define PZ_DMA              0
+#define PZ_DMA32            1
+#define PZ_NORMAL           2
+#define PZ_COUNT            3
 
 #define VAF_DEFAULT         0x00000000
 #define VAF_KERNEL          0x00000001
+#define VAF_LARGE           0x00000002  /* start on a 4MiB boundary, so that PMF_LARGE can map whole directory entries */
 
 #define PMF_DEFAULT          0x00000000
 #define PMF_READONLY         0x00000001
 #define PMF_USER             0x00000002
 #define PMF_NOCACHE          0x00000004
 #define PMF_WTCACHE          0x00000008
+#define PMF_LARGE            0x00000010  /* use 4MiB pages for whole directory entries whose pages and frames are both 4MiB aligned */
 
 typedef uintptr_t pfn_t;
 typedef uintptr_t vpn_t;
 
+#define PFF_PRESENT         0x00000001  /* the page was present, the access was not allowed */
+#define PFF_WRITE           0x00000002
+#define PFF_USER            0x00000004
+
+#define ASF_DEFAULT         0x00000000
+#define ASF_EAGER_COPY      0x00000001  /* copy every frame instead of sharing it copy-on-write */
+
+struct mm_fault_stat {
+    size_t demand_zero_fault_count;
+    size_t reserved_page_count;     /* reserved pages not backed by a frame yet */
+    size_t copy_on_write_fault_count;
+    size_t copied_page_count;       /* copy-on-write faults that had to copy the frame */
+};
+
+struct mm_zero_pool_stat {
+    size_t frame_count;             /* zeroed frames ready to be handed out */
+    size_t hit_count;
+    size_t miss_count;              /* PAF_ZERO requests that had to zero inline */
+    size_t fill_count;
+};
+
 status_t mm_pma_init(vpn_t pagedir_vpn, struct bootinfo_entry_memory_map *mment, struct bootinfo_entry_unavailable_frames *ufent);
 
 status_t mm_pma_get_available_frame_count(size_t *frame_count);
 status_t mm_pma_get_free_frame_count(size_t *frame_count);
+status_t mm_pma_get_zone_frame_count(int zone, size_t *available_count, size_t *free_count);
+
+status_t mm_pma_mark_reserved(pfn_t base_pfn, pfn_t limit_pfn);
+status_t mm_pma_unmark_reserved(pfn_t base_pfn, pfn_t limit_pfn);
 
 status_t mm_pma_allocate_frame(size_t frame_count, pfn_t *pfn, uint32_t alloc_flags);
 void mm_pma_free_frame(pfn_t pfn, size_t frame_count);
 
+status_t mm_pma_reference_frame(pfn_t pfn, size_t frame_count);
+status_t mm_pma_get_frame_refcount(pfn_t pfn, size_t *refcount);
+
+status_t mm_pma_fill_zero_pool(void);
+status_t mm_pma_get_zero_pool_stat(struct mm_zero_pool_stat *stat);
+status_t mm_start_zero_thread(void);
+
 
 status_t mm_vma_init(vpn_t user_base_vpn, vpn_t user_limit_vpn, vpn_t kernel_base_vpn, vpn_t kernel_limit_vpn);
 
@@ -40,6 +80,9 @@ status_t mm_vma_get_free_kernel_page_count(size_t *page_count);
 status_t mm_vma_get_available_user_page_count(size_t *page_count);
 status_t mm_vma_get_free_user_page_count(size_t *page_count);
 
+status_t mm_vma_get_free_kernel_extent_count(size_t *extent_count, size_t *largest_page_count);
+status_t mm_vma_get_free_user_extent_count(size_t *extent_count, size_t *largest_page_count);
+
 status_t mm_vma_allocate_page(size_t page_count, vpn_t *vpn, uint32_t alloc_flags);
 void mm_vma_free_page(vpn_t vpn, size_t page_count);
 
@@ -52,4 +95,24 @@ status_t mm_vaddr_to_paddr(void *vaddr, uintptr_t *paddr);
 status_t mm_map(pfn_t pfn, vpn_t vpn, size_t page_count, uint32_t flags);
 status_t mm_unmap(vpn_t vpn, size_t page_count);
 
+/* drop stale translations on this processor only, the others are asked through smp_flush_tlb() */
+void mm_flush_tlb_local(vpn_t vpn, size_t page_count);
+
+status_t mm_reserve(vpn_t vpn, size_t page_count, uint32_t flags);
+
+void mm_enable_demand_paging(void);
+status_t mm_handle_page_fault(uintptr_t vaddr, uint32_t fault_flags);
+status_t mm_get_fault_stat(struct mm_fault_stat *stat);
+
+status_t mm_clone_address_space(uint32_t flags, uintptr_t *cr3);
+status_t mm_destroy_address_space(uintptr_t cr3);
+
+status_t mm_allocate_pages(size_t page_count, vpn_t *vpn);
+status_t mm_allocate_pages_to(vpn_t vpn, size_t page_count);
+void mm_free_pages(vpn_t vpn, size_t page_count);
+
+/* map device memory into the kernel half, with 4MiB pages wherever the range covers one */
+status_t mm_map_physical(pfn_t pfn, size_t page_count, uint32_t flags, vpn_t *vpn);
+void mm_unmap_physical(vpn_t vpn, size_t page_count);
+
 #endif // __EMOS_MM_H__
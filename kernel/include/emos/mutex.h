@@ -1,13 +1,40 @@
 #ifndef __EMOS_MUTEX_H__
 #define __EMOS_MUTEX_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <emos/thread.h>
 #include <emos/status.h>
+#include <emos/waitqueue.h>
+
+#define MUTEX_HAS_WAITERS   0x1     /* or'd into the owner, unlocking has to wake someone */
 
 struct mutex {
-    volatile int locked;
+    volatile uintptr_t owner;   /* the owning thread, 0 while unlocked */
+    struct wait_queue waiters;  /* highest priority first */
+
+    struct mutex *held_next;    /* next mutex held by the same owner */
+
+    /* in scheduler clock units, kept by the owner */
+    uint64_t lock_time;
+    uint64_t hold_time_total;
+    uint64_t hold_time_max;
+
+    size_t lock_count;
+    size_t contended_count;     /* locks that found the mutex taken */
+    size_t spin_count;          /* contended locks that got it without sleeping */
+};
+
+struct mutex_stat {
     struct thread *owner;
-    struct thread *blocking_threads;
+
+    size_t lock_count;
+    size_t contended_count;
+    size_t spin_count;
+
+    uint64_t hold_time_total;
+    uint64_t hold_time_max;
 };
 
 status_t mutex_init(struct mutex *mtx);
@@ -17,4 +44,6 @@ status_t mutex_lock_with_timeout(struct mutex *mtx, int timeout_ms);
 status_t mutex_try_lock(struct mutex *mtx);
 status_t mutex_unlock(struct mutex *mtx);
 
+status_t mutex_get_stat(const struct mutex *mtx, struct mutex_stat *stat);
+
 #endif // __EMOS_MUTEX_H__
@@ -0,0 +1,38 @@
+#ifndef __EMOS_PERCPU_H__
+#define __EMOS_PERCPU_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <emos/softirq.h>
+#include <emos/heap.h>
+
+struct thread;
+struct run_queue;
+struct heap_magazine_set;
+
+/* data only its own processor touches, reached through this_cpu_read() and friends */
+struct percpu {
+    struct percpu *self;        /* where the area is, for this_cpu_ptr() */
+    int cpu;
+
+    struct thread *current_thread;
+    struct run_queue *run_queue;
+    int preemption_enabled;
+
+    /* with interrupts disabled only */
+    uint32_t softirq_pending;
+    int softirq_running;
+    uint64_t softirq_raise_times[SOFTIRQ_COUNT];
+    struct softirq_stat softirq_stats[SOFTIRQ_COUNT];
+
+    struct heap_magazine_set *heap_magazines;
+    struct heap_stat heap_stat;
+};
+
+/* the area of any processor, for summing up statistics or looking at another run queue */
+struct percpu *percpu_get(int cpu);
+
+#include <emos/asm/percpu.h>
+
+#endif // __EMOS_PERCPU_H__
@@ -0,0 +1,54 @@
+#ifndef __EMOS_RCU_H__
+#define __EMOS_RCU_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <emos/status.h>
+
+/*
+ * Readers run with preemption disabled and never sleep, so once every processor
+ * has gone through the scheduler no reader can still see what was unlinked before.
+ */
+
+struct rcu_head;
+
+typedef void (*rcu_func_t)(struct rcu_head *head);
+
+/* embedded in whatever is to be freed after a grace period */
+struct rcu_head {
+    struct rcu_head *next;
+    rcu_func_t func;
+};
+
+struct rcu_stat {
+    size_t grace_period_count;
+    size_t callback_count;
+
+    /* in nanoseconds */
+    uint64_t wait_time_total;
+    uint64_t wait_time_max;
+};
+
+/* publishes a pointer after the object it points to has been filled in */
+#define rcu_assign_pointer(p, v)    __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/* reads a pointer published with rcu_assign_pointer(), only between rcu_read_lock() and rcu_read_unlock() */
+#define rcu_dereference(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+/* nests, callable from interrupt handlers */
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+/* called by the scheduler on every switch */
+void rcu_note_quiescent_state(void);
+
+/* sleeps until every reader that could have seen the old pointers is done */
+status_t synchronize_rcu(void);
+
+/* calls func from the system workqueue after a grace period, never sleeps */
+status_t call_rcu(struct rcu_head *head, rcu_func_t func);
+
+status_t rcu_get_stat(struct rcu_stat *stat);
+
+#endif // __EMOS_RCU_H__
@@ -0,0 +1,33 @@
+#ifndef __EMOS_RWLOCK_H__
+#define __EMOS_RWLOCK_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+#define RWLOCK_WRITER           0x80000000  /* held for writing */
+#define RWLOCK_WRITER_WAITING   0x40000000  /* new readers hold back until the writer is through */
+#define RWLOCK_READER_MASK      0x3FFFFFFF
+
+/* spinning reader-writer lock, any number of readers or a single writer */
+struct rwlock {
+    volatile uint32_t value;    /* reader count and the flags above */
+};
+
+status_t rwlock_init(struct rwlock *lock);
+
+status_t rwlock_read_lock(struct rwlock *lock);
+status_t rwlock_read_try_lock(struct rwlock *lock);
+status_t rwlock_read_unlock(struct rwlock *lock);
+
+status_t rwlock_write_lock(struct rwlock *lock);
+status_t rwlock_write_try_lock(struct rwlock *lock);
+status_t rwlock_write_unlock(struct rwlock *lock);
+
+/* needed if the lock is also taken in interrupt handlers, for either side */
+status_t rwlock_read_lock_irqsave(struct rwlock *lock, uint32_t *irqstate);
+status_t rwlock_read_unlock_irqrestore(struct rwlock *lock, uint32_t irqstate);
+status_t rwlock_write_lock_irqsave(struct rwlock *lock, uint32_t *irqstate);
+status_t rwlock_write_unlock_irqrestore(struct rwlock *lock, uint32_t irqstate);
+
+#endif // __EMOS_RWLOCK_H__
@@ -0,0 +1,33 @@
+#ifndef __EMOS_RWSEM_H__
+#define __EMOS_RWSEM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/waitqueue.h>
+
+struct thread;
+
+/* sleeping reader-writer lock, a writer waiting keeps new readers out */
+struct rw_semaphore {
+    struct wait_queue waiters;  /* readers and writers alike, its lock guards the fields below */
+
+    int reader_count;
+    int writer_waiting_count;
+    struct thread *writer;
+};
+
+status_t rwsem_init(struct rw_semaphore *sem);
+
+status_t rwsem_read_lock(struct rw_semaphore *sem);
+status_t rwsem_read_lock_with_timeout(struct rw_semaphore *sem, int timeout_ms);
+status_t rwsem_read_try_lock(struct rw_semaphore *sem);
+status_t rwsem_read_unlock(struct rw_semaphore *sem);
+
+status_t rwsem_write_lock(struct rw_semaphore *sem);
+status_t rwsem_write_lock_with_timeout(struct rw_semaphore *sem, int timeout_ms);
+status_t rwsem_write_try_lock(struct rw_semaphore *sem);
+status_t rwsem_write_unlock(struct rw_semaphore *sem);
+
+#endif // __EMOS_RWSEM_H__
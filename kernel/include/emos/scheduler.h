@@ -3,17 +3,28 @@
 
 #include <emos/thread.h>
 
+#define SCHEDULER_TICK_RATE     100     /* Hz */
+
 status_t scheduler_add_thread(struct thread *th);
 status_t scheduler_remove_thread(struct thread *th);
 
 status_t scheduler_get_current_thread(struct thread **current);
 status_t scheduler_get_next_thread(struct thread **next);
 status_t scheduler_set_current_thread(struct thread *th);
+void scheduler_finish_switch(void);
 
 int scheduler_has_other_runnable_thread(void);
 
-status_t scheduler_yield(void);
+status_t scheduler_wake_thread(struct thread *th);
+status_t scheduler_set_thread_priority(struct thread *th, int priority);
+status_t scheduler_set_thread_nice(struct thread *th, int nice);
+status_t scheduler_set_thread_boost(struct thread *th, int priority);
+
+int scheduler_get_effective_priority(const struct thread *th);
+int scheduler_is_thread_on_cpu(const struct thread *th);
 
-status_t scheduler_maintain(void);  /* can be refactored to a better name */
+uint64_t scheduler_clock(void);
+
+status_t scheduler_yield(void);
 
 #endif // __EMOS_SCHEDULER_H__
@@ -0,0 +1,27 @@
+#ifndef __EMOS_SEMAPHORE_H__
+#define __EMOS_SEMAPHORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/waitqueue.h>
+
+/* counting semaphore, down sleeps while the count is zero */
+struct semaphore {
+    struct wait_queue waiters;  /* its lock guards the count */
+    int count;
+};
+
+status_t semaphore_init(struct semaphore *sem, int count);
+
+status_t semaphore_down(struct semaphore *sem);
+status_t semaphore_down_with_timeout(struct semaphore *sem, int timeout_ms);
+status_t semaphore_try_down(struct semaphore *sem);
+
+/* callable from interrupt handlers */
+status_t semaphore_up(struct semaphore *sem);
+
+int semaphore_get_count(const struct semaphore *sem);
+
+#endif // __EMOS_SEMAPHORE_H__
@@ -0,0 +1,72 @@
+#ifndef __EMOS_SLAB_H__
+#define __EMOS_SLAB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/spinlock.h>
+
+typedef void (*kmem_ctor_t)(void *object);
+
+struct kmem_slab;
+
+struct kmem_cache {
+    struct kmem_cache *next;
+
+    struct spinlock lock;
+
+    const char *name;
+
+    size_t object_size;
+    size_t object_align;
+    kmem_ctor_t ctor;
+
+    size_t objects_per_slab;
+    size_t first_object_offset;
+
+    /* shift the objects of each new slab to spread them over cache lines */
+    size_t color_count;
+    size_t next_color;
+
+    struct kmem_slab *partial_slabs;
+    struct kmem_slab *full_slabs;
+    struct kmem_slab *free_slabs;
+
+    size_t slab_count;
+    size_t free_slab_count;
+    size_t active_object_count;
+
+    size_t allocation_count;
+    size_t free_count;
+    size_t grow_count;
+    size_t shrink_count;
+};
+
+struct kmem_cache_stat {
+    const char *name;
+
+    size_t object_size;
+    size_t objects_per_slab;
+
+    size_t slab_count;
+    size_t free_slab_count;
+    size_t total_object_count;
+    size_t active_object_count;
+
+    size_t allocation_count;
+    size_t free_count;
+    size_t grow_count;
+    size_t shrink_count;
+};
+
+status_t kmem_cache_init(struct kmem_cache *cache, const char *name, size_t object_size, size_t object_align, kmem_ctor_t ctor);
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+status_t kmem_cache_allocate(struct kmem_cache *cache, void **object);
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+
+status_t kmem_cache_get_stat(const struct kmem_cache *cache, struct kmem_cache_stat *stat);
+struct kmem_cache *kmem_cache_get_next(const struct kmem_cache *cache);
+
+#endif // __EMOS_SLAB_H__
@@ -0,0 +1,27 @@
+#ifndef __EMOS_SMP_H__
+#define __EMOS_SMP_H__
+
+#include <stddef.h>
+
+#include <emos/status.h>
+#include <emos/mm.h>
+
+#define SMP_MAX_CPU_COUNT   16
+
+/* start the other processors, each comes up running its own idle thread */
+status_t smp_init(void);
+
+int smp_get_cpu_count(void);
+int smp_get_cpu_index(void);
+int smp_is_cpu_online(int cpu);
+
+/* make another processor go through the scheduler */
+void smp_send_reschedule(int cpu);
+
+/* drop the translations of a page range on every other processor, returns once they have */
+void smp_flush_tlb(vpn_t vpn, size_t page_count);
+
+/* spin loop body, serves requests of other processors that must not wait for interrupts to be enabled */
+void smp_cpu_relax(void);
+
+#endif // __EMOS_SMP_H__
@@ -0,0 +1,56 @@
+#ifndef __EMOS_SOFTIRQ_H__
+#define __EMOS_SOFTIRQ_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <emos/status.h>
+
+#define SOFTIRQ_TIMER       0   /* expired timers of the wheel */
+#define SOFTIRQ_TASKLET     1   /* tasklets scheduled from interrupt handlers */
+#define SOFTIRQ_COUNT       8
+
+/* runs with interrupts enabled and preemption disabled, must neither sleep nor yield */
+typedef void (*softirq_func_t)(void *data);
+
+struct tasklet;
+
+typedef void (*tasklet_func_t)(struct tasklet *tasklet, void *data);
+
+struct tasklet {
+    struct tasklet *next;
+    volatile uint32_t scheduled;    /* queued on some processor and not yet started */
+
+    tasklet_func_t func;
+    void *data;
+};
+
+struct softirq_stat {
+    size_t raise_count;
+    size_t run_count;
+
+    /* in scheduler clock units, from the first raise to the handler starting */
+    uint64_t latency_total;
+    uint64_t latency_max;
+
+    uint64_t time_total;
+    uint64_t time_max;
+};
+
+status_t softirq_register(int nr, softirq_func_t func, void *data);
+
+/* the handler runs on this processor when the outermost interrupt returns, or right away from a thread */
+status_t softirq_raise(int nr);
+
+/* called on interrupt exit with interrupts disabled, enables them while handlers run */
+void softirq_run(void);
+int softirq_is_running(void);
+
+status_t softirq_get_stat(int nr, struct softirq_stat *stat);
+
+status_t tasklet_init(struct tasklet *tasklet, tasklet_func_t func, void *data);
+
+/* a tasklet scheduled again before it started only runs once, after it started it runs again */
+status_t tasklet_schedule(struct tasklet *tasklet);
+
+#endif // __EMOS_SOFTIRQ_H__
@@ -1,11 +1,21 @@
 #ifndef __EMOS_SPINLOCK_H__
 #define __EMOS_SPINLOCK_H__
 
-#include <emos/thread.h>
+#include <stdint.h>
+
 #include <emos/status.h>
 
+struct thread;
+
+/* ticket lock, lockers are served in the order they arrived */
 struct spinlock {
-    volatile int locked;
+    union {
+        volatile uint32_t ticket;
+        struct {
+            volatile uint16_t serving;  /* ticket of the holder */
+            volatile uint16_t next;     /* ticket handed to the next locker */
+        };
+    };
     struct thread *owner;
 };
 
@@ -15,6 +25,8 @@ status_t spinlock_lock(struct spinlock *lock);
 status_t spinlock_try_lock(struct spinlock *lock);
 status_t spinlock_unlock(struct spinlock *lock);
 
+/* a lock also taken with interrupts enabled may be held by a preempted thread, never spin on it with them off */
+status_t spinlock_lock_irqsave(struct spinlock *lock, uint32_t *irqstate);
 status_t spinlock_try_lock_irqsave(struct spinlock *lock, uint32_t *irqstate);
 status_t spinlock_unlock_irqrestore(struct spinlock *lock, uint32_t irqstate);
 
@@ -51,6 +51,7 @@ typedef unsigned int status_t;
 #define STATUS_FEATURE_DISABLED         0x80000019
 #define STATUS_THREAD_NOT_FINISHED      0x8000001A
 #define STATUS_INVALID_THREAD           0x8000001B
+#define STATUS_TIMED_OUT                0x8000001C
 
 #define STATUS_FS_INCONSISTENT          0xC0000000
 #define STATUS_SYSTEM_CORRUPTED         0xC0000001
@@ -4,8 +4,24 @@
 #include <emos/status.h>
 #include <emos/compiler.h>
 #include <emos/mm.h>
+#include <emos/avltree.h>
+#include <emos/waitqueue.h>
 
 struct thread;
+struct mutex;
+
+struct thread_stat {
+    int sched_class;
+    int priority;
+    int boost_priority;     /* inherited from a waiter, higher than the own level while boosted */
+    int nice;
+    uint32_t weight;        /* share of CPU time against other fair threads, 1024 at nice 0 */
+
+    uint64_t runtime;       /* nanoseconds spent running */
+    uint64_t vruntime;      /* runtime scaled by the nice weight, 1024 units per nanosecond at nice 0 */
+    uint64_t wait_time;     /* time spent runnable but waiting for the CPU */
+    size_t switch_count;    /* times the thread was switched in */
+};
 
 typedef void (*thread_entry_t)(struct thread *);
 
@@ -18,9 +34,24 @@ typedef void (*thread_entry_t)(struct thread *);
 #define TT_MAIN         0
 #define TT_KERNEL       1
 #define TT_USER         2
+#define TT_IDLE         3   /* what a processor other than the boot one runs when there is nothing else */
+
+#define TP_COUNT        32
+#define TP_IDLE         0
+#define TP_LOW          8
+#define TP_NORMAL       16
+#define TP_HIGH         24
+
+#define TC_FIXED        0   /* strict priority, first come first served within a level */
+#define TC_FAIR         1   /* shares the TP_NORMAL level by virtual runtime */
+
+#define THREAD_TLS_SLOT_COUNT   8   /* words of thread-local storage, read with this_thread_tls_read() */
+
+#define NICE_MIN        -20
+#define NICE_MAX        19
 
 struct thread {
-    struct thread *next;
+    struct thread *next, *prev;
 
     int id;
 
@@ -28,6 +59,30 @@ struct thread {
 
     int type;
 
+    int priority;
+    int sched_class;
+    int nice;
+    uint32_t weight;
+
+    /* highest level of the threads waiting for a mutex held by this one, only counts above its own */
+    int boost_priority;
+
+    /* run queue links, only valid while the thread is queued */
+    struct thread *run_next, *run_prev;
+    struct avl_node fair_node;
+    int queued;
+
+    int cpu;                /* processor whose run queue the thread belongs to */
+    volatile int on_cpu;    /* set from the switch in until the switch out has saved the context */
+
+    /* in nanoseconds of the monotonic clock */
+    uint64_t vruntime;      /* scaled like in struct thread_stat */
+    uint64_t exec_start;
+    uint64_t enqueue_time;
+    uint64_t runtime;
+    uint64_t wait_time;
+    size_t switch_count;
+
     size_t kmode_stack_page_count;
     vpn_t kmode_stack_base_vpn;
     void *kmode_stack_ptr;
@@ -39,16 +94,22 @@ struct thread {
 
     uintptr_t cr3;
 
+    void *fpu_state;        /* x87/SSE registers, only loaded on the first FPU instruction after a switch in */
+    int fpu_cpu;            /* processor that last saved or loaded fpu_state, -1 if none yet */
+
     int detached;
 
-    struct thread **wait_list;
-    int wait_count;
-    int wait_timeout;
+    struct mutex *held_mutexes;     /* most recently locked first */
+    struct mutex *blocked_on;       /* mutex this thread sleeps on, followed when passing a boost on */
+
+    struct wait_queue exit_queue;   /* threads waiting for this one to finish */
+    struct thread *reap_next;       /* finished detached threads waiting to be removed */
 
-    struct thread *mutex_blocking_next;
+    uintptr_t tls[THREAD_TLS_SLOT_COUNT];   /* FS covers these while the thread runs */
 };
 
 status_t thread_init(struct thread **main_thread);
+status_t thread_init_cpu(struct thread **idle_thread);
 
 void thread_enable_preemption(void);
 void thread_disable_preemption(void);
@@ -57,8 +118,19 @@ int thread_is_preemption_enabled(void);
 status_t thread_create(thread_entry_t entry, size_t stack_size, struct thread **threadout);
 status_t thread_remove(struct thread *thread);
 
+status_t thread_set_priority(struct thread *thread, int priority);
+status_t thread_set_nice(struct thread *thread, int nice);
+status_t thread_get_stat(const struct thread *thread, struct thread_stat *stat);
+
 status_t thread_detach(struct thread *thread);
-status_t thread_wait(struct thread **list, int count, int timeout);
+status_t thread_wait(struct thread **list, int count, int timeout_ms);
+status_t thread_reap(void);
+
+status_t thread_sleep(uint64_t ns);
+
+/* a slot is the same index in every thread, allocated once for all of them */
+status_t thread_tls_allocate(int *slot);
+void thread_tls_free(int slot);
 
 __noreturn
 void thread_exit(void);
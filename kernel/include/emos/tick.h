@@ -0,0 +1,24 @@
+#ifndef __EMOS_TICK_H__
+#define __EMOS_TICK_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+struct tick_stat {
+    uint64_t interrupt_count;   /* timer interrupts taken */
+    uint64_t avoided_count;     /* ticks that passed without an interrupt */
+    uint64_t oneshot_count;     /* times the periodic tick was stopped for a one-shot deadline */
+};
+
+uint64_t get_global_tick(void);
+
+/* stop the periodic tick while nothing can be preempted, called with interrupts disabled */
+void tick_update(void);
+
+/* whether the processor sleeps through ticks, a thread queued there would not be sliced in */
+int tick_is_stopped(int cpu);
+
+status_t tick_get_stat(struct tick_stat *stat);
+
+#endif // __EMOS_TICK_H__
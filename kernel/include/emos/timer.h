@@ -0,0 +1,39 @@
+#ifndef __EMOS_TIMER_H__
+#define __EMOS_TIMER_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+
+struct timer;
+struct timer_slot;
+
+/* runs from the timer softirq with interrupts disabled, the wheel is not locked meanwhile */
+typedef void (*timer_func_t)(struct timer *timer, void *data);
+
+struct timer {
+    struct timer *next, *prev;
+    struct timer_slot *slot;    /* NULL while not pending */
+
+    uint64_t expires;           /* in ticks */
+
+    timer_func_t func;
+    void *data;
+};
+
+status_t timer_init(struct timer *timer, timer_func_t func, void *data);
+
+status_t timer_add(struct timer *timer, uint64_t expires);
+status_t timer_cancel(struct timer *timer);
+
+/* also waits for the callback if it runs on another processor, never call it from the callback */
+status_t timer_cancel_sync(struct timer *timer);
+int timer_is_pending(const struct timer *timer);
+
+uint64_t timer_ns_to_ticks(uint64_t ns);
+uint64_t timer_ms_to_ticks(uint64_t ms);
+
+void timer_run(uint64_t now);
+status_t timer_get_next_expiry(uint64_t *expires);
+
+#endif // __EMOS_TIMER_H__
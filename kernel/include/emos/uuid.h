@@ -10,9 +10,10 @@ typedef uint8_t uuid_t[16];
 
 #define UUID(...) ((uuid_t){ __VA_ARGS__ })
 
-static __always_inline int emos_uuid_isequal(uuid_t uuid1, uuid_t uuid2)
+static __always_inline int emos_uuid_isequal(const uuid_t uuid1, const uuid_t uuid2)
 {
-    return memcmp(uuid1, uuid2, sizeof(uuid1)) == 0;
+    /* the parameters are pointers, sizeof on them would compare 4 bytes */
+    return memcmp(uuid1, uuid2, sizeof(uuid_t)) == 0;
 }
 
 #endif // __EMOS_UUID_H__
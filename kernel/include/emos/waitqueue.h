@@ -0,0 +1,48 @@
+#ifndef __EMOS_WAITQUEUE_H__
+#define __EMOS_WAITQUEUE_H__
+
+#include <stdint.h>
+
+#include <emos/status.h>
+#include <emos/spinlock.h>
+
+#define WAIT_INFINITE   -1
+
+struct thread;
+struct wait_queue_entry;
+
+struct wait_queue {
+    struct spinlock lock;
+    struct wait_queue_entry *first, *last;
+    int ordered;    /* keep the waiters sorted by priority instead of arrival */
+};
+
+status_t wait_queue_init(struct wait_queue *wq);
+status_t wait_queue_init_ordered(struct wait_queue *wq);
+
+/* interrupts are disabled while the queue is locked */
+status_t wait_queue_lock(struct wait_queue *wq, uint32_t *irqstate);
+status_t wait_queue_unlock(struct wait_queue *wq, uint32_t irqstate);
+
+/*
+ * Check the condition with the queue locked and keep it locked until the wait,
+ * or a wakeup may slip in between. The queue is locked again on return.
+ */
+status_t wait_queue_wait(struct wait_queue *wq, int timeout_ms);
+status_t wait_queue_wait_until(struct wait_queue *wq, uint64_t deadline_tick);
+
+status_t wait_queue_wake_one(struct wait_queue *wq);
+status_t wait_queue_wake_all(struct wait_queue *wq);
+
+/* for callers that hold the lock already */
+status_t wait_queue_wake_one_locked(struct wait_queue *wq);
+status_t wait_queue_wake_all_locked(struct wait_queue *wq);
+
+int wait_queue_is_empty(const struct wait_queue *wq);
+
+/* called with the queue locked, the thread may be woken right after */
+struct thread *wait_queue_get_first_thread(const struct wait_queue *wq);
+
+uint64_t wait_queue_get_deadline(int timeout_ms);
+
+#endif // __EMOS_WAITQUEUE_H__
@@ -0,0 +1,87 @@
+#ifndef __EMOS_WORKQUEUE_H__
+#define __EMOS_WORKQUEUE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <emos/status.h>
+#include <emos/waitqueue.h>
+
+#define WORKQUEUE_MAX_WORKER_COUNT  8
+
+struct work;
+struct workqueue;
+
+/* runs in a worker thread, may sleep */
+typedef void (*work_func_t)(struct work *work, void *data);
+
+struct work {
+    struct work *next;
+    struct workqueue *queue;    /* the queue the work is pending on, NULL otherwise */
+
+    uint64_t queue_time;        /* in scheduler clock units */
+
+    work_func_t func;
+    void *data;
+};
+
+struct workqueue_stat {
+    const char *name;
+    int worker_count;
+
+    size_t queued_count;
+    size_t done_count;
+    size_t pending_count;
+
+    /* in scheduler clock units, from queueing to a worker picking the work up */
+    uint64_t latency_total;
+    uint64_t latency_max;
+
+    uint64_t time_total;
+    uint64_t time_max;
+};
+
+struct workqueue {
+    struct workqueue *next;
+    const char *name;
+
+    /* the lock of the wait queue guards the whole queue */
+    struct wait_queue wait;         /* idle workers */
+    struct wait_queue flush_wait;   /* threads waiting for the queue to run empty */
+    struct work *first, *last;
+    int busy_count;                 /* work running right now */
+    int worker_count;
+    int stopping;
+
+    size_t queued_count;
+    size_t done_count;
+    size_t pending_count;
+    uint64_t latency_total;
+    uint64_t latency_max;
+    uint64_t time_total;
+    uint64_t time_max;
+};
+
+status_t work_init(struct work *work, work_func_t func, void *data);
+int work_is_pending(const struct work *work);
+
+status_t workqueue_init(struct workqueue *wq, const char *name, int worker_count);
+
+/* waits for the work already queued, then stops the workers */
+status_t workqueue_destroy(struct workqueue *wq);
+
+/* callable from interrupt handlers, work still pending stays where it is, on one queue at a time */
+status_t workqueue_queue(struct workqueue *wq, struct work *work);
+status_t workqueue_cancel(struct work *work);
+
+/* returns once the queue has run empty, never call it from work on the same queue */
+status_t workqueue_flush(struct workqueue *wq);
+
+status_t workqueue_get_stat(struct workqueue *wq, struct workqueue_stat *stat);
+struct workqueue *workqueue_get_next(struct workqueue *wq);
+
+/* a shared queue for work that does not need one of its own */
+status_t workqueue_start_system(void);
+struct workqueue *workqueue_get_system(void);
+
+#endif // __EMOS_WORKQUEUE_H__
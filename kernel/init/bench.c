@@ -0,0 +1,711 @@
+#include "bench.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <emos/asm/page.h>
+#include <emos/asm/atomic.h>
+#include <emos/asm/fpu.h>
+
+#include <emos/mm.h>
+#include <emos/thread.h>
+#include <emos/scheduler.h>
+#include <emos/status.h>
+#include <emos/macros.h>
+#include <emos/panic.h>
+#include <emos/log.h>
+#include <emos/mutex.h>
+#include <emos/semaphore.h>
+#include <emos/condvar.h>
+#include <emos/event.h>
+#include <emos/spinlock.h>
+#include <emos/heap.h>
+#include <emos/tick.h>
+#include <emos/smp.h>
+#include <emos/percpu.h>
+#include <emos/timer.h>
+#include <emos/clock.h>
+#include <emos/softirq.h>
+#include <emos/workqueue.h>
+
+#define MODULE_NAME "bench"
+
+#define FORK_BENCH_PAGE_COUNT       256
+#define FORK_BENCH_ROUND_COUNT      16
+
+static uint64_t bench_clock(void)
+{
+    return clock_get_monotonic_ns();
+}
+
+static void fork_bench_run(const char *name, uint32_t flags, vpn_t vpn)
+{
+    status_t status;
+    uint64_t start, fork_time = 0, touch_time = 0;
+    uintptr_t cr3;
+
+    for (int i = 0; i < FORK_BENCH_ROUND_COUNT; i++) {
+        start = bench_clock();
+
+        /* a child that exits right away */
+        status = mm_clone_address_space(flags, &cr3);
+        if (!CHECK_SUCCESS(status)) {
+            panic(status, "failed to clone address space");
+        }
+
+        status = mm_destroy_address_space(cr3);
+        if (!CHECK_SUCCESS(status)) {
+            panic(status, "failed to destroy address space");
+        }
+
+        fork_time += bench_clock() - start;
+
+        /* the parent writing afterwards pays for what the fork deferred */
+        start = bench_clock();
+        memset((void *)(vpn * PAGE_SIZE), i, FORK_BENCH_PAGE_COUNT * PAGE_SIZE);
+        touch_time += bench_clock() - start;
+    }
+
+    LOG_DEBUG("%-5s fork+exit: %10llu, touch: %10llu %s per round\n", name, fork_time / FORK_BENCH_ROUND_COUNT, touch_time / FORK_BENCH_ROUND_COUNT, "ns");
+}
+
+static void fork_bench_main(struct thread *th)
+{
+    status_t status;
+    vpn_t vpn;
+
+    status = mm_allocate_pages(FORK_BENCH_PAGE_COUNT, &vpn);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to allocate pages for fork benchmark");
+    }
+
+    memset((void *)(vpn * PAGE_SIZE), 0xA5, FORK_BENCH_PAGE_COUNT * PAGE_SIZE);
+
+    fork_bench_run("cow", ASF_DEFAULT, vpn);
+    fork_bench_run("eager", ASF_EAGER_COPY, vpn);
+
+    mm_free_pages(vpn, FORK_BENCH_PAGE_COUNT);
+}
+
+#define HEAP_BENCH_MAX_THREAD_COUNT 4
+#define HEAP_BENCH_ROUND_COUNT      2000
+#define HEAP_BENCH_BATCH_SIZE       8
+
+static void heap_bench_worker_main(struct thread *th)
+{
+    static const size_t sizes[] = { 16, 24, 40, 64, 100, 128, 200, 256, 480, 1024 };
+    void *blocks[HEAP_BENCH_BATCH_SIZE];
+
+    for (int i = 0; i < HEAP_BENCH_ROUND_COUNT; i++) {
+        for (int j = 0; j < HEAP_BENCH_BATCH_SIZE; j++) {
+            blocks[j] = malloc(sizes[(i + j) % ARRAY_SIZE(sizes)]);
+            if (!blocks[j]) {
+                panic(STATUS_INSUFFICIENT_MEMORY, "heap benchmark ran out of memory");
+            }
+            *(volatile uint8_t *)blocks[j] = j;
+        }
+
+        for (int j = HEAP_BENCH_BATCH_SIZE - 1; j >= 0; j--) {
+            free(blocks[j]);
+        }
+    }
+}
+
+static void heap_bench_main(struct thread *th)
+{
+    struct thread *workers[HEAP_BENCH_MAX_THREAD_COUNT];
+    struct heap_stat heap_stat;
+    uint64_t start, elapsed;
+    size_t op_count;
+
+    for (int thread_count = 1; thread_count <= HEAP_BENCH_MAX_THREAD_COUNT; thread_count *= 2) {
+        start = bench_clock();
+
+        for (int i = 0; i < thread_count; i++) {
+            thread_create(heap_bench_worker_main, 0x4000, &workers[i]);
+        }
+        thread_wait(workers, thread_count, -1);
+
+        elapsed = bench_clock() - start;
+
+        for (int i = 0; i < thread_count; i++) {
+            thread_remove(workers[i]);
+        }
+
+        op_count = (size_t)thread_count * HEAP_BENCH_ROUND_COUNT * HEAP_BENCH_BATCH_SIZE * 2;
+        LOG_DEBUG("heap %d thread(s): %lu malloc/free in %llu %s, %llu per op\n", thread_count, op_count, elapsed, "ns", elapsed / op_count);
+    }
+
+    heap_get_stat(&heap_stat);
+    LOG_DEBUG("heap magazines: %lu hits, %lu misses, %lu frees kept, %lu frees to heap\n", heap_stat.magazine_hit_count, heap_stat.magazine_miss_count, heap_stat.magazine_free_count, heap_stat.heap_free_count);
+}
+
+#define FAIR_BENCH_DURATION         3000000000ULL  /* ns */
+
+static const int fair_bench_nices[] = { -5, 0, 0, 5 };
+static volatile int fair_bench_stop = 0;
+
+static void fair_bench_worker_main(struct thread *th)
+{
+    while (!fair_bench_stop) {}
+}
+
+static void fair_bench_main(struct thread *th)
+{
+    struct thread *workers[ARRAY_SIZE(fair_bench_nices)];
+    struct thread_stat stat[ARRAY_SIZE(fair_bench_nices)];
+    uint64_t total_runtime = 0;
+    uint32_t total_weight = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(fair_bench_nices); i++) {
+        thread_create(fair_bench_worker_main, 0x4000, &workers[i]);
+        thread_set_nice(workers[i], fair_bench_nices[i]);
+    }
+
+    thread_sleep(FAIR_BENCH_DURATION);
+
+    fair_bench_stop = 1;
+    thread_wait(workers, ARRAY_SIZE(workers), -1);
+
+    for (size_t i = 0; i < ARRAY_SIZE(fair_bench_nices); i++) {
+        thread_get_stat(workers[i], &stat[i]);
+        total_runtime += stat[i].runtime;
+        total_weight += stat[i].weight;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(fair_bench_nices); i++) {
+        LOG_DEBUG("fair nice %3d: %3llu.%llu%% of cpu (expected ~%lu%%), waited %llu, %lu switches\n",
+                  stat[i].nice,
+                  stat[i].runtime * 100 / total_runtime, stat[i].runtime * 1000 / total_runtime % 10,
+                  stat[i].weight * 100 / total_weight,
+                  stat[i].wait_time, stat[i].switch_count);
+
+        thread_remove(workers[i]);
+    }
+}
+
+#define SPIN_STRESS_THREAD_COUNT    4
+#define SPIN_STRESS_DURATION        2000000000ULL  /* ns */
+
+static struct spinlock spin_stress_lock;
+static volatile int spin_stress_stop = 0;
+static volatile int spin_stress_inside = 0;
+static volatile uint32_t spin_stress_counter = 0;
+static volatile uint32_t spin_stress_counts[SPIN_STRESS_THREAD_COUNT + 1];
+static volatile uint32_t spin_stress_next_index = 0;
+
+static void spin_stress_enter(int index)
+{
+    uint32_t value;
+
+    if (spin_stress_inside) {
+        panic(STATUS_SYSTEM_CORRUPTED, "two threads inside spinlock");
+    }
+    spin_stress_inside = 1;
+
+    /* a torn increment shows up as a lost count, hold long enough to get preempted in here */
+    value = spin_stress_counter;
+    for (volatile int i = 0; i < 256; i++) {}
+    spin_stress_counter = value + 1;
+
+    spin_stress_counts[index]++;
+    spin_stress_inside = 0;
+}
+
+static void spin_stress_worker_main(struct thread *th)
+{
+    int index = _i686_atomic_fetch_add32(&spin_stress_next_index, 1);
+
+    while (!spin_stress_stop) {
+        spinlock_lock(&spin_stress_lock);
+        spin_stress_enter(index);
+        spinlock_unlock(&spin_stress_lock);
+    }
+}
+
+/* takes the lock with interrupts off, so it must never spin on a preempted holder */
+static void spin_stress_irq_main(struct thread *th)
+{
+    uint32_t irqstate;
+
+    while (!spin_stress_stop) {
+        if (spinlock_try_lock_irqsave(&spin_stress_lock, &irqstate) == STATUS_SUCCESS) {
+            spin_stress_enter(SPIN_STRESS_THREAD_COUNT);
+            spinlock_unlock_irqrestore(&spin_stress_lock, irqstate);
+        }
+
+        scheduler_yield();
+    }
+}
+
+static void spin_stress_main(struct thread *th)
+{
+    struct thread *workers[SPIN_STRESS_THREAD_COUNT + 1];
+    uint32_t total = 0, min_count = UINT32_MAX, max_count = 0;
+
+    spinlock_init(&spin_stress_lock);
+
+    for (int i = 0; i < SPIN_STRESS_THREAD_COUNT; i++) {
+        thread_create(spin_stress_worker_main, 0x4000, &workers[i]);
+    }
+    thread_create(spin_stress_irq_main, 0x4000, &workers[SPIN_STRESS_THREAD_COUNT]);
+
+    thread_sleep(SPIN_STRESS_DURATION);
+
+    spin_stress_stop = 1;
+    thread_wait(workers, ARRAY_SIZE(workers), -1);
+
+    for (int i = 0; i < ARRAY_SIZE(workers); i++) {
+        total += spin_stress_counts[i];
+        if (i < SPIN_STRESS_THREAD_COUNT) {
+            min_count = MIN(min_count, spin_stress_counts[i]);
+            max_count = MAX(max_count, spin_stress_counts[i]);
+        }
+
+        thread_remove(workers[i]);
+    }
+
+    if (total != spin_stress_counter) {
+        panic(STATUS_SYSTEM_CORRUPTED, "spinlock lost %lu of %lu increments", total - spin_stress_counter, total);
+    }
+
+    LOG_DEBUG("spinlock: %lu acquisitions, %lu with interrupts off, workers %lu..%lu\n", total, spin_stress_counts[SPIN_STRESS_THREAD_COUNT], min_count, max_count);
+}
+
+#define PI_BENCH_HOLD_WORK          20000000    /* loop rounds the low priority thread spends holding the mutex */
+#define PI_BENCH_MEDIUM_DURATION    50          /* ticks */
+
+static struct mutex pi_bench_mutex;
+static volatile int pi_bench_locked = 0;
+static uint64_t pi_bench_wait_ticks;
+static int pi_bench_boost;
+
+static void pi_bench_low_main(struct thread *th)
+{
+    mutex_lock(&pi_bench_mutex);
+    pi_bench_locked = 1;
+
+    for (volatile uint32_t i = 0; i < PI_BENCH_HOLD_WORK; i++) {}
+
+    pi_bench_boost = th->boost_priority;
+    mutex_unlock(&pi_bench_mutex);
+}
+
+/* hogs the CPU above the holder, without the boost it keeps the high thread waiting too */
+static void pi_bench_medium_main(struct thread *th)
+{
+    uint64_t start_tick = get_global_tick();
+
+    while (get_global_tick() - start_tick < PI_BENCH_MEDIUM_DURATION) {}
+}
+
+static void pi_bench_high_main(struct thread *th)
+{
+    uint64_t start_tick = get_global_tick();
+
+    mutex_lock(&pi_bench_mutex);
+    pi_bench_wait_ticks = get_global_tick() - start_tick;
+    mutex_unlock(&pi_bench_mutex);
+}
+
+static void pi_bench_main(struct thread *th)
+{
+    struct thread *workers[3];
+    struct mutex_stat stat;
+
+    mutex_init(&pi_bench_mutex);
+    thread_set_priority(th, TP_HIGH + 1);
+
+    thread_create(pi_bench_low_main, 0x4000, &workers[0]);
+    thread_set_priority(workers[0], TP_LOW);
+
+    while (!pi_bench_locked) {
+        thread_sleep(10000000);
+    }
+
+    thread_create(pi_bench_medium_main, 0x4000, &workers[1]);
+    thread_set_priority(workers[1], TP_NORMAL);
+
+    thread_create(pi_bench_high_main, 0x4000, &workers[2]);
+    thread_set_priority(workers[2], TP_HIGH);
+
+    thread_wait(workers, ARRAY_SIZE(workers), -1);
+
+    for (size_t i = 0; i < ARRAY_SIZE(workers); i++) {
+        thread_remove(workers[i]);
+    }
+
+    mutex_get_stat(&pi_bench_mutex, &stat);
+
+    LOG_DEBUG("pi: high waited %llu ticks (medium runs %d), holder boosted to %d, held for %llu %s\n",
+              pi_bench_wait_ticks, PI_BENCH_MEDIUM_DURATION, pi_bench_boost,
+              stat.hold_time_max, "ns");
+}
+
+#define SMP_BENCH_WORK              (1UL << 26) /* loop rounds shared out among the workers */
+
+static volatile uint32_t smp_bench_rounds;
+
+static void smp_bench_worker_main(struct thread *th)
+{
+    for (volatile uint32_t i = 0; i < smp_bench_rounds; i++) {}
+}
+
+/* the same amount of work split over more threads should finish sooner with every processor added */
+static void smp_bench_main(struct thread *th)
+{
+    struct thread *workers[SMP_MAX_CPU_COUNT];
+    uint64_t start, elapsed, base_elapsed = 0;
+    int cpu_count = smp_get_cpu_count();
+
+    for (int thread_count = 1; thread_count <= cpu_count; thread_count++) {
+        smp_bench_rounds = SMP_BENCH_WORK / thread_count;
+
+        start = bench_clock();
+
+        for (int i = 0; i < thread_count; i++) {
+            thread_create(smp_bench_worker_main, 0x4000, &workers[i]);
+        }
+        thread_wait(workers, thread_count, -1);
+
+        elapsed = MAX(bench_clock() - start, 1);
+        if (thread_count == 1) {
+            base_elapsed = elapsed;
+        }
+
+        for (int i = 0; i < thread_count; i++) {
+            thread_remove(workers[i]);
+        }
+
+        LOG_DEBUG("smp %d/%d thread(s): %llu %s, speedup %llu.%02llu\n", thread_count, cpu_count, elapsed, "ns",
+                  base_elapsed / elapsed, base_elapsed * 100 / elapsed % 100);
+    }
+}
+
+#define FPU_CHECK_WORKER_COUNT      4
+#define FPU_CHECK_ROUND_COUNT       16
+#define FPU_CHECK_ITERATION_COUNT   (1UL << 20)
+
+static volatile uint32_t fpu_check_mismatch_count;
+
+/* long enough to be preempted with the values still in the x87 registers */
+static double fpu_check_series(int seed)
+{
+    double value = seed;
+
+    for (uint32_t i = 0; i < FPU_CHECK_ITERATION_COUNT; i++) {
+        value = value * 0.999999 + 1.0 / (i + seed);
+    }
+
+    return value;
+}
+
+static void fpu_check_worker_main(struct thread *th)
+{
+    double first = fpu_check_series(th->id);
+
+    for (int i = 1; i < FPU_CHECK_ROUND_COUNT; i++) {
+        if (fpu_check_series(th->id) != first) {
+            _i686_atomic_fetch_add32(&fpu_check_mismatch_count, 1);
+        }
+    }
+}
+
+/* every round has to come out the same however the workers interleave, or some switch lost FPU state */
+static void fpu_check_main(struct thread *th)
+{
+    struct thread *workers[FPU_CHECK_WORKER_COUNT];
+    struct fpu_stat stat;
+
+    for (int i = 0; i < FPU_CHECK_WORKER_COUNT; i++) {
+        thread_create(fpu_check_worker_main, 0x4000, &workers[i]);
+    }
+    thread_wait(workers, FPU_CHECK_WORKER_COUNT, -1);
+
+    for (int i = 0; i < FPU_CHECK_WORKER_COUNT; i++) {
+        thread_remove(workers[i]);
+    }
+
+    _pc_fpu_get_stat(&stat);
+
+    LOG_DEBUG("fpu mode %d: %lu mismatch(es), %llu trap(s), %llu restore(s), %llu reuse(s), %llu save(s)\n", stat.mode,
+              fpu_check_mismatch_count, stat.trap_count, stat.restore_count, stat.reuse_count, stat.save_count);
+}
+
+#define DEFERRED_BENCH_ROUND_COUNT  64
+
+static struct timer deferred_bench_timer;
+static struct tasklet deferred_bench_tasklet;
+static struct work deferred_bench_work;
+static volatile uint32_t deferred_bench_done_count;
+
+static void deferred_bench_work_func(struct work *work, void *data)
+{
+    _i686_atomic_fetch_add32(&deferred_bench_done_count, 1);
+}
+
+static void deferred_bench_tasklet_func(struct tasklet *tasklet, void *data)
+{
+    workqueue_queue(workqueue_get_system(), &deferred_bench_work);
+}
+
+static void deferred_bench_timer_func(struct timer *timer, void *data)
+{
+    tasklet_schedule(&deferred_bench_tasklet);
+}
+
+/* timer, tasklet and worker in a chain, the way an interrupt handler hands down what takes longer */
+static void deferred_bench_main(struct thread *th)
+{
+    struct workqueue *wq = workqueue_get_system();
+    struct softirq_stat timer_stat, tasklet_stat;
+    struct workqueue_stat wq_stat;
+
+    if (!wq) return;
+
+    timer_init(&deferred_bench_timer, deferred_bench_timer_func, NULL);
+    tasklet_init(&deferred_bench_tasklet, deferred_bench_tasklet_func, NULL);
+    work_init(&deferred_bench_work, deferred_bench_work_func, NULL);
+
+    for (int i = 0; i < DEFERRED_BENCH_ROUND_COUNT; i++) {
+        timer_add(&deferred_bench_timer, get_global_tick() + 1);
+        thread_sleep(20000000);
+    }
+
+    timer_cancel_sync(&deferred_bench_timer);
+    workqueue_flush(wq);
+
+    softirq_get_stat(SOFTIRQ_TIMER, &timer_stat);
+    softirq_get_stat(SOFTIRQ_TASKLET, &tasklet_stat);
+    workqueue_get_stat(wq, &wq_stat);
+
+    LOG_DEBUG("deferred %lu/%d done, max latency in %s: timer softirq %llu, tasklet %llu, work %llu (avg %llu)\n",
+              deferred_bench_done_count, DEFERRED_BENCH_ROUND_COUNT, "ns",
+              timer_stat.latency_max, tasklet_stat.latency_max, wq_stat.latency_max,
+              wq_stat.latency_total / MAX(wq_stat.done_count, 1));
+}
+
+#define PINGPONG_BENCH_ROUND_COUNT  1000
+#define PINGPONG_BENCH_TIMEOUT      10      /* ms */
+
+#define PINGPONG_SEMAPHORE          0
+#define PINGPONG_EVENT              1
+#define PINGPONG_CONDVAR            2
+#define PINGPONG_MODE_COUNT         3
+
+static const char *pingpong_bench_names[PINGPONG_MODE_COUNT] = { "semaphore", "event", "condvar" };
+
+static int pingpong_bench_mode;
+static struct semaphore pingpong_bench_semaphores[2];
+static struct event pingpong_bench_events[2];
+static struct mutex pingpong_bench_mutex;
+static struct condvar pingpong_bench_condvar;
+static int pingpong_bench_turn;
+
+/* side 0 is the bench thread, side 1 its partner */
+static void pingpong_bench_wait(int side)
+{
+    switch (pingpong_bench_mode) {
+        case PINGPONG_SEMAPHORE:
+            semaphore_down(&pingpong_bench_semaphores[side]);
+            break;
+        case PINGPONG_EVENT:
+            event_wait(&pingpong_bench_events[side]);
+            break;
+        case PINGPONG_CONDVAR:
+            mutex_lock(&pingpong_bench_mutex);
+            while (pingpong_bench_turn != side) {
+                condvar_wait(&pingpong_bench_condvar, &pingpong_bench_mutex);
+            }
+            mutex_unlock(&pingpong_bench_mutex);
+            break;
+    }
+}
+
+static void pingpong_bench_pass(int side)
+{
+    switch (pingpong_bench_mode) {
+        case PINGPONG_SEMAPHORE:
+            semaphore_up(&pingpong_bench_semaphores[side]);
+            break;
+        case PINGPONG_EVENT:
+            event_set(&pingpong_bench_events[side]);
+            break;
+        case PINGPONG_CONDVAR:
+            mutex_lock(&pingpong_bench_mutex);
+            pingpong_bench_turn = side;
+            condvar_signal(&pingpong_bench_condvar);
+            mutex_unlock(&pingpong_bench_mutex);
+            break;
+    }
+}
+
+static void pingpong_bench_partner_main(struct thread *th)
+{
+    for (int i = 0; i < PINGPONG_BENCH_ROUND_COUNT; i++) {
+        pingpong_bench_wait(1);
+        pingpong_bench_pass(0);
+    }
+}
+
+/* two threads handing the turn back and forth, every handoff is a wakeup of a sleeping thread */
+static void pingpong_bench_main(struct thread *th)
+{
+    struct thread *partner;
+    struct event never_set;
+    status_t status;
+    uint64_t start, elapsed;
+
+    for (int mode = 0; mode < PINGPONG_MODE_COUNT; mode++) {
+        pingpong_bench_mode = mode;
+
+        for (int i = 0; i < 2; i++) {
+            semaphore_init(&pingpong_bench_semaphores[i], 0);
+            event_init(&pingpong_bench_events[i], EVENT_AUTO_RESET, 0);
+        }
+        mutex_init(&pingpong_bench_mutex);
+        condvar_init(&pingpong_bench_condvar);
+        pingpong_bench_turn = 0;
+
+        thread_create(pingpong_bench_partner_main, 0x4000, &partner);
+
+        start = bench_clock();
+
+        for (int i = 0; i < PINGPONG_BENCH_ROUND_COUNT; i++) {
+            pingpong_bench_pass(1);
+            pingpong_bench_wait(0);
+        }
+
+        elapsed = bench_clock() - start;
+
+        thread_wait(&partner, 1, -1);
+        thread_remove(partner);
+
+        LOG_DEBUG("pingpong %-9s %d rounds in %llu ns, %llu ns per handoff\n", pingpong_bench_names[mode],
+                  PINGPONG_BENCH_ROUND_COUNT, elapsed, elapsed / (PINGPONG_BENCH_ROUND_COUNT * 2));
+    }
+
+    /* nobody sets it, so the wait has to run into its timeout */
+    event_init(&never_set, EVENT_MANUAL_RESET, 0);
+
+    start = bench_clock();
+    status = event_wait_with_timeout(&never_set, PINGPONG_BENCH_TIMEOUT);
+    elapsed = bench_clock() - start;
+
+    LOG_DEBUG("pingpong timed wait of %d ms: %s after %llu ns\n", PINGPONG_BENCH_TIMEOUT,
+              status == STATUS_TIMED_OUT ? "timed out" : "woken", elapsed);
+}
+
+#define PERCPU_BENCH_LOOKUP_COUNT   (1UL << 16)
+#define PERCPU_BENCH_WORKER_COUNT   4
+#define PERCPU_BENCH_ROUND_COUNT    256
+
+static int percpu_bench_slot;
+static volatile uint32_t percpu_bench_mismatch_count;
+
+static void percpu_bench_worker_main(struct thread *th)
+{
+    this_thread_tls_write(percpu_bench_slot, (uintptr_t)th);
+
+    /* every yield is a chance to come back on another processor with the slot of another thread */
+    for (int i = 0; i < PERCPU_BENCH_ROUND_COUNT; i++) {
+        if (this_thread_tls_read(percpu_bench_slot) != (uintptr_t)th || this_cpu_read(current_thread) != th) {
+            _i686_atomic_fetch_add32(&percpu_bench_mismatch_count, 1);
+        }
+
+        scheduler_yield();
+    }
+}
+
+/* the current thread used to take a task register read and an array lookup with interrupts disabled */
+static void percpu_bench_main(struct thread *th)
+{
+    struct thread *workers[PERCPU_BENCH_WORKER_COUNT];
+    struct thread *current;
+    status_t status;
+    uint64_t start, str_elapsed, gs_elapsed;
+    volatile int sink = 0;
+
+    start = bench_clock();
+    for (uint32_t i = 0; i < PERCPU_BENCH_LOOKUP_COUNT; i++) {
+        sink += smp_get_cpu_index();
+    }
+    str_elapsed = bench_clock() - start;
+
+    start = bench_clock();
+    for (uint32_t i = 0; i < PERCPU_BENCH_LOOKUP_COUNT; i++) {
+        scheduler_get_current_thread(&current);
+        sink += current == th;
+    }
+    gs_elapsed = bench_clock() - start;
+
+    LOG_DEBUG("percpu %lu lookups: task register %llu ns, current thread through GS %llu ns\n",
+              PERCPU_BENCH_LOOKUP_COUNT, str_elapsed, gs_elapsed);
+
+    status = thread_tls_allocate(&percpu_bench_slot);
+    if (!CHECK_SUCCESS(status)) {
+        LOG_DEBUG("percpu no TLS slot left\n");
+        return;
+    }
+
+    for (int i = 0; i < PERCPU_BENCH_WORKER_COUNT; i++) {
+        thread_create(percpu_bench_worker_main, 0x4000, &workers[i]);
+    }
+    thread_wait(workers, PERCPU_BENCH_WORKER_COUNT, -1);
+
+    for (int i = 0; i < PERCPU_BENCH_WORKER_COUNT; i++) {
+        thread_remove(workers[i]);
+    }
+
+    thread_tls_free(percpu_bench_slot);
+
+    LOG_DEBUG("percpu TLS slot %d: %lu mismatch(es) over %d switch(es)\n", percpu_bench_slot,
+              percpu_bench_mismatch_count, PERCPU_BENCH_WORKER_COUNT * PERCPU_BENCH_ROUND_COUNT);
+}
+
+static const thread_entry_t bench_entries[] = {
+    fork_bench_main,
+    heap_bench_main,
+    fair_bench_main,
+    spin_stress_main,
+    pi_bench_main,
+    smp_bench_main,
+    fpu_check_main,
+    deferred_bench_main,
+    pingpong_bench_main,
+    percpu_bench_main,
+};
+
+/* one at a time, benchmarks running side by side would mostly measure each other */
+static void bench_main(struct thread *th)
+{
+    status_t status;
+    struct thread *bench;
+
+    for (size_t i = 0; i < ARRAY_SIZE(bench_entries); i++) {
+        status = thread_create(bench_entries[i], 0x10000, &bench);
+        if (!CHECK_SUCCESS(status)) {
+            LOG_DEBUG("cannot start benchmark #%lu\n", i);
+            continue;
+        }
+
+        thread_wait(&bench, 1, -1);
+        thread_remove(bench);
+    }
+
+    LOG_DEBUG("all benchmarks done\n");
+}
+
+void bench_start(void)
+{
+    status_t status;
+    struct thread *th;
+
+    status = thread_create(bench_main, 0x4000, &th);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to start benchmarks");
+    }
+
+    thread_detach(th);
+}
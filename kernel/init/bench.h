@@ -0,0 +1,6 @@
+#ifndef __INIT_BENCH_H__
+#define __INIT_BENCH_H__
+
+void bench_start(void);
+
+#endif // __INIT_BENCH_H__
@@ -8,7 +8,7 @@
 #include <emos/asm/io.h>
 #include <emos/asm/page.h>
 #include <emos/asm/interrupt.h>
-#include <emos/asm/instruction.h>
+#include <emos/asm/fpu.h>
 
 #include <emos/compiler.h>
 #include <emos/mm.h>
@@ -19,9 +19,17 @@
 #include <emos/panic.h>
 #include <emos/log.h>
 #include <emos/mutex.h>
+#include <emos/slab.h>
+#include <emos/tick.h>
+#include <emos/smp.h>
+#include <emos/clock.h>
+#include <emos/workqueue.h>
 #include <bootemos/bootinfo.h>
 #include <bootemos/ramdisk.h>
 
+#include "config.h"
+#include "bench.h"
+
 #define MODULE_NAME "main"
 
 extern struct bootinfo_table_header *_pc_bootinfo_table;
@@ -82,7 +90,7 @@ static int early_print_char(void *_state, char ch)
 
 static uint16_t *fb;
 
-extern uint64_t get_global_tick(void);
+struct mutex mtx;
 
 static void fb_print_str(int col, int row, const char *str)
 {
@@ -93,15 +101,22 @@ static void fb_print_str(int col, int row, const char *str)
 
 static void thread1_main(struct thread *th)
 {
-    uint64_t prev_tick = 0, current_tick;
     size_t free_frames, free_kvaddr, free_uvaddr;
+    struct kmem_cache *cache;
+    struct kmem_cache_stat cache_stat;
+    struct mm_fault_stat fault_stat;
+    struct mm_zero_pool_stat zero_stat;
+    struct tick_stat tick_stat;
+    struct mutex_stat mutex_stat;
+    struct fpu_stat fpu_stat;
+    struct workqueue_stat workqueue_stat;
+    struct clock_stat clock_stat;
+    int row;
 
     char buf[512];
 
     for (;;) {
-        current_tick = get_global_tick();
-        if (current_tick - prev_tick < 20) scheduler_yield();
-        prev_tick = current_tick;
+        thread_sleep(200000000);
 
         mm_pma_get_free_frame_count(&free_frames);
         mm_vma_get_free_kernel_page_count(&free_kvaddr);
@@ -115,13 +130,62 @@ static void thread1_main(struct thread *th)
 
         snprintf(buf, sizeof(buf), "free uvaddr: %10ld", free_uvaddr * 1024);
         fb_print_str(80 - 23, 2, buf);
+
+        row = 3;
+        for (cache = kmem_cache_get_next(NULL); cache && row < 8; cache = kmem_cache_get_next(cache)) {
+            kmem_cache_get_stat(cache, &cache_stat);
+
+            snprintf(buf, sizeof(buf), "%-8.8s %6lu/%6lu", cache_stat.name, cache_stat.active_object_count, cache_stat.total_object_count);
+            fb_print_str(80 - 23, row++, buf);
+        }
+
+        mm_get_fault_stat(&fault_stat);
+
+        snprintf(buf, sizeof(buf), "dz fault: %13lu", fault_stat.demand_zero_fault_count);
+        fb_print_str(80 - 23, 8, buf);
+
+        snprintf(buf, sizeof(buf), "cow fault: %5lu/%6lu", fault_stat.copied_page_count, fault_stat.copy_on_write_fault_count);
+        fb_print_str(80 - 23, 9, buf);
+
+        mm_pma_get_zero_pool_stat(&zero_stat);
+
+        snprintf(buf, sizeof(buf), "zero %4lu %6lu/%6lu", zero_stat.frame_count, zero_stat.hit_count, zero_stat.miss_count);
+        fb_print_str(80 - 23, 10, buf);
+
+        tick_get_stat(&tick_stat);
+
+        snprintf(buf, sizeof(buf), "tick %7llu/%8llu", tick_stat.interrupt_count, tick_stat.avoided_count);
+        fb_print_str(80 - 23, 11, buf);
+
+        mutex_get_stat(&mtx, &mutex_stat);
+
+        snprintf(buf, sizeof(buf), "mutex %7lu/%8lu", mutex_stat.contended_count, mutex_stat.lock_count);
+        fb_print_str(80 - 23, 12, buf);
+
+        snprintf(buf, sizeof(buf), "cpus online: %10d", smp_get_cpu_count());
+        fb_print_str(80 - 23, 13, buf);
+
+        _pc_fpu_get_stat(&fpu_stat);
+
+        snprintf(buf, sizeof(buf), "fpu %7llu/%9llu", fpu_stat.restore_count, fpu_stat.trap_count);
+        fb_print_str(80 - 23, 14, buf);
+
+        if (workqueue_get_system()) {
+            workqueue_get_stat(workqueue_get_system(), &workqueue_stat);
+
+            snprintf(buf, sizeof(buf), "work %6lu/%10llu", workqueue_stat.done_count, workqueue_stat.latency_max);
+            fb_print_str(80 - 23, 15, buf);
+        }
+
+        clock_get_stat(&clock_stat);
+
+        snprintf(buf, sizeof(buf), "clock %-4.4s %10lluHz", clock_stat.name, clock_stat.frequency);
+        fb_print_str(80 - 23, 16, buf);
     }
 }
 
 static int shared_value = 0;
 
-struct mutex mtx;
-
 static void thread2_main(struct thread *th);
 
 static void thread4_main(struct thread *th)
@@ -142,7 +206,7 @@ static void thread4_main(struct thread *th)
 
         time = (get_global_tick() - start_tick) / 100;
         if (time == prev_time) {
-            scheduler_yield();
+            thread_sleep(10000000);
             continue;
         }
         prev_time = time;
@@ -175,7 +239,7 @@ static void thread3_main(struct thread *th)
 
         time = (get_global_tick() - start_tick) / 100;
         if (time == prev_time) {
-            scheduler_yield();
+            thread_sleep(10000000);
             continue;
         }
         prev_time = time;
@@ -213,7 +277,7 @@ static void thread2_main(struct thread *th)
 
         time = (get_global_tick() - start_tick) / 100;
         if (time == prev_time) {
-            scheduler_yield();
+            thread_sleep(10000000);
             continue;
         }
         prev_time = time;
@@ -299,19 +363,20 @@ void main(void)
         enthdr = (void *)((uintptr_t)enthdr + enthdr->size);
     }
 
-    /* hang if there's no framebuffer or not in text mode */
-    if (!fbent || fbent->type != BEFT_TEXT) {
+    /* hang if there's no framebuffer */
+    if (!fbent) {
         for (;;) {}
     }
 
-    status = mm_vma_allocate_page(ALIGN_DIV(fbent->pitch * fbent->height, PAGE_SIZE), &earlyfb_vpn, VAF_KERNEL);
+    /* a linear framebuffer is physically contiguous, so it gets 4MiB pages wherever it spans one */
+    status = mm_map_physical(fbent->framebuffer_addr / PAGE_SIZE, ALIGN_DIV(fbent->pitch * fbent->height, PAGE_SIZE), PMF_WTCACHE, &earlyfb_vpn);
     if (!CHECK_SUCCESS(status)) {
-        panic(status, "cannot allocate pages for early framebuffer");
+        panic(status, "cannot map early framebuffer");
     }
 
-    status = mm_map(fbent->framebuffer_addr / PAGE_SIZE, earlyfb_vpn, ALIGN_DIV(fbent->pitch * fbent->height, PAGE_SIZE), PMF_WTCACHE);
-    if (!CHECK_SUCCESS(status)) {
-        panic(status, "cannot map early framebuffer");
+    /* hang if not in text mode */
+    if (fbent->type != BEFT_TEXT) {
+        for (;;) {}
     }
 
     pstate.framebuffer = (uint16_t *)(earlyfb_vpn * PAGE_SIZE);
@@ -425,6 +490,22 @@ void main(void)
         panic(status, "failed to initialize multitasking");
     }
 
+    status = mm_start_zero_thread();
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to start zeroing thread");
+    }
+
+    LOG_DEBUG("starting application processors...\n");
+    status = smp_init();
+    if (!CHECK_SUCCESS(status)) {
+        LOG_DEBUG("running on the boot processor only\n");
+    }
+
+    status = workqueue_start_system();
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to start system workqueue");
+    }
+
     mutex_init(&mtx);
 
     thread_enable_preemption();
@@ -434,8 +515,12 @@ void main(void)
     thread_detach(thread1);
     thread_detach(thread2);
 
+#ifdef CONFIG_BENCHMARK
+    bench_start();
+#endif
+
     for (;;) {
-        scheduler_maintain();
+        thread_reap();
 
         if (scheduler_has_other_runnable_thread()) {
             scheduler_yield();
@@ -0,0 +1,227 @@
+#include <emos/avltree.h>
+
+static int node_height(const struct avl_node *node)
+{
+    return node ? node->height : 0;
+}
+
+static void update_height(struct avl_node *node)
+{
+    node->height = 1 + MAX(node_height(node->left), node_height(node->right));
+}
+
+static void replace_child(struct avl_tree *tree, struct avl_node *parent, struct avl_node *old_child, struct avl_node *new_child)
+{
+    if (!parent) {
+        tree->root = new_child;
+    } else if (parent->left == old_child) {
+        parent->left = new_child;
+    } else {
+        parent->right = new_child;
+    }
+
+    if (new_child) {
+        new_child->parent = parent;
+    }
+}
+
+static struct avl_node *rotate_left(struct avl_tree *tree, struct avl_node *node)
+{
+    struct avl_node *pivot = node->right;
+
+    node->right = pivot->left;
+    if (pivot->left) {
+        pivot->left->parent = node;
+    }
+
+    replace_child(tree, node->parent, node, pivot);
+
+    pivot->left = node;
+    node->parent = pivot;
+
+    update_height(node);
+    update_height(pivot);
+
+    return pivot;
+}
+
+static struct avl_node *rotate_right(struct avl_tree *tree, struct avl_node *node)
+{
+    struct avl_node *pivot = node->left;
+
+    node->left = pivot->right;
+    if (pivot->right) {
+        pivot->right->parent = node;
+    }
+
+    replace_child(tree, node->parent, node, pivot);
+
+    pivot->right = node;
+    node->parent = pivot;
+
+    update_height(node);
+    update_height(pivot);
+
+    return pivot;
+}
+
+/* walk up from node to the root, restoring the height invariant */
+static void rebalance(struct avl_tree *tree, struct avl_node *node)
+{
+    int balance;
+
+    while (node) {
+        update_height(node);
+
+        balance = node_height(node->left) - node_height(node->right);
+        if (balance > 1) {
+            if (node_height(node->left->left) < node_height(node->left->right)) {
+                rotate_left(tree, node->left);
+            }
+            node = rotate_right(tree, node);
+        } else if (balance < -1) {
+            if (node_height(node->right->right) < node_height(node->right->left)) {
+                rotate_right(tree, node->right);
+            }
+            node = rotate_left(tree, node);
+        }
+
+        node = node->parent;
+    }
+}
+
+void avl_init(struct avl_tree *tree, avl_compare_t compare)
+{
+    tree->root = NULL;
+    tree->compare = compare;
+}
+
+void avl_insert(struct avl_tree *tree, struct avl_node *node)
+{
+    struct avl_node *parent = NULL;
+    struct avl_node **link = &tree->root;
+
+    while (*link) {
+        parent = *link;
+
+        if (tree->compare(node, parent) < 0) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->height = 1;
+
+    *link = node;
+
+    rebalance(tree, parent);
+}
+
+void avl_remove(struct avl_tree *tree, struct avl_node *node)
+{
+    struct avl_node *successor, *child, *rebalance_start;
+
+    if (node->left && node->right) {
+        /* put the in-order successor on the place of the node */
+        successor = node->right;
+        while (successor->left) {
+            successor = successor->left;
+        }
+
+        if (successor->parent == node) {
+            rebalance_start = successor;
+        } else {
+            rebalance_start = successor->parent;
+
+            rebalance_start->left = successor->right;
+            if (successor->right) {
+                successor->right->parent = rebalance_start;
+            }
+
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        successor->left->parent = successor;
+
+        replace_child(tree, node->parent, node, successor);
+    } else {
+        child = node->left ? node->left : node->right;
+        rebalance_start = node->parent;
+
+        replace_child(tree, node->parent, node, child);
+    }
+
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+
+    rebalance(tree, rebalance_start);
+}
+
+struct avl_node *avl_first(const struct avl_tree *tree)
+{
+    struct avl_node *node = tree->root;
+
+    if (!node) return NULL;
+
+    while (node->left) {
+        node = node->left;
+    }
+
+    return node;
+}
+
+struct avl_node *avl_last(const struct avl_tree *tree)
+{
+    struct avl_node *node = tree->root;
+
+    if (!node) return NULL;
+
+    while (node->right) {
+        node = node->right;
+    }
+
+    return node;
+}
+
+struct avl_node *avl_next(const struct avl_node *node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+
+        return (struct avl_node *)node;
+    }
+
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+struct avl_node *avl_prev(const struct avl_node *node)
+{
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+
+        return (struct avl_node *)node;
+    }
+
+    while (node->parent && node->parent->left == node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
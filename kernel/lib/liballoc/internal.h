@@ -1,6 +1,7 @@
 #ifndef __LIBALLOC_INTERNAL_H__
 #define __LIBALLOC_INTERNAL_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <emos/asm/page.h>
@@ -10,7 +11,8 @@
 //typedef	unsigned long	uintptr_t;
 
 //This lets you prefix malloc and friends
-#define PREFIX(func)		func
+//The kernel puts per-processor magazines in front, see magazine.c
+#define PREFIX(func)		__liballoc_##func
 
 /** This is a boundary tag which is prepended to the
  * page or section of a page which we have allocated. It is
@@ -67,4 +69,14 @@ extern void* liballoc_alloc(int);
  */
 extern int liballoc_free(void*,int);
 
+void *PREFIX(malloc)(size_t);
+void *PREFIX(realloc)(void *, size_t);
+void *PREFIX(calloc)(size_t, size_t);
+void PREFIX(free)(void *);
+
+/** Returns the requested size of an allocated block, or 0 if the
+ * pointer does not look like one.
+ */
+size_t PREFIX(usable_size)(void *);
+
 #endif // __LIBALLOC_INTERNAL_H__
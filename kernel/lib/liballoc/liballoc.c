@@ -835,3 +835,21 @@ void*   PREFIX(realloc)(void *p, size_t size)
 
 
 
+size_t PREFIX(usable_size)(void *p)
+{
+	void *ptr;
+	struct liballoc_minor *min;
+
+	if ( p == NULL ) return 0;
+
+	// Unalign the pointer if required.
+	ptr = p;
+	UNALIGN(ptr);
+
+	min = (struct liballoc_minor*)((uintptr_t)ptr - sizeof( struct liballoc_minor ));
+
+	// Only the owner of a block changes it, so no need to lock.
+	if ( min->magic != LIBALLOC_MAGIC ) return 0;
+
+	return min->req_size;
+}
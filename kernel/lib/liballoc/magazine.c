@@ -0,0 +1,185 @@
+#include <liballoc.h>
+
+#include <string.h>
+
+#include <emos/asm/interrupt.h>
+
+#include <emos/heap.h>
+#include <emos/smp.h>
+#include <emos/percpu.h>
+
+#include "internal.h"
+
+/* small blocks of 16 to 512 bytes are recycled through per-processor magazines */
+#define MAGAZINE_MIN_SHIFT          4
+#define MAGAZINE_CLASS_COUNT        6
+#define MAGAZINE_CAPACITY           16
+
+struct heap_magazine {
+    size_t count;
+    void *objects[MAGAZINE_CAPACITY];
+};
+
+struct heap_magazine_set {
+    struct heap_magazine magazines[MAGAZINE_CLASS_COUNT];
+};
+
+static struct heap_magazine_set magazine_sets[SMP_MAX_CPU_COUNT];
+
+static int get_size_class(size_t size)
+{
+    int class_idx = 0;
+
+    while (((size_t)1 << (class_idx + MAGAZINE_MIN_SHIFT)) < size) {
+        if (++class_idx >= MAGAZINE_CLASS_COUNT) return -1;
+    }
+
+    return class_idx;
+}
+
+static size_t get_class_size(int class_idx)
+{
+    return (size_t)1 << (class_idx + MAGAZINE_MIN_SHIFT);
+}
+
+/* called with interrupts disabled, which keeps both other threads and handlers on this processor out */
+static struct heap_magazine *get_magazine(int class_idx)
+{
+    struct heap_magazine_set *set = this_cpu_read(heap_magazines);
+
+    if (!set) {
+        set = &magazine_sets[this_cpu_read(cpu)];
+        this_cpu_write(heap_magazines, set);
+    }
+
+    return &set->magazines[class_idx];
+}
+
+void *malloc(size_t size)
+{
+    struct heap_magazine *mag;
+    uint32_t irqstate;
+    void *object;
+    int class_idx;
+
+    class_idx = size ? get_size_class(size) : -1;
+    if (class_idx < 0) return __liballoc_malloc(size);
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    mag = get_magazine(class_idx);
+
+    if (mag->count > 0) {
+        object = mag->objects[--mag->count];
+        this_cpu_ptr(heap_stat)->magazine_hit_count++;
+
+        interrupt_restore(irqstate);
+
+        return object;
+    }
+
+    this_cpu_ptr(heap_stat)->magazine_miss_count++;
+
+    interrupt_restore(irqstate);
+
+    /* allocate the whole class so that the block can be reused for any size in it */
+    return __liballoc_malloc(get_class_size(class_idx));
+}
+
+void free(void *ptr)
+{
+    struct heap_magazine *mag;
+    uint32_t irqstate;
+    size_t size;
+    int class_idx;
+
+    if (!ptr) return;
+
+    size = __liballoc_usable_size(ptr);
+    class_idx = size ? get_size_class(size) : -1;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    if (class_idx >= 0 && get_class_size(class_idx) == size) {
+        mag = get_magazine(class_idx);
+
+        if (mag->count < MAGAZINE_CAPACITY) {
+            mag->objects[mag->count++] = ptr;
+            this_cpu_ptr(heap_stat)->magazine_free_count++;
+
+            interrupt_restore(irqstate);
+
+            return;
+        }
+    }
+
+    this_cpu_ptr(heap_stat)->heap_free_count++;
+
+    interrupt_restore(irqstate);
+
+    __liballoc_free(ptr);
+}
+
+void *calloc(size_t nobj, size_t size)
+{
+    void *ptr;
+
+    if (size && nobj > SIZE_MAX / size) return NULL;
+
+    ptr = malloc(nobj * size);
+    if (ptr) {
+        memset(ptr, 0, nobj * size);
+    }
+
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *new_ptr;
+    size_t old_size;
+
+    if (!ptr) return malloc(size);
+
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    old_size = __liballoc_usable_size(ptr);
+    if (old_size == 0) return NULL;
+
+    /* keep magazine blocks at their class size, liballoc would shrink them */
+    if (size <= old_size) return ptr;
+
+    new_ptr = malloc(size);
+    if (!new_ptr) return NULL;
+
+    memcpy(new_ptr, ptr, old_size);
+    free(ptr);
+
+    return new_ptr;
+}
+
+/* the counters of every processor, each only ever written by its own with interrupts disabled */
+status_t heap_get_stat(struct heap_stat *stat)
+{
+    const struct heap_stat *cpu_stat;
+
+    if (!stat) return STATUS_INVALID_VALUE;
+
+    memset(stat, 0, sizeof(*stat));
+
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        cpu_stat = &percpu_get(i)->heap_stat;
+
+        stat->magazine_hit_count += cpu_stat->magazine_hit_count;
+        stat->magazine_miss_count += cpu_stat->magazine_miss_count;
+        stat->magazine_free_count += cpu_stat->magazine_free_count;
+        stat->heap_free_count += cpu_stat->heap_free_count;
+    }
+
+    return STATUS_SUCCESS;
+}
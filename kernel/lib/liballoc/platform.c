@@ -1,80 +1,65 @@
 #include "internal.h"
 
 #include <emos/mm.h>
-#include <emos/panic.h>
+#include <emos/thread.h>
+#include <emos/spinlock.h>
+
+static struct spinlock heap_lock;
+static int heap_lock_preemption_enabled = 0;
 
 int liballoc_lock(void) {
+    int preemption_enabled = thread_is_preemption_enabled();
+
+    /* a preempted holder would leave every other allocating thread spinning */
+    thread_disable_preemption();
+
+    /* interrupts stay on, the heap may fault in pages while it is locked */
+    spinlock_lock(&heap_lock);
+
+    heap_lock_preemption_enabled = preemption_enabled;
+
     return 0;
 }
 
 int liballoc_unlock(void) {
+    int preemption_enabled = heap_lock_preemption_enabled;
+
+    spinlock_unlock(&heap_lock);
+
+    if (preemption_enabled) {
+        thread_enable_preemption();
+    }
+
     return 0;
 }
 
 void *liballoc_alloc(int page_count)
 {
     status_t status;
-    pfn_t allocated_pfn = (pfn_t)-1;
-    vpn_t allocated_vpn = (vpn_t)-1;
-    size_t allocated_count = 0;
+    vpn_t allocated_vpn;
     
     /* allocate virtual memory pages first */
     status = mm_vma_allocate_page(page_count, &allocated_vpn, VAF_KERNEL);
-    if (!CHECK_SUCCESS(status)) goto has_error;
+    if (!CHECK_SUCCESS(status)) return NULL;
 
-    /* it will allow allocating non-contiguous physical memory frames */
+    /* frames are allocated on first access and may not be contiguous. */
     /* if you want to allocate/map frames/pages for hardware I/O, */
     /* you should use memory management API directly, not this "malloc" API. */
-    for (; allocated_count < page_count; allocated_count++) {
-        status = mm_vpn_to_pfn(allocated_vpn + allocated_count, NULL);
-        if (status != STATUS_PAGE_NOT_PRESENT) goto has_error;
-
-        status = mm_pma_allocate_frame(1, &allocated_pfn, PAF_DEFAULT);
-        if (!CHECK_SUCCESS(status)) goto has_error;
-
-        status = mm_map(allocated_pfn, allocated_vpn + allocated_count, 1, PMF_DEFAULT);
-        if (!CHECK_SUCCESS(status)) {
-            mm_pma_free_frame(allocated_pfn, 1);
-            goto has_error;
-        }
-    }
-
-    return (void *)(allocated_vpn * PAGE_SIZE);
-
-has_error:
-    /* allocation failed. rollback changes */
-    for (size_t i = 0; i < allocated_count; i++) {
-        /* read vpn-pfn mapping to know which frames to free */
-        status = mm_vpn_to_pfn(allocated_vpn + i, &allocated_pfn);
-        if (!CHECK_SUCCESS(status)) continue;
-
-        /* unmap vpn & free frame*/
-        mm_unmap(allocated_vpn + i, 1);
-        mm_pma_free_frame(allocated_pfn, 1);
-    }
-
-    if (allocated_vpn != (vpn_t)-1) {
+    status = mm_reserve(allocated_vpn, page_count, PMF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) {
         mm_vma_free_page(allocated_vpn, page_count);
+        return NULL;
     }
 
-    return NULL;
+    return (void *)(allocated_vpn * PAGE_SIZE);
 }
 
 int liballoc_free(void *vaddr, int page_count)
 {
-    status_t status;
     vpn_t vpn = (uintptr_t)vaddr / PAGE_SIZE;
-    pfn_t pfn;
 
-    for (size_t i = 0; i < page_count; i++) {
-        status = mm_vpn_to_pfn(vpn + i, &pfn);
-        if (!CHECK_SUCCESS(status)) {
-            panic(STATUS_CONFLICTING_STATE, "tried to free unmapped page");
-        }
-
-        mm_unmap(vpn + i, 1);
-        mm_pma_free_frame(pfn, 1);
-    }
+    mm_free_pages(vpn, page_count);
+    mm_vma_free_page(vpn, page_count);
 
     return 0;
 }
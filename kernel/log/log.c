@@ -5,6 +5,7 @@
 #include <emos/asm/io.h>
 
 #include <emos/status.h>
+#include <emos/clock.h>
 
 #ifdef NDEBUG
 static int log_level = LL_NONE;
@@ -53,11 +54,19 @@ static const char *ll_str[] = {
     "FATAL", "ERROR", "WARN", "INFO", "DEBUG", "TRACE",
 };
 
+/* seconds since boot, down to the microsecond */
+static void print_prefix(int level, const char *module_name)
+{
+    uint64_t now = clock_get_monotonic_ns();
+
+    cprintf(log_print_func, log_print_state, "[%5llu.%06llu] %s [%s] ", now / NS_PER_SEC, now % NS_PER_SEC / 1000, module_name, ll_str[level]);
+}
+
 void log_vprintf(int level, const char *module_name, const char *fmt, va_list args)
 {
     if (log_level < level) return;
 
-    cprintf(log_print_func, log_print_state, "%s [%s] ", module_name, ll_str[level]);
+    print_prefix(level, module_name);
     vcprintf(log_print_func, log_print_state, fmt, args);
 }
 
@@ -65,6 +74,6 @@ void log_isr_vprintf(int level, const char *module_name, const char *fmt, va_lis
 {
     if (log_level < level) return;
     
-    cprintf(log_print_func, log_print_state, "%s [%s] ", module_name, ll_str[level]);
+    print_prefix(level, module_name);
     vcprintf(log_print_func, log_print_state, fmt, args);
 }
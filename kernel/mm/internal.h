@@ -0,0 +1,55 @@
+#ifndef __MM_INTERNAL_H__
+#define __MM_INTERNAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <emos/asm/page.h>
+
+#include <emos/mm.h>
+
+#define PAGE_TABLE_BASE             0xFFC00000
+#define PAGE_TABLE_ENTRY_COUNT      1024
+
+#define KERNEL_PDI_BASE             0x300   /* page directory entries from here are shared by every address space */
+#define RECURSIVE_PDI               0x3FF
+
+/* software bits of a page table entry */
+#define PTE_DEMAND_ZERO             0x00000200  /* non-present: back with a zeroed frame on first access */
+#define PTE_COPY_ON_WRITE           0x00000400  /* read-only: copy the shared frame on the first write */
+#define PTE_UNMANAGED               0x00000800  /* frame not owned by the address space, never released with it */
+
+#define SCRATCH_FAULT               0
+#define SCRATCH_TABLE               1
+#define SCRATCH_COPY                2
+#define SCRATCH_ZERO                3
+#define SCRATCH_SLOT_COUNT          4   /* per processor */
+
+extern struct page_dir_recursive *_pc_page_dir;
+
+extern size_t mm_reserved_page_count;
+
+static inline union page_table_entry *get_page_table(size_t pdi)
+{
+    return (void *)(PAGE_TABLE_BASE + pdi * PAGE_SIZE);
+}
+
+/* nests inside the heap and vma locks, and outside the pma and address space list locks */
+void mm_lock_page_tables(uint32_t *irqstate);
+void mm_unlock_page_tables(uint32_t irqstate);
+
+/* flushes the range on every processor */
+void mm_invalidate_range(vpn_t vpn, size_t page_count);
+
+status_t mm_split_large_page(size_t pdi);
+
+/* use with interrupts disabled, the slots belong to the processor */
+status_t mm_map_scratch(int slot, pfn_t pfn, void **ptr);
+void mm_unmap_scratch(int slot);
+
+void mm_zero_frame(pfn_t pfn);
+void mm_zero_pool_wake(void);
+
+void mm_space_sync_kernel_pde(size_t pdi);
+
+#endif // __MM_INTERNAL_H__
@@ -9,34 +9,107 @@
 #include <emos/asm/instruction.h>
 #include <emos/asm/intrinsics/register.h>
 #include <emos/asm/intrinsics/invlpg.h>
+#include <emos/asm/intrinsics/cpuid.h>
+#include <emos/asm/interrupt.h>
 
 #include <emos/macros.h>
+#include <emos/spinlock.h>
+#include <emos/smp.h>
 #include <emos/panic.h>
 #include <emos/log.h>
 
+#include "internal.h"
+
 #define MODULE_NAME "mm"
 
 struct page_dir_recursive *_pc_page_dir;
 
+static int pse_enabled = 0;
+static int demand_paging_enabled = 0;
+
+static size_t demand_zero_fault_count = 0;
+static size_t copy_on_write_fault_count = 0;
+static size_t copied_page_count = 0;
+
+size_t mm_reserved_page_count = 0;
+
+static vpn_t scratch_base_vpn = 0;
+
+/* guards the page tables of every address space, taken with interrupts disabled */
+static struct spinlock mm_lock;
+
+static status_t create_page_table(size_t pdi);
+
+/* the scratch page tables are made up front, so that mapping a scratch page never allocates */
+static status_t init_scratch(void)
+{
+    status_t status;
+    vpn_t vpn;
+    size_t pdi;
+
+    /* each processor has slots of its own */
+    status = mm_vma_allocate_page(SCRATCH_SLOT_COUNT * SMP_MAX_CPU_COUNT, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    for (int slot = 0; slot < SCRATCH_SLOT_COUNT * SMP_MAX_CPU_COUNT; slot++) {
+        pdi = (vpn + slot) / PAGE_TABLE_ENTRY_COUNT;
+        if (_pc_page_dir->pde[pdi].dir.p) continue;
+
+        status = create_page_table(pdi);
+        if (!CHECK_SUCCESS(status)) return status;
+    }
+
+    scratch_base_vpn = vpn;
+
+    return STATUS_SUCCESS;
+}
+
 status_t mm_init(void)
 {
     uint32_t cr0;
+    uint32_t eax, ebx, ecx, edx;
 
     LOG_DEBUG("setting up registers...\n");
     cr0 = _i686_read_cr0();
     cr0 |= CR0_PG;
+    cr0 |= CR0_WP;  /* make kernel writes fault on read-only pages too, for copy-on-write */
     _i686_write_cr0(cr0);
 
     _pc_page_dir = (void *)0xFFFFF000;
 
-    return STATUS_SUCCESS;
+    spinlock_init(&mm_lock);
+
+    if (_i686_cpuid_max_request() >= CPUID_GET_FEATURES) {
+        _i686_cpuid(CPUID_GET_FEATURES, &eax, &ebx, &ecx, &edx);
+
+        if (edx & CPUID_FEATURE_EDX_PSE) {
+            LOG_DEBUG("enabling 4MiB pages...\n");
+            _i686_write_cr4(_i686_read_cr4() | CR4_PSE);
+            pse_enabled = 1;
+        }
+    }
+
+    return init_scratch();
+}
+
+static pfn_t large_page_pfn(union page_dir_entry pde)
+{
+    return ((pfn_t)pde.pse.base_high << 20) | ((pfn_t)pde.pse.base_low << 10);
 }
 
 status_t mm_vpn_to_pfn(vpn_t vpn, pfn_t *pfn)
 {
     union page_table_entry *pt = (void *)(0xFFC00000 + ((vpn & 0x000FFC00) << 2));
+    union page_dir_entry pde = _pc_page_dir->pde[(vpn & 0x000FFC00) >> 10];
+
+    if (!pde.dir.p) return STATUS_PAGE_NOT_PRESENT;
+
+    if (pde.dir.ps) {
+        if (pfn) *pfn = large_page_pfn(pde) + (vpn & 0x000003FF);
+
+        return STATUS_SUCCESS;
+    }
 
-    if (!_pc_page_dir->pde[(vpn & 0x000FFC00) >> 10].dir.p) return STATUS_PAGE_NOT_PRESENT;
     if (!pt[vpn & 0x000003FF].p) return STATUS_PAGE_NOT_PRESENT;
 
     if (pfn) *pfn = pt[vpn & 0x000003FF].base;
@@ -57,7 +130,20 @@ status_t mm_vaddr_to_paddr(void *vaddr, uintptr_t *paddr)
     return STATUS_SUCCESS;
 }
 
-static void invalidate_page(vpn_t vpn)
+void mm_lock_page_tables(uint32_t *irqstate)
+{
+    spinlock_lock_irqsave(&mm_lock, irqstate);
+}
+
+void mm_unlock_page_tables(uint32_t irqstate)
+{
+    spinlock_unlock_irqrestore(&mm_lock, irqstate);
+}
+
+/* above this many pages, reloading CR3 is cheaper than invalidating each page */
+#define INVLPG_THRESHOLD            32
+
+static void invalidate_local_page(vpn_t vpn)
 {
     if (!_pc_invlpg_undefined) {
         _i686_invlpg((void *)(vpn * PAGE_SIZE));
@@ -66,55 +152,252 @@ static void invalidate_page(vpn_t vpn)
     }
 }
 
-static status_t map(pfn_t pfn, vpn_t vpn, uint32_t flags)
+void mm_flush_tlb_local(vpn_t vpn, size_t page_count)
+{
+    if (_pc_invlpg_undefined || page_count > INVLPG_THRESHOLD) {
+        _i686_write_cr3(_i686_read_cr3());
+        return;
+    }
+
+    for (size_t i = 0; i < page_count; i++) {
+        _i686_invlpg((void *)((vpn + i) * PAGE_SIZE));
+    }
+}
+
+/*
+ * Entries that were not present are never cached, so filling them in only needs the local flush.
+ * Anything that was present may be cached by other processors as well.
+ */
+static void invalidate_page(vpn_t vpn)
+{
+    invalidate_local_page(vpn);
+    smp_flush_tlb(vpn, 1);
+}
+
+void mm_invalidate_range(vpn_t vpn, size_t page_count)
+{
+    mm_flush_tlb_local(vpn, page_count);
+    smp_flush_tlb(vpn, page_count);
+}
+
+static void set_page_dir_entry(size_t pdi, uint32_t raw)
+{
+    _pc_page_dir->pde[pdi].raw = raw;
+
+    /* the kernel half has to look the same in every address space */
+    if (pdi >= KERNEL_PDI_BASE) {
+        mm_space_sync_kernel_pde(pdi);
+    }
+}
+
+static status_t create_page_table(size_t pdi)
 {
     status_t status;
-    union page_table_entry *pt = (void *)(0xFFC00000 + ((vpn & 0x000FFC00) << 2));
+    union page_table_entry *pt = get_page_table(pdi);
     pfn_t new_pt_pfn;
+    uint32_t alloc_flags;
 
-    if (!_pc_page_dir->pde[(vpn & 0x000FFC00) >> 10].dir.p) {
-        // create a new page table
-        status = mm_pma_allocate_frame(1, &new_pt_pfn, PAF_DEFAULT);
-        if (!CHECK_SUCCESS(status)) return status;
+    /* frames can only be zeroed through the scratch pages once their own page tables exist */
+    alloc_flags = scratch_base_vpn ? PAF_ZERO : PAF_DEFAULT;
+
+    status = mm_pma_allocate_frame(1, &new_pt_pfn, alloc_flags);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    set_page_dir_entry(pdi, 0x00000003 | (new_pt_pfn << 12));
 
-        _pc_page_dir->pde[(vpn & 0x000FFC00) >> 10].raw = 0x00000003 | (new_pt_pfn << 12);
+    invalidate_local_page((uintptr_t)pt >> 12);
 
-        invalidate_page((uintptr_t)pt >> 12);
-        
-        for (int i = 0; i < 1024; i++) {
+    if (!(alloc_flags & PAF_ZERO)) {
+        for (int i = 0; i < PAGE_TABLE_ENTRY_COUNT; i++) {
             pt[i].raw = 0x00000000;
         }
     }
 
-    if (pt[vpn & 0x000003FF].p) {
-        return STATUS_CONFLICTING_STATE;
+    return STATUS_SUCCESS;
+}
+
+static void destroy_page_table(size_t pdi)
+{
+    pfn_t pt_pfn = _pc_page_dir->pde[pdi].dir.base;
+
+    set_page_dir_entry(pdi, 0x00000000);
+
+    invalidate_page((uintptr_t)get_page_table(pdi) >> 12);
+
+    mm_pma_free_frame(pt_pfn, 1);
+}
+
+/* replace a 4MiB page by a page table mapping the same frames, called with the page tables locked */
+static status_t split_large_page(size_t pdi)
+{
+    status_t status;
+    union page_table_entry *pt = get_page_table(pdi);
+    union page_dir_entry pde = _pc_page_dir->pde[pdi];
+    pfn_t pt_pfn, base_pfn = large_page_pfn(pde);
+    uint32_t pte;
+
+    /* someone else may have split it while we waited for the lock */
+    if (!pde.dir.p || !pde.dir.ps) return STATUS_SUCCESS;
+
+    status = mm_pma_allocate_frame(1, &pt_pfn, PAF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    /* p, r_w, u_s, pwt and pcd are at the same place; pat moves to bit 7 */
+    pte = (base_pfn << 12) | (pde.raw & 0x0000001F) | (pde.pse.pat ? 0x00000080 : 0);
+
+    set_page_dir_entry(pdi, (pt_pfn << 12) | (pde.raw & 0x00000007));
+
+    invalidate_local_page((uintptr_t)pt >> 12);
+
+    for (int i = 0; i < PAGE_TABLE_ENTRY_COUNT; i++) {
+        pt[i].raw = pte;
+        pte += PAGE_SIZE;
     }
 
-    pt[vpn & 0x000003FF].raw = pfn << 12;
+    /* one page of it drops the whole 4MiB translation */
+    invalidate_page(pdi * PAGE_TABLE_ENTRY_COUNT);
+
+    return STATUS_SUCCESS;
+}
+
+status_t mm_split_large_page(size_t pdi)
+{
+    status_t status;
+    uint32_t irqstate;
+
+    mm_lock_page_tables(&irqstate);
+
+    status = split_large_page(pdi);
+
+    mm_unlock_page_tables(irqstate);
+
+    return status;
+}
+
+static uint32_t make_page_table_entry(pfn_t pfn, uint32_t flags)
+{
+    union page_table_entry pte;
+
+    pte.raw = pfn << 12;
 
     if (!(flags & PMF_READONLY)) {
-        pt[vpn & 0x000003FF].r_w = 1;
+        pte.r_w = 1;
     }
 
     if (flags & PMF_USER) {
-        pt[vpn & 0x000003FF].u_s = 1;
+        pte.u_s = 1;
     }
 
     if ((flags & PMF_NOCACHE) || (flags & PMF_WTCACHE)) {
-        pt[vpn & 0x000003FF].pat = 1;
+        pte.pat = 1;
 
         if (flags & PMF_NOCACHE) {
-            pt[vpn & 0x000003FF].pcd = 1;
+            pte.pcd = 1;
         }
 
         if (flags & PMF_WTCACHE) {
-            pt[vpn & 0x000003FF].pwt = 1;
+            pte.pwt = 1;
         }
     }
 
-    pt[vpn & 0x000003FF].p = 1;
+    pte.p = 1;
 
-    invalidate_page(vpn);
+    return pte.raw;
+}
+
+static uint32_t make_large_page_dir_entry(pfn_t pfn, uint32_t flags)
+{
+    union page_table_entry pte;
+    union page_dir_entry pde;
+
+    /* the flags of a page table entry apply to a 4MiB page as well */
+    pte.raw = make_page_table_entry(0, flags);
+
+    pde.raw = pte.raw & 0x0000001F;
+    pde.pse.ps = 1;
+    pde.pse.pat = pte.pat;
+    pde.pse.base_low = pfn >> 10;
+    pde.pse.base_high = pfn >> 20;
+
+    return pde.raw;
+}
+
+/* a page directory entry is mapped as a whole when the range and frames allow it */
+static int can_map_large(size_t pdi, size_t start, size_t end, pfn_t pfn, uint32_t flags)
+{
+    if (!pse_enabled || !(flags & PMF_LARGE)) return 0;
+    if (start != 0 || end != PAGE_TABLE_ENTRY_COUNT) return 0;
+    if (pfn % PAGE_TABLE_ENTRY_COUNT) return 0;
+
+    return !_pc_page_dir->pde[pdi].dir.p;
+}
+
+/* an entry in use is either mapped or reserved for demand-zero paging */
+static int is_entry_used(union page_table_entry pte)
+{
+    return pte.p || (pte.raw & PTE_DEMAND_ZERO);
+}
+
+static int is_page_used(vpn_t vpn)
+{
+    union page_dir_entry pde = _pc_page_dir->pde[vpn / PAGE_TABLE_ENTRY_COUNT];
+
+    if (!pde.dir.p) return 0;
+    if (pde.dir.ps) return 1;
+
+    return is_entry_used(get_page_table(vpn / PAGE_TABLE_ENTRY_COUNT)[vpn % PAGE_TABLE_ENTRY_COUNT]);
+}
+
+static void destroy_created_page_tables(size_t first_pdi, size_t last_pdi, const uint32_t *created_pts)
+{
+    for (size_t pdi = first_pdi; pdi <= last_pdi; pdi++) {
+        if (created_pts[pdi / 32] & (1UL << (pdi % 32))) {
+            destroy_page_table(pdi);
+        }
+    }
+}
+
+/* check the range for conflicts and allocate all missing page tables in advance */
+static status_t prepare_range(pfn_t pfn, vpn_t vpn, size_t page_count, uint32_t flags, uint32_t *created_pts)
+{
+    status_t status;
+    size_t first_pdi, last_pdi, pdi, start, end;
+    union page_table_entry *pt;
+    pfn_t chunk_pfn;
+
+    first_pdi = vpn / PAGE_TABLE_ENTRY_COUNT;
+    last_pdi = (vpn + page_count - 1) / PAGE_TABLE_ENTRY_COUNT;
+
+    for (pdi = first_pdi; pdi <= last_pdi; pdi++) {
+        if (!_pc_page_dir->pde[pdi].dir.p) continue;
+        if (_pc_page_dir->pde[pdi].dir.ps) return STATUS_CONFLICTING_STATE;
+
+        pt = get_page_table(pdi);
+        start = pdi == first_pdi ? vpn % PAGE_TABLE_ENTRY_COUNT : 0;
+        end = pdi == last_pdi ? (vpn + page_count - 1) % PAGE_TABLE_ENTRY_COUNT + 1 : PAGE_TABLE_ENTRY_COUNT;
+
+        for (size_t i = start; i < end; i++) {
+            if (is_entry_used(pt[i])) return STATUS_CONFLICTING_STATE;
+        }
+    }
+
+    for (pdi = first_pdi; pdi <= last_pdi; pdi++) {
+        if (_pc_page_dir->pde[pdi].dir.p) continue;
+
+        start = pdi == first_pdi ? vpn % PAGE_TABLE_ENTRY_COUNT : 0;
+        end = pdi == last_pdi ? (vpn + page_count - 1) % PAGE_TABLE_ENTRY_COUNT + 1 : PAGE_TABLE_ENTRY_COUNT;
+        chunk_pfn = pfn + (pdi * PAGE_TABLE_ENTRY_COUNT + start - vpn);
+
+        if (can_map_large(pdi, start, end, chunk_pfn, flags)) continue;
+
+        status = create_page_table(pdi);
+        if (!CHECK_SUCCESS(status)) {
+            destroy_created_page_tables(first_pdi, last_pdi, created_pts);
+            return status;
+        }
+
+        created_pts[pdi / 32] |= 1UL << (pdi % 32);
+    }
 
     return STATUS_SUCCESS;
 }
@@ -122,61 +405,393 @@ static status_t map(pfn_t pfn, vpn_t vpn, uint32_t flags)
 status_t mm_map(pfn_t pfn, vpn_t vpn, size_t page_count, uint32_t flags)
 {
     status_t status;
+    uint32_t created_pts[PAGE_TABLE_ENTRY_COUNT / 32] = { 0 };
+    size_t first_pdi, last_pdi, pdi, start, end;
+    union page_table_entry *pt;
+    uint32_t pte, irqstate;
+    pfn_t chunk_pfn;
 
-    for (size_t i = 0; i < page_count; i++) {
-        status = map(pfn + i, vpn + i, flags);
-        if (!CHECK_SUCCESS(status)) return status;
+    if (page_count == 0 || vpn + page_count - 1 < vpn) return STATUS_INVALID_VALUE;
+
+    mm_lock_page_tables(&irqstate);
+
+    status = prepare_range(pfn, vpn, page_count, flags, created_pts);
+    if (!CHECK_SUCCESS(status)) {
+        mm_unlock_page_tables(irqstate);
+        return status;
+    }
+
+    first_pdi = vpn / PAGE_TABLE_ENTRY_COUNT;
+    last_pdi = (vpn + page_count - 1) / PAGE_TABLE_ENTRY_COUNT;
+
+    /* nothing can fail from here */
+    for (pdi = first_pdi; pdi <= last_pdi; pdi++) {
+        pt = get_page_table(pdi);
+        start = pdi == first_pdi ? vpn % PAGE_TABLE_ENTRY_COUNT : 0;
+        end = pdi == last_pdi ? (vpn + page_count - 1) % PAGE_TABLE_ENTRY_COUNT + 1 : PAGE_TABLE_ENTRY_COUNT;
+        chunk_pfn = pfn + (pdi * PAGE_TABLE_ENTRY_COUNT + start - vpn);
+
+        if (can_map_large(pdi, start, end, chunk_pfn, flags)) {
+            set_page_dir_entry(pdi, make_large_page_dir_entry(chunk_pfn, flags));
+            continue;
+        }
+
+        pte = make_page_table_entry(chunk_pfn, flags);
+        for (size_t i = start; i < end; i++) {
+            pt[i].raw = pte;
+            pte += PAGE_SIZE;
+        }
     }
 
-    // TODO: rollback if failed
+    mm_flush_tlb_local(vpn, page_count);
+
+    mm_unlock_page_tables(irqstate);
 
     LOG_TRACE("mapped page %lu-%lu to frame %lu-%lu\n", vpn, vpn + page_count - 1, pfn, pfn + page_count - 1);
 
     return STATUS_SUCCESS;
 }
 
-static void unmap(vpn_t vpn)
+status_t mm_unmap(vpn_t vpn, size_t page_count)
 {
-    union page_table_entry *pt = (void *)(0xFFC00000 + ((vpn & 0x000FFC00) << 2));
+    status_t status;
+    size_t first_pdi, last_pdi, pdi, start, end;
+    union page_table_entry *pt;
+    uint32_t irqstate;
+    int unmapped = 0;
+
+    if (page_count == 0) return STATUS_SUCCESS;
+    if (vpn + page_count - 1 < vpn) return STATUS_INVALID_VALUE;
+
+    LOG_TRACE("unmapping page %lu-%lu\n", vpn, vpn + page_count - 1);
+
+    first_pdi = vpn / PAGE_TABLE_ENTRY_COUNT;
+    last_pdi = (vpn + page_count - 1) / PAGE_TABLE_ENTRY_COUNT;
+
+    mm_lock_page_tables(&irqstate);
+
+    for (pdi = first_pdi; pdi <= last_pdi; pdi++) {
+        if (!_pc_page_dir->pde[pdi].dir.p) continue;
+
+        pt = get_page_table(pdi);
+        start = pdi == first_pdi ? vpn % PAGE_TABLE_ENTRY_COUNT : 0;
+        end = pdi == last_pdi ? (vpn + page_count - 1) % PAGE_TABLE_ENTRY_COUNT + 1 : PAGE_TABLE_ENTRY_COUNT;
+
+        if (_pc_page_dir->pde[pdi].dir.ps) {
+            if (start == 0 && end == PAGE_TABLE_ENTRY_COUNT) {
+                set_page_dir_entry(pdi, 0x00000000);
+                unmapped = 1;
+                continue;
+            }
+
+            status = split_large_page(pdi);
+            if (!CHECK_SUCCESS(status)) {
+                if (unmapped) {
+                    mm_invalidate_range(vpn, page_count);
+                }
+                mm_unlock_page_tables(irqstate);
+                return status;
+            }
+        }
 
-    if (!_pc_page_dir->pde[(vpn & 0x000FFC00) >> 10].dir.p) return;
-    if (!pt[vpn & 0x000003FF].p) return;
+        for (size_t i = start; i < end; i++) {
+            if (!is_entry_used(pt[i])) continue;
 
-    pt[vpn & 0x000003FF].raw = 0;
+            if (pt[i].p) {
+                unmapped = 1;
+            } else {
+                mm_reserved_page_count--;
+            }
+
+            pt[i].raw = 0;
+        }
+    }
+
+    if (unmapped) {
+        mm_invalidate_range(vpn, page_count);
+    }
+
+    mm_unlock_page_tables(irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+/* back the range right away, used until page faults can be served */
+static status_t commit_range(vpn_t vpn, size_t page_count, uint32_t flags)
+{
+    status_t status;
+    pfn_t pfn;
+    size_t mapped_count = 0;
+
+    /* try a contiguous run first, so that it is mapped at once */
+    status = mm_pma_allocate_frame(page_count, &pfn, PAF_DEFAULT);
+    if (CHECK_SUCCESS(status)) {
+        status = mm_map(pfn, vpn, page_count, flags);
+        if (!CHECK_SUCCESS(status)) {
+            mm_pma_free_frame(pfn, page_count);
+            return status;
+        }
+
+        memset((void *)(vpn * PAGE_SIZE), 0, page_count * PAGE_SIZE);
+
+        return STATUS_SUCCESS;
+    }
+
+    for (; mapped_count < page_count; mapped_count++) {
+        status = mm_pma_allocate_frame(1, &pfn, PAF_ZERO);
+        if (!CHECK_SUCCESS(status)) goto has_error;
+
+        status = mm_map(pfn, vpn + mapped_count, 1, flags);
+        if (!CHECK_SUCCESS(status)) {
+            mm_pma_free_frame(pfn, 1);
+            goto has_error;
+        }
+    }
+
+    return STATUS_SUCCESS;
+
+has_error:
+    mm_free_pages(vpn, mapped_count);
+
+    return status;
+}
+
+status_t mm_reserve(vpn_t vpn, size_t page_count, uint32_t flags)
+{
+    status_t status;
+    uint32_t created_pts[PAGE_TABLE_ENTRY_COUNT / 32] = { 0 };
+    size_t first_pdi, last_pdi, pdi, start, end;
+    union page_table_entry *pt;
+    uint32_t pte, irqstate;
+
+    if (page_count == 0 || vpn + page_count - 1 < vpn) return STATUS_INVALID_VALUE;
+
+    /* reserved pages are backed one by one, never by 4MiB pages */
+    flags &= ~PMF_LARGE;
+
+    if (!demand_paging_enabled) return commit_range(vpn, page_count, flags);
+
+    mm_lock_page_tables(&irqstate);
+
+    status = prepare_range(0, vpn, page_count, flags, created_pts);
+    if (!CHECK_SUCCESS(status)) {
+        mm_unlock_page_tables(irqstate);
+        return status;
+    }
+
+    first_pdi = vpn / PAGE_TABLE_ENTRY_COUNT;
+    last_pdi = (vpn + page_count - 1) / PAGE_TABLE_ENTRY_COUNT;
+
+    /* keep the access bits of the future mapping in the non-present entry */
+    pte = (make_page_table_entry(0, flags) & ~0x00000001) | PTE_DEMAND_ZERO;
+
+    for (pdi = first_pdi; pdi <= last_pdi; pdi++) {
+        pt = get_page_table(pdi);
+        start = pdi == first_pdi ? vpn % PAGE_TABLE_ENTRY_COUNT : 0;
+        end = pdi == last_pdi ? (vpn + page_count - 1) % PAGE_TABLE_ENTRY_COUNT + 1 : PAGE_TABLE_ENTRY_COUNT;
+
+        for (size_t i = start; i < end; i++) {
+            pt[i].raw = pte;
+        }
+    }
+
+    mm_reserved_page_count += page_count;
+
+    mm_unlock_page_tables(irqstate);
+
+    LOG_TRACE("reserved page %lu-%lu\n", vpn, vpn + page_count - 1);
+
+    return STATUS_SUCCESS;
+}
+
+void mm_enable_demand_paging(void)
+{
+    demand_paging_enabled = 1;
+}
+
+static vpn_t get_scratch_vpn(int slot)
+{
+    return scratch_base_vpn + smp_get_cpu_index() * SCRATCH_SLOT_COUNT + slot;
+}
+
+/* no other processor ever touches the slot, so the entry is written without the lock and flushed locally */
+status_t mm_map_scratch(int slot, pfn_t pfn, void **ptr)
+{
+    vpn_t vpn;
+
+    if (slot < 0 || slot >= SCRATCH_SLOT_COUNT) return STATUS_INVALID_VALUE;
+    if (!scratch_base_vpn) return STATUS_CONFLICTING_STATE;
+
+    vpn = get_scratch_vpn(slot);
+
+    get_page_table(vpn / PAGE_TABLE_ENTRY_COUNT)[vpn % PAGE_TABLE_ENTRY_COUNT].raw = make_page_table_entry(pfn, PMF_DEFAULT);
+    invalidate_local_page(vpn);
+
+    *ptr = (void *)(vpn * PAGE_SIZE);
+
+    return STATUS_SUCCESS;
+}
+
+void mm_unmap_scratch(int slot)
+{
+    vpn_t vpn = get_scratch_vpn(slot);
+
+    get_page_table(vpn / PAGE_TABLE_ENTRY_COUNT)[vpn % PAGE_TABLE_ENTRY_COUNT].raw = 0;
+    invalidate_local_page(vpn);
+}
+
+void mm_zero_frame(pfn_t pfn)
+{
+    status_t status;
+    uint32_t irqstate;
+    void *ptr;
+
+    /* the zeroing slot is shared by every context on the processor, so hold it with interrupts off */
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    status = mm_map_scratch(SCRATCH_ZERO, pfn, &ptr);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to map frame %lu for zeroing", pfn);
+    }
+
+    memset(ptr, 0, PAGE_SIZE);
+    mm_unmap_scratch(SCRATCH_ZERO);
+
+    interrupt_restore(irqstate);
+}
+
+static status_t handle_demand_zero_fault(vpn_t vpn, union page_table_entry *entry)
+{
+    status_t status;
+    union page_table_entry pte = *entry;
+    pfn_t pfn;
+
+    status = mm_pma_allocate_frame(1, &pfn, PAF_ZERO);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    pte.raw &= ~PTE_DEMAND_ZERO;
+    pte.base = pfn;
+    pte.p = 1;
+    *entry = pte;
+
+    invalidate_local_page(vpn);
+
+    mm_reserved_page_count--;
+    demand_zero_fault_count++;
+
+    return STATUS_SUCCESS;
+}
+
+static status_t handle_copy_on_write_fault(vpn_t vpn, union page_table_entry *entry)
+{
+    status_t status;
+    union page_table_entry pte = *entry;
+    pfn_t pfn;
+    size_t refcount;
+    void *copy;
+
+    status = mm_pma_get_frame_refcount(pte.base, &refcount);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    /* the last one sharing the frame just takes it over */
+    if (refcount > 1) {
+        status = mm_pma_allocate_frame(1, &pfn, PAF_DEFAULT);
+        if (!CHECK_SUCCESS(status)) return status;
+
+        status = mm_map_scratch(SCRATCH_FAULT, pfn, &copy);
+        if (!CHECK_SUCCESS(status)) {
+            mm_pma_free_frame(pfn, 1);
+            return status;
+        }
+
+        memcpy(copy, (void *)(vpn * PAGE_SIZE), PAGE_SIZE);
+        mm_unmap_scratch(SCRATCH_FAULT);
+
+        mm_pma_free_frame(pte.base, 1);
+        pte.base = pfn;
+
+        copied_page_count++;
+    }
+
+    pte.raw &= ~PTE_COPY_ON_WRITE;
+    pte.r_w = 1;
+    *entry = pte;
 
     invalidate_page(vpn);
+
+    copy_on_write_fault_count++;
+
+    return STATUS_SUCCESS;
 }
 
-status_t mm_unmap(vpn_t vpn, size_t page_count)
+static status_t handle_page_fault(vpn_t vpn, union page_table_entry *entry, uint32_t fault_flags)
 {
-    LOG_TRACE("unmapping page %lu-%lu\n", vpn, vpn + page_count - 1);
+    /* another processor may have served the same page while we waited for the lock */
+    if (entry->p && (!(fault_flags & PFF_USER) || entry->u_s) && (!(fault_flags & PFF_WRITE) || entry->r_w)) {
+        invalidate_local_page(vpn);
+        return STATUS_SUCCESS;
+    }
 
-    for (size_t i = 0; i < page_count; i++) {
-        unmap(vpn + i);
+    if (!(fault_flags & PFF_PRESENT)) {
+        if (entry->p || !(entry->raw & PTE_DEMAND_ZERO)) return STATUS_PAGE_NOT_PRESENT;
+
+        return handle_demand_zero_fault(vpn, entry);
+    }
+
+    if ((fault_flags & PFF_WRITE) && entry->p && (entry->raw & PTE_COPY_ON_WRITE)) {
+        return handle_copy_on_write_fault(vpn, entry);
     }
 
+    return STATUS_CONFLICTING_STATE;
+}
+
+status_t mm_handle_page_fault(uintptr_t vaddr, uint32_t fault_flags)
+{
+    status_t status;
+    vpn_t vpn = vaddr / PAGE_SIZE;
+    size_t pdi = vpn / PAGE_TABLE_ENTRY_COUNT;
+    union page_table_entry *entry = &get_page_table(pdi)[vpn % PAGE_TABLE_ENTRY_COUNT];
+    uint32_t irqstate;
+
+    mm_lock_page_tables(&irqstate);
+
+    if (!_pc_page_dir->pde[pdi].dir.p || _pc_page_dir->pde[pdi].dir.ps) {
+        mm_unlock_page_tables(irqstate);
+        return STATUS_PAGE_NOT_PRESENT;
+    }
+
+    status = handle_page_fault(vpn, entry, fault_flags);
+
+    mm_unlock_page_tables(irqstate);
+
+    return status;
+}
+
+status_t mm_get_fault_stat(struct mm_fault_stat *stat)
+{
+    if (!stat) return STATUS_INVALID_VALUE;
+
+    stat->demand_zero_fault_count = demand_zero_fault_count;
+    stat->reserved_page_count = mm_reserved_page_count;
+    stat->copy_on_write_fault_count = copy_on_write_fault_count;
+    stat->copied_page_count = copied_page_count;
+
     return STATUS_SUCCESS;
 }
 
 status_t mm_allocate_pages(size_t page_count, vpn_t *vpn)
 {
     status_t status;
-    pfn_t allocated_pfn;
     vpn_t allocated_vpn;
 
     status = mm_vma_allocate_page(page_count, &allocated_vpn, VAF_DEFAULT);
-    
-    for (size_t i = 0; i < page_count; i++) {
-        status = mm_vpn_to_pfn(allocated_vpn + i, NULL);
-        if (!CHECK_SUCCESS(status) && status != STATUS_PAGE_NOT_PRESENT) return status;
-
-        if (status == STATUS_PAGE_NOT_PRESENT) {
-            status = mm_pma_allocate_frame(1, &allocated_pfn, PAF_DEFAULT);
-            if (!CHECK_SUCCESS(status)) return status;
+    if (!CHECK_SUCCESS(status)) return status;
 
-            status = mm_map(allocated_pfn, allocated_vpn + i, 1, PMF_DEFAULT);
-            if (!CHECK_SUCCESS(status)) return status;
-        }
+    status = mm_reserve(allocated_vpn, page_count, PMF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(allocated_vpn, page_count);
+        return status;
     }
 
     if (vpn) *vpn = allocated_vpn;
@@ -187,36 +802,81 @@ status_t mm_allocate_pages(size_t page_count, vpn_t *vpn)
 status_t mm_allocate_pages_to(vpn_t vpn, size_t page_count)
 {
     status_t status;
-    pfn_t allocated_pfn;
+    size_t run_start = 0;
 
-    for (size_t i = 0; i < page_count; i++) {
-        status = mm_vpn_to_pfn(vpn + i, NULL);
-        if (!CHECK_SUCCESS(status) && status != STATUS_PAGE_NOT_PRESENT) return status;
+    /* reserve every run of pages that are neither mapped nor reserved yet */
+    for (size_t i = 0; i <= page_count; i++) {
+        if (i < page_count && !is_page_used(vpn + i)) continue;
 
-        if (status == STATUS_PAGE_NOT_PRESENT) {
-            status = mm_pma_allocate_frame(1, &allocated_pfn, PAF_DEFAULT);
-            if (!CHECK_SUCCESS(status)) return status;
-
-            status = mm_map(allocated_pfn, vpn + i, 1, PMF_DEFAULT);
+        if (i > run_start) {
+            status = mm_reserve(vpn + run_start, i - run_start, PMF_DEFAULT);
             if (!CHECK_SUCCESS(status)) return status;
         }
+
+        run_start = i + 1;
     }
-    
+
     return STATUS_SUCCESS;
 }
 
 void mm_free_pages(vpn_t vpn, size_t page_count)
 {
     status_t status;
-    pfn_t pfn;
+    pfn_t pfn, next_pfn;
+    size_t run_start = 0, run_length = 0;
 
-    for (size_t i = 0; i < page_count; i++) {
-        status = mm_vpn_to_pfn(vpn + i, &pfn);
-        if (!CHECK_SUCCESS(status)) continue;
-    
-        status = mm_unmap(vpn + i, 1);
-        if (!CHECK_SUCCESS(status)) continue;
-    
-        mm_pma_free_frame(pfn, 1);
+    /* unmap and free physically contiguous runs at once */
+    for (size_t i = 0; i <= page_count; i++) {
+        status = i < page_count ? mm_vpn_to_pfn(vpn + i, &next_pfn) : STATUS_PAGE_NOT_PRESENT;
+
+        if (CHECK_SUCCESS(status) && run_length > 0 && next_pfn == pfn + run_length) {
+            run_length++;
+            continue;
+        }
+
+        if (run_length > 0) {
+            mm_unmap(vpn + run_start, run_length);
+            mm_pma_free_frame(pfn, run_length);
+            run_length = 0;
+        }
+
+        if (CHECK_SUCCESS(status)) {
+            run_start = i;
+            run_length = 1;
+            pfn = next_pfn;
+        }
+    }
+
+    /* drop reservations that were never touched */
+    mm_unmap(vpn, page_count);
+}
+
+status_t mm_map_physical(pfn_t pfn, size_t page_count, uint32_t flags, vpn_t *vpn)
+{
+    status_t status;
+    vpn_t base_vpn;
+    size_t offset = pfn % PAGE_TABLE_ENTRY_COUNT;
+
+    /* give the pages the same position within a 4MiB page as the frames,
+     * so that every directory entry the range covers maps as one large page */
+    status = mm_vma_allocate_page(page_count + offset, &base_vpn, VAF_KERNEL | VAF_LARGE);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_map(pfn, base_vpn + offset, page_count, flags | PMF_LARGE);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(base_vpn, page_count + offset);
+        return status;
     }
+
+    *vpn = base_vpn + offset;
+
+    return STATUS_SUCCESS;
+}
+
+void mm_unmap_physical(vpn_t vpn, size_t page_count)
+{
+    size_t offset = vpn % PAGE_TABLE_ENTRY_COUNT;
+
+    mm_unmap(vpn, page_count);
+    mm_vma_free_page(vpn - offset, page_count + offset);
 }
@@ -9,59 +9,254 @@
 #include <emos/asm/instruction.h>
 #include <emos/asm/intrinsics/register.h>
 #include <emos/asm/intrinsics/invlpg.h>
+#include <emos/asm/interrupt.h>
 
 #include <emos/macros.h>
+#include <emos/spinlock.h>
 #include <emos/panic.h>
 #include <emos/log.h>
 
+#include "internal.h"
+
 #define MODULE_NAME "pma"
 
-extern int __end;
+#define PFS_FREE            0
+#define PFS_ALLOCATED       1
+#define PFS_RESERVED        2
+#define PFS_ZEROED          3   /* free, zeroed and kept in the zero pool */
+
+/* largest buddy block is 2^PMA_MAX_ORDER frames (4MiB) */
+#define PMA_MAX_ORDER       10
+#define PMA_ORDER_NONE      0xFF
+
+#define PFN_NONE            ((pfn_t)-1)
+
+/* frames below 1MiB are the PRECIOUS conventional memory, we never manage them */
+#define PMA_LOWEST_PFN      0x00000100
+#define PMA_HIGHEST_PFN     0x000FFFFF
+
+/* zone boundaries, buddy blocks never cross them */
+#define PMA_DMA32_BASE_PFN  0x00001000
+#define PMA_NORMAL_BASE_PFN 0x00100000
 
-#define PBM_FREE            0
-#define PBM_ALLOCATED       1
-#define PBM_RESERVED        2
+/* frames kept zeroed ahead of time, refilled when the pool drops below the low mark */
+#define PMA_ZERO_POOL_TARGET        256
+#define PMA_ZERO_POOL_LOW           192
 
-#define PBM_GET(idx)        ((pma_bitmap[idx >> 2] >> ((idx & 3) * 2)) & 3)
-#define PBM_SET(idx, val) \
-    do { \
-        pma_bitmap[idx >> 2] &= ~(3 << ((idx & 3) * 2)); \
-        pma_bitmap[idx >> 2] |= val << ((idx & 3) * 2); \
-    } while (0)
+/* frame table lives right below the recursive page directory mapping */
+#define PMA_FRAME_TABLE_BASE        0xFF000000
+#define PMA_FRAME_TABLE_PT_COUNT    3
 
-static pfn_t pma_bitmap_pfn_list[64];
-static size_t pma_bitmap_pfn_count;
+struct pma_frame {
+    pfn_t next;         /* next free block of the same order (valid only on a free block head), or next zeroed frame */
+    pfn_t prev;         /* previous free block of the same order */
+    uint8_t state;
+    uint8_t order;      /* order of the free block if this frame is a free block head */
+    uint16_t refcount;  /* mappings sharing an allocated frame */
+};
 
-static uint8_t *pma_bitmap;
-static size_t pma_bitmap_size;
+struct pma_free_area {
+    pfn_t first;
+    size_t count;
+};
+
+struct pma_zone {
+    const char *name;
+    pfn_t base_pfn, limit_pfn;
+    struct pma_free_area free_areas[PMA_MAX_ORDER + 1];
+    size_t available_frames, free_frames;
+};
+
+static struct pma_frame *pma_frame_table;
+static size_t pma_frame_table_page_count;
 static size_t pma_frame_desc_count;
 static size_t pma_available_frames, pma_free_frames;
 static pfn_t pma_base_pfn, pma_limit_pfn;
 
-static union page_table_entry pma_bitmap_page_table[1024] __aligned(PAGE_SIZE);
+/* innermost of the memory management locks, frames are never zeroed with it held */
+static struct spinlock pma_lock;
+
+/* zeroed frames stay counted as free, they only left the buddy lists */
+static pfn_t pma_zero_pool_first = PFN_NONE;
+static size_t pma_zero_pool_count = 0;
+static size_t pma_zero_pool_hit_count = 0;
+static size_t pma_zero_pool_miss_count = 0;
+static size_t pma_zero_pool_fill_count = 0;
 
-static status_t pma_allocate_bitmap_frame(pfn_t base_pfn, pfn_t limit_pfn, struct bootinfo_entry_unavailable_frames *ufent)
+static struct pma_zone pma_zones[PZ_COUNT] = {
+    [PZ_DMA] = { .name = "dma", .base_pfn = 0, .limit_pfn = PMA_DMA32_BASE_PFN - 1 },
+    [PZ_DMA32] = { .name = "dma32", .base_pfn = PMA_DMA32_BASE_PFN, .limit_pfn = PMA_NORMAL_BASE_PFN - 1 },
+    [PZ_NORMAL] = { .name = "normal", .base_pfn = PMA_NORMAL_BASE_PFN, .limit_pfn = PFN_NONE },
+};
+
+static union page_table_entry pma_frame_table_page_tables[PMA_FRAME_TABLE_PT_COUNT][1024] __aligned(PAGE_SIZE);
+
+#define PMA_FRAME(pfn) (&pma_frame_table[(pfn) - pma_base_pfn])
+
+static struct pma_zone *pma_get_zone(pfn_t pfn)
 {
-    for (uint32_t i = 0; i < ufent->entry_count; i++) {
-        if (ufent->entries[i].pfn < base_pfn) continue;
-        if (base_pfn > limit_pfn) break;
-        if (pma_bitmap_pfn_count >= ALIGN_DIV(pma_bitmap_size, PAGE_SIZE)) break;
-        if (pma_bitmap_pfn_count >= ARRAY_SIZE(pma_bitmap_pfn_list)) break;
-
-        for (pfn_t pfn = base_pfn; pfn < ufent->entries[i].pfn; pfn++) {
-            pma_bitmap_pfn_list[pma_bitmap_pfn_count++] = pfn;
-            if (pma_bitmap_pfn_count >= ALIGN_DIV(pma_bitmap_size, PAGE_SIZE)) break;
-            if (pma_bitmap_pfn_count >= ARRAY_SIZE(pma_bitmap_pfn_list)) break;
+    if (pfn < PMA_DMA32_BASE_PFN) return &pma_zones[PZ_DMA];
+    if (pfn < PMA_NORMAL_BASE_PFN) return &pma_zones[PZ_DMA32];
+
+    return &pma_zones[PZ_NORMAL];
+}
+
+static void pma_free_area_add(pfn_t pfn, int order)
+{
+    struct pma_free_area *area = &pma_get_zone(pfn)->free_areas[order];
+    struct pma_frame *frame = PMA_FRAME(pfn);
+
+    frame->state = PFS_FREE;
+    frame->order = order;
+    frame->prev = PFN_NONE;
+    frame->next = area->first;
+
+    if (area->first != PFN_NONE) {
+        PMA_FRAME(area->first)->prev = pfn;
+    }
+
+    area->first = pfn;
+    area->count++;
+}
+
+static void pma_free_area_remove(pfn_t pfn)
+{
+    struct pma_frame *frame = PMA_FRAME(pfn);
+    struct pma_free_area *area = &pma_get_zone(pfn)->free_areas[frame->order];
+
+    if (frame->prev != PFN_NONE) {
+        PMA_FRAME(frame->prev)->next = frame->next;
+    } else {
+        area->first = frame->next;
+    }
+
+    if (frame->next != PFN_NONE) {
+        PMA_FRAME(frame->next)->prev = frame->prev;
+    }
+
+    area->count--;
+
+    frame->next = PFN_NONE;
+    frame->prev = PFN_NONE;
+    frame->order = PMA_ORDER_NONE;
+}
+
+/* put a block of free frames back, merging it with its buddies as far as possible */
+static void pma_release_block(pfn_t pfn, int order)
+{
+    pfn_t buddy_pfn;
+    struct pma_frame *buddy;
+
+    while (order < PMA_MAX_ORDER) {
+        buddy_pfn = pfn ^ (1 << order);
+        if (buddy_pfn < pma_base_pfn || buddy_pfn + (1 << order) - 1 > pma_limit_pfn) break;
+
+        buddy = PMA_FRAME(buddy_pfn);
+        if (buddy->state != PFS_FREE || buddy->order != order) break;
+
+        pma_free_area_remove(buddy_pfn);
+
+        if (buddy_pfn < pfn) {
+            PMA_FRAME(pfn)->order = PMA_ORDER_NONE;
+            pfn = buddy_pfn;
         }
+        order++;
+    }
+
+    pma_free_area_add(pfn, order);
+}
+
+/* release an arbitrary range of frames already marked as PFS_FREE */
+static void pma_release_range(pfn_t pfn, size_t count)
+{
+    int order;
+
+    while (count > 0) {
+        order = 0;
+        while (order < PMA_MAX_ORDER && !(pfn & (1 << order)) && (2 << order) <= count) {
+            order++;
+        }
+
+        pma_release_block(pfn, order);
 
-        base_pfn = ufent->entries[i].pfn + 1;
+        pfn += 1 << order;
+        count -= 1 << order;
+    }
+}
+
+/* find the free block that contains pfn */
+static status_t pma_find_free_block(pfn_t pfn, pfn_t *head_pfn)
+{
+    pfn_t head;
+    struct pma_frame *frame;
+
+    for (int order = 0; order <= PMA_MAX_ORDER; order++) {
+        head = pfn & ~((pfn_t)(1 << order) - 1);
+        if (head < pma_base_pfn) break;
+
+        frame = PMA_FRAME(head);
+        if (frame->state != PFS_FREE) break;
+        if (frame->order == PMA_ORDER_NONE) continue;
+        if (frame->order < order) break;
+
+        if (head_pfn) *head_pfn = head;
+
+        return STATUS_SUCCESS;
+    }
+
+    return STATUS_ENTRY_NOT_FOUND;
+}
+
+/* take a single free frame out of the free areas, splitting its block */
+static status_t pma_isolate_frame(pfn_t pfn)
+{
+    status_t status;
+    pfn_t head;
+    int order;
+
+    status = pma_find_free_block(pfn, &head);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    order = PMA_FRAME(head)->order;
+    pma_free_area_remove(head);
+
+    while (order > 0) {
+        order--;
+
+        if (pfn >= head + (1 << order)) {
+            pma_free_area_add(head, order);
+            head += 1 << order;
+        } else {
+            pma_free_area_add(head + (1 << order), order);
+        }
     }
 
     return STATUS_SUCCESS;
 }
 
+/* the pool is short and singly linked, so a walk is good enough for the rare frame taken out of the middle */
+static void pma_zero_pool_remove(pfn_t pfn)
+{
+    pfn_t *link = &pma_zero_pool_first;
+
+    while (*link != PFN_NONE) {
+        if (*link == pfn) {
+            *link = PMA_FRAME(pfn)->next;
+            pma_zero_pool_count--;
+            return;
+        }
+
+        link = &PMA_FRAME(*link)->next;
+    }
+}
+
 status_t mm_pma_mark_reserved(pfn_t base_pfn, pfn_t limit_pfn)
 {
+    status_t status;
+    struct pma_frame *frame;
+    struct pma_zone *zone;
+    uint32_t irqstate;
+
     if (base_pfn < pma_base_pfn) {
         base_pfn = pma_base_pfn;
     }
@@ -70,18 +265,39 @@ status_t mm_pma_mark_reserved(pfn_t base_pfn, pfn_t limit_pfn)
         limit_pfn = pma_limit_pfn;
     }
 
-    for (size_t i = base_pfn - pma_base_pfn; i <= limit_pfn - pma_base_pfn; i++) {
-        if (PBM_GET(i) == PBM_RESERVED) continue;
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
+
+    for (pfn_t pfn = base_pfn; pfn <= limit_pfn; pfn++) {
+        frame = PMA_FRAME(pfn);
+        if (frame->state == PFS_RESERVED) continue;
+
+        zone = pma_get_zone(pfn);
 
-        if (PBM_GET(i) == PBM_FREE) {
+        if (frame->state == PFS_FREE) {
+            status = pma_isolate_frame(pfn);
+            if (!CHECK_SUCCESS(status)) {
+                spinlock_unlock_irqrestore(&pma_lock, irqstate);
+                return STATUS_SYSTEM_CORRUPTED;
+            }
+
+            zone->free_frames--;
+            pma_free_frames--;
+        } else if (frame->state == PFS_ZEROED) {
+            /* may also be on its way into the pool, the zero thread checks the state before linking it in */
+            pma_zero_pool_remove(pfn);
+
+            zone->free_frames--;
             pma_free_frames--;
         }
 
+        zone->available_frames--;
         pma_available_frames--;
 
-        PBM_SET(i, PBM_RESERVED);
+        frame->state = PFS_RESERVED;
     }
 
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
     LOG_TRACE("marked frame %lu-%lu to reserved\n", base_pfn, limit_pfn);
 
     return STATUS_SUCCESS;
@@ -89,6 +305,10 @@ status_t mm_pma_mark_reserved(pfn_t base_pfn, pfn_t limit_pfn)
 
 status_t mm_pma_unmark_reserved(pfn_t base_pfn, pfn_t limit_pfn)
 {
+    struct pma_frame *frame;
+    struct pma_zone *zone;
+    uint32_t irqstate;
+
     if (base_pfn < pma_base_pfn) {
         base_pfn = pma_base_pfn;
     }
@@ -97,143 +317,212 @@ status_t mm_pma_unmark_reserved(pfn_t base_pfn, pfn_t limit_pfn)
         limit_pfn = pma_limit_pfn;
     }
 
-    for (size_t i = base_pfn - pma_base_pfn; i <= limit_pfn - pma_base_pfn; i++) {
-        if (PBM_GET(i) != PBM_RESERVED) continue;
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
+
+    for (pfn_t pfn = base_pfn; pfn <= limit_pfn; pfn++) {
+        frame = PMA_FRAME(pfn);
+        if (frame->state != PFS_RESERVED) continue;
 
+        zone = pma_get_zone(pfn);
+        zone->free_frames++;
+        zone->available_frames++;
         pma_free_frames++;
         pma_available_frames++;
 
-        PBM_SET(i, PBM_FREE);
+        frame->state = PFS_FREE;
+        frame->order = PMA_ORDER_NONE;
+        pma_release_block(pfn, 0);
     }
 
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
     LOG_TRACE("unmarked frame %lu-%lu\n", base_pfn, limit_pfn);
 
     return STATUS_SUCCESS;
 }
 
-static status_t pma_bitmap_init(vpn_t pagedir_vpn, struct bootinfo_entry_memory_map *mment, struct bootinfo_entry_unavailable_frames *ufent)
+/* clip a memory map entry to the frames we manage */
+static int pma_clip_entry(struct bootinfo_memory_map_entry *entry, pfn_t *base_pfn, pfn_t *limit_pfn)
+{
+    uint64_t base, limit;
+
+    if (entry->type != BEMT_FREE) return 0;
+
+    base = ALIGN(entry->base, PAGE_SIZE) / PAGE_SIZE;
+    limit = (entry->base + entry->size) / PAGE_SIZE;
+    if (limit <= base) return 0;
+    limit--;
+
+    if (base < PMA_LOWEST_PFN) base = PMA_LOWEST_PFN;
+    if (limit > PMA_HIGHEST_PFN) limit = PMA_HIGHEST_PFN;
+    if (limit < base) return 0;
+
+    *base_pfn = base;
+    *limit_pfn = limit;
+
+    return 1;
+}
+
+static int pma_is_unavailable(struct bootinfo_entry_unavailable_frames *ufent, pfn_t pfn)
+{
+    for (uint32_t i = 0; i < ufent->entry_count; i++) {
+        if (ufent->entries[i].pfn == pfn) return 1;
+    }
+
+    return 0;
+}
+
+static status_t pma_frame_table_init(vpn_t pagedir_vpn, struct bootinfo_entry_memory_map *mment, struct bootinfo_entry_unavailable_frames *ufent)
 {
     status_t status;
-    uintptr_t base_paddr, limit_paddr;
-    pfn_t base_pfn, limit_pfn;
-    pfn_t bitmap_page_table_pfn;
+    pfn_t base_pfn, limit_pfn, entry_base_pfn, entry_limit_pfn;
+    size_t filled_count;
     union page_dir_entry *pd;
-    union page_table_entry *pt;
+    union page_table_entry *pt, *pte;
 
     /* calculate available area that covers free memory from 0x100000 to 0xFFFFFFFF */
-    base_paddr = (uintptr_t)-1;
-    limit_paddr = 0;
+    base_pfn = PFN_NONE;
+    limit_pfn = 0;
     for (uint32_t i = 0; i < mment->entry_count; i++) {
-        if (mment->entries[i].type != BEMT_FREE) continue;
+        if (!pma_clip_entry(&mment->entries[i], &entry_base_pfn, &entry_limit_pfn)) continue;
 
-        if (base_paddr == (uintptr_t)-1) {
-            base_paddr = mment->entries[i].base;
+        if (base_pfn > entry_base_pfn) {
+            base_pfn = entry_base_pfn;
         }
-        if (limit_paddr < mment->entries[i].base + mment->entries[i].size - 1) {
-            limit_paddr = mment->entries[i].base + mment->entries[i].size - 1;
+        if (limit_pfn < entry_limit_pfn) {
+            limit_pfn = entry_limit_pfn;
         }
     }
 
-    base_pfn = base_paddr / PAGE_SIZE;
-    limit_pfn = limit_paddr / PAGE_SIZE;
+    if (base_pfn == PFN_NONE) {
+        return STATUS_INSUFFICIENT_MEMORY;
+    }
 
+    pma_base_pfn = base_pfn;
+    pma_limit_pfn = limit_pfn;
     pma_frame_desc_count = limit_pfn - base_pfn + 1;
-    pma_available_frames = pma_frame_desc_count;
-    pma_free_frames = pma_frame_desc_count;
+    pma_frame_table_page_count = ALIGN_DIV(pma_frame_desc_count * sizeof(struct pma_frame), PAGE_SIZE);
 
-    /* 2 bits per frame descriptor -> 4 frame descriptors per byte */
-    pma_bitmap_size = (pma_frame_desc_count + 3) / 4;
+    if (pma_frame_table_page_count > PMA_FRAME_TABLE_PT_COUNT * 1024) {
+        return STATUS_INSUFFICIENT_MEMORY;
+    }
 
-    pma_base_pfn = base_pfn;
-    pma_limit_pfn = limit_pfn;
+    memset(pma_frame_table_page_tables, 0, sizeof(pma_frame_table_page_tables));
 
-    /* allocate frames */
-    pma_bitmap_pfn_count = 0;
-    for (uint32_t i = 0; i < mment->entry_count; i++) {
-        /* we do not place bitmap to the PRECIOUS conventional memory */
-        if (mment->entries[i].base < 0x00100000) continue;
-        if (mment->entries[i].type != BEMT_FREE) continue;
+    /* take frames from the top of the memory, low memory is more valuable for devices */
+    filled_count = 0;
+    for (uint32_t i = mment->entry_count; i-- > 0 && filled_count < pma_frame_table_page_count;) {
+        if (!pma_clip_entry(&mment->entries[i], &entry_base_pfn, &entry_limit_pfn)) continue;
 
-        status = pma_allocate_bitmap_frame(mment->entries[i].base / PAGE_SIZE, (mment->entries[i].base + mment->entries[i].size) / PAGE_SIZE, ufent);
-        if (!CHECK_SUCCESS(status)) return status;
+        for (pfn_t pfn = entry_limit_pfn; pfn >= entry_base_pfn && filled_count < pma_frame_table_page_count; pfn--) {
+            if (pma_is_unavailable(ufent, pfn)) continue;
+
+            pte = &pma_frame_table_page_tables[filled_count / 1024][filled_count % 1024];
+            pte->base = pfn;
+            pte->r_w = 1;
+            pte->p = 1;
 
-        if (pma_bitmap_pfn_count >= ALIGN_DIV(pma_bitmap_size, PAGE_SIZE)) break;
+            filled_count++;
+        }
     }
 
-    if (pma_bitmap_pfn_count < ALIGN_DIV(pma_bitmap_size, PAGE_SIZE)) {
-        for (;;) {}
+    if (filled_count < pma_frame_table_page_count) {
         return STATUS_INSUFFICIENT_MEMORY;
     }
 
-    pma_bitmap_pfn_count = ALIGN_DIV(pma_bitmap_size, PAGE_SIZE);
-
-    /* get bitmap page table physical frame */
-    pt = (void *)(0xFFC00000 + (((uintptr_t)pma_bitmap_page_table & 0xFFC00000) >> 10));
-    bitmap_page_table_pfn = pt[((uintptr_t)pma_bitmap_page_table & 0x003FF000) >> 12].base;
-    
-    memset(pma_bitmap_page_table, 0, sizeof(pma_bitmap_page_table));
-
-    /* map pma bitmap */
+    /* map frame table */
     pd = (void *)(pagedir_vpn * PAGE_SIZE);
-    pd[0x000C0400 >> 10].dir.base = bitmap_page_table_pfn;
-    pd[0x000C0400 >> 10].dir.p = 1;
-    pd[0x000C0400 >> 10].dir.r_w = 1;
+    for (int i = 0; i < PMA_FRAME_TABLE_PT_COUNT; i++) {
+        /* get frame table page table physical frame */
+        pt = (void *)(0xFFC00000 + (((uintptr_t)pma_frame_table_page_tables[i] & 0xFFC00000) >> 10));
+
+        pd[(PMA_FRAME_TABLE_BASE >> 22) + i].raw = 0;
+        pd[(PMA_FRAME_TABLE_BASE >> 22) + i].dir.base = pt[((uintptr_t)pma_frame_table_page_tables[i] & 0x003FF000) >> 12].base;
+        pd[(PMA_FRAME_TABLE_BASE >> 22) + i].dir.p = 1;
+        pd[(PMA_FRAME_TABLE_BASE >> 22) + i].dir.r_w = 1;
+    }
 
-    pt = (void *)(0xFFC00000 + 0x00301000);
-    _i686_invlpg(pt);
+    /* force flush tlb */
+    _i686_write_cr3(_i686_read_cr3());
 
-    for (size_t i = 0; i < pma_bitmap_pfn_count; i++) {
-        pt[i].base = pma_bitmap_pfn_list[i];
-        pt[i].p = 1;
-        pt[i].r_w = 1;
+    /* every frame is reserved until the memory map says otherwise */
+    pma_frame_table = (void *)PMA_FRAME_TABLE_BASE;
+    for (size_t i = 0; i < pma_frame_desc_count; i++) {
+        pma_frame_table[i].next = PFN_NONE;
+        pma_frame_table[i].prev = PFN_NONE;
+        pma_frame_table[i].state = PFS_RESERVED;
+        pma_frame_table[i].order = PMA_ORDER_NONE;
     }
 
-    /* unmap lower area */
-    for (int i = 1; i < 768; i++) {
-        if (!pd[i].dir.p) continue;
-
-        pd[i].raw = 0;
+    for (int i = 0; i < PZ_COUNT; i++) {
+        for (int j = 0; j <= PMA_MAX_ORDER; j++) {
+            pma_zones[i].free_areas[j].first = PFN_NONE;
+            pma_zones[i].free_areas[j].count = 0;
+        }
 
-        status = mm_pma_unmark_reserved(pd[i].dir.base, pd[i].dir.base);
-        if (!CHECK_SUCCESS(status)) return status;
+        pma_zones[i].available_frames = 0;
+        pma_zones[i].free_frames = 0;
     }
 
-    /* force flush tlb */
-    _i686_write_cr3(_i686_read_cr3());
+    pma_available_frames = 0;
+    pma_free_frames = 0;
 
-    /* set pma bitmap */
-    pma_bitmap = (void *)ALIGN((uintptr_t)&__end, PAGE_SIZE * 1024);
+    /* build free areas from the memory map */
+    for (uint32_t i = 0; i < mment->entry_count; i++) {
+        if (!pma_clip_entry(&mment->entries[i], &entry_base_pfn, &entry_limit_pfn)) continue;
 
-    memset(pma_bitmap, 0, pma_bitmap_size);
+        status = mm_pma_unmark_reserved(entry_base_pfn, entry_limit_pfn);
+        if (!CHECK_SUCCESS(status)) return status;
+    }
 
-    LOG_TRACE("PMA bitmap initialized to 0x%p. basepfn=%lu limitpfn=%lu\n", pma_bitmap, pma_base_pfn, pma_limit_pfn);
+    LOG_TRACE("PMA frame table initialized to 0x%p. basepfn=%lu limitpfn=%lu\n", (void *)pma_frame_table, pma_base_pfn, pma_limit_pfn);
 
-    
     return STATUS_SUCCESS;
 }
 
 status_t mm_pma_init(vpn_t pagedir_vpn, struct bootinfo_entry_memory_map *mment, struct bootinfo_entry_unavailable_frames *ufent)
 {
     status_t status;
+    union page_dir_entry *pd;
 
-    /* early allocate pma bitmap */
-    status = pma_bitmap_init(pagedir_vpn, mment, ufent);
+    /* early allocate pma frame table */
+    status = pma_frame_table_init(pagedir_vpn, mment, ufent);
     if (!CHECK_SUCCESS(status)) return status;
 
     /* mark unavailable frames as reserved */
-    for (size_t i = 0; i < pma_bitmap_pfn_count; i++) {
-        status = mm_pma_mark_reserved(pma_bitmap_pfn_list[i], pma_bitmap_pfn_list[i]);
+    for (size_t i = 0; i < pma_frame_table_page_count; i++) {
+        pfn_t pfn = pma_frame_table_page_tables[i / 1024][i % 1024].base;
+
+        status = mm_pma_mark_reserved(pfn, pfn);
         if (!CHECK_SUCCESS(status)) return status;
     }
 
     for (uint32_t i = 0; i < ufent->entry_count; i++) {
         if (ufent->entries[i].pfn < pma_base_pfn) continue;
-        if (ufent->entries[i].pfn > pma_limit_pfn) break;
+        if (ufent->entries[i].pfn > pma_limit_pfn) continue;
 
         status = mm_pma_mark_reserved(ufent->entries[i].pfn, ufent->entries[i].pfn);
         if (!CHECK_SUCCESS(status)) return status;
     }
 
+    /* unmap lower area */
+    pd = (void *)(pagedir_vpn * PAGE_SIZE);
+    for (int i = 1; i < 768; i++) {
+        if (!pd[i].dir.p) continue;
+
+        status = mm_pma_unmark_reserved(pd[i].dir.base, pd[i].dir.base);
+        if (!CHECK_SUCCESS(status)) return status;
+
+        pd[i].raw = 0;
+    }
+
+    /* force flush tlb */
+    _i686_write_cr3(_i686_read_cr3());
+
+    for (int i = 0; i < PZ_COUNT; i++) {
+        LOG_DEBUG("zone %-6s: %7lu frames available\n", pma_zones[i].name, pma_zones[i].available_frames);
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -251,21 +540,33 @@ status_t mm_pma_get_free_frame_count(size_t *frame_count)
     return STATUS_SUCCESS;
 }
 
-status_t mm_pma_allocate_frame(size_t count, pfn_t *pfn, uint32_t flags)
+status_t mm_pma_get_zone_frame_count(int zone, size_t *available_count, size_t *free_count)
+{
+    if (zone < 0 || zone >= PZ_COUNT) return STATUS_INVALID_VALUE;
+
+    if (available_count) *available_count = pma_zones[zone].available_frames;
+    if (free_count) *free_count = pma_zones[zone].free_frames;
+
+    return STATUS_SUCCESS;
+}
+
+/* slow path for requests larger than the largest buddy block */
+static status_t pma_allocate_contiguous(struct pma_zone *zone, size_t count, pfn_t *pfn)
 {
+    status_t status;
     size_t free_count = 0;
-    uintptr_t alloc_start_idx = 0;
-    
-    for (size_t i = 0; i < pma_frame_desc_count; i++) {
-        if (pma_base_pfn + i < 0x100) continue;
+    pfn_t alloc_start_pfn = 0;
+    pfn_t base_pfn = MAX(zone->base_pfn, pma_base_pfn);
+    pfn_t limit_pfn = MIN(zone->limit_pfn, pma_limit_pfn);
 
-        if (PBM_GET(i) != PBM_FREE) {
+    for (pfn_t current = base_pfn; current <= limit_pfn; current++) {
+        if (PMA_FRAME(current)->state != PFS_FREE) {
             free_count = 0;
             continue;
         }
 
         if (free_count == 0) {
-            alloc_start_idx = i;
+            alloc_start_pfn = current;
         }
 
         free_count++;
@@ -279,35 +580,319 @@ status_t mm_pma_allocate_frame(size_t count, pfn_t *pfn, uint32_t flags)
         return STATUS_INSUFFICIENT_MEMORY;
     }
 
-    for (size_t i = alloc_start_idx; i < alloc_start_idx + count; i++) {
-        PBM_SET(i, PBM_ALLOCATED);
-        pma_free_frames--;
+    for (pfn_t current = alloc_start_pfn; current < alloc_start_pfn + count; current++) {
+        status = pma_isolate_frame(current);
+        if (!CHECK_SUCCESS(status)) return STATUS_SYSTEM_CORRUPTED;
+    }
+
+    if (pfn) *pfn = alloc_start_pfn;
+
+    return STATUS_SUCCESS;
+}
+
+static status_t pma_allocate_block(struct pma_zone *zone, size_t count, pfn_t *pfn)
+{
+    int order, block_order;
+    pfn_t head;
+
+    order = 0;
+    while ((1 << order) < count) {
+        order++;
+    }
+
+    for (block_order = order; block_order <= PMA_MAX_ORDER; block_order++) {
+        if (zone->free_areas[block_order].first != PFN_NONE) break;
+    }
+
+    if (block_order > PMA_MAX_ORDER) {
+        return STATUS_INSUFFICIENT_MEMORY;
+    }
+
+    head = zone->free_areas[block_order].first;
+    pma_free_area_remove(head);
+
+    /* split larger block */
+    while (block_order > order) {
+        block_order--;
+        pma_free_area_add(head + (1 << block_order), block_order);
     }
 
-    if (pfn) *pfn = pma_base_pfn + alloc_start_idx;
+    /* give back the unused tail of a non power-of-two request */
+    if ((1 << order) > count) {
+        pma_release_range(head + count, (1 << order) - count);
+    }
 
-    LOG_TRACE("allocated frame %lu-%lu\n", pma_base_pfn + alloc_start_idx, pma_base_pfn + alloc_start_idx + count - 1);
+    if (pfn) *pfn = head;
 
     return STATUS_SUCCESS;
 }
 
+static int pma_get_max_zone(uint32_t flags)
+{
+    if (flags & PAF_NO_24BIT) return PZ_DMA;
+    if (flags & PAF_NO_32BIT) return PZ_DMA32;
+
+    return PZ_NORMAL;
+}
+
+/* prefer the highest zone allowed so that low memory stays free for devices */
+static status_t pma_take_frames(int max_zone, size_t count, pfn_t *pfn)
+{
+    status_t status = STATUS_INSUFFICIENT_MEMORY;
+    struct pma_zone *zone;
+
+    for (int zone_idx = max_zone; zone_idx >= 0; zone_idx--) {
+        zone = &pma_zones[zone_idx];
+        if (zone->free_frames < count) continue;
+
+        if (count <= (1 << PMA_MAX_ORDER)) {
+            status = pma_allocate_block(zone, count, pfn);
+        } else {
+            status = pma_allocate_contiguous(zone, count, pfn);
+        }
+        if (CHECK_SUCCESS(status)) break;
+    }
+
+    return status;
+}
+
+/* sets low when the pool should be refilled, the zero thread is woken once the lock is dropped */
+static int pma_zero_pool_take(int max_zone, pfn_t *pfn, int *low)
+{
+    pfn_t head = pma_zero_pool_first;
+
+    if (head == PFN_NONE) return 0;
+    if (pma_get_zone(head) > &pma_zones[max_zone]) return 0;
+
+    pma_zero_pool_first = PMA_FRAME(head)->next;
+    pma_zero_pool_count--;
+
+    if (pma_zero_pool_count < PMA_ZERO_POOL_LOW) {
+        *low = 1;
+    }
+
+    *pfn = head;
+
+    return 1;
+}
+
+status_t mm_pma_allocate_frame(size_t count, pfn_t *pfn, uint32_t flags)
+{
+    status_t status;
+    pfn_t alloc_start_pfn;
+    struct pma_zone *zone;
+    int max_zone, from_pool = 0, pool_low = 0;
+    uint32_t irqstate;
+
+    if (count == 0) return STATUS_INVALID_VALUE;
+
+    max_zone = pma_get_max_zone(flags);
+
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
+
+    if ((flags & PAF_ZERO) && count == 1) {
+        from_pool = pma_zero_pool_take(max_zone, &alloc_start_pfn, &pool_low);
+    }
+
+    if (!from_pool) {
+        status = pma_take_frames(max_zone, count, &alloc_start_pfn);
+
+        /* the pool is still free memory when the buddy lists ran dry */
+        if (!CHECK_SUCCESS(status) && count == 1) {
+            from_pool = pma_zero_pool_take(max_zone, &alloc_start_pfn, &pool_low);
+        }
+        if (!CHECK_SUCCESS(status) && !from_pool) {
+            spinlock_unlock_irqrestore(&pma_lock, irqstate);
+            return status;
+        }
+    }
+
+    for (pfn_t current = alloc_start_pfn; current < alloc_start_pfn + count; current++) {
+        PMA_FRAME(current)->state = PFS_ALLOCATED;
+        PMA_FRAME(current)->order = PMA_ORDER_NONE;
+        PMA_FRAME(current)->refcount = 1;
+    }
+
+    zone = pma_get_zone(alloc_start_pfn);
+    zone->free_frames -= count;
+    pma_free_frames -= count;
+
+    if (flags & PAF_ZERO) {
+        if (from_pool) {
+            pma_zero_pool_hit_count++;
+        } else {
+            pma_zero_pool_miss_count++;
+        }
+    }
+
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
+    if (pool_low) {
+        mm_zero_pool_wake();
+    }
+
+    if ((flags & PAF_ZERO) && !from_pool) {
+        for (pfn_t current = alloc_start_pfn; current < alloc_start_pfn + count; current++) {
+            mm_zero_frame(current);
+        }
+    }
+
+    if (pfn) *pfn = alloc_start_pfn;
+
+    LOG_TRACE("allocated frame %lu-%lu\n", alloc_start_pfn, alloc_start_pfn + count - 1);
+
+    return STATUS_SUCCESS;
+}
+
+static void pma_free_run(pfn_t pfn, size_t frame_count)
+{
+    if (frame_count == 0) return;
+
+    for (pfn_t current = pfn; current < pfn + frame_count; current++) {
+        PMA_FRAME(current)->state = PFS_FREE;
+        PMA_FRAME(current)->order = PMA_ORDER_NONE;
+        PMA_FRAME(current)->refcount = 0;
+        pma_get_zone(current)->free_frames++;
+    }
+
+    pma_release_range(pfn, frame_count);
+    pma_free_frames += frame_count;
+}
+
 void mm_pma_free_frame(pfn_t pfn, size_t frame_count)
 {
+    pfn_t run_start = pfn;
+    uint32_t irqstate;
+
     if (pfn < pma_base_pfn || pfn + frame_count > pma_limit_pfn + 1) goto has_error;
 
-    uintptr_t free_start_idx = pfn - pma_base_pfn;
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
 
-    for (size_t i = free_start_idx; i < free_start_idx + frame_count; i++) {
-        if (PBM_GET(i) != PBM_ALLOCATED) goto has_error;
+    for (pfn_t current = pfn; current < pfn + frame_count; current++) {
+        if (PMA_FRAME(current)->state != PFS_ALLOCATED) goto has_error;
+    }
 
-        PBM_SET(i, PBM_FREE);
-        pma_free_frames++;
+    /* shared frames only drop a reference, the others are released in runs */
+    for (pfn_t current = pfn; current < pfn + frame_count; current++) {
+        if (PMA_FRAME(current)->refcount <= 1) continue;
+
+        PMA_FRAME(current)->refcount--;
+
+        pma_free_run(run_start, current - run_start);
+        run_start = current + 1;
     }
+    pma_free_run(run_start, pfn + frame_count - run_start);
 
-    LOG_TRACE("freed frame %lu-%lu\n", pma_base_pfn + free_start_idx, pma_base_pfn + free_start_idx + frame_count - 1);
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
+    LOG_TRACE("freed frame %lu-%lu\n", pfn, pfn + frame_count - 1);
 
     return;
 
 has_error:
     panic(STATUS_CONFLICTING_STATE, "failed to free memory frame");
 }
+
+status_t mm_pma_reference_frame(pfn_t pfn, size_t frame_count)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    if (pfn < pma_base_pfn || pfn + frame_count > pma_limit_pfn + 1) return STATUS_INVALID_VALUE;
+
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
+
+    for (pfn_t current = pfn; current < pfn + frame_count; current++) {
+        if (PMA_FRAME(current)->state != PFS_ALLOCATED) {
+            status = STATUS_CONFLICTING_STATE;
+            goto out;
+        }
+        if (PMA_FRAME(current)->refcount == UINT16_MAX) {
+            status = STATUS_INSUFFICIENT_MEMORY;
+            goto out;
+        }
+    }
+
+    for (pfn_t current = pfn; current < pfn + frame_count; current++) {
+        PMA_FRAME(current)->refcount++;
+    }
+
+out:
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
+    return status;
+}
+
+status_t mm_pma_get_frame_refcount(pfn_t pfn, size_t *refcount)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    if (pfn < pma_base_pfn || pfn > pma_limit_pfn) return STATUS_INVALID_VALUE;
+
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
+
+    if (PMA_FRAME(pfn)->state != PFS_ALLOCATED) {
+        status = STATUS_CONFLICTING_STATE;
+    } else if (refcount) {
+        *refcount = PMA_FRAME(pfn)->refcount;
+    }
+
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
+    return status;
+}
+
+status_t mm_pma_fill_zero_pool(void)
+{
+    status_t status;
+    pfn_t pfn;
+    uint32_t irqstate;
+
+    if (pma_zero_pool_count >= PMA_ZERO_POOL_TARGET) return STATUS_NO_EVENT;
+
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
+
+    status = pma_take_frames(PZ_NORMAL, 1, &pfn);
+    if (!CHECK_SUCCESS(status)) {
+        spinlock_unlock_irqrestore(&pma_lock, irqstate);
+        return status;
+    }
+
+    /* counted free all along, nobody can take it before it is linked in */
+    PMA_FRAME(pfn)->state = PFS_ZEROED;
+    PMA_FRAME(pfn)->order = PMA_ORDER_NONE;
+
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
+    mm_zero_frame(pfn);
+
+    spinlock_lock_irqsave(&pma_lock, &irqstate);
+
+    /* reserved while it was being zeroed, it is no longer ours to pool */
+    if (PMA_FRAME(pfn)->state != PFS_ZEROED) {
+        spinlock_unlock_irqrestore(&pma_lock, irqstate);
+        return STATUS_SUCCESS;
+    }
+
+    PMA_FRAME(pfn)->next = pma_zero_pool_first;
+    pma_zero_pool_first = pfn;
+    pma_zero_pool_count++;
+    pma_zero_pool_fill_count++;
+
+    spinlock_unlock_irqrestore(&pma_lock, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t mm_pma_get_zero_pool_stat(struct mm_zero_pool_stat *stat)
+{
+    if (!stat) return STATUS_INVALID_VALUE;
+
+    stat->frame_count = pma_zero_pool_count;
+    stat->hit_count = pma_zero_pool_hit_count;
+    stat->miss_count = pma_zero_pool_miss_count;
+    stat->fill_count = pma_zero_pool_fill_count;
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,321 @@
+#include <emos/slab.h>
+
+#include <string.h>
+
+#include <emos/asm/page.h>
+
+#include <emos/mm.h>
+#include <emos/macros.h>
+#include <emos/panic.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "slab"
+
+#define KMEM_CACHE_LINE_SIZE        64
+#define KMEM_MIN_ALIGN              sizeof(void *)
+
+/* empty slabs kept around before giving the page back */
+#define KMEM_FREE_SLAB_LIMIT        1
+
+/* every slab is a single page starting with this header */
+struct kmem_slab {
+    struct kmem_slab *next, *prev;
+    struct kmem_cache *cache;
+
+    void *objects;
+
+    uint16_t active_count;
+    uint16_t free_top;
+    uint16_t free_stack[];  /* indices of the free objects */
+};
+
+static struct spinlock kmem_cache_list_lock;
+static struct kmem_cache *kmem_first_cache = NULL;
+
+static void slab_list_add(struct kmem_slab **list, struct kmem_slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static void slab_list_remove(struct kmem_slab **list, struct kmem_slab *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->next = slab->prev = NULL;
+}
+
+static status_t create_slab(struct kmem_cache *cache, struct kmem_slab **slabout)
+{
+    status_t status;
+    pfn_t pfn;
+    vpn_t vpn;
+    struct kmem_slab *slab;
+    uint8_t *object;
+
+    status = mm_pma_allocate_frame(1, &pfn, PAF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_vma_allocate_page(1, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) goto has_error;
+
+    status = mm_map(pfn, vpn, 1, PMF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(vpn, 1);
+        goto has_error;
+    }
+
+    slab = (void *)(vpn * PAGE_SIZE);
+    slab->cache = cache;
+    slab->objects = (uint8_t *)slab + cache->first_object_offset + cache->next_color * KMEM_CACHE_LINE_SIZE;
+    slab->active_count = 0;
+    slab->free_top = cache->objects_per_slab;
+
+    /* hand out the lowest object first */
+    object = slab->objects;
+    for (size_t i = 0; i < cache->objects_per_slab; i++) {
+        slab->free_stack[i] = cache->objects_per_slab - 1 - i;
+
+        if (cache->ctor) {
+            cache->ctor(object);
+        }
+        object += cache->object_size;
+    }
+
+    cache->next_color = (cache->next_color + 1) % cache->color_count;
+    cache->slab_count++;
+    cache->grow_count++;
+
+    LOG_TRACE("cache %s grew by slab at page %lu\n", cache->name, vpn);
+
+    *slabout = slab;
+
+    return STATUS_SUCCESS;
+
+has_error:
+    mm_pma_free_frame(pfn, 1);
+
+    return status;
+}
+
+static void release_slab(struct kmem_cache *cache, struct kmem_slab *slab)
+{
+    status_t status;
+    vpn_t vpn = (uintptr_t)slab / PAGE_SIZE;
+    pfn_t pfn;
+
+    status = mm_vpn_to_pfn(vpn, &pfn);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "slab page of cache %s is not mapped", cache->name);
+    }
+
+    mm_unmap(vpn, 1);
+    mm_pma_free_frame(pfn, 1);
+    mm_vma_free_page(vpn, 1);
+
+    cache->slab_count--;
+    cache->shrink_count++;
+
+    LOG_TRACE("cache %s released slab at page %lu\n", cache->name, vpn);
+}
+
+status_t kmem_cache_init(struct kmem_cache *cache, const char *name, size_t object_size, size_t object_align, kmem_ctor_t ctor)
+{
+    size_t header_size = 0, leftover;
+    uint32_t irqstate;
+
+    if (!cache || object_size == 0) return STATUS_INVALID_VALUE;
+
+    if (object_align < KMEM_MIN_ALIGN) {
+        object_align = KMEM_MIN_ALIGN;
+    }
+    if ((object_align & (object_align - 1)) || object_align > KMEM_CACHE_LINE_SIZE) return STATUS_INVALID_VALUE;
+
+    memset(cache, 0, sizeof(*cache));
+    spinlock_init(&cache->lock);
+    cache->name = name;
+    cache->object_size = ALIGN(object_size, object_align);
+    cache->object_align = object_align;
+    cache->ctor = ctor;
+
+    /* fit as many objects as possible together with their free stack entries */
+    cache->objects_per_slab = (PAGE_SIZE - sizeof(struct kmem_slab)) / (cache->object_size + sizeof(uint16_t));
+    for (; cache->objects_per_slab > 0; cache->objects_per_slab--) {
+        header_size = ALIGN(sizeof(struct kmem_slab) + cache->objects_per_slab * sizeof(uint16_t), object_align);
+        if (header_size + cache->objects_per_slab * cache->object_size <= PAGE_SIZE) break;
+    }
+    if (cache->objects_per_slab == 0) return STATUS_INVALID_VALUE;
+
+    cache->first_object_offset = header_size;
+
+    leftover = PAGE_SIZE - header_size - cache->objects_per_slab * cache->object_size;
+    cache->color_count = leftover / KMEM_CACHE_LINE_SIZE + 1;
+    cache->next_color = 0;
+
+    spinlock_lock_irqsave(&kmem_cache_list_lock, &irqstate);
+
+    cache->next = kmem_first_cache;
+    kmem_first_cache = cache;
+
+    spinlock_unlock_irqrestore(&kmem_cache_list_lock, irqstate);
+
+    LOG_DEBUG("created cache %s: object size %lu, %lu objects per slab, %lu colors\n", name, cache->object_size, cache->objects_per_slab, cache->color_count);
+
+    return STATUS_SUCCESS;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+    struct kmem_cache **link;
+    struct kmem_slab *slab;
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&cache->lock, &irqstate);
+
+    if (cache->active_object_count) {
+        panic(STATUS_CONFLICTING_STATE, "destroying cache %s with %lu objects in use", cache->name, cache->active_object_count);
+    }
+
+    while ((slab = cache->free_slabs)) {
+        slab_list_remove(&cache->free_slabs, slab);
+        release_slab(cache, slab);
+    }
+    cache->free_slab_count = 0;
+
+    spinlock_unlock(&cache->lock);
+    spinlock_lock(&kmem_cache_list_lock);
+
+    for (link = &kmem_first_cache; *link; link = &(*link)->next) {
+        if (*link == cache) {
+            *link = cache->next;
+            break;
+        }
+    }
+
+    spinlock_unlock_irqrestore(&kmem_cache_list_lock, irqstate);
+}
+
+status_t kmem_cache_allocate(struct kmem_cache *cache, void **object)
+{
+    status_t status;
+    struct kmem_slab *slab;
+    uint32_t irqstate;
+    uint16_t index;
+
+    if (!object) return STATUS_INVALID_VALUE;
+
+    spinlock_lock_irqsave(&cache->lock, &irqstate);
+
+    if ((slab = cache->partial_slabs)) {
+        /* keep filling partially used slabs so that empty ones can be released */
+    } else if ((slab = cache->free_slabs)) {
+        slab_list_remove(&cache->free_slabs, slab);
+        slab_list_add(&cache->partial_slabs, slab);
+        cache->free_slab_count--;
+    } else {
+        status = create_slab(cache, &slab);
+        if (!CHECK_SUCCESS(status)) {
+            spinlock_unlock_irqrestore(&cache->lock, irqstate);
+            return status;
+        }
+
+        slab_list_add(&cache->partial_slabs, slab);
+    }
+
+    index = slab->free_stack[--slab->free_top];
+    slab->active_count++;
+
+    if (slab->free_top == 0) {
+        slab_list_remove(&cache->partial_slabs, slab);
+        slab_list_add(&cache->full_slabs, slab);
+    }
+
+    cache->active_object_count++;
+    cache->allocation_count++;
+
+    *object = (uint8_t *)slab->objects + index * cache->object_size;
+
+    spinlock_unlock_irqrestore(&cache->lock, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *object)
+{
+    struct kmem_slab *slab;
+    uintptr_t offset;
+    uint32_t irqstate;
+
+    if (!object) return;
+
+    slab = (void *)((uintptr_t)object & ~(PAGE_SIZE - 1));
+    offset = (uintptr_t)object - (uintptr_t)slab->objects;
+
+    if (slab->cache != cache || (uintptr_t)object < (uintptr_t)slab->objects || offset % cache->object_size) {
+        panic(STATUS_INVALID_VALUE, "freeing invalid object %p to cache %s", object, cache->name);
+    }
+
+    spinlock_lock_irqsave(&cache->lock, &irqstate);
+
+    if (slab->free_top == 0) {
+        slab_list_remove(&cache->full_slabs, slab);
+        slab_list_add(&cache->partial_slabs, slab);
+    }
+
+    slab->free_stack[slab->free_top++] = offset / cache->object_size;
+    slab->active_count--;
+
+    cache->active_object_count--;
+    cache->free_count++;
+
+    if (slab->active_count == 0) {
+        slab_list_remove(&cache->partial_slabs, slab);
+
+        if (cache->free_slab_count < KMEM_FREE_SLAB_LIMIT) {
+            slab_list_add(&cache->free_slabs, slab);
+            cache->free_slab_count++;
+        } else {
+            release_slab(cache, slab);
+        }
+    }
+
+    spinlock_unlock_irqrestore(&cache->lock, irqstate);
+}
+
+status_t kmem_cache_get_stat(const struct kmem_cache *cache, struct kmem_cache_stat *stat)
+{
+    if (!cache || !stat) return STATUS_INVALID_VALUE;
+
+    stat->name = cache->name;
+    stat->object_size = cache->object_size;
+    stat->objects_per_slab = cache->objects_per_slab;
+    stat->slab_count = cache->slab_count;
+    stat->free_slab_count = cache->free_slab_count;
+    stat->total_object_count = cache->slab_count * cache->objects_per_slab;
+    stat->active_object_count = cache->active_object_count;
+    stat->allocation_count = cache->allocation_count;
+    stat->free_count = cache->free_count;
+    stat->grow_count = cache->grow_count;
+    stat->shrink_count = cache->shrink_count;
+
+    return STATUS_SUCCESS;
+}
+
+struct kmem_cache *kmem_cache_get_next(const struct kmem_cache *cache)
+{
+    if (!cache) return kmem_first_cache;
+
+    return cache->next;
+}
@@ -0,0 +1,404 @@
+#include <emos/mm.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <emos/asm/page.h>
+#include <emos/asm/interrupt.h>
+#include <emos/asm/intrinsics/register.h>
+
+#include <emos/slab.h>
+#include <emos/spinlock.h>
+#include <emos/macros.h>
+#include <emos/panic.h>
+#include <emos/log.h>
+
+#include "internal.h"
+
+#define MODULE_NAME "space"
+
+struct address_space {
+    struct address_space *next;
+
+    pfn_t dir_pfn;
+    union page_dir_entry *dir;  /* the page directory, mapped in the kernel half */
+};
+
+static struct kmem_cache space_cache;
+static struct spinlock space_list_lock;
+static struct address_space *space_list = NULL;
+static int space_initialized = 0;
+
+static pfn_t current_dir_pfn(void)
+{
+    return _i686_read_cr3() >> 12;
+}
+
+static status_t map_directory(struct address_space *space)
+{
+    status_t status;
+    vpn_t vpn;
+
+    status = mm_vma_allocate_page(1, &vpn, VAF_KERNEL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_map(space->dir_pfn, vpn, 1, PMF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) {
+        mm_vma_free_page(vpn, 1);
+        return status;
+    }
+
+    space->dir = (void *)(vpn * PAGE_SIZE);
+
+    return STATUS_SUCCESS;
+}
+
+static void unmap_directory(struct address_space *space)
+{
+    vpn_t vpn = (uintptr_t)space->dir / PAGE_SIZE;
+
+    mm_unmap(vpn, 1);
+    mm_vma_free_page(vpn, 1);
+}
+
+static void space_list_add(struct address_space *space)
+{
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&space_list_lock, &irqstate);
+
+    space->next = space_list;
+    space_list = space;
+
+    spinlock_unlock_irqrestore(&space_list_lock, irqstate);
+}
+
+static void space_list_remove(struct address_space *space)
+{
+    struct address_space **link;
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&space_list_lock, &irqstate);
+
+    for (link = &space_list; *link; link = &(*link)->next) {
+        if (*link == space) {
+            *link = space->next;
+            break;
+        }
+    }
+
+    spinlock_unlock_irqrestore(&space_list_lock, irqstate);
+}
+
+static struct address_space *find_space(pfn_t dir_pfn)
+{
+    struct address_space *space;
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&space_list_lock, &irqstate);
+
+    for (space = space_list; space; space = space->next) {
+        if (space->dir_pfn == dir_pfn) break;
+    }
+
+    spinlock_unlock_irqrestore(&space_list_lock, irqstate);
+
+    return space;
+}
+
+/* register the address space we booted with, so that it receives kernel page directory updates too */
+static status_t init_spaces(void)
+{
+    status_t status;
+    struct address_space *space;
+
+    status = kmem_cache_init(&space_cache, "aspace", sizeof(struct address_space), 0, NULL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    spinlock_init(&space_list_lock);
+
+    status = kmem_cache_allocate(&space_cache, (void **)&space);
+    if (!CHECK_SUCCESS(status)) goto has_error;
+
+    space->dir_pfn = current_dir_pfn();
+
+    status = map_directory(space);
+    if (!CHECK_SUCCESS(status)) {
+        kmem_cache_free(&space_cache, space);
+        goto has_error;
+    }
+
+    space_list_add(space);
+    space_initialized = 1;
+
+    return STATUS_SUCCESS;
+
+has_error:
+    kmem_cache_destroy(&space_cache);
+
+    return status;
+}
+
+/* called with the page tables locked */
+void mm_space_sync_kernel_pde(size_t pdi)
+{
+    pfn_t current_pfn;
+
+    if (!space_initialized) return;
+
+    current_pfn = current_dir_pfn();
+
+    spinlock_lock(&space_list_lock);
+
+    for (struct address_space *space = space_list; space; space = space->next) {
+        if (space->dir_pfn == current_pfn) continue;
+
+        space->dir[pdi] = _pc_page_dir->pde[pdi];
+    }
+
+    spinlock_unlock(&space_list_lock);
+}
+
+static status_t copy_frame(vpn_t vpn, pfn_t *pfn)
+{
+    status_t status;
+    void *copy;
+
+    status = mm_pma_allocate_frame(1, pfn, PAF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_map_scratch(SCRATCH_COPY, *pfn, &copy);
+    if (!CHECK_SUCCESS(status)) {
+        mm_pma_free_frame(*pfn, 1);
+        return status;
+    }
+
+    memcpy(copy, (void *)(vpn * PAGE_SIZE), PAGE_SIZE);
+    mm_unmap_scratch(SCRATCH_COPY);
+
+    return STATUS_SUCCESS;
+}
+
+/* fill the zeroed page table in place, so that a partial copy is released with the space on failure; called with the page tables locked */
+static status_t clone_page_table(size_t pdi, union page_table_entry *new_pt, uint32_t flags)
+{
+    status_t status;
+    union page_table_entry *pt = get_page_table(pdi);
+    union page_table_entry pte;
+    vpn_t vpn;
+    pfn_t pfn;
+
+    for (size_t i = 0; i < PAGE_TABLE_ENTRY_COUNT; i++) {
+        pte = pt[i];
+        vpn = pdi * PAGE_TABLE_ENTRY_COUNT + i;
+
+        if (!pte.p) {
+            if (pte.raw & PTE_DEMAND_ZERO) {
+                new_pt[i] = pte;
+                mm_reserved_page_count++;
+            }
+            continue;
+        }
+
+        if (!(pte.raw & PTE_UNMANAGED) && !CHECK_SUCCESS(mm_pma_get_frame_refcount(pte.base, NULL))) {
+            /* frames the allocator does not hand out, like device memory, are shared as they are */
+            pte.raw |= PTE_UNMANAGED;
+        }
+
+        if (pte.raw & PTE_UNMANAGED) {
+            new_pt[i] = pte;
+            continue;
+        }
+
+        if (flags & ASF_EAGER_COPY) {
+            status = copy_frame(vpn, &pfn);
+            if (!CHECK_SUCCESS(status)) return status;
+
+            if (pte.raw & PTE_COPY_ON_WRITE) {
+                pte.raw &= ~PTE_COPY_ON_WRITE;
+                pte.r_w = 1;
+            }
+            pte.base = pfn;
+            new_pt[i] = pte;
+            continue;
+        }
+
+        status = mm_pma_reference_frame(pte.base, 1);
+        if (!CHECK_SUCCESS(status)) return status;
+
+        if (pte.r_w) {
+            pte.r_w = 0;
+            pte.raw |= PTE_COPY_ON_WRITE;
+            pt[i] = pte;
+        }
+        new_pt[i] = pte;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+status_t mm_clone_address_space(uint32_t flags, uintptr_t *cr3)
+{
+    status_t status;
+    struct address_space *space;
+    union page_table_entry *new_pt;
+    union page_dir_entry pde;
+    pfn_t pt_pfn;
+    uint32_t irqstate;
+
+    if (!cr3) return STATUS_INVALID_VALUE;
+
+    if (!space_initialized) {
+        status = init_spaces();
+        if (!CHECK_SUCCESS(status)) return status;
+    }
+
+    status = kmem_cache_allocate(&space_cache, (void **)&space);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    status = mm_pma_allocate_frame(1, &space->dir_pfn, PAF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) {
+        kmem_cache_free(&space_cache, space);
+        return status;
+    }
+
+    status = map_directory(space);
+    if (!CHECK_SUCCESS(status)) {
+        mm_pma_free_frame(space->dir_pfn, 1);
+        kmem_cache_free(&space_cache, space);
+        return status;
+    }
+
+    memset(space->dir, 0, KERNEL_PDI_BASE * sizeof(*space->dir));
+
+    /* take the kernel half and start receiving its updates at once */
+    mm_lock_page_tables(&irqstate);
+
+    for (size_t pdi = KERNEL_PDI_BASE; pdi < RECURSIVE_PDI; pdi++) {
+        space->dir[pdi] = _pc_page_dir->pde[pdi];
+    }
+    space->dir[RECURSIVE_PDI].raw = (space->dir_pfn << 12) | 0x00000003;
+
+    spinlock_lock(&space_list_lock);
+
+    space->next = space_list;
+    space_list = space;
+
+    spinlock_unlock(&space_list_lock);
+
+    mm_unlock_page_tables(irqstate);
+
+    for (size_t pdi = 0; pdi < KERNEL_PDI_BASE; pdi++) {
+        if (!_pc_page_dir->pde[pdi].dir.p) continue;
+
+        /* large pages cannot be write protected one page at a time */
+        if (_pc_page_dir->pde[pdi].dir.ps) {
+            status = mm_split_large_page(pdi);
+            if (!CHECK_SUCCESS(status)) goto has_error;
+        }
+
+        status = mm_pma_allocate_frame(1, &pt_pfn, PAF_ZERO);
+        if (!CHECK_SUCCESS(status)) goto has_error;
+
+        mm_lock_page_tables(&irqstate);
+
+        status = mm_map_scratch(SCRATCH_TABLE, pt_pfn, (void **)&new_pt);
+        if (!CHECK_SUCCESS(status)) {
+            mm_unlock_page_tables(irqstate);
+            mm_pma_free_frame(pt_pfn, 1);
+            goto has_error;
+        }
+
+        status = clone_page_table(pdi, new_pt, flags);
+        mm_unmap_scratch(SCRATCH_TABLE);
+
+        pde = _pc_page_dir->pde[pdi];
+        pde.dir.base = pt_pfn;
+        space->dir[pdi] = pde;
+
+        mm_unlock_page_tables(irqstate);
+
+        if (!CHECK_SUCCESS(status)) goto has_error;
+    }
+
+    /* drop the writable translations of the pages we now share, other processors may hold them too */
+    mm_invalidate_range(0, KERNEL_PDI_BASE * PAGE_TABLE_ENTRY_COUNT);
+
+    *cr3 = space->dir_pfn << 12;
+
+    LOG_TRACE("cloned address space to directory frame %lu\n", space->dir_pfn);
+
+    return STATUS_SUCCESS;
+
+has_error:
+    mm_invalidate_range(0, KERNEL_PDI_BASE * PAGE_TABLE_ENTRY_COUNT);
+    mm_destroy_address_space(space->dir_pfn << 12);
+
+    return status;
+}
+
+static void release_page_table(union page_table_entry *pt)
+{
+    for (size_t i = 0; i < PAGE_TABLE_ENTRY_COUNT; i++) {
+        if (!pt[i].p) {
+            if (pt[i].raw & PTE_DEMAND_ZERO) {
+                mm_reserved_page_count--;
+            }
+            continue;
+        }
+
+        if (pt[i].raw & PTE_UNMANAGED) continue;
+
+        /* drops our reference if the frame is still shared */
+        mm_pma_free_frame(pt[i].base, 1);
+    }
+}
+
+status_t mm_destroy_address_space(uintptr_t cr3)
+{
+    status_t status;
+    struct address_space *space;
+    union page_table_entry *pt;
+    union page_dir_entry pde;
+    uint32_t irqstate;
+
+    if (!space_initialized) return STATUS_ENTRY_NOT_FOUND;
+
+    space = find_space(cr3 >> 12);
+    if (!space) return STATUS_ENTRY_NOT_FOUND;
+    if (space->dir_pfn == current_dir_pfn()) return STATUS_CONFLICTING_STATE;
+
+    for (size_t pdi = 0; pdi < KERNEL_PDI_BASE; pdi++) {
+        pde = space->dir[pdi];
+
+        /* large pages are only made for frames the caller mapped itself */
+        if (!pde.dir.p || pde.dir.ps) continue;
+
+        irqstate = interrupt_save();
+        interrupt_disable();
+
+        status = mm_map_scratch(SCRATCH_TABLE, pde.dir.base, (void **)&pt);
+        if (!CHECK_SUCCESS(status)) {
+            panic(status, "failed to map page table of address space %lu", space->dir_pfn);
+        }
+
+        release_page_table(pt);
+        mm_unmap_scratch(SCRATCH_TABLE);
+
+        interrupt_restore(irqstate);
+
+        mm_pma_free_frame(pde.dir.base, 1);
+    }
+
+    space_list_remove(space);
+
+    unmap_directory(space);
+    mm_pma_free_frame(space->dir_pfn, 1);
+
+    LOG_TRACE("destroyed address space with directory frame %lu\n", space->dir_pfn);
+
+    kmem_cache_free(&space_cache, space);
+
+    return STATUS_SUCCESS;
+}
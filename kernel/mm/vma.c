@@ -10,86 +10,431 @@
 #include <emos/asm/intrinsics/register.h>
 #include <emos/asm/intrinsics/invlpg.h>
 
+#include <emos/avltree.h>
+#include <emos/spinlock.h>
 #include <emos/macros.h>
 #include <emos/panic.h>
 #include <emos/log.h>
 
 #define MODULE_NAME "vma"
 
-static vpn_t vma_user_base_vpn;
-static vpn_t vma_user_limit_vpn;
-static vpn_t vma_user_alloc_vpn;
+/* extents available before we are able to map pages for more */
+#define VMA_EARLY_EXTENT_COUNT      64
+#define VMA_EXTENT_REFILL_THRESHOLD 8
 
-static vpn_t vma_kernel_base_vpn;
-static vpn_t vma_kernel_limit_vpn;
-static vpn_t vma_kernel_alloc_vpn;
+#define VMA_LARGE_PAGE_COUNT        1024    /* pages a page directory entry covers */
+
+struct vma_extent {
+    union {
+        struct avl_node addr_node;
+        struct vma_extent *next_free;
+    };
+    struct avl_node size_node;
+
+    vpn_t base_vpn;
+    size_t page_count;
+};
+
+struct vma_space {
+    vpn_t base_vpn;
+    vpn_t limit_vpn;
+
+    struct avl_tree addr_tree;  /* free extents ordered by address */
+    struct avl_tree size_tree;  /* free extents ordered by size, then by address */
+
+    size_t free_page_count;
+    size_t extent_count;
+};
+
+static struct vma_space vma_user_space;
+static struct vma_space vma_kernel_space;
+
+/* covers both spaces and the extent descriptors, held while a refill maps a page */
+static struct spinlock vma_lock;
+
+static struct vma_extent vma_early_extents[VMA_EARLY_EXTENT_COUNT];
+static struct vma_extent *vma_free_extents;
+static size_t vma_free_extent_count;
+static int vma_refilling;
+
+static int compare_extent_addr(const struct avl_node *a, const struct avl_node *b)
+{
+    const struct vma_extent *ext_a = AVL_ENTRY(a, struct vma_extent, addr_node);
+    const struct vma_extent *ext_b = AVL_ENTRY(b, struct vma_extent, addr_node);
+
+    if (ext_a->base_vpn < ext_b->base_vpn) return -1;
+    if (ext_a->base_vpn > ext_b->base_vpn) return 1;
+
+    return 0;
+}
+
+static int compare_extent_size(const struct avl_node *a, const struct avl_node *b)
+{
+    const struct vma_extent *ext_a = AVL_ENTRY(a, struct vma_extent, size_node);
+    const struct vma_extent *ext_b = AVL_ENTRY(b, struct vma_extent, size_node);
+
+    if (ext_a->page_count < ext_b->page_count) return -1;
+    if (ext_a->page_count > ext_b->page_count) return 1;
+    if (ext_a->base_vpn < ext_b->base_vpn) return -1;
+    if (ext_a->base_vpn > ext_b->base_vpn) return 1;
+
+    return 0;
+}
+
+static void put_extent(struct vma_extent *ext)
+{
+    ext->next_free = vma_free_extents;
+    vma_free_extents = ext;
+    vma_free_extent_count++;
+}
+
+static struct vma_extent *get_extent(void)
+{
+    struct vma_extent *ext = vma_free_extents;
+
+    if (!ext) return NULL;
+
+    vma_free_extents = ext->next_free;
+    vma_free_extent_count--;
+
+    return ext;
+}
+
+static void space_insert(struct vma_space *space, struct vma_extent *ext)
+{
+    avl_insert(&space->addr_tree, &ext->addr_node);
+    avl_insert(&space->size_tree, &ext->size_node);
+    space->extent_count++;
+}
+
+static void space_remove(struct vma_space *space, struct vma_extent *ext)
+{
+    avl_remove(&space->addr_tree, &ext->addr_node);
+    avl_remove(&space->size_tree, &ext->size_node);
+    space->extent_count--;
+}
+
+static void space_init(struct vma_space *space, vpn_t base_vpn, vpn_t limit_vpn, struct vma_extent *ext)
+{
+    space->base_vpn = base_vpn;
+    space->limit_vpn = limit_vpn;
+    space->free_page_count = 0;
+    space->extent_count = 0;
+
+    avl_init(&space->addr_tree, compare_extent_addr);
+    avl_init(&space->size_tree, compare_extent_size);
+
+    ext->base_vpn = base_vpn;
+    ext->page_count = limit_vpn - base_vpn + 1;
+    space_insert(space, ext);
+
+    space->free_page_count = ext->page_count;
+}
+
+/* take pages from the front of ext */
+static status_t space_allocate_from(struct vma_space *space, struct vma_extent *ext, size_t page_count, vpn_t *vpn)
+{
+    if (vpn) *vpn = ext->base_vpn;
+
+    if (ext->page_count == page_count) {
+        space_remove(space, ext);
+        put_extent(ext);
+    } else {
+        /* shrinking from the front keeps the address order */
+        avl_remove(&space->size_tree, &ext->size_node);
+        ext->base_vpn += page_count;
+        ext->page_count -= page_count;
+        avl_insert(&space->size_tree, &ext->size_node);
+    }
+
+    space->free_page_count -= page_count;
+
+    return STATUS_SUCCESS;
+}
+
+static status_t space_allocate(struct vma_space *space, size_t page_count, vpn_t *vpn)
+{
+    struct avl_node *node = space->size_tree.root;
+    struct vma_extent *ext, *best = NULL;
+
+    /* best fit: the smallest extent that is large enough */
+    while (node) {
+        ext = AVL_ENTRY(node, struct vma_extent, size_node);
+
+        if (ext->page_count >= page_count) {
+            best = ext;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    if (!best) return STATUS_INSUFFICIENT_MEMORY;
+
+    return space_allocate_from(space, best, page_count, vpn);
+}
+
+/* best fit again, but an extent only fits once its start is rounded up to the alignment */
+static status_t space_allocate_aligned(struct vma_space *space, size_t page_count, size_t align, vpn_t *vpn)
+{
+    struct avl_node *node;
+    struct vma_extent *ext, *tail;
+    vpn_t base_vpn;
+    size_t padding, tail_page_count;
+
+    for (node = avl_first(&space->size_tree); node; node = avl_next(node)) {
+        ext = AVL_ENTRY(node, struct vma_extent, size_node);
+
+        base_vpn = ALIGN(ext->base_vpn, align);
+        padding = base_vpn - ext->base_vpn;
+        if (ext->page_count >= padding + page_count) break;
+    }
+
+    if (!node) return STATUS_INSUFFICIENT_MEMORY;
+
+    if (!padding) return space_allocate_from(space, ext, page_count, vpn);
+
+    /* the pages in front stay in the extent, the ones behind need one of their own */
+    tail_page_count = ext->page_count - padding - page_count;
+    tail = NULL;
+    if (tail_page_count) {
+        tail = get_extent();
+        if (!tail) return STATUS_INSUFFICIENT_MEMORY;
+    }
+
+    avl_remove(&space->size_tree, &ext->size_node);
+    ext->page_count = padding;
+    avl_insert(&space->size_tree, &ext->size_node);
+
+    if (tail) {
+        tail->base_vpn = base_vpn + page_count;
+        tail->page_count = tail_page_count;
+        space_insert(space, tail);
+    }
+
+    space->free_page_count -= page_count;
+
+    if (vpn) *vpn = base_vpn;
+
+    return STATUS_SUCCESS;
+}
+
+static status_t space_free(struct vma_space *space, vpn_t vpn, size_t page_count)
+{
+    struct avl_node *node = space->addr_tree.root;
+    struct vma_extent *ext, *prev = NULL, *next = NULL;
+
+    if (vpn < space->base_vpn || vpn + page_count - 1 > space->limit_vpn) return STATUS_INVALID_VALUE;
+
+    /* find free extents right before and after the range */
+    while (node) {
+        ext = AVL_ENTRY(node, struct vma_extent, addr_node);
+
+        if (ext->base_vpn < vpn) {
+            prev = ext;
+            node = node->right;
+        } else {
+            next = ext;
+            node = node->left;
+        }
+    }
+
+    if (prev && prev->base_vpn + prev->page_count > vpn) return STATUS_CONFLICTING_STATE;
+    if (next && vpn + page_count > next->base_vpn) return STATUS_CONFLICTING_STATE;
+
+    if (prev && prev->base_vpn + prev->page_count != vpn) prev = NULL;
+    if (next && vpn + page_count != next->base_vpn) next = NULL;
+
+    if (prev && next) {
+        avl_remove(&space->size_tree, &prev->size_node);
+        prev->page_count += page_count + next->page_count;
+        avl_insert(&space->size_tree, &prev->size_node);
+
+        space_remove(space, next);
+        put_extent(next);
+    } else if (prev) {
+        avl_remove(&space->size_tree, &prev->size_node);
+        prev->page_count += page_count;
+        avl_insert(&space->size_tree, &prev->size_node);
+    } else if (next) {
+        /* growing to the front keeps the address order */
+        avl_remove(&space->size_tree, &next->size_node);
+        next->base_vpn = vpn;
+        next->page_count += page_count;
+        avl_insert(&space->size_tree, &next->size_node);
+    } else {
+        ext = get_extent();
+        if (!ext) return STATUS_INSUFFICIENT_MEMORY;
+
+        ext->base_vpn = vpn;
+        ext->page_count = page_count;
+        space_insert(space, ext);
+    }
+
+    space->free_page_count += page_count;
+
+    return STATUS_SUCCESS;
+}
+
+/* map a new page of extent descriptors so that frees never run out of them */
+static void refill_extents(void)
+{
+    status_t status;
+    vpn_t vpn;
+    pfn_t pfn;
+    struct vma_extent *exts;
+
+    if (vma_free_extent_count >= VMA_EXTENT_REFILL_THRESHOLD || vma_refilling) return;
+
+    vma_refilling = 1;
+
+    status = space_allocate(&vma_kernel_space, 1, &vpn);
+    if (!CHECK_SUCCESS(status)) goto out;
+
+    status = mm_pma_allocate_frame(1, &pfn, PAF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) {
+        space_free(&vma_kernel_space, vpn, 1);
+        goto out;
+    }
+
+    status = mm_map(pfn, vpn, 1, PMF_DEFAULT);
+    if (!CHECK_SUCCESS(status)) {
+        mm_pma_free_frame(pfn, 1);
+        space_free(&vma_kernel_space, vpn, 1);
+        goto out;
+    }
+
+    exts = (void *)(vpn * PAGE_SIZE);
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(*exts); i++) {
+        put_extent(&exts[i]);
+    }
+
+    LOG_TRACE("mapped extent descriptor page %lu\n", vpn);
+
+out:
+    vma_refilling = 0;
+}
 
 status_t mm_vma_init(vpn_t user_base_vpn, vpn_t user_limit_vpn, vpn_t kernel_base_vpn, vpn_t kernel_limit_vpn)
 {
-    vma_user_base_vpn = user_base_vpn;
-    vma_user_limit_vpn = user_limit_vpn;
-    vma_user_alloc_vpn = user_base_vpn;
-    
-    vma_kernel_base_vpn = kernel_base_vpn;
-    vma_kernel_limit_vpn = kernel_limit_vpn;
-    vma_kernel_alloc_vpn = kernel_base_vpn;
-    
+    spinlock_init(&vma_lock);
+
+    vma_free_extents = NULL;
+    vma_free_extent_count = 0;
+    for (int i = 0; i < VMA_EARLY_EXTENT_COUNT; i++) {
+        put_extent(&vma_early_extents[i]);
+    }
+
+    space_init(&vma_user_space, user_base_vpn, user_limit_vpn, get_extent());
+    space_init(&vma_kernel_space, kernel_base_vpn, kernel_limit_vpn, get_extent());
+
     return STATUS_SUCCESS;
 }
 
 status_t mm_vma_get_available_kernel_page_count(size_t *page_count)
 {
-    if (page_count) *page_count = vma_kernel_limit_vpn - vma_kernel_base_vpn + 1;
+    if (page_count) *page_count = vma_kernel_space.limit_vpn - vma_kernel_space.base_vpn + 1;
 
     return STATUS_SUCCESS;
 }
 
 status_t mm_vma_get_free_kernel_page_count(size_t *page_count)
 {
-    if (page_count) *page_count = vma_kernel_limit_vpn - vma_kernel_alloc_vpn + 1;
+    if (page_count) *page_count = vma_kernel_space.free_page_count;
 
     return STATUS_SUCCESS;
 }
 
 status_t mm_vma_get_available_user_page_count(size_t *page_count)
 {
-    if (page_count) *page_count = vma_user_limit_vpn - vma_user_base_vpn + 1;
+    if (page_count) *page_count = vma_user_space.limit_vpn - vma_user_space.base_vpn + 1;
 
     return STATUS_SUCCESS;
 }
 
 status_t mm_vma_get_free_user_page_count(size_t *page_count)
 {
-    if (page_count) *page_count = vma_user_limit_vpn - vma_user_alloc_vpn + 1;
+    if (page_count) *page_count = vma_user_space.free_page_count;
+
+    return STATUS_SUCCESS;
+}
+
+static void get_extent_stat(struct vma_space *space, size_t *extent_count, size_t *largest_page_count)
+{
+    struct avl_node *largest = avl_last(&space->size_tree);
+
+    if (extent_count) *extent_count = space->extent_count;
+    if (largest_page_count) {
+        *largest_page_count = largest ? AVL_ENTRY(largest, struct vma_extent, size_node)->page_count : 0;
+    }
+}
+
+status_t mm_vma_get_free_kernel_extent_count(size_t *extent_count, size_t *largest_page_count)
+{
+    get_extent_stat(&vma_kernel_space, extent_count, largest_page_count);
+
+    return STATUS_SUCCESS;
+}
+
+status_t mm_vma_get_free_user_extent_count(size_t *extent_count, size_t *largest_page_count)
+{
+    get_extent_stat(&vma_user_space, extent_count, largest_page_count);
 
     return STATUS_SUCCESS;
 }
 
 status_t mm_vma_allocate_page(size_t page_count, vpn_t *vpn, uint32_t alloc_flags)
 {
+    status_t status;
+    struct vma_space *space;
     vpn_t new_vpn;
+    uint32_t irqstate;
 
-    if (alloc_flags & VAF_KERNEL) {
-        new_vpn = vma_kernel_alloc_vpn;
+    if (page_count == 0) return STATUS_INVALID_VALUE;
 
-        if (vma_kernel_alloc_vpn + page_count >= vma_kernel_limit_vpn) {
-            return STATUS_INSUFFICIENT_MEMORY; 
-        }
-    
-        vma_kernel_alloc_vpn += page_count;
-    } else {
-        new_vpn = vma_user_alloc_vpn;
+    spinlock_lock_irqsave(&vma_lock, &irqstate);
 
-        if (vma_user_alloc_vpn + page_count >= vma_user_limit_vpn) {
-            return STATUS_INSUFFICIENT_MEMORY; 
-        }
-    
-        vma_user_alloc_vpn += page_count;
+    space = (alloc_flags & VAF_KERNEL) ? &vma_kernel_space : &vma_user_space;
+
+    if (alloc_flags & VAF_LARGE) {
+        status = space_allocate_aligned(space, page_count, VMA_LARGE_PAGE_COUNT, &new_vpn);
+    } else {
+        status = space_allocate(space, page_count, &new_vpn);
     }
 
+    spinlock_unlock_irqrestore(&vma_lock, irqstate);
+
+    if (!CHECK_SUCCESS(status)) return status;
+
     if (vpn) *vpn = new_vpn;
 
     return STATUS_SUCCESS;
 }
 
-void mm_vma_free_page(vpn_t vpn, size_t page_count) {}
+void mm_vma_free_page(vpn_t vpn, size_t page_count)
+{
+    status_t status;
+    struct vma_space *space;
+    uint32_t irqstate;
+
+    if (page_count == 0) return;
+
+    spinlock_lock_irqsave(&vma_lock, &irqstate);
+
+    refill_extents();
+
+    if (vma_kernel_space.base_vpn <= vpn && vpn <= vma_kernel_space.limit_vpn) {
+        space = &vma_kernel_space;
+    } else {
+        space = &vma_user_space;
+    }
+
+    status = space_free(space, vpn, page_count);
+    if (!CHECK_SUCCESS(status)) {
+        panic(status, "failed to free virtual page %lu-%lu", vpn, vpn + page_count - 1);
+    }
+
+    spinlock_unlock_irqrestore(&vma_lock, irqstate);
+
+    LOG_TRACE("freed page %lu-%lu\n", vpn, vpn + page_count - 1);
+}
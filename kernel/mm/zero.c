@@ -0,0 +1,66 @@
+#include <emos/mm.h>
+
+#include <emos/thread.h>
+#include <emos/scheduler.h>
+#include <emos/waitqueue.h>
+#include <emos/log.h>
+
+#include "internal.h"
+
+#define MODULE_NAME "zero"
+
+#define ZERO_THREAD_STACK_SIZE      0x4000
+
+static struct thread *zero_thread = NULL;
+static struct wait_queue zero_wait;
+
+static void zero_thread_main(struct thread *th)
+{
+    status_t status;
+    uint32_t irqstate;
+
+    for (;;) {
+        /* zero only while nothing else wants the CPU */
+        if (scheduler_has_other_runnable_thread()) {
+            scheduler_yield();
+            continue;
+        }
+
+        status = mm_pma_fill_zero_pool();
+        if (CHECK_SUCCESS(status) && status != STATUS_NO_EVENT) continue;
+
+        /* the pool is full or memory ran out, sleep until allocations drain it */
+        wait_queue_lock(&zero_wait, &irqstate);
+
+        wait_queue_wait(&zero_wait, WAIT_INFINITE);
+
+        wait_queue_unlock(&zero_wait, irqstate);
+    }
+}
+
+void mm_zero_pool_wake(void)
+{
+    wait_queue_wake_one(&zero_wait);
+}
+
+status_t mm_start_zero_thread(void)
+{
+    status_t status;
+    struct thread *th;
+
+    if (zero_thread) return STATUS_CONFLICTING_STATE;
+
+    wait_queue_init(&zero_wait);
+
+    status = thread_create(zero_thread_main, ZERO_THREAD_STACK_SIZE, &th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    /* background work, take as little as the fair share allows */
+    thread_set_nice(th, NICE_MAX);
+    thread_detach(th);
+    zero_thread = th;
+
+    LOG_DEBUG("started zeroing thread #%d\n", th->id);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,85 @@
+#include <emos/condvar.h>
+
+#include <string.h>
+
+#include <emos/mutex.h>
+
+status_t condvar_init(struct condvar *cv)
+{
+    memset(cv, 0, sizeof(*cv));
+    wait_queue_init(&cv->waiters);
+
+    return STATUS_SUCCESS;
+}
+
+static status_t wait(struct condvar *cv, struct mutex *mtx, int timed, uint64_t deadline)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t seq, irqstate;
+
+    /* taken before the unlock, a signal sent after it is not missed */
+    wait_queue_lock(&cv->waiters, &irqstate);
+    seq = cv->seq;
+    wait_queue_unlock(&cv->waiters, irqstate);
+
+    /* not with the queue locked, unlocking may yield to a waiter that lost its boost */
+    status = mutex_unlock(mtx);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    wait_queue_lock(&cv->waiters, &irqstate);
+
+    while (cv->seq == seq) {
+        if (timed) {
+            status = wait_queue_wait_until(&cv->waiters, deadline);
+        } else {
+            status = wait_queue_wait(&cv->waiters, WAIT_INFINITE);
+        }
+        if (!CHECK_SUCCESS(status)) break;
+    }
+
+    wait_queue_unlock(&cv->waiters, irqstate);
+
+    mutex_lock(mtx);
+
+    return status;
+}
+
+status_t condvar_wait(struct condvar *cv, struct mutex *mtx)
+{
+    return wait(cv, mtx, 0, 0);
+}
+
+status_t condvar_wait_with_timeout(struct condvar *cv, struct mutex *mtx, int timeout_ms)
+{
+    if (timeout_ms < 0) return condvar_wait(cv, mtx);
+
+    return wait(cv, mtx, 1, wait_queue_get_deadline(timeout_ms));
+}
+
+status_t condvar_signal(struct condvar *cv)
+{
+    uint32_t irqstate;
+
+    wait_queue_lock(&cv->waiters, &irqstate);
+
+    cv->seq++;
+    wait_queue_wake_one_locked(&cv->waiters);
+
+    wait_queue_unlock(&cv->waiters, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t condvar_broadcast(struct condvar *cv)
+{
+    uint32_t irqstate;
+
+    wait_queue_lock(&cv->waiters, &irqstate);
+
+    cv->seq++;
+    wait_queue_wake_all_locked(&cv->waiters);
+
+    wait_queue_unlock(&cv->waiters, irqstate);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#include <emos/event.h>
+
+#include <string.h>
+
+status_t event_init(struct event *ev, int type, int signaled)
+{
+    if (type != EVENT_AUTO_RESET && type != EVENT_MANUAL_RESET) return STATUS_INVALID_VALUE;
+
+    memset(ev, 0, sizeof(*ev));
+    wait_queue_init(&ev->waiters);
+    ev->type = type;
+    ev->signaled = !!signaled;
+
+    return STATUS_SUCCESS;
+}
+
+status_t event_set(struct event *ev)
+{
+    uint32_t irqstate;
+
+    wait_queue_lock(&ev->waiters, &irqstate);
+
+    ev->signaled = 1;
+
+    if (ev->type == EVENT_MANUAL_RESET) {
+        wait_queue_wake_all_locked(&ev->waiters);
+    } else {
+        wait_queue_wake_one_locked(&ev->waiters);
+    }
+
+    wait_queue_unlock(&ev->waiters, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t event_reset(struct event *ev)
+{
+    uint32_t irqstate;
+
+    wait_queue_lock(&ev->waiters, &irqstate);
+    ev->signaled = 0;
+    wait_queue_unlock(&ev->waiters, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+static status_t wait(struct event *ev, int timed, uint64_t deadline)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    wait_queue_lock(&ev->waiters, &irqstate);
+
+    /* another waiter may have taken an auto reset signal before we got to run */
+    while (!ev->signaled) {
+        if (timed) {
+            status = wait_queue_wait_until(&ev->waiters, deadline);
+        } else {
+            status = wait_queue_wait(&ev->waiters, WAIT_INFINITE);
+        }
+        if (!CHECK_SUCCESS(status)) break;
+    }
+
+    if (CHECK_SUCCESS(status) && ev->type == EVENT_AUTO_RESET) {
+        ev->signaled = 0;
+    }
+
+    wait_queue_unlock(&ev->waiters, irqstate);
+
+    return status;
+}
+
+status_t event_wait(struct event *ev)
+{
+    return wait(ev, 0, 0);
+}
+
+status_t event_wait_with_timeout(struct event *ev, int timeout_ms)
+{
+    if (timeout_ms < 0) return event_wait(ev);
+
+    return wait(ev, 1, wait_queue_get_deadline(timeout_ms));
+}
+
+int event_is_set(const struct event *ev)
+{
+    return ev->signaled;
+}
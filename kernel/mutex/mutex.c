@@ -1,91 +1,212 @@
 #include <emos/mutex.h>
 
+#include <string.h>
+
+#include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
+#include <emos/asm/pause.h>
+
 #include <emos/log.h>
 #include <emos/scheduler.h>
 #include <emos/thread.h>
 
 #define MODULE_NAME "mutex"
 
-status_t mutex_init(struct mutex *mtx)
+#define MUTEX_SPIN_LIMIT    1000    /* pause rounds before going to sleep */
+#define MUTEX_CHAIN_LIMIT   8       /* owners boosted through nested mutexes */
+
+static struct thread *get_owner(uintptr_t owner)
 {
-    mtx->locked = 0;
-    mtx->owner = NULL;
-    
-    return STATUS_SUCCESS;
+    return (struct thread *)(owner & ~MUTEX_HAS_WAITERS);
 }
 
-static void add_blocking_thread(struct mutex *mtx, struct thread *th)
+/* takes the mutex if it is unowned, keeping the waiters flag */
+static int try_acquire(struct mutex *mtx, struct thread *th)
 {
-    struct thread *last_blocking_th;
-        
-    LOG_DEBUG("blocking thread #%d\n", th->id);
+    uintptr_t owner = mtx->owner;
 
-    if (mtx->blocking_threads == th) return;
+    if (get_owner(owner)) return 0;
 
-    if (!mtx->blocking_threads) {
-        mtx->blocking_threads = th;
-        th->mutex_blocking_next = NULL;
-        return;
+    return _i686_atomic_cmpxchg32(&mtx->owner, owner, (uintptr_t)th | owner) == owner;
+}
+
+static void set_held(struct mutex *mtx, struct thread *th, int contended, int spun)
+{
+    mtx->held_next = th->held_mutexes;
+    th->held_mutexes = mtx;
+
+    mtx->lock_time = scheduler_clock();
+    mtx->lock_count++;
+    if (contended) {
+        mtx->contended_count++;
+    }
+    if (spun) {
+        mtx->spin_count++;
     }
+}
+
+static void clear_held(struct mutex *mtx, struct thread *th)
+{
+    uint64_t hold_time = scheduler_clock() - mtx->lock_time;
 
-    last_blocking_th = mtx->blocking_threads;
-    while (last_blocking_th) {
-        if (last_blocking_th == th) return;
-        if (!last_blocking_th->mutex_blocking_next) break;
-        last_blocking_th = last_blocking_th->mutex_blocking_next;
+    for (struct mutex **link = &th->held_mutexes; *link; link = &(*link)->held_next) {
+        if (*link == mtx) {
+            *link = mtx->held_next;
+            break;
+        }
     }
+    mtx->held_next = NULL;
 
-    last_blocking_th->mutex_blocking_next = th;
-    th->mutex_blocking_next = NULL;
+    mtx->hold_time_total += hold_time;
+    if (hold_time > mtx->hold_time_max) {
+        mtx->hold_time_max = hold_time;
+    }
 }
 
-static void unblock_blocking_thread(struct mutex *mtx)
+/* an owner that is running now is likely to unlock before a sleep and wakeup would be over */
+static int spin_on_owner(struct mutex *mtx, struct thread *th)
 {
-    struct thread *th_to_unblock;
-
-    if (!mtx->blocking_threads) return;
-    
-    th_to_unblock = mtx->blocking_threads;
-    mtx->blocking_threads = th_to_unblock->mutex_blocking_next;
-        
-    LOG_DEBUG("unblocking thread #%d\n", th_to_unblock->id);
-
-    th_to_unblock->mutex_blocking_next = NULL;
-    if (th_to_unblock->status == TS_BLOCKING) {
-        th_to_unblock->status = TS_RUNNING;
+    struct thread *owner;
+
+    for (int i = 0; i < MUTEX_SPIN_LIMIT; i++) {
+        owner = get_owner(mtx->owner);
+        if (!owner) {
+            if (try_acquire(mtx, th)) return 1;
+            continue;
+        }
+
+        /* with the owner switched out, it cannot unlock while we keep the CPU */
+        if (!scheduler_is_thread_on_cpu(owner)) return 0;
+
+        _i686_pause();
     }
+
+    return 0;
 }
 
-status_t mutex_lock(struct mutex *mtx)
+/* called with the waiters of mtx locked */
+static void boost_owners(struct mutex *mtx, int priority)
+{
+    struct thread *owner;
+
+    for (int i = 0; i < MUTEX_CHAIN_LIMIT && mtx; i++) {
+        owner = get_owner(mtx->owner);
+        if (!owner || scheduler_get_effective_priority(owner) >= priority) break;
+
+        LOG_TRACE("boosting thread #%d to priority %d\n", owner->id, priority);
+
+        scheduler_set_thread_boost(owner, priority);
+
+        /* an owner sleeping on another mutex passes the boost on to that owner */
+        mtx = owner->blocked_on;
+    }
+}
+
+/* returns nonzero if the thread lost a boost */
+static int update_boost(struct thread *th)
+{
+    struct thread *waiter;
+    int priority = 0, prev_priority;
+    uint32_t irqstate;
+
+    /* only the owner changes its list of held mutexes, their waiters are locked one at a time */
+    for (struct mutex *mtx = th->held_mutexes; mtx; mtx = mtx->held_next) {
+        wait_queue_lock(&mtx->waiters, &irqstate);
+
+        waiter = wait_queue_get_first_thread(&mtx->waiters);
+        if (waiter && scheduler_get_effective_priority(waiter) > priority) {
+            priority = scheduler_get_effective_priority(waiter);
+        }
+
+        wait_queue_unlock(&mtx->waiters, irqstate);
+    }
+
+    if (priority == th->boost_priority) return 0;
+
+    prev_priority = scheduler_get_effective_priority(th);
+    scheduler_set_thread_boost(th, priority);
+
+    return scheduler_get_effective_priority(th) < prev_priority;
+}
+
+status_t mutex_init(struct mutex *mtx)
+{
+    memset(mtx, 0, sizeof(*mtx));
+    wait_queue_init_ordered(&mtx->waiters);
+
+    return STATUS_SUCCESS;
+}
+
+static status_t lock(struct mutex *mtx, int timed, uint64_t deadline)
 {
     status_t status;
     struct thread *th;
+    uintptr_t owner;
+    uint32_t irqstate;
 
     status = scheduler_get_current_thread(&th);
     if (!CHECK_SUCCESS(status)) return status;
 
-    thread_disable_preemption();
+    if (try_acquire(mtx, th)) {
+        set_held(mtx, th, 0, 0);
+        return STATUS_SUCCESS;
+    }
 
-    while (mtx->locked) {
-        thread_enable_preemption();
+    if (spin_on_owner(mtx, th)) {
+        set_held(mtx, th, 1, 1);
+        return STATUS_SUCCESS;
+    }
 
-        th->status = TS_BLOCKING;
+    wait_queue_lock(&mtx->waiters, &irqstate);
 
-        add_blocking_thread(mtx, th);
+    while (!try_acquire(mtx, th)) {
+        owner = mtx->owner;
+        if (!get_owner(owner)) continue;
 
-        scheduler_yield();
+        /* the owner has to see the flag before it unlocks, or nobody wakes us */
+        if (!(owner & MUTEX_HAS_WAITERS) &&
+            _i686_atomic_cmpxchg32(&mtx->owner, owner, owner | MUTEX_HAS_WAITERS) != owner) continue;
+
+        LOG_DEBUG("blocking thread #%d\n", th->id);
+
+        th->blocked_on = mtx;
+        boost_owners(mtx, scheduler_get_effective_priority(th));
 
-        thread_disable_preemption();
+        if (timed) {
+            status = wait_queue_wait_until(&mtx->waiters, deadline);
+        } else {
+            status = wait_queue_wait(&mtx->waiters, WAIT_INFINITE);
+        }
+
+        th->blocked_on = NULL;
+
+        /* a boost given for us is taken back when the owner unlocks */
+        if (!CHECK_SUCCESS(status)) {
+            wait_queue_unlock(&mtx->waiters, irqstate);
+
+            return status;
+        }
     }
 
-    mtx->locked = 1;
-    mtx->owner = th;
+    set_held(mtx, th, 1, 0);
 
-    thread_enable_preemption();
+    wait_queue_unlock(&mtx->waiters, irqstate);
 
     return STATUS_SUCCESS;
 }
 
+status_t mutex_lock(struct mutex *mtx)
+{
+    return lock(mtx, 0, 0);
+}
+
+status_t mutex_lock_with_timeout(struct mutex *mtx, int timeout_ms)
+{
+    if (timeout_ms < 0) return mutex_lock(mtx);
+
+    return lock(mtx, 1, wait_queue_get_deadline(timeout_ms));
+}
+
 status_t mutex_try_lock(struct mutex *mtx)
 {
     status_t status;
@@ -93,19 +214,10 @@ status_t mutex_try_lock(struct mutex *mtx)
 
     status = scheduler_get_current_thread(&th);
     if (!CHECK_SUCCESS(status)) return status;
-    
-    thread_disable_preemption();
 
-    if (mtx->locked) {
-        thread_enable_preemption();
+    if (!try_acquire(mtx, th)) return STATUS_MUTEX_LOCKED;
 
-        return STATUS_MUTEX_LOCKED;
-    }
-    
-    mtx->locked = 1;
-    mtx->owner = th;
-
-    thread_enable_preemption();
+    set_held(mtx, th, 0, 0);
 
     return STATUS_SUCCESS;
 }
@@ -114,24 +226,54 @@ status_t mutex_unlock(struct mutex *mtx)
 {
     status_t status;
     struct thread *th;
+    uint32_t irqstate;
+    int unboosted;
 
     status = scheduler_get_current_thread(&th);
     if (!CHECK_SUCCESS(status)) return status;
 
-    thread_disable_preemption();
+    if (get_owner(mtx->owner) != th) return STATUS_INVALID_THREAD;
+
+    clear_held(mtx, th);
+
+    if (_i686_atomic_cmpxchg32(&mtx->owner, (uintptr_t)th, 0) == (uintptr_t)th) return STATUS_SUCCESS;
+
+    wait_queue_lock(&mtx->waiters, &irqstate);
+
+    wait_queue_wake_one_locked(&mtx->waiters);
+
+    /* leave the flag behind for the waiters still sleeping, whoever takes the mutex next inherits it */
+    mtx->owner = wait_queue_is_empty(&mtx->waiters) ? 0 : MUTEX_HAS_WAITERS;
 
-    if (mtx->owner != th) {
-        thread_enable_preemption();
+    wait_queue_unlock(&mtx->waiters, irqstate);
 
-        return STATUS_INVALID_THREAD;
+    unboosted = update_boost(th);
+
+    /* the waiter we ran for is likely the more important one now */
+    if (unboosted) {
+        scheduler_yield();
     }
 
-    mtx->locked = 0;
-    mtx->owner = NULL;
+    return STATUS_SUCCESS;
+}
+
+status_t mutex_get_stat(const struct mutex *mtx, struct mutex_stat *stat)
+{
+    uint32_t irqstate;
+
+    if (!mtx || !stat) return STATUS_INVALID_VALUE;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    stat->owner = get_owner(mtx->owner);
+    stat->lock_count = mtx->lock_count;
+    stat->contended_count = mtx->contended_count;
+    stat->spin_count = mtx->spin_count;
+    stat->hold_time_total = mtx->hold_time_total;
+    stat->hold_time_max = mtx->hold_time_max;
 
-    unblock_blocking_thread(mtx);
-    
-    thread_enable_preemption();
+    interrupt_restore(irqstate);
 
     return STATUS_SUCCESS;
 }
@@ -0,0 +1,153 @@
+#include <emos/rwlock.h>
+
+#include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
+
+#include <emos/smp.h>
+
+status_t rwlock_init(struct rwlock *lock)
+{
+    lock->value = 0;
+
+    return STATUS_SUCCESS;
+}
+
+static int try_acquire_read(struct rwlock *lock)
+{
+    uint32_t value = lock->value;
+
+    if (value & (RWLOCK_WRITER | RWLOCK_WRITER_WAITING)) return 0;
+
+    return _i686_atomic_cmpxchg32(&lock->value, value, value + 1) == value;
+}
+
+/* the waiting flag is dropped along the way, other waiting writers put it back */
+static int try_acquire_write(struct rwlock *lock)
+{
+    uint32_t value = lock->value;
+
+    if (value & (RWLOCK_WRITER | RWLOCK_READER_MASK)) return 0;
+
+    return _i686_atomic_cmpxchg32(&lock->value, value, RWLOCK_WRITER) == value;
+}
+
+static void acquire_read(struct rwlock *lock)
+{
+    while (!try_acquire_read(lock)) {
+        smp_cpu_relax();
+    }
+}
+
+static void acquire_write(struct rwlock *lock)
+{
+    uint32_t value;
+
+    while (!try_acquire_write(lock)) {
+        /* keeps a steady stream of readers from starving the writer */
+        value = lock->value;
+        if (!(value & RWLOCK_WRITER_WAITING)) {
+            _i686_atomic_cmpxchg32(&lock->value, value, value | RWLOCK_WRITER_WAITING);
+        }
+
+        smp_cpu_relax();
+    }
+}
+
+static status_t release_read(struct rwlock *lock)
+{
+    if (!(lock->value & RWLOCK_READER_MASK)) return STATUS_CONFLICTING_STATE;
+
+    _i686_atomic_fetch_add32(&lock->value, (uint32_t)-1);
+
+    return STATUS_SUCCESS;
+}
+
+static status_t release_write(struct rwlock *lock)
+{
+    if (!(lock->value & RWLOCK_WRITER)) return STATUS_CONFLICTING_STATE;
+
+    /* a writer waiting may set its flag meanwhile, so only the writer bit goes */
+    _i686_atomic_fetch_add32(&lock->value, (uint32_t)-RWLOCK_WRITER);
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwlock_read_lock(struct rwlock *lock)
+{
+    acquire_read(lock);
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwlock_read_try_lock(struct rwlock *lock)
+{
+    if (!try_acquire_read(lock)) return STATUS_MUTEX_LOCKED;
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwlock_read_unlock(struct rwlock *lock)
+{
+    return release_read(lock);
+}
+
+status_t rwlock_write_lock(struct rwlock *lock)
+{
+    acquire_write(lock);
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwlock_write_try_lock(struct rwlock *lock)
+{
+    if (!try_acquire_write(lock)) return STATUS_MUTEX_LOCKED;
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwlock_write_unlock(struct rwlock *lock)
+{
+    return release_write(lock);
+}
+
+status_t rwlock_read_lock_irqsave(struct rwlock *lock, uint32_t *irqstate)
+{
+    *irqstate = interrupt_save();
+    interrupt_disable();
+
+    acquire_read(lock);
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwlock_read_unlock_irqrestore(struct rwlock *lock, uint32_t irqstate)
+{
+    status_t status;
+
+    status = release_read(lock);
+
+    interrupt_restore(irqstate);
+
+    return status;
+}
+
+status_t rwlock_write_lock_irqsave(struct rwlock *lock, uint32_t *irqstate)
+{
+    *irqstate = interrupt_save();
+    interrupt_disable();
+
+    acquire_write(lock);
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwlock_write_unlock_irqrestore(struct rwlock *lock, uint32_t irqstate)
+{
+    status_t status;
+
+    status = release_write(lock);
+
+    interrupt_restore(irqstate);
+
+    return status;
+}
@@ -0,0 +1,196 @@
+#include <emos/rwsem.h>
+
+#include <string.h>
+
+#include <emos/scheduler.h>
+#include <emos/thread.h>
+
+status_t rwsem_init(struct rw_semaphore *sem)
+{
+    memset(sem, 0, sizeof(*sem));
+    wait_queue_init(&sem->waiters);
+
+    return STATUS_SUCCESS;
+}
+
+/* called with the waiters locked */
+static int can_read(const struct rw_semaphore *sem)
+{
+    return !sem->writer && !sem->writer_waiting_count;
+}
+
+static int can_write(const struct rw_semaphore *sem)
+{
+    return !sem->writer && !sem->reader_count;
+}
+
+static status_t wait(struct rw_semaphore *sem, int timed, uint64_t deadline)
+{
+    if (timed) return wait_queue_wait_until(&sem->waiters, deadline);
+
+    return wait_queue_wait(&sem->waiters, WAIT_INFINITE);
+}
+
+static status_t read_lock(struct rw_semaphore *sem, int timed, uint64_t deadline)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    while (!can_read(sem)) {
+        status = wait(sem, timed, deadline);
+        if (!CHECK_SUCCESS(status)) break;
+    }
+
+    if (CHECK_SUCCESS(status)) {
+        sem->reader_count++;
+    }
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return status;
+}
+
+static status_t write_lock(struct rw_semaphore *sem, int timed, uint64_t deadline)
+{
+    status_t status = STATUS_SUCCESS;
+    struct thread *th;
+    uint32_t irqstate;
+
+    status = scheduler_get_current_thread(&th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    sem->writer_waiting_count++;
+
+    while (!can_write(sem)) {
+        status = wait(sem, timed, deadline);
+        if (!CHECK_SUCCESS(status)) break;
+    }
+
+    sem->writer_waiting_count--;
+
+    if (CHECK_SUCCESS(status)) {
+        sem->writer = th;
+    } else if (!sem->writer_waiting_count) {
+        /* readers held back for us may go now */
+        wait_queue_wake_all_locked(&sem->waiters);
+    }
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return status;
+}
+
+status_t rwsem_read_lock(struct rw_semaphore *sem)
+{
+    return read_lock(sem, 0, 0);
+}
+
+status_t rwsem_read_lock_with_timeout(struct rw_semaphore *sem, int timeout_ms)
+{
+    if (timeout_ms < 0) return rwsem_read_lock(sem);
+
+    return read_lock(sem, 1, wait_queue_get_deadline(timeout_ms));
+}
+
+status_t rwsem_read_try_lock(struct rw_semaphore *sem)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    if (can_read(sem)) {
+        sem->reader_count++;
+    } else {
+        status = STATUS_MUTEX_LOCKED;
+    }
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return status;
+}
+
+status_t rwsem_read_unlock(struct rw_semaphore *sem)
+{
+    uint32_t irqstate;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    if (!sem->reader_count) {
+        wait_queue_unlock(&sem->waiters, irqstate);
+        return STATUS_CONFLICTING_STATE;
+    }
+
+    /* only a writer can be waiting on readers */
+    if (!--sem->reader_count && sem->writer_waiting_count) {
+        wait_queue_wake_all_locked(&sem->waiters);
+    }
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t rwsem_write_lock(struct rw_semaphore *sem)
+{
+    return write_lock(sem, 0, 0);
+}
+
+status_t rwsem_write_lock_with_timeout(struct rw_semaphore *sem, int timeout_ms)
+{
+    if (timeout_ms < 0) return rwsem_write_lock(sem);
+
+    return write_lock(sem, 1, wait_queue_get_deadline(timeout_ms));
+}
+
+status_t rwsem_write_try_lock(struct rw_semaphore *sem)
+{
+    status_t status;
+    struct thread *th;
+    uint32_t irqstate;
+
+    status = scheduler_get_current_thread(&th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    if (can_write(sem)) {
+        sem->writer = th;
+    } else {
+        status = STATUS_MUTEX_LOCKED;
+    }
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return status;
+}
+
+status_t rwsem_write_unlock(struct rw_semaphore *sem)
+{
+    status_t status;
+    struct thread *th;
+    uint32_t irqstate;
+
+    status = scheduler_get_current_thread(&th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    if (sem->writer != th) {
+        wait_queue_unlock(&sem->waiters, irqstate);
+        return STATUS_INVALID_THREAD;
+    }
+
+    sem->writer = NULL;
+
+    /* the next writer and every reader race for it, a waiting writer still keeps the readers out */
+    wait_queue_wake_all_locked(&sem->waiters);
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include <emos/semaphore.h>
+
+#include <string.h>
+
+status_t semaphore_init(struct semaphore *sem, int count)
+{
+    if (count < 0) return STATUS_INVALID_VALUE;
+
+    memset(sem, 0, sizeof(*sem));
+    wait_queue_init(&sem->waiters);
+    sem->count = count;
+
+    return STATUS_SUCCESS;
+}
+
+static status_t down(struct semaphore *sem, int timed, uint64_t deadline)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    /* a thread coming in between the up and the wakeup may take the count, then it is back to sleep */
+    while (!sem->count) {
+        if (timed) {
+            status = wait_queue_wait_until(&sem->waiters, deadline);
+        } else {
+            status = wait_queue_wait(&sem->waiters, WAIT_INFINITE);
+        }
+        if (!CHECK_SUCCESS(status)) break;
+    }
+
+    if (CHECK_SUCCESS(status)) {
+        sem->count--;
+    }
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return status;
+}
+
+status_t semaphore_down(struct semaphore *sem)
+{
+    return down(sem, 0, 0);
+}
+
+status_t semaphore_down_with_timeout(struct semaphore *sem, int timeout_ms)
+{
+    if (timeout_ms < 0) return semaphore_down(sem);
+
+    return down(sem, 1, wait_queue_get_deadline(timeout_ms));
+}
+
+status_t semaphore_try_down(struct semaphore *sem)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    if (sem->count) {
+        sem->count--;
+    } else {
+        status = STATUS_MUTEX_LOCKED;
+    }
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return status;
+}
+
+status_t semaphore_up(struct semaphore *sem)
+{
+    uint32_t irqstate;
+
+    wait_queue_lock(&sem->waiters, &irqstate);
+
+    sem->count++;
+    wait_queue_wake_one_locked(&sem->waiters);
+
+    wait_queue_unlock(&sem->waiters, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+int semaphore_get_count(const struct semaphore *sem)
+{
+    return sem->count;
+}
@@ -2,40 +2,56 @@
 
 #include <emos/scheduler.h>
 #include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
+
+#include <emos/smp.h>
 
 extern int _pc_irq_level;
 
 status_t spinlock_init(struct spinlock *lock)
 {
-    lock->locked = 0;
+    lock->ticket = 0;
     lock->owner = NULL;
 
     return STATUS_SUCCESS;
 }
 
-status_t spinlock_lock(struct spinlock *lock)
+static void acquire(struct spinlock *lock, struct thread *th)
 {
-    status_t status;
-    struct thread *th;
-
-    status = scheduler_get_current_thread(&th);
-    if (!CHECK_SUCCESS(status)) return status;
+    uint16_t ticket;
 
-    thread_disable_preemption();
+    ticket = _i686_atomic_fetch_add16(&lock->next, 1);
 
-    while (lock->locked) {
-        /* busy wait */
+    while (lock->serving != ticket) {
+        smp_cpu_relax();
     }
 
-    lock->locked = 1;
     lock->owner = th;
+}
+
+static int try_acquire(struct spinlock *lock, struct thread *th)
+{
+    uint32_t ticket = lock->ticket;
 
-    thread_enable_preemption();
+    /* only take a ticket if it is served right away */
+    if ((ticket & 0xFFFF) != (ticket >> 16)) return 0;
+    if (_i686_atomic_cmpxchg32(&lock->ticket, ticket, ticket + 0x10000) != ticket) return 0;
 
-    return STATUS_SUCCESS;
+    lock->owner = th;
+
+    return 1;
 }
 
-status_t spinlock_try_lock(struct spinlock *lock)
+static void release(struct spinlock *lock)
+{
+    lock->owner = NULL;
+
+    /* only the holder moves serving on, a plain store is enough */
+    _i686_compiler_barrier();
+    lock->serving = lock->serving + 1;
+}
+
+status_t spinlock_lock(struct spinlock *lock)
 {
     status_t status;
     struct thread *th;
@@ -43,17 +59,20 @@ status_t spinlock_try_lock(struct spinlock *lock)
     status = scheduler_get_current_thread(&th);
     if (!CHECK_SUCCESS(status)) return status;
 
-    thread_disable_preemption();
+    acquire(lock, th);
 
-    if (lock->locked) {
-        thread_enable_preemption();
-        return STATUS_MUTEX_LOCKED;
-    }
+    return STATUS_SUCCESS;
+}
 
-    lock->locked = 1;
-    lock->owner = th;
+status_t spinlock_try_lock(struct spinlock *lock)
+{
+    status_t status;
+    struct thread *th;
 
-    thread_enable_preemption();
+    status = scheduler_get_current_thread(&th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    if (!try_acquire(lock, th)) return STATUS_MUTEX_LOCKED;
 
     return STATUS_SUCCESS;
 }
@@ -66,17 +85,28 @@ status_t spinlock_unlock(struct spinlock *lock)
     status = scheduler_get_current_thread(&th);
     if (!CHECK_SUCCESS(status)) return status;
 
-    thread_disable_preemption();
+    if (lock->owner != th) return STATUS_INVALID_THREAD;
 
-    if (lock->owner != th) {
-        thread_enable_preemption();
-        return STATUS_INVALID_THREAD;
-    }
+    release(lock);
 
-    lock->locked = 0;
-    lock->owner = NULL;
+    return STATUS_SUCCESS;
+}
 
-    thread_enable_preemption();
+status_t spinlock_lock_irqsave(struct spinlock *lock, uint32_t *irqstate)
+{
+    status_t status;
+    struct thread *th;
+
+    *irqstate = interrupt_save();
+    interrupt_disable();
+
+    status = scheduler_get_current_thread(&th);
+    if (!CHECK_SUCCESS(status)) {
+        interrupt_restore(*irqstate);
+        return status;
+    }
+
+    acquire(lock, th);
 
     return STATUS_SUCCESS;
 }
@@ -95,14 +125,11 @@ status_t spinlock_try_lock_irqsave(struct spinlock *lock, uint32_t *irqstate)
         return status;
     }
 
-    if (lock->locked) {
+    if (!try_acquire(lock, th)) {
         interrupt_restore(*irqstate);
         return STATUS_MUTEX_LOCKED;
     }
 
-    lock->locked = 1;
-    lock->owner = th;
-
     return STATUS_SUCCESS;
 }
 
@@ -119,8 +146,7 @@ status_t spinlock_unlock_irqrestore(struct spinlock *lock, uint32_t irqstate)
         return STATUS_INVALID_THREAD;
     }
 
-    lock->locked = 0;
-    lock->owner = NULL;
+    release(lock);
 
     interrupt_restore(irqstate);
 
@@ -0,0 +1,218 @@
+#include <emos/rcu.h>
+
+#include <string.h>
+
+#include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
+
+#include <emos/thread.h>
+#include <emos/scheduler.h>
+#include <emos/spinlock.h>
+#include <emos/workqueue.h>
+#include <emos/clock.h>
+#include <emos/smp.h>
+
+#define RCU_POLL_INTERVAL   1000000     /* ns between checks on the other processors */
+
+static volatile uint32_t gp_seq = 0;    /* grace periods started */
+
+/* gp_seq as the processor last went through the scheduler */
+static volatile uint32_t cpu_seq[SMP_MAX_CPU_COUNT];
+
+static int read_depth[SMP_MAX_CPU_COUNT];
+static int read_preemption_enabled[SMP_MAX_CPU_COUNT];
+
+static struct spinlock callback_lock;
+static struct rcu_head *first_callback = NULL, *last_callback = NULL;
+
+static void run_callbacks(struct work *work, void *data);
+
+static struct work callback_work = {
+    .func = run_callbacks,
+};
+
+static struct spinlock stat_lock;
+static size_t grace_period_count = 0;
+static size_t callback_count = 0;
+static uint64_t wait_time_total = 0;
+static uint64_t wait_time_max = 0;
+
+void rcu_read_lock(void)
+{
+    uint32_t irqstate;
+    int cpu;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    cpu = smp_get_cpu_index();
+
+    /* the outermost section decides what preemption goes back to */
+    if (read_depth[cpu]++ == 0) {
+        read_preemption_enabled[cpu] = thread_is_preemption_enabled();
+        thread_disable_preemption();
+    }
+
+    interrupt_restore(irqstate);
+}
+
+void rcu_read_unlock(void)
+{
+    uint32_t irqstate;
+    int cpu;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    cpu = smp_get_cpu_index();
+
+    if (read_depth[cpu] > 0 && --read_depth[cpu] == 0 && read_preemption_enabled[cpu]) {
+        thread_enable_preemption();
+    }
+
+    interrupt_restore(irqstate);
+}
+
+void rcu_note_quiescent_state(void)
+{
+    cpu_seq[smp_get_cpu_index()] = gp_seq;
+}
+
+/* stays correct when the sequence wraps around */
+static int seq_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static int is_cpu_quiescent(int cpu, uint32_t seq)
+{
+    return !smp_is_cpu_online(cpu) || !seq_before(cpu_seq[cpu], seq);
+}
+
+status_t synchronize_rcu(void)
+{
+    status_t status;
+    uint32_t seq, irqstate;
+    uint64_t start, elapsed;
+    int done;
+
+    start = clock_get_monotonic_ns();
+
+    /* the full barrier of the increment orders it after the caller unlinked the old data */
+    seq = _i686_atomic_fetch_add32(&gp_seq, 1) + 1;
+
+    /* the caller is outside any read section, so is the processor it runs on */
+    irqstate = interrupt_save();
+    interrupt_disable();
+    cpu_seq[smp_get_cpu_index()] = seq;
+    interrupt_restore(irqstate);
+
+    for (;;) {
+        done = 1;
+
+        for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+            if (is_cpu_quiescent(i, seq)) continue;
+
+            /* an idle processor sleeps until something wakes it */
+            smp_send_reschedule(i);
+            done = 0;
+        }
+
+        if (done) break;
+
+        status = thread_sleep(RCU_POLL_INTERVAL);
+        if (!CHECK_SUCCESS(status)) return status;
+    }
+
+    elapsed = clock_get_monotonic_ns() - start;
+
+    spinlock_lock_irqsave(&stat_lock, &irqstate);
+
+    grace_period_count++;
+    wait_time_total += elapsed;
+    if (elapsed > wait_time_max) {
+        wait_time_max = elapsed;
+    }
+
+    spinlock_unlock_irqrestore(&stat_lock, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+/* one grace period covers everything queued before it started */
+static void run_callbacks(struct work *work, void *data)
+{
+    struct rcu_head *head, *next;
+    uint32_t irqstate;
+    size_t count = 0;
+
+    spinlock_lock_irqsave(&callback_lock, &irqstate);
+
+    head = first_callback;
+    first_callback = NULL;
+    last_callback = NULL;
+
+    spinlock_unlock_irqrestore(&callback_lock, irqstate);
+
+    if (!head) return;
+
+    synchronize_rcu();
+
+    for (; head; head = next) {
+        next = head->next;
+        head->func(head);
+        count++;
+    }
+
+    spinlock_lock_irqsave(&stat_lock, &irqstate);
+    callback_count += count;
+    spinlock_unlock_irqrestore(&stat_lock, irqstate);
+}
+
+status_t call_rcu(struct rcu_head *head, rcu_func_t func)
+{
+    status_t status;
+    uint32_t irqstate;
+
+    if (!head || !func) return STATUS_INVALID_VALUE;
+
+    if (!workqueue_get_system()) return STATUS_CONFLICTING_STATE;
+
+    head->next = NULL;
+    head->func = func;
+
+    status = spinlock_lock_irqsave(&callback_lock, &irqstate);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    if (last_callback) {
+        last_callback->next = head;
+    } else {
+        first_callback = head;
+    }
+    last_callback = head;
+
+    spinlock_unlock_irqrestore(&callback_lock, irqstate);
+
+    /* already pending work takes the new callback along */
+    return workqueue_queue(workqueue_get_system(), &callback_work);
+}
+
+status_t rcu_get_stat(struct rcu_stat *stat)
+{
+    uint32_t irqstate;
+
+    if (!stat) return STATUS_INVALID_VALUE;
+
+    memset(stat, 0, sizeof(*stat));
+
+    spinlock_lock_irqsave(&stat_lock, &irqstate);
+
+    stat->grace_period_count = grace_period_count;
+    stat->callback_count = callback_count;
+    stat->wait_time_total = wait_time_total;
+    stat->wait_time_max = wait_time_max;
+
+    spinlock_unlock_irqrestore(&stat_lock, irqstate);
+
+    return STATUS_SUCCESS;
+}
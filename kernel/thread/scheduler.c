@@ -1,40 +1,384 @@
 #include <emos/scheduler.h>
 
+#include <emos/asm/interrupt.h>
+
+#include <emos/avltree.h>
+#include <emos/spinlock.h>
+#include <emos/smp.h>
+#include <emos/percpu.h>
+#include <emos/tick.h>
+#include <emos/clock.h>
+#include <emos/rcu.h>
 #include <emos/panic.h>
 #include <emos/log.h>
 
 #define MODULE_NAME "scheduler"
 
+#define NICE_0_WEIGHT       1024
+
+/* keep fractions of a nanosecond, the clock is as coarse as a timer tick until a source is registered */
+#define VRUNTIME_SHIFT      10
+
+/* ticks between balancing runs of a processor that has work of its own */
+#define BALANCE_INTERVAL    (SCHEDULER_TICK_RATE / 10)
+
+/* one per processor, runnable threads only, the running one is taken off until it is switched out */
+struct run_queue {
+    struct spinlock lock;
+
+    struct percpu *percpu;  /* of the processor the queue belongs to, which keeps its current thread */
+    struct thread *idle;    /* runs when nothing else does, the main thread on the boot processor */
+    struct thread *prev;    /* switched out, but its context is not saved until the switch is over */
+
+    struct thread *heads[TP_COUNT];
+    struct thread *tails[TP_COUNT];
+    uint32_t bitmap;        /* bit n is set while level n has queued threads */
+    size_t count;           /* queued threads other than the idle one */
+
+    struct avl_tree fair_tree;  /* fair threads ordered by virtual runtime, served at TP_NORMAL */
+    uint64_t min_vruntime;      /* never goes backwards, woken threads start from here */
+
+    uint64_t last_balance_tick;
+};
+
+/* each nice level is worth about 10% of CPU time against its neighbour */
+static const uint32_t nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
+
+static struct spinlock thread_list_lock;
 static struct thread *volatile first_thread = NULL;
-static struct thread *volatile current_thread = NULL;
+
+static struct run_queue run_queues[SMP_MAX_CPU_COUNT];
+static int run_queues_ready = 0;
+
+uint64_t scheduler_clock(void)
+{
+    return clock_get_monotonic_ns();
+}
+
+/* stays correct when the counters wrap around */
+static int vruntime_before(uint64_t a, uint64_t b)
+{
+    return (int64_t)(a - b) < 0;
+}
+
+static int compare_vruntime(const struct avl_node *a, const struct avl_node *b)
+{
+    const struct thread *tha = AVL_ENTRY(a, struct thread, fair_node);
+    const struct thread *thb = AVL_ENTRY(b, struct thread, fair_node);
+
+    /* equal ones go right, so that they take turns */
+    return vruntime_before(tha->vruntime, thb->vruntime) ? -1 : 1;
+}
+
+/* the boot processor adds the main thread before any other one runs */
+static void init_run_queues(void)
+{
+    spinlock_init(&thread_list_lock);
+
+    for (int cpu = 0; cpu < SMP_MAX_CPU_COUNT; cpu++) {
+        spinlock_init(&run_queues[cpu].lock);
+        avl_init(&run_queues[cpu].fair_tree, compare_vruntime);
+
+        run_queues[cpu].percpu = percpu_get(cpu);
+        run_queues[cpu].percpu->run_queue = &run_queues[cpu];
+    }
+
+    run_queues_ready = 1;
+}
+
+static struct thread *first_fair_thread(struct run_queue *rq)
+{
+    struct avl_node *node = avl_first(&rq->fair_tree);
+
+    return node ? AVL_ENTRY(node, struct thread, fair_node) : NULL;
+}
+
+static void update_min_vruntime(struct run_queue *rq)
+{
+    struct thread *first = first_fair_thread(rq);
+    struct thread *current = rq->percpu->current_thread;
+    uint64_t vruntime;
+    int found = 0;
+
+    if (current && current->sched_class == TC_FAIR && !current->queued) {
+        vruntime = current->vruntime;
+        found = 1;
+    }
+
+    if (first && (!found || vruntime_before(first->vruntime, vruntime))) {
+        vruntime = first->vruntime;
+        found = 1;
+    }
+
+    if (found && vruntime_before(rq->min_vruntime, vruntime)) {
+        rq->min_vruntime = vruntime;
+    }
+}
+
+/* charge the time since the current thread was switched in */
+static void update_current(struct run_queue *rq, uint64_t now)
+{
+    struct thread *current = rq->percpu->current_thread;
+    uint64_t delta;
+
+    if (!current) return;
+
+    delta = now - current->exec_start;
+    current->exec_start = now;
+    current->runtime += delta;
+
+    if (current->sched_class == TC_FAIR) {
+        if (current->weight == NICE_0_WEIGHT) {
+            current->vruntime += delta << VRUNTIME_SHIFT;
+        } else {
+            current->vruntime += (delta << VRUNTIME_SHIFT) * NICE_0_WEIGHT / current->weight;
+        }
+    }
+
+    update_min_vruntime(rq);
+}
+
+static int base_priority(const struct thread *th)
+{
+    return th->sched_class == TC_FAIR ? TP_NORMAL : th->priority;
+}
+
+/* a boosted fair thread leaves the fair tree and queues first come first served at the inherited level */
+static int is_boosted(const struct thread *th)
+{
+    return th->boost_priority > base_priority(th);
+}
+
+int scheduler_get_effective_priority(const struct thread *th)
+{
+    return is_boosted(th) ? th->boost_priority : base_priority(th);
+}
+
+static int is_idle_thread(const struct thread *th)
+{
+    return th->type == TT_MAIN || th->type == TT_IDLE;
+}
+
+static void enqueue_thread(struct run_queue *rq, struct thread *th)
+{
+    int priority = scheduler_get_effective_priority(th);
+
+    th->enqueue_time = scheduler_clock();
+
+    if (th->sched_class == TC_FAIR && !is_boosted(th)) {
+        /* sleeping does not bank CPU time to burst with later */
+        if (vruntime_before(th->vruntime, rq->min_vruntime)) {
+            th->vruntime = rq->min_vruntime;
+        }
+
+        avl_insert(&rq->fair_tree, &th->fair_node);
+    } else {
+        th->run_next = NULL;
+        th->run_prev = rq->tails[priority];
+
+        if (rq->tails[priority]) {
+            rq->tails[priority]->run_next = th;
+        } else {
+            rq->heads[priority] = th;
+        }
+        rq->tails[priority] = th;
+    }
+
+    rq->bitmap |= 1UL << priority;
+    if (!is_idle_thread(th)) {
+        rq->count++;
+    }
+
+    th->queued = 1;
+}
+
+static void dequeue_thread(struct run_queue *rq, struct thread *th)
+{
+    int priority = scheduler_get_effective_priority(th);
+
+    if (th->sched_class == TC_FAIR && !is_boosted(th)) {
+        avl_remove(&rq->fair_tree, &th->fair_node);
+    } else {
+        if (th->run_prev) {
+            th->run_prev->run_next = th->run_next;
+        } else {
+            rq->heads[priority] = th->run_next;
+        }
+
+        if (th->run_next) {
+            th->run_next->run_prev = th->run_prev;
+        } else {
+            rq->tails[priority] = th->run_prev;
+        }
+
+        th->run_next = th->run_prev = NULL;
+    }
+
+    if (!rq->heads[priority] && (priority != TP_NORMAL || !rq->fair_tree.root)) {
+        rq->bitmap &= ~(1UL << priority);
+    }
+    if (!is_idle_thread(th)) {
+        rq->count--;
+    }
+
+    th->queued = 0;
+}
+
+static int is_runnable(const struct thread *th)
+{
+    return th->status == TS_RUNNING || th->status == TS_PENDING;
+}
+
+/* the run queue of a thread changes while it migrates, so check it again once it is locked */
+static struct run_queue *lock_thread_run_queue(struct thread *th, uint32_t *irqstate)
+{
+    struct run_queue *rq;
+
+    for (;;) {
+        rq = &run_queues[th->cpu];
+        spinlock_lock_irqsave(&rq->lock, irqstate);
+
+        if (rq == &run_queues[th->cpu]) return rq;
+
+        spinlock_unlock_irqrestore(&rq->lock, *irqstate);
+    }
+}
+
+/* read without the lock, only a hint for placing threads */
+static size_t get_load(int cpu)
+{
+    struct run_queue *rq = &run_queues[cpu];
+
+    return rq->count + (rq->percpu->current_thread && rq->percpu->current_thread != rq->idle);
+}
+
+/* the least loaded processor, the current one on ties */
+static int select_cpu(void)
+{
+    int cpu = smp_get_cpu_index();
+    size_t load = get_load(cpu);
+
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        if (!smp_is_cpu_online(i) || get_load(i) >= load) continue;
+
+        cpu = i;
+        load = get_load(i);
+    }
+
+    return cpu;
+}
+
+/* a processor that idles or runs something less important has to look at its queue now, called with rq locked */
+static void kick_cpu(struct run_queue *rq, struct thread *th)
+{
+    int cpu = rq - run_queues;
+
+    if (cpu == smp_get_cpu_index()) return;
+
+    if (rq->percpu->current_thread == rq->idle || scheduler_get_effective_priority(th) > scheduler_get_effective_priority(rq->percpu->current_thread)) {
+        smp_send_reschedule(cpu);
+        return;
+    }
+
+    /* an equal one still needs the tick to get a slice */
+    if (tick_is_stopped(cpu)) {
+        smp_send_reschedule(cpu);
+    }
+}
 
 status_t scheduler_add_thread(struct thread *th)
 {
-    LOG_DEBUG("thread #%d added to scheduler\n", th->id);
+    struct run_queue *rq;
+    uint32_t irqstate;
+
+    if (th->priority < 0 || th->priority >= TP_COUNT) return STATUS_INVALID_VALUE;
+    if (th->nice < NICE_MIN || th->nice > NICE_MAX) return STATUS_INVALID_VALUE;
+
+    if (!run_queues_ready) {
+        init_run_queues();
+    }
+
+    th->weight = nice_to_weight[th->nice - NICE_MIN];
+    th->on_cpu = 0;
+
+    spinlock_lock_irqsave(&thread_list_lock, &irqstate);
 
+    th->prev = NULL;
     th->next = first_thread;
+    if (first_thread) {
+        first_thread->prev = th;
+    }
     first_thread = th;
 
+    /* an idle thread belongs to the processor it is made on */
+    th->cpu = is_idle_thread(th) ? smp_get_cpu_index() : select_cpu();
+
+    spinlock_unlock(&thread_list_lock);
+
+    rq = &run_queues[th->cpu];
+    spinlock_lock(&rq->lock);
+
+    th->vruntime = rq->min_vruntime;
+
+    if (is_runnable(th) && th != rq->percpu->current_thread) {
+        enqueue_thread(rq, th);
+        kick_cpu(rq, th);
+        tick_update();
+    }
+
+    spinlock_unlock_irqrestore(&rq->lock, irqstate);
+
+    LOG_DEBUG("thread #%d added to scheduler on cpu %d\n", th->id, th->cpu);
+
     return STATUS_SUCCESS;
 }
 
 status_t scheduler_remove_thread(struct thread *th)
 {
+    struct run_queue *rq;
+    uint32_t irqstate;
+
     if (th->status != TS_FINISHED) {
         return STATUS_THREAD_NOT_FINISHED;
     }
 
-    if (th == first_thread) {
-        current_thread = th->next;
+    /* a thread that has just exited on another processor may still be on its way out */
+    while (th->on_cpu) {
+        smp_cpu_relax();
     }
 
-    for (struct thread *current = first_thread; current->next; current = current->next) {
-        if (th == current->next) {
-            current->next = th->next;
-            break;
-        }
+    rq = lock_thread_run_queue(th, &irqstate);
+
+    if (th->queued) {
+        dequeue_thread(rq, th);
+    }
+
+    spinlock_unlock(&rq->lock);
+    spinlock_lock(&thread_list_lock);
+
+    if (th->prev) {
+        th->prev->next = th->next;
+    } else {
+        first_thread = th->next;
+    }
+
+    if (th->next) {
+        th->next->prev = th->prev;
     }
 
+    th->next = th->prev = NULL;
+
+    spinlock_unlock_irqrestore(&thread_list_lock, irqstate);
+
     LOG_DEBUG("thread #%d removed from scheduler\n", th->id);
 
     return STATUS_SUCCESS;
@@ -42,119 +386,340 @@ status_t scheduler_remove_thread(struct thread *th)
 
 status_t scheduler_get_current_thread(struct thread **current)
 {
-    if (current) *current = current_thread;
+    /* a single read, whichever processor the thread is on has it as the current one */
+    if (current) *current = this_cpu_read(current_thread);
 
     return STATUS_SUCCESS;
 }
 
-status_t scheduler_get_next_thread(struct thread **next)
+static int can_migrate(const struct thread *th)
+{
+    return !th->on_cpu && !is_idle_thread(th);
+}
+
+/* the most important thread that may leave, fair ones from the back of the tree */
+static struct thread *find_migratable_thread(struct run_queue *rq)
 {
-    struct thread *next_thread = current_thread;
-    
-    do {
-        next_thread = next_thread->next;
-        if (!next_thread) {
-            next_thread = first_thread;
+    struct avl_node *node;
+    struct thread *th;
+
+    for (int priority = TP_COUNT - 1; priority >= 0; priority--) {
+        if (!(rq->bitmap & (1UL << priority))) continue;
+
+        for (th = rq->tails[priority]; th; th = th->run_prev) {
+            if (can_migrate(th)) return th;
         }
-    } while (next_thread->status != TS_RUNNING && next_thread->status != TS_PENDING);
-    
+
+        if (priority != TP_NORMAL) continue;
+
+        for (node = avl_last(&rq->fair_tree); node; node = avl_prev(node)) {
+            th = AVL_ENTRY(node, struct thread, fair_node);
+            if (can_migrate(th)) return th;
+        }
+    }
+
+    return NULL;
+}
+
+/* pull a thread over from the busiest processor, called with rq locked */
+static void balance(struct run_queue *rq, int cpu)
+{
+    struct run_queue *busiest = NULL;
+    struct thread *th;
+    uint64_t tick = get_global_tick();
+    uint64_t vruntime_lag;
+    size_t load, busiest_load = 0;
+
+    /* a processor without work looks on every switch, a busy one only now and then */
+    if (rq->count > 0 && tick - rq->last_balance_tick < BALANCE_INTERVAL) return;
+    rq->last_balance_tick = tick;
+
+    /* the loads of the others are only read, a stale one just makes for a worse pick */
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        if (i == cpu || !smp_is_cpu_online(i)) continue;
+
+        load = get_load(i);
+        if (run_queues[i].count > 0 && load > busiest_load) {
+            busiest = &run_queues[i];
+            busiest_load = load;
+        }
+    }
+
+    /* the preempted thread is queued again by now, so the count is the whole load here */
+    if (!busiest || busiest_load < rq->count + 2) return;
+
+    /* two processors pulling from each other would deadlock on a plain lock */
+    if (!CHECK_SUCCESS(spinlock_try_lock(&busiest->lock))) return;
+
+    th = find_migratable_thread(busiest);
+    if (th) {
+        dequeue_thread(busiest, th);
+
+        /* keep the distance to the others, the virtual clocks of the queues are unrelated */
+        vruntime_lag = th->vruntime - busiest->min_vruntime;
+        th->vruntime = rq->min_vruntime + vruntime_lag;
+        th->cpu = cpu;
+
+        enqueue_thread(rq, th);
+
+        LOG_TRACE("thread #%d pulled over to cpu %d\n", th->id, cpu);
+    }
+
+    spinlock_unlock(&busiest->lock);
+}
+
+/* called on every switch with interrupts disabled, the thread returned is the current one from now on */
+status_t scheduler_get_next_thread(struct thread **next)
+{
+    int cpu = this_cpu_read(cpu);
+    struct run_queue *rq = this_cpu_read(run_queue);
+    struct thread *prev, *next_thread;
+    uint64_t now = scheduler_clock();
+    int priority;
+
+    /* nobody switches with preemption disabled, so no read section is open here */
+    rcu_note_quiescent_state();
+
+    spinlock_lock(&rq->lock);
+
+    prev = rq->percpu->current_thread;
+
+    update_current(rq, now);
+
+    /* a preempted thread goes behind the others of its level */
+    if (prev && prev->status == TS_RUNNING && !prev->queued) {
+        enqueue_thread(rq, prev);
+    }
+
+    if (smp_get_cpu_count() > 1) {
+        balance(rq, cpu);
+    }
+
+    if (!rq->bitmap) {
+        spinlock_unlock(&rq->lock);
+        return STATUS_ENTRY_NOT_FOUND;
+    }
+
+    priority = 31 - __builtin_clz(rq->bitmap);
+    next_thread = rq->heads[priority];
+    if (!next_thread) {
+        /* fixed threads of the fair level go first */
+        next_thread = first_fair_thread(rq);
+    }
+    dequeue_thread(rq, next_thread);
+
+    rq->prev = NULL;
+    if (next_thread != prev) {
+        next_thread->wait_time += now - next_thread->enqueue_time;
+        next_thread->switch_count++;
+        next_thread->on_cpu = 1;
+
+        rq->prev = prev;
+    }
+    next_thread->exec_start = now;
+
+    rq->percpu->current_thread = next_thread;
+
+    /* whoever holds the lock is the current thread, and that has just changed */
+    rq->lock.owner = next_thread;
+    spinlock_unlock(&rq->lock);
+
     if (next) *next = next_thread;
 
     return STATUS_SUCCESS;
 }
 
+/* called on the stack of the next thread, once the previous one can be picked up elsewhere */
+void scheduler_finish_switch(void)
+{
+    struct run_queue *rq = this_cpu_read(run_queue);
+
+    if (rq->prev) {
+        rq->prev->on_cpu = 0;
+        rq->prev = NULL;
+    }
+}
+
+/* make the context the processor runs in right now a thread */
 status_t scheduler_set_current_thread(struct thread *th)
 {
-    current_thread = th;
+    int cpu = smp_get_cpu_index();
+    struct run_queue *rq = &run_queues[cpu];
+    uint64_t now = scheduler_clock();
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&rq->lock, &irqstate);
+
+    if (th->queued) {
+        dequeue_thread(rq, th);
+    }
+
+    if (th != rq->percpu->current_thread) {
+        th->wait_time += now - th->enqueue_time;
+        th->switch_count++;
+    }
+    th->exec_start = now;
+    th->on_cpu = 1;
+    th->cpu = cpu;
+
+    if (is_idle_thread(th)) {
+        rq->idle = th;
+    }
+
+    rq->percpu->current_thread = th;
+
+    rq->lock.owner = th;
+    spinlock_unlock_irqrestore(&rq->lock, irqstate);
 
     return STATUS_SUCCESS;
 }
 
+int scheduler_is_thread_on_cpu(const struct thread *th)
+{
+    return th->on_cpu;
+}
+
 int scheduler_has_other_runnable_thread(void)
 {
-    int result = 0;
+    /* the idle thread is never work that someone has to wait for, the queue may not be set up yet */
+    return run_queues[this_cpu_read(cpu)].count > 0;
+}
 
-    for (struct thread *current = first_thread; current; current = current->next) {
-        if (current == current_thread) continue;
+status_t scheduler_wake_thread(struct thread *th)
+{
+    struct run_queue *rq;
+    uint32_t irqstate;
+    uint64_t vruntime_lag;
+    int cpu;
+
+    rq = lock_thread_run_queue(th, &irqstate);
+
+    if (th->status != TS_BLOCKING && th->status != TS_WAITING) {
+        spinlock_unlock_irqrestore(&rq->lock, irqstate);
+        return STATUS_CONFLICTING_STATE;
+    }
 
-        if (current->status == TS_RUNNING || current->status == TS_PENDING) {
-            result = 1;
-        } 
+    th->status = TS_RUNNING;
+
+    /* a thread woken before it managed to switch out is still the current one */
+    if (th == rq->percpu->current_thread || th->queued) {
+        spinlock_unlock_irqrestore(&rq->lock, irqstate);
+        return STATUS_SUCCESS;
     }
 
-    return result;
+    /* rather go to an idle processor than wait behind others, unless the context is still being saved */
+    if (!th->on_cpu && get_load(th->cpu) > 0) {
+        cpu = select_cpu();
+
+        if (cpu != th->cpu && get_load(cpu) == 0) {
+            vruntime_lag = th->vruntime - rq->min_vruntime;
+            th->cpu = cpu;
+
+            spinlock_unlock(&rq->lock);
+            rq = &run_queues[cpu];
+            spinlock_lock(&rq->lock);
+
+            th->vruntime = rq->min_vruntime + vruntime_lag;
+        }
+    }
+
+    enqueue_thread(rq, th);
+    kick_cpu(rq, th);
+    tick_update();
+
+    spinlock_unlock_irqrestore(&rq->lock, irqstate);
+
+    return STATUS_SUCCESS;
 }
 
-status_t scheduler_yield(void)
+static void change_thread_class(struct thread *th, int sched_class, int priority, int nice)
 {
-    asm volatile (
-        "pushf\n\t"
-        "cli\n\t"
-        "int $0x20\n\t"
-        "popf\n\t"
-    );
+    struct run_queue *rq;
+    uint32_t irqstate;
+    int queued;
+
+    rq = lock_thread_run_queue(th, &irqstate);
+
+    if (th == rq->percpu->current_thread) {
+        update_current(rq, scheduler_clock());
+    }
+
+    queued = th->queued;
+    if (queued) {
+        dequeue_thread(rq, th);
+    }
+
+    if (sched_class == TC_FAIR && th->sched_class != TC_FAIR) {
+        th->vruntime = rq->min_vruntime;
+    }
+
+    th->sched_class = sched_class;
+    th->priority = priority;
+    th->nice = nice;
+    th->weight = nice_to_weight[nice - NICE_MIN];
+
+    if (queued) {
+        enqueue_thread(rq, th);
+    }
+
+    spinlock_unlock_irqrestore(&rq->lock, irqstate);
+}
+
+status_t scheduler_set_thread_priority(struct thread *th, int priority)
+{
+    if (priority < 0 || priority >= TP_COUNT) return STATUS_INVALID_VALUE;
+
+    change_thread_class(th, TC_FIXED, priority, th->nice);
 
     return STATUS_SUCCESS;
 }
 
-status_t scheduler_maintain(void)
+status_t scheduler_set_thread_nice(struct thread *th, int nice)
 {
-    int unwait_thread;
+    if (nice < NICE_MIN || nice > NICE_MAX) return STATUS_INVALID_VALUE;
 
-    if (current_thread && current_thread->type == TT_MAIN) {
-        /* if there's an entry point, then it's not a main thread */
-        return STATUS_INVALID_THREAD;
-    }
+    change_thread_class(th, TC_FAIR, TP_NORMAL, nice);
 
-    for (struct thread *current = first_thread; current; current = current->next) {
-        if (current->status != TS_WAITING) continue;
-        if (!current->wait_list) continue;
+    return STATUS_SUCCESS;
+}
 
-        unwait_thread = 1;
+status_t scheduler_set_thread_boost(struct thread *th, int priority)
+{
+    struct run_queue *rq;
+    uint32_t irqstate;
+    int queued;
 
-        for (int i = 0; i < current->wait_count; i++) {
-            if (!current->wait_list[i]) continue;
-            if (current->wait_list[i]->status != TS_FINISHED) {
-                unwait_thread = 0;
-                break;
-            }
+    if (priority < 0 || priority >= TP_COUNT) return STATUS_INVALID_VALUE;
 
-            current->wait_list[i] = NULL;
-        }
+    rq = lock_thread_run_queue(th, &irqstate);
 
-        if (unwait_thread) {
-            current->wait_list = NULL;
-            current->status = TS_RUNNING;
-        }
+    queued = th->queued;
+    if (queued) {
+        dequeue_thread(rq, th);
     }
 
-    struct thread *current, *prev;
-    prev = NULL;
-    current = first_thread;
-    while (current) {
-        if (current->status != TS_FINISHED) {
-            prev = current;
-            current = current->next;
-            continue;
-        }
-        
-        struct thread *thread_to_remove = current;
-        
-        if (prev) {
-            prev->next = current->next;
-        } else {
-            first_thread = current->next;
-        }
+    th->boost_priority = priority;
 
-        current = current->next;
+    if (queued) {
+        enqueue_thread(rq, th);
+        kick_cpu(rq, th);
+    }
 
-        LOG_DEBUG("thread #%d removed from scheduler (maintain)\n", thread_to_remove->id);
+    spinlock_unlock_irqrestore(&rq->lock, irqstate);
 
-        if (thread_to_remove->detached) {
-            LOG_DEBUG("detached\n");
-            thread_remove(thread_to_remove);
-        }
-    }
+    return STATUS_SUCCESS;
+}
+
+status_t scheduler_yield(void)
+{
+    asm volatile (
+        "pushf\n\t"
+        "cli\n\t"
+        "int %0\n\t"
+        "popf\n\t"
+        :
+        : "i"(INTERRUPT_YIELD_VECTOR)
+    );
 
     return STATUS_SUCCESS;
 }
@@ -0,0 +1,244 @@
+#include <emos/softirq.h>
+
+#include <string.h>
+
+#include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
+
+#include <emos/thread.h>
+#include <emos/scheduler.h>
+#include <emos/smp.h>
+#include <emos/percpu.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "softirq"
+
+/* handlers raised again while running get this many more passes, the rest waits for the next interrupt */
+#define SOFTIRQ_RESTART_LIMIT   8
+
+struct softirq_action {
+    softirq_func_t func;
+    void *data;
+};
+
+struct tasklet_list {
+    struct tasklet *first, *last;
+};
+
+/* only ever touched by the processor they belong to, with interrupts disabled */
+static struct tasklet_list tasklets[SMP_MAX_CPU_COUNT];
+
+static void run_tasklets(void *data)
+{
+    struct tasklet_list *list;
+    struct tasklet *tasklet;
+
+    interrupt_disable();
+
+    /* take the whole list, tasklets scheduled meanwhile go to a fresh one */
+    list = &tasklets[smp_get_cpu_index()];
+    tasklet = list->first;
+    list->first = list->last = NULL;
+
+    interrupt_enable();
+
+    while (tasklet) {
+        struct tasklet *next = tasklet->next;
+
+        tasklet->next = NULL;
+        tasklet->scheduled = 0;
+
+        tasklet->func(tasklet, tasklet->data);
+
+        tasklet = next;
+    }
+}
+
+static struct softirq_action actions[SOFTIRQ_COUNT] = {
+    [SOFTIRQ_TASKLET] = { run_tasklets, NULL },
+};
+
+status_t softirq_register(int nr, softirq_func_t func, void *data)
+{
+    if (nr < 0 || nr >= SOFTIRQ_COUNT || !func) return STATUS_INVALID_VALUE;
+    if (actions[nr].func) return STATUS_CONFLICTING_STATE;
+
+    actions[nr].data = data;
+    actions[nr].func = func;
+
+    LOG_DEBUG("registered softirq #%d\n", nr);
+
+    return STATUS_SUCCESS;
+}
+
+static void raise(struct percpu *pc, int nr)
+{
+    if (!(pc->softirq_pending & (1 << nr))) {
+        pc->softirq_raise_times[nr] = scheduler_clock();
+    }
+
+    pc->softirq_pending |= 1 << nr;
+    pc->softirq_stats[nr].raise_count++;
+}
+
+status_t softirq_raise(int nr)
+{
+    uint32_t irqstate;
+
+    if (nr < 0 || nr >= SOFTIRQ_COUNT) return STATUS_INVALID_VALUE;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    raise(this_cpu_read(self), nr);
+
+    interrupt_restore(irqstate);
+
+    /* interrupt handlers run with interrupts disabled, a thread raising one has no interrupt exit to wait for */
+    if (irqstate) {
+        softirq_run();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void softirq_run(void)
+{
+    struct softirq_stat *stat;
+    uint64_t start, elapsed;
+    struct percpu *pc;
+    uint32_t irqstate, mask;
+    int prev_preemption_enabled;
+
+    /* the common case of nothing raised is a single read */
+    if (!this_cpu_read(softirq_pending)) return;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    pc = this_cpu_read(self);
+
+    /* an interrupt taken while the handlers run only raises, the loop below picks that up */
+    if (pc->softirq_running || !pc->softirq_pending) {
+        interrupt_restore(irqstate);
+        return;
+    }
+
+    pc->softirq_running = 1;
+
+    /* the handlers run on the stack of whatever thread was interrupted, it must not move meanwhile */
+    prev_preemption_enabled = thread_is_preemption_enabled();
+    thread_disable_preemption();
+
+    for (int pass = 0; pass < SOFTIRQ_RESTART_LIMIT && pc->softirq_pending; pass++) {
+        mask = pc->softirq_pending;
+        pc->softirq_pending = 0;
+
+        for (int nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if (!(mask & (1 << nr)) || !actions[nr].func) continue;
+
+            stat = &pc->softirq_stats[nr];
+            start = scheduler_clock();
+
+            elapsed = start - pc->softirq_raise_times[nr];
+            stat->latency_total += elapsed;
+            if (elapsed > stat->latency_max) {
+                stat->latency_max = elapsed;
+            }
+
+            interrupt_enable();
+
+            actions[nr].func(actions[nr].data);
+
+            interrupt_disable();
+
+            elapsed = scheduler_clock() - start;
+            stat->run_count++;
+            stat->time_total += elapsed;
+            if (elapsed > stat->time_max) {
+                stat->time_max = elapsed;
+            }
+        }
+    }
+
+    if (prev_preemption_enabled) {
+        thread_enable_preemption();
+    }
+
+    pc->softirq_running = 0;
+
+    interrupt_restore(irqstate);
+}
+
+int softirq_is_running(void)
+{
+    return this_cpu_read(softirq_running);
+}
+
+status_t softirq_get_stat(int nr, struct softirq_stat *stat)
+{
+    uint32_t irqstate;
+
+    if (nr < 0 || nr >= SOFTIRQ_COUNT || !stat) return STATUS_INVALID_VALUE;
+
+    memset(stat, 0, sizeof(*stat));
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    for (int i = 0; i < SMP_MAX_CPU_COUNT; i++) {
+        const struct softirq_stat *cpu_stat = &percpu_get(i)->softirq_stats[nr];
+
+        stat->raise_count += cpu_stat->raise_count;
+        stat->run_count += cpu_stat->run_count;
+        stat->latency_total += cpu_stat->latency_total;
+        stat->time_total += cpu_stat->time_total;
+        if (cpu_stat->latency_max > stat->latency_max) {
+            stat->latency_max = cpu_stat->latency_max;
+        }
+        if (cpu_stat->time_max > stat->time_max) {
+            stat->time_max = cpu_stat->time_max;
+        }
+    }
+
+    interrupt_restore(irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t tasklet_init(struct tasklet *tasklet, tasklet_func_t func, void *data)
+{
+    if (!tasklet || !func) return STATUS_INVALID_VALUE;
+
+    tasklet->next = NULL;
+    tasklet->scheduled = 0;
+    tasklet->func = func;
+    tasklet->data = data;
+
+    return STATUS_SUCCESS;
+}
+
+status_t tasklet_schedule(struct tasklet *tasklet)
+{
+    struct tasklet_list *list;
+    uint32_t irqstate;
+
+    if (_i686_atomic_cmpxchg32(&tasklet->scheduled, 0, 1) != 0) return STATUS_SUCCESS;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    tasklet->next = NULL;
+
+    list = &tasklets[smp_get_cpu_index()];
+    if (list->last) {
+        list->last->next = tasklet;
+    } else {
+        list->first = tasklet;
+    }
+    list->last = tasklet;
+
+    interrupt_restore(irqstate);
+
+    return softirq_raise(SOFTIRQ_TASKLET);
+}
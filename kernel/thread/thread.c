@@ -1,18 +1,46 @@
 #include <emos/thread.h>
 
-#include <stdlib.h>
+#include <string.h>
 
 #include <emos/asm/thread.h>
 #include <emos/asm/page.h>
+#include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
 
 #include <emos/panic.h>
 #include <emos/log.h>
 #include <emos/scheduler.h>
 #include <emos/macros.h>
+#include <emos/slab.h>
+#include <emos/tick.h>
+#include <emos/timer.h>
+#include <emos/spinlock.h>
+#include <emos/smp.h>
+#include <emos/percpu.h>
 
 #define MODULE_NAME "thread"
 
-static volatile int preemption_enabled = 0;
+/* bit n is set while slot n of every thread is handed out */
+static volatile uint32_t tls_slot_mask = 0;
+
+static volatile uint32_t new_thread_id = 1;
+
+static struct kmem_cache thread_cache;
+
+static struct spinlock reap_lock;
+static struct thread *first_reapable_thread = NULL;
+
+static status_t allocate_thread(struct thread **th)
+{
+    status_t status;
+
+    status = kmem_cache_allocate(&thread_cache, (void **)th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    memset(*th, 0, sizeof(**th));
+
+    return STATUS_SUCCESS;
+}
 
 status_t thread_init(struct thread **main_thread)
 {
@@ -20,14 +48,23 @@ status_t thread_init(struct thread **main_thread)
     struct thread *main_th = NULL;
     int added_thread_to_scheduler = 0;
 
-    main_th = calloc(1, sizeof(*main_th));
-    if (!main_th) {
-        status = STATUS_UNKNOWN_ERROR;
-        goto has_error;
-    }
+    status = kmem_cache_init(&thread_cache, "thread", sizeof(struct thread), 0, NULL);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    spinlock_init(&reap_lock);
+
+    status = allocate_thread(&main_th);
+    if (!CHECK_SUCCESS(status)) goto has_error;
     main_th->id = 0;
     main_th->status = TS_RUNNING;
     main_th->type = TT_MAIN;
+    /* the main thread only idles from now on */
+    main_th->priority = TP_IDLE;
+    main_th->sched_class = TC_FIXED;
+    wait_queue_init(&main_th->exit_queue);
+
+    status = thread_allocate_fpu_state(main_th);
+    if (!CHECK_SUCCESS(status)) goto has_error;
 
     status = scheduler_add_thread(main_th);
     if (!CHECK_SUCCESS(status)) goto has_error;
@@ -36,6 +73,8 @@ status_t thread_init(struct thread **main_thread)
     status = scheduler_set_current_thread(main_th);
     if (!CHECK_SUCCESS(status)) goto has_error;
 
+    thread_load_tls(main_th);
+
     if (main_thread) *main_thread = main_th;
     
     return STATUS_SUCCESS;
@@ -46,48 +85,89 @@ has_error:
     }
 
     if (main_th) {
-        free(main_th);
+        thread_free_fpu_state(main_th);
+        kmem_cache_free(&thread_cache, main_th);
     }
 
     return status;
 }
 
+/* the context a processor other than the boot one starts in idles from now on */
+status_t thread_init_cpu(struct thread **idle_thread)
+{
+    status_t status;
+    struct thread *idle_th = NULL;
+
+    status = allocate_thread(&idle_th);
+    if (!CHECK_SUCCESS(status)) return status;
+    idle_th->id = _i686_atomic_fetch_add32(&new_thread_id, 1);
+    idle_th->status = TS_RUNNING;
+    idle_th->type = TT_IDLE;
+    idle_th->priority = TP_IDLE;
+    idle_th->sched_class = TC_FIXED;
+    wait_queue_init(&idle_th->exit_queue);
+
+    status = thread_allocate_fpu_state(idle_th);
+    if (!CHECK_SUCCESS(status)) {
+        kmem_cache_free(&thread_cache, idle_th);
+        return status;
+    }
+
+    status = scheduler_add_thread(idle_th);
+    if (!CHECK_SUCCESS(status)) {
+        thread_free_fpu_state(idle_th);
+        kmem_cache_free(&thread_cache, idle_th);
+        return status;
+    }
+
+    status = scheduler_set_current_thread(idle_th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    thread_load_tls(idle_th);
+
+    if (idle_thread) *idle_thread = idle_th;
+
+    return STATUS_SUCCESS;
+}
+
+/* a single store to the area of whichever processor the thread is on, it cannot move halfway */
 void thread_enable_preemption(void)
 {
-    preemption_enabled = 1;
+    this_cpu_write(preemption_enabled, 1);
 }
 
 void thread_disable_preemption(void)
 {
-    preemption_enabled = 0;
+    this_cpu_write(preemption_enabled, 0);
 }
 
 int thread_is_preemption_enabled(void)
 {
-    return preemption_enabled;
+    return this_cpu_read(preemption_enabled);
 }
 
 status_t thread_create(thread_entry_t entry, size_t stack_size, struct thread **threadout)
 {
-    static int new_thread_id = 1;
-
     status_t status;
-    int prev_preemption_enabled = preemption_enabled;
+    int prev_preemption_enabled = thread_is_preemption_enabled();
     struct thread *th = NULL;
     int stack_allocated = 0;
     int added_thread_to_scheduler = 0;
 
+    /* the stacks of threads that exited on their own are only freed from another thread */
+    thread_reap();
+
     thread_disable_preemption();
 
     /* create thread object */
-    th = calloc(1, sizeof(*th));
-    if (!th) {
-        status = STATUS_UNKNOWN_ERROR;
-        goto has_error;
-    }
-    th->id = new_thread_id++;
+    status = allocate_thread(&th);
+    if (!CHECK_SUCCESS(status)) goto has_error;
+    th->id = _i686_atomic_fetch_add32(&new_thread_id, 1);
     th->status = TS_PENDING;
     th->type = TT_KERNEL;
+    th->priority = TP_NORMAL;
+    th->sched_class = TC_FAIR;
+    wait_queue_init(&th->exit_queue);
 
     /* prepare stack */
     th->kmode_stack_page_count = ALIGN_DIV(stack_size, PAGE_SIZE);
@@ -100,6 +180,9 @@ status_t thread_create(thread_entry_t entry, size_t stack_size, struct thread **
     status = thread_setup_kthread_stack(th);
     if (!CHECK_SUCCESS(status)) goto has_error;
 
+    status = thread_allocate_fpu_state(th);
+    if (!CHECK_SUCCESS(status)) goto has_error;
+
     /* add thread object to list */
     status = scheduler_add_thread(th);
     if (!CHECK_SUCCESS(status)) goto has_error;
@@ -125,7 +208,8 @@ has_error:
     }
 
     if (th) {
-        free(th);
+        thread_free_fpu_state(th);
+        kmem_cache_free(&thread_cache, th);
     }
 
     if (prev_preemption_enabled) {
@@ -137,7 +221,7 @@ has_error:
 
 status_t thread_remove(struct thread *th)
 {
-    if (th->type == TT_MAIN) return STATUS_INVALID_THREAD;
+    if (th->type == TT_MAIN || th->type == TT_IDLE) return STATUS_INVALID_THREAD;
     if (th->status != TS_FINISHED) return STATUS_THREAD_NOT_FINISHED;
 
     LOG_DEBUG("removing thread #%d\n", th->id);
@@ -146,52 +230,164 @@ status_t thread_remove(struct thread *th)
 
     thread_free_kthread_stack(th);
 
-    free(th);
+    thread_free_fpu_state(th);
+
+    kmem_cache_free(&thread_cache, th);
 
     return STATUS_SUCCESS;
 }
 
+status_t thread_set_priority(struct thread *thread, int priority)
+{
+    return scheduler_set_thread_priority(thread, priority);
+}
+
+status_t thread_set_nice(struct thread *thread, int nice)
+{
+    return scheduler_set_thread_nice(thread, nice);
+}
+
+status_t thread_get_stat(const struct thread *thread, struct thread_stat *stat)
+{
+    uint32_t irqstate;
+
+    if (!thread || !stat) return STATUS_INVALID_VALUE;
+
+    /* the 64-bit counters are updated from the timer interrupt */
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    stat->sched_class = thread->sched_class;
+    stat->priority = thread->priority;
+    stat->boost_priority = thread->boost_priority;
+    stat->nice = thread->nice;
+    stat->weight = thread->weight;
+    stat->runtime = thread->runtime;
+    stat->vruntime = thread->vruntime;
+    stat->wait_time = thread->wait_time;
+    stat->switch_count = thread->switch_count;
+
+    interrupt_restore(irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+static void add_reapable_thread(struct thread *th)
+{
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&reap_lock, &irqstate);
+
+    th->reap_next = first_reapable_thread;
+    first_reapable_thread = th;
+
+    spinlock_unlock_irqrestore(&reap_lock, irqstate);
+}
+
 status_t thread_detach(struct thread *thread)
 {
-    status_t status;
-    struct thread *current_thread;
-    
-    status = scheduler_get_current_thread(&current_thread);
-    if (!CHECK_SUCCESS(status)) return status;
+    uint32_t irqstate;
 
-    if (thread->wait_list) return STATUS_CONFLICTING_STATE;
+    /* the exit queue lock orders this against the thread finishing */
+    wait_queue_lock(&thread->exit_queue, &irqstate);
+
+    if (!wait_queue_is_empty(&thread->exit_queue)) {
+        wait_queue_unlock(&thread->exit_queue, irqstate);
+        return STATUS_CONFLICTING_STATE;
+    }
 
     thread->detached = 1;
 
+    if (thread->status == TS_FINISHED) {
+        add_reapable_thread(thread);
+    }
+
+    wait_queue_unlock(&thread->exit_queue, irqstate);
+
     LOG_DEBUG("detaching thread #%d\n", thread->id);
 
     return STATUS_SUCCESS;
 }
 
-status_t thread_wait(struct thread **list, int count, int timeout)
+status_t thread_wait(struct thread **list, int count, int timeout_ms)
 {
-    status_t status;
-    struct thread *current_thread;
-    
-    status = scheduler_get_current_thread(&current_thread);
-    if (!CHECK_SUCCESS(status)) return status;
+    status_t status = STATUS_SUCCESS;
+    uint64_t deadline = 0;
+    uint32_t irqstate;
 
     for (int i = 0; i < count; i++) {
         if (list[i]->detached) return STATUS_CONFLICTING_STATE;
     }
 
-    thread_disable_preemption();
+    if (timeout_ms >= 0) {
+        deadline = wait_queue_get_deadline(timeout_ms);
+    }
 
-    // TODO: implement timeout
+    for (int i = 0; i < count && CHECK_SUCCESS(status); i++) {
+        wait_queue_lock(&list[i]->exit_queue, &irqstate);
 
-    current_thread->wait_list = list;
-    current_thread->wait_count = count;
-    current_thread->wait_timeout = timeout;
-    current_thread->status = TS_WAITING;
+        while (list[i]->status != TS_FINISHED) {
+            if (timeout_ms >= 0) {
+                status = wait_queue_wait_until(&list[i]->exit_queue, deadline);
+            } else {
+                status = wait_queue_wait(&list[i]->exit_queue, WAIT_INFINITE);
+            }
+            if (!CHECK_SUCCESS(status)) break;
+        }
 
-    thread_enable_preemption();
+        wait_queue_unlock(&list[i]->exit_queue, irqstate);
+    }
 
-    scheduler_yield();
+    return status;
+}
+
+status_t thread_sleep(uint64_t ns)
+{
+    status_t status;
+    struct wait_queue wq;
+    uint64_t deadline;
+    uint32_t irqstate;
+
+    if (!ns) return scheduler_yield();
+
+    wait_queue_init(&wq);
+
+    /* the current tick is already partly over, so wait one more to sleep at least as long */
+    deadline = get_global_tick() + timer_ns_to_ticks(ns) + 1;
+
+    wait_queue_lock(&wq, &irqstate);
+
+    /* nobody else knows the queue, only the timer ends the wait */
+    status = wait_queue_wait_until(&wq, deadline);
+
+    wait_queue_unlock(&wq, irqstate);
+
+    if (status == STATUS_TIMED_OUT) return STATUS_SUCCESS;
+
+    return status;
+}
+
+status_t thread_reap(void)
+{
+    struct thread *th;
+    uint32_t irqstate;
+
+    for (;;) {
+        spinlock_lock_irqsave(&reap_lock, &irqstate);
+
+        th = first_reapable_thread;
+        if (th) {
+            first_reapable_thread = th->reap_next;
+        }
+
+        spinlock_unlock_irqrestore(&reap_lock, irqstate);
+
+        if (!th) break;
+
+        LOG_DEBUG("reaping detached thread #%d\n", th->id);
+
+        thread_remove(th);
+    }
 
     return STATUS_SUCCESS;
 }
@@ -201,21 +397,67 @@ void thread_exit(void)
 {
     status_t status;
     struct thread *current_thread;
+    uint32_t irqstate;
     
     status = scheduler_get_current_thread(&current_thread);
     if (!CHECK_SUCCESS(status)) {
         panic(status, "cannot get current thread");
     }
 
-    if (current_thread->type == TT_MAIN) {
-        panic(STATUS_INVALID_THREAD, "cannot exit from main thread");
+    if (current_thread->type == TT_MAIN || current_thread->type == TT_IDLE) {
+        panic(STATUS_INVALID_THREAD, "cannot exit from an idle thread");
     }
 
+    interrupt_disable();
+
+    /* interrupts stay off when the lock is dropped */
+    wait_queue_lock(&current_thread->exit_queue, &irqstate);
+
     current_thread->status = TS_FINISHED;
 
     LOG_DEBUG("thread #%d finished\n", current_thread->id);
 
+    wait_queue_wake_all_locked(&current_thread->exit_queue);
+
+    if (current_thread->detached) {
+        add_reapable_thread(current_thread);
+    }
+
+    wait_queue_unlock(&current_thread->exit_queue, irqstate);
+
+    /* never scheduled again, so nothing else would switch away from us */
+    thread_enable_preemption();
+
     scheduler_yield();
 
     for (;;) {}
 }
+
+status_t thread_tls_allocate(int *slot)
+{
+    uint32_t mask;
+
+    if (!slot) return STATUS_INVALID_VALUE;
+
+    for (;;) {
+        mask = tls_slot_mask;
+        if (mask == (1UL << THREAD_TLS_SLOT_COUNT) - 1) return STATUS_INSUFFICIENT_MEMORY;
+
+        *slot = __builtin_ctz(~mask);
+        if (_i686_atomic_cmpxchg32(&tls_slot_mask, mask, mask | (1UL << *slot)) == mask) break;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/* threads keep whatever they stored in the slot, the next owner has to overwrite it before reading */
+void thread_tls_free(int slot)
+{
+    uint32_t mask;
+
+    if (slot < 0 || slot >= THREAD_TLS_SLOT_COUNT) return;
+
+    do {
+        mask = tls_slot_mask;
+    } while (_i686_atomic_cmpxchg32(&tls_slot_mask, mask, mask & ~(1UL << slot)) != mask);
+}
@@ -0,0 +1,261 @@
+#include <emos/waitqueue.h>
+
+#include <emos/thread.h>
+#include <emos/scheduler.h>
+#include <emos/tick.h>
+#include <emos/timer.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "waitqueue"
+
+#define WQE_WAITING     0
+#define WQE_WOKEN       1
+#define WQE_TIMED_OUT   2
+
+/* lives on the stack of the waiting thread */
+struct wait_queue_entry {
+    struct wait_queue_entry *next, *prev;
+    struct wait_queue *queue;
+    struct thread *thread;
+
+    struct timer timer;     /* timed waits only */
+
+    volatile int result;
+};
+
+static void queue_insert_before(struct wait_queue *wq, struct wait_queue_entry *pos, struct wait_queue_entry *entry)
+{
+    entry->next = pos;
+    entry->prev = pos->prev;
+
+    if (pos->prev) {
+        pos->prev->next = entry;
+    } else {
+        wq->first = entry;
+    }
+    pos->prev = entry;
+}
+
+static void queue_append(struct wait_queue *wq, struct wait_queue_entry *entry)
+{
+    struct wait_queue_entry *pos;
+    int priority;
+
+    if (wq->ordered) {
+        /* behind the waiters of the same level, so that they still take turns */
+        priority = scheduler_get_effective_priority(entry->thread);
+        for (pos = wq->first; pos; pos = pos->next) {
+            if (scheduler_get_effective_priority(pos->thread) < priority) {
+                queue_insert_before(wq, pos, entry);
+                return;
+            }
+        }
+    }
+
+    entry->next = NULL;
+    entry->prev = wq->last;
+
+    if (wq->last) {
+        wq->last->next = entry;
+    } else {
+        wq->first = entry;
+    }
+    wq->last = entry;
+}
+
+static void queue_remove(struct wait_queue *wq, struct wait_queue_entry *entry)
+{
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->first = entry->next;
+    }
+
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->last = entry->prev;
+    }
+
+    entry->next = entry->prev = NULL;
+}
+
+/* called with the queue locked, the waiter cannot return and drop the entry before it is unlocked */
+static void wake_entry(struct wait_queue_entry *entry, int result)
+{
+    struct thread *th = entry->thread;
+
+    queue_remove(entry->queue, entry);
+
+    entry->result = result;
+
+    scheduler_wake_thread(th);
+}
+
+static void wait_timed_out(struct timer *timer, void *data)
+{
+    struct wait_queue_entry *entry = data;
+    struct wait_queue *wq = entry->queue;
+
+    spinlock_lock(&wq->lock);
+
+    /* a wakeup may have won the race for the lock */
+    if (entry->result == WQE_WAITING) {
+        wake_entry(entry, WQE_TIMED_OUT);
+    }
+
+    spinlock_unlock(&wq->lock);
+}
+
+status_t wait_queue_init(struct wait_queue *wq)
+{
+    spinlock_init(&wq->lock);
+    wq->first = wq->last = NULL;
+    wq->ordered = 0;
+
+    return STATUS_SUCCESS;
+}
+
+status_t wait_queue_init_ordered(struct wait_queue *wq)
+{
+    spinlock_init(&wq->lock);
+    wq->first = wq->last = NULL;
+    wq->ordered = 1;
+
+    return STATUS_SUCCESS;
+}
+
+status_t wait_queue_lock(struct wait_queue *wq, uint32_t *irqstate)
+{
+    return spinlock_lock_irqsave(&wq->lock, irqstate);
+}
+
+status_t wait_queue_unlock(struct wait_queue *wq, uint32_t irqstate)
+{
+    return spinlock_unlock_irqrestore(&wq->lock, irqstate);
+}
+
+static status_t wait(struct wait_queue *wq, int timed, uint64_t deadline)
+{
+    status_t status;
+    struct wait_queue_entry entry;
+    struct thread *th;
+    int prev_preemption_enabled;
+
+    status = scheduler_get_current_thread(&th);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    if (timed && deadline <= get_global_tick()) return STATUS_TIMED_OUT;
+
+    entry.queue = wq;
+    entry.thread = th;
+    entry.result = WQE_WAITING;
+
+    queue_append(wq, &entry);
+
+    timer_init(&entry.timer, wait_timed_out, &entry);
+    if (timed) {
+        timer_add(&entry.timer, deadline);
+    }
+
+    th->status = TS_WAITING;
+
+    /* interrupts stay off, so that nothing switches away before the yield */
+    spinlock_unlock(&wq->lock);
+
+    /* a thread that gives up the CPU has to let the others preempt each other */
+    prev_preemption_enabled = thread_is_preemption_enabled();
+    thread_enable_preemption();
+
+    while (entry.result == WQE_WAITING) {
+        scheduler_yield();
+    }
+
+    /* the timer may be firing on another processor right now, and the entry goes away with us */
+    if (timed) {
+        timer_cancel_sync(&entry.timer);
+    }
+
+    if (!prev_preemption_enabled) {
+        thread_disable_preemption();
+    }
+
+    spinlock_lock(&wq->lock);
+
+    return entry.result == WQE_TIMED_OUT ? STATUS_TIMED_OUT : STATUS_SUCCESS;
+}
+
+status_t wait_queue_wait(struct wait_queue *wq, int timeout_ms)
+{
+    if (timeout_ms < 0) return wait(wq, 0, 0);
+
+    return wait(wq, 1, wait_queue_get_deadline(timeout_ms));
+}
+
+status_t wait_queue_wait_until(struct wait_queue *wq, uint64_t deadline_tick)
+{
+    return wait(wq, 1, deadline_tick);
+}
+
+status_t wait_queue_wake_one_locked(struct wait_queue *wq)
+{
+    if (!wq->first) return STATUS_NO_EVENT;
+
+    wake_entry(wq->first, WQE_WOKEN);
+
+    return STATUS_SUCCESS;
+}
+
+status_t wait_queue_wake_all_locked(struct wait_queue *wq)
+{
+    if (!wq->first) return STATUS_NO_EVENT;
+
+    while (wq->first) {
+        wake_entry(wq->first, WQE_WOKEN);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+status_t wait_queue_wake_one(struct wait_queue *wq)
+{
+    status_t status;
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&wq->lock, &irqstate);
+
+    status = wait_queue_wake_one_locked(wq);
+
+    spinlock_unlock_irqrestore(&wq->lock, irqstate);
+
+    return status;
+}
+
+status_t wait_queue_wake_all(struct wait_queue *wq)
+{
+    status_t status;
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&wq->lock, &irqstate);
+
+    status = wait_queue_wake_all_locked(wq);
+
+    spinlock_unlock_irqrestore(&wq->lock, irqstate);
+
+    return status;
+}
+
+int wait_queue_is_empty(const struct wait_queue *wq)
+{
+    return !wq->first;
+}
+
+struct thread *wait_queue_get_first_thread(const struct wait_queue *wq)
+{
+    return wq->first ? wq->first->thread : NULL;
+}
+
+uint64_t wait_queue_get_deadline(int timeout_ms)
+{
+    return get_global_tick() + timer_ms_to_ticks(timeout_ms);
+}
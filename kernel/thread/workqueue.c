@@ -0,0 +1,366 @@
+#include <emos/workqueue.h>
+
+#include <string.h>
+
+#include <emos/thread.h>
+#include <emos/scheduler.h>
+#include <emos/spinlock.h>
+#include <emos/smp.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "workqueue"
+
+#define WORKER_STACK_SIZE   0x4000
+
+static struct spinlock list_lock;
+static struct workqueue *first_queue = NULL;
+
+/* handed to one new worker at a time, the worker clears it once it knows its queue */
+static struct wait_queue start_wait;
+static struct workqueue *starting_queue = NULL;
+
+static struct workqueue system_queue;
+static int system_queue_started = 0;
+
+static void update_max(uint64_t *max, uint64_t value)
+{
+    if (value > *max) {
+        *max = value;
+    }
+}
+
+static void worker_main(struct thread *th)
+{
+    struct workqueue *wq;
+    struct work *work;
+    work_func_t func;
+    void *data;
+    uint64_t start, elapsed;
+    uint32_t irqstate;
+
+    wait_queue_lock(&start_wait, &irqstate);
+    wq = starting_queue;
+    starting_queue = NULL;
+    wait_queue_wake_one_locked(&start_wait);
+    wait_queue_unlock(&start_wait, irqstate);
+
+    wait_queue_lock(&wq->wait, &irqstate);
+
+    for (;;) {
+        while (!wq->first && !wq->stopping) {
+            wait_queue_wait(&wq->wait, WAIT_INFINITE);
+        }
+
+        /* a stopping queue is drained before the workers go */
+        work = wq->first;
+        if (!work) break;
+
+        wq->first = work->next;
+        if (!wq->first) {
+            wq->last = NULL;
+        }
+        work->next = NULL;
+        work->queue = NULL;
+
+        /* the work may be queued again or freed as soon as it runs */
+        func = work->func;
+        data = work->data;
+
+        start = scheduler_clock();
+        elapsed = start - work->queue_time;
+
+        wq->pending_count--;
+        wq->busy_count++;
+        wq->latency_total += elapsed;
+        update_max(&wq->latency_max, elapsed);
+
+        wait_queue_unlock(&wq->wait, irqstate);
+
+        func(work, data);
+
+        elapsed = scheduler_clock() - start;
+
+        wait_queue_lock(&wq->wait, &irqstate);
+
+        wq->busy_count--;
+        wq->done_count++;
+        wq->time_total += elapsed;
+        update_max(&wq->time_max, elapsed);
+
+        if (!wq->first && !wq->busy_count) {
+            wait_queue_wake_all(&wq->flush_wait);
+        }
+    }
+
+    wq->worker_count--;
+    wait_queue_wake_all(&wq->flush_wait);
+
+    wait_queue_unlock(&wq->wait, irqstate);
+}
+
+status_t work_init(struct work *work, work_func_t func, void *data)
+{
+    if (!work || !func) return STATUS_INVALID_VALUE;
+
+    memset(work, 0, sizeof(*work));
+    work->func = func;
+    work->data = data;
+
+    return STATUS_SUCCESS;
+}
+
+int work_is_pending(const struct work *work)
+{
+    return !!work->queue;
+}
+
+static status_t start_worker(struct workqueue *wq)
+{
+    status_t status;
+    struct thread *th;
+    uint32_t irqstate;
+
+    /* wait for the worker started before to pick up its queue */
+    wait_queue_lock(&start_wait, &irqstate);
+    while (starting_queue) {
+        wait_queue_wait(&start_wait, WAIT_INFINITE);
+    }
+    starting_queue = wq;
+    wait_queue_unlock(&start_wait, irqstate);
+
+    wait_queue_lock(&wq->wait, &irqstate);
+    wq->worker_count++;
+    wait_queue_unlock(&wq->wait, irqstate);
+
+    status = thread_create(worker_main, WORKER_STACK_SIZE, &th);
+    if (!CHECK_SUCCESS(status)) {
+        wait_queue_lock(&wq->wait, &irqstate);
+        wq->worker_count--;
+        wait_queue_unlock(&wq->wait, irqstate);
+
+        wait_queue_lock(&start_wait, &irqstate);
+        starting_queue = NULL;
+        wait_queue_wake_one_locked(&start_wait);
+        wait_queue_unlock(&start_wait, irqstate);
+
+        return status;
+    }
+
+    thread_detach(th);
+
+    LOG_DEBUG("started worker thread #%d for %s\n", th->id, wq->name);
+
+    return STATUS_SUCCESS;
+}
+
+status_t workqueue_init(struct workqueue *wq, const char *name, int worker_count)
+{
+    status_t status;
+    uint32_t irqstate;
+
+    if (!wq || worker_count < 1 || worker_count > WORKQUEUE_MAX_WORKER_COUNT) return STATUS_INVALID_VALUE;
+
+    memset(wq, 0, sizeof(*wq));
+    wq->name = name;
+    wait_queue_init(&wq->wait);
+    wait_queue_init(&wq->flush_wait);
+
+    spinlock_lock_irqsave(&list_lock, &irqstate);
+    wq->next = first_queue;
+    first_queue = wq;
+    spinlock_unlock_irqrestore(&list_lock, irqstate);
+
+    for (int i = 0; i < worker_count; i++) {
+        status = start_worker(wq);
+        if (!CHECK_SUCCESS(status)) {
+            workqueue_destroy(wq);
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+status_t workqueue_destroy(struct workqueue *wq)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    wait_queue_lock(&wq->wait, &irqstate);
+    wq->stopping = 1;
+    wait_queue_wake_all_locked(&wq->wait);
+    wait_queue_unlock(&wq->wait, irqstate);
+
+    wait_queue_lock(&wq->flush_wait, &irqstate);
+    while (wq->worker_count && CHECK_SUCCESS(status)) {
+        status = wait_queue_wait(&wq->flush_wait, WAIT_INFINITE);
+    }
+    wait_queue_unlock(&wq->flush_wait, irqstate);
+
+    /* the last worker still holds the queue lock while it wakes us */
+    wait_queue_lock(&wq->wait, &irqstate);
+    wait_queue_unlock(&wq->wait, irqstate);
+
+    spinlock_lock_irqsave(&list_lock, &irqstate);
+    for (struct workqueue **link = &first_queue; *link; link = &(*link)->next) {
+        if (*link == wq) {
+            *link = wq->next;
+            break;
+        }
+    }
+    spinlock_unlock_irqrestore(&list_lock, irqstate);
+
+    return status;
+}
+
+status_t workqueue_queue(struct workqueue *wq, struct work *work)
+{
+    uint32_t irqstate;
+
+    if (!wq || !work) return STATUS_INVALID_VALUE;
+
+    wait_queue_lock(&wq->wait, &irqstate);
+
+    if (wq->stopping) {
+        wait_queue_unlock(&wq->wait, irqstate);
+        return STATUS_CONFLICTING_STATE;
+    }
+
+    if (work->queue) {
+        wait_queue_unlock(&wq->wait, irqstate);
+        return STATUS_SUCCESS;
+    }
+
+    work->queue = wq;
+    work->next = NULL;
+    work->queue_time = scheduler_clock();
+
+    if (wq->last) {
+        wq->last->next = work;
+    } else {
+        wq->first = work;
+    }
+    wq->last = work;
+
+    wq->queued_count++;
+    wq->pending_count++;
+
+    wait_queue_wake_one_locked(&wq->wait);
+
+    wait_queue_unlock(&wq->wait, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t workqueue_cancel(struct work *work)
+{
+    struct workqueue *wq = work->queue;
+    struct work *prev = NULL;
+    uint32_t irqstate;
+
+    if (!wq) return STATUS_NO_EVENT;
+
+    wait_queue_lock(&wq->wait, &irqstate);
+
+    /* a worker may have taken it meanwhile */
+    if (work->queue != wq) {
+        wait_queue_unlock(&wq->wait, irqstate);
+        return STATUS_NO_EVENT;
+    }
+
+    for (struct work *current = wq->first; current != work; current = current->next) {
+        prev = current;
+    }
+
+    if (prev) {
+        prev->next = work->next;
+    } else {
+        wq->first = work->next;
+    }
+    if (wq->last == work) {
+        wq->last = prev;
+    }
+
+    work->next = NULL;
+    work->queue = NULL;
+    wq->pending_count--;
+
+    if (!wq->first && !wq->busy_count) {
+        wait_queue_wake_all(&wq->flush_wait);
+    }
+
+    wait_queue_unlock(&wq->wait, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t workqueue_flush(struct workqueue *wq)
+{
+    status_t status = STATUS_SUCCESS;
+    uint32_t irqstate;
+
+    if (!wq) return STATUS_INVALID_VALUE;
+
+    /* the workers change the queue before they take this lock to wake us, so no wakeup gets lost */
+    wait_queue_lock(&wq->flush_wait, &irqstate);
+    while ((wq->first || wq->busy_count) && CHECK_SUCCESS(status)) {
+        status = wait_queue_wait(&wq->flush_wait, WAIT_INFINITE);
+    }
+    wait_queue_unlock(&wq->flush_wait, irqstate);
+
+    return status;
+}
+
+status_t workqueue_get_stat(struct workqueue *wq, struct workqueue_stat *stat)
+{
+    uint32_t irqstate;
+
+    if (!wq || !stat) return STATUS_INVALID_VALUE;
+
+    wait_queue_lock(&wq->wait, &irqstate);
+
+    stat->name = wq->name;
+    stat->worker_count = wq->worker_count;
+    stat->queued_count = wq->queued_count;
+    stat->done_count = wq->done_count;
+    stat->pending_count = wq->pending_count;
+    stat->latency_total = wq->latency_total;
+    stat->latency_max = wq->latency_max;
+    stat->time_total = wq->time_total;
+    stat->time_max = wq->time_max;
+
+    wait_queue_unlock(&wq->wait, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+struct workqueue *workqueue_get_next(struct workqueue *wq)
+{
+    if (!wq) return first_queue;
+
+    return wq->next;
+}
+
+status_t workqueue_start_system(void)
+{
+    status_t status;
+    int worker_count = smp_get_cpu_count();
+
+    if (system_queue_started) return STATUS_CONFLICTING_STATE;
+
+    if (worker_count > WORKQUEUE_MAX_WORKER_COUNT) {
+        worker_count = WORKQUEUE_MAX_WORKER_COUNT;
+    }
+
+    status = workqueue_init(&system_queue, "system", worker_count);
+    if (!CHECK_SUCCESS(status)) return status;
+
+    system_queue_started = 1;
+
+    return STATUS_SUCCESS;
+}
+
+struct workqueue *workqueue_get_system(void)
+{
+    return system_queue_started ? &system_queue : NULL;
+}
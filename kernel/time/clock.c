@@ -0,0 +1,127 @@
+#include <emos/clock.h>
+
+#include <emos/asm/interrupt.h>
+#include <emos/asm/atomic.h>
+
+#include <emos/scheduler.h>
+#include <emos/tick.h>
+#include <emos/smp.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "clock"
+
+#define NS_PER_TICK     (NS_PER_SEC / SCHEDULER_TICK_RATE)
+
+static struct clock_source *source = NULL;
+
+/* ns = count * mult >> shift, with mult as large as 32 bits allow */
+static uint32_t mult;
+static int shift;
+
+static uint64_t start_count;    /* where a full width counter was when it was picked */
+static uint64_t base_ns;        /* what the clock read when the current source was picked */
+
+/* a narrow counter is extended on every read, which can happen before multitasking, so no struct spinlock */
+static volatile uint32_t extend_lock = 0;
+static uint64_t last_count;
+static uint64_t extended_count;
+
+/* splits the multiplication so that neither half overflows */
+static uint64_t count_to_ns(uint64_t count)
+{
+    uint64_t high = (count >> 32) * mult;
+    uint64_t low = (count & 0xFFFFFFFF) * mult;
+
+    return (high << (32 - shift)) + (low >> shift);
+}
+
+static uint64_t read_extended(void)
+{
+    uint64_t count, value;
+    uint32_t irqstate;
+
+    irqstate = interrupt_save();
+    interrupt_disable();
+
+    while (_i686_atomic_cmpxchg32(&extend_lock, 0, 1) != 0) {
+        smp_cpu_relax();
+    }
+
+    count = source->read();
+    extended_count += (count - last_count) & source->mask;
+    last_count = count;
+    value = extended_count;
+
+    _i686_compiler_barrier();
+    extend_lock = 0;
+
+    interrupt_restore(irqstate);
+
+    return value;
+}
+
+static uint64_t read_ns(void)
+{
+    if (!source) return get_global_tick() * NS_PER_TICK;
+
+    if (source->mask == UINT64_MAX) return base_ns + count_to_ns(source->read() - start_count);
+
+    return base_ns + count_to_ns(read_extended());
+}
+
+status_t clock_register_source(struct clock_source *new_source)
+{
+    uint64_t now;
+
+    if (!new_source || !new_source->read || !new_source->frequency || !new_source->mask) return STATUS_INVALID_VALUE;
+
+    LOG_DEBUG("%s counts at %llu Hz, rating %d\n", new_source->name, new_source->frequency, new_source->rating);
+
+    if (source && source->rating >= new_source->rating) return STATUS_SUCCESS;
+
+    now = read_ns();
+
+    if (new_source->enable) {
+        new_source->enable();
+    }
+
+    /* the largest shift whose multiplier still fits in 32 bits */
+    for (shift = 32; shift > 0; shift--) {
+        if ((NS_PER_SEC << shift) / new_source->frequency <= UINT32_MAX) break;
+    }
+    mult = (NS_PER_SEC << shift) / new_source->frequency;
+
+    /* carry on from where the previous source left off */
+    base_ns = now;
+    start_count = new_source->read();
+    last_count = start_count;
+    extended_count = 0;
+
+    source = new_source;
+
+    LOG_DEBUG("using %s as clock source\n", source->name);
+
+    return STATUS_SUCCESS;
+}
+
+uint64_t clock_get_monotonic_ns(void)
+{
+    return read_ns();
+}
+
+status_t clock_get_stat(struct clock_stat *stat)
+{
+    if (!stat) return STATUS_INVALID_VALUE;
+
+    if (!source) {
+        stat->name = "tick";
+        stat->rating = 0;
+        stat->frequency = SCHEDULER_TICK_RATE;
+    } else {
+        stat->name = source->name;
+        stat->rating = source->rating;
+        stat->frequency = source->frequency;
+    }
+
+    return STATUS_SUCCESS;
+}
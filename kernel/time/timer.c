@@ -0,0 +1,261 @@
+#include <emos/timer.h>
+
+#include <emos/asm/interrupt.h>
+
+#include <emos/spinlock.h>
+#include <emos/smp.h>
+#include <emos/tick.h>
+#include <emos/scheduler.h>
+#include <emos/macros.h>
+#include <emos/log.h>
+
+#define MODULE_NAME "timer"
+
+#define WHEEL_LEVEL_COUNT   4
+#define WHEEL_SLOT_BITS     6
+#define WHEEL_SLOT_COUNT    (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK     (WHEEL_SLOT_COUNT - 1)
+
+/* about two days at 100 Hz, later timers wait in the last slot and are put back when it comes around */
+#define WHEEL_MAX_DELTA     ((1ULL << (WHEEL_LEVEL_COUNT * WHEEL_SLOT_BITS)) - 1)
+
+struct timer_slot {
+    struct timer *first;
+};
+
+/*
+ * Level n has slots one 64^n ticks apart. A timer is filed at the coarsest level that can tell
+ * its expiry apart, and is moved one level down each time the level below wraps around.
+ */
+struct timer_wheel {
+    struct timer_slot slots[WHEEL_LEVEL_COUNT][WHEEL_SLOT_COUNT];
+    uint64_t current;       /* the next tick to be processed */
+    size_t pending_count;
+
+    struct spinlock lock;   /* dropped while a callback runs, so that it can add timers */
+    struct timer *volatile running;
+};
+
+static struct timer_wheel wheel;
+
+static void slot_add(struct timer_slot *slot, struct timer *timer)
+{
+    timer->prev = NULL;
+    timer->next = slot->first;
+    if (slot->first) {
+        slot->first->prev = timer;
+    }
+    slot->first = timer;
+
+    timer->slot = slot;
+}
+
+static void slot_remove(struct timer *timer)
+{
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        timer->slot->first = timer->next;
+    }
+
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+
+    timer->next = timer->prev = NULL;
+    timer->slot = NULL;
+}
+
+static void file_timer(struct timer *timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    int level;
+
+    if (expires < wheel.current) {
+        expires = wheel.current;
+    }
+
+    delta = expires - wheel.current;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        expires = wheel.current + delta;
+    }
+
+    for (level = 0; level < WHEEL_LEVEL_COUNT - 1; level++) {
+        if (delta < (1ULL << ((level + 1) * WHEEL_SLOT_BITS))) break;
+    }
+
+    slot_add(&wheel.slots[level][(expires >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK], timer);
+}
+
+/* move the timers of the level slot that just came around to the levels below */
+static void cascade(int level)
+{
+    struct timer_slot *slot = &wheel.slots[level][(wheel.current >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK];
+    struct timer *timer;
+
+    while ((timer = slot->first)) {
+        slot_remove(timer);
+        file_timer(timer);
+    }
+}
+
+status_t timer_init(struct timer *timer, timer_func_t func, void *data)
+{
+    if (!timer || !func) return STATUS_INVALID_VALUE;
+
+    timer->next = timer->prev = NULL;
+    timer->slot = NULL;
+    timer->expires = 0;
+    timer->func = func;
+    timer->data = data;
+
+    return STATUS_SUCCESS;
+}
+
+status_t timer_add(struct timer *timer, uint64_t expires)
+{
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&wheel.lock, &irqstate);
+
+    if (timer->slot) {
+        slot_remove(timer);
+        wheel.pending_count--;
+    }
+
+    if (!wheel.current) {
+        wheel.current = get_global_tick();
+    }
+
+    timer->expires = expires;
+    file_timer(timer);
+    wheel.pending_count++;
+
+    spinlock_unlock(&wheel.lock);
+
+    /* the tick may be stopped for longer than this timer wants */
+    tick_update();
+
+    interrupt_restore(irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t timer_cancel(struct timer *timer)
+{
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&wheel.lock, &irqstate);
+
+    if (!timer->slot) {
+        spinlock_unlock_irqrestore(&wheel.lock, irqstate);
+        return STATUS_NO_EVENT;
+    }
+
+    slot_remove(timer);
+    wheel.pending_count--;
+
+    spinlock_unlock_irqrestore(&wheel.lock, irqstate);
+
+    return STATUS_SUCCESS;
+}
+
+status_t timer_cancel_sync(struct timer *timer)
+{
+    status_t status;
+
+    status = timer_cancel(timer);
+
+    while (wheel.running == timer) {
+        smp_cpu_relax();
+    }
+
+    return status;
+}
+
+int timer_is_pending(const struct timer *timer)
+{
+    return !!timer->slot;
+}
+
+uint64_t timer_ns_to_ticks(uint64_t ns)
+{
+    return ALIGN_DIV(ns * SCHEDULER_TICK_RATE, 1000000000ULL);
+}
+
+uint64_t timer_ms_to_ticks(uint64_t ms)
+{
+    return ALIGN_DIV(ms * SCHEDULER_TICK_RATE, 1000);
+}
+
+/* called from the timer softirq with interrupts disabled, catches up on every tick up to now */
+void timer_run(uint64_t now)
+{
+    struct timer_slot *slot;
+    struct timer *timer;
+    int level;
+
+    spinlock_lock(&wheel.lock);
+
+    if (!wheel.current) {
+        wheel.current = now;
+    }
+
+    while (wheel.current <= now) {
+        if (!wheel.pending_count) {
+            wheel.current = now + 1;
+            break;
+        }
+
+        for (level = 1; level < WHEEL_LEVEL_COUNT; level++) {
+            if (wheel.current & ((1ULL << (level * WHEEL_SLOT_BITS)) - 1)) break;
+
+            cascade(level);
+        }
+
+        slot = &wheel.slots[0][wheel.current & WHEEL_SLOT_MASK];
+        while ((timer = slot->first)) {
+            slot_remove(timer);
+            wheel.pending_count--;
+
+            wheel.running = timer;
+            spinlock_unlock(&wheel.lock);
+
+            timer->func(timer, timer->data);
+
+            spinlock_lock(&wheel.lock);
+            wheel.running = NULL;
+        }
+
+        wheel.current++;
+    }
+
+    spinlock_unlock(&wheel.lock);
+}
+
+/* the earliest tick a timer may expire at, only looks ahead one turn of the first level */
+status_t timer_get_next_expiry(uint64_t *expires)
+{
+    uint64_t tick;
+    uint32_t irqstate;
+
+    spinlock_lock_irqsave(&wheel.lock, &irqstate);
+
+    if (!wheel.pending_count) {
+        spinlock_unlock_irqrestore(&wheel.lock, irqstate);
+        return STATUS_NO_EVENT;
+    }
+
+    for (tick = wheel.current; tick & WHEEL_SLOT_MASK || tick == wheel.current; tick++) {
+        if (wheel.slots[0][tick & WHEEL_SLOT_MASK].first) break;
+    }
+
+    spinlock_unlock_irqrestore(&wheel.lock, irqstate);
+
+    /* nothing close, but the next cascade may bring timers down */
+    if (expires) *expires = tick;
+
+    return STATUS_SUCCESS;
+}